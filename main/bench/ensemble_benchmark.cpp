@@ -0,0 +1,86 @@
+/*
+ * An ensemble of small grids stepped as separate GridFluidSimulators, one after another, against
+ * the same members stepped together by EnsembleGridSimulator.
+ *
+ *   EnsembleBenchmark [grid size] [members] [steps] [threads]
+ *
+ * Defaults to 256 members of 64 x 64, 10 timed steps and every hardware thread. The separate
+ * simulators use the scalar advection kernel, so that every member gets the same result both
+ * ways; the largest difference is printed as a check.
+ */
+#include "ensemble_grid_simulator.h"
+#include "grid_fluid_simulator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+const uint32_t DEFAULT_GRID_SIZE = 64;
+const uint32_t DEFAULT_NUM_MEMBERS = 256;
+const uint32_t DEFAULT_NUM_STEPS = 10;
+const float DELTA_T = 1.0f / 15.0f;
+
+namespace {
+// A spread of diffusion rates and jet angles across the ensemble
+float DiffusionRate(uint32_t member) { return 0.01f * (float) (member % 32); }
+
+float JetSpeedY(uint32_t member, uint32_t size) { return 0.001f * (float) (member % 50) * (float) size; }
+
+double Milliseconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+}
+
+int main(int argc, char *argv[]) {
+  auto size = (argc > 1) ? (uint32_t) std::atoi(argv[1]) : DEFAULT_GRID_SIZE;
+  auto num_members = (argc > 2) ? (uint32_t) std::atoi(argv[2]) : DEFAULT_NUM_MEMBERS;
+  auto num_steps = (argc > 3) ? (uint32_t) std::atoi(argv[3]) : DEFAULT_NUM_STEPS;
+  auto num_threads = (argc > 4) ? (uint32_t) std::atoi(argv[4]) : std::max(1u, std::thread::hardware_concurrency());
+
+  std::vector<std::unique_ptr<GridFluidSimulator>> separate;
+  EnsembleGridSimulator ensemble{size, size, num_members, DELTA_T, 0.0f};
+  ensemble.SetNumThreads(num_threads);
+  for (auto member = 0u; member < num_members; ++member) {
+    separate.push_back(std::make_unique<GridFluidSimulator>(size, size, DELTA_T, DiffusionRate(member)));
+    separate.back()->SetNumThreads(1);
+    separate.back()->SetAdvectionIsa(SemiLagrangianAdvector::SCALAR);
+    separate.back()->AddSource(size / 4, size / 2, 1.0f, 0.1f * (float) size, JetSpeedY(member, size));
+    ensemble.SetDiffusionRate(member, DiffusionRate(member));
+    ensemble.AddSource(member, size / 4, size / 2, 1.0f, 0.1f * (float) size, JetSpeedY(member, size));
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (auto step = 0u; step < num_steps; ++step) {
+    for (auto &sim : separate) {
+      sim->Simulate();
+    }
+  }
+  auto separate_ms = Milliseconds(start) / num_steps;
+
+  start = std::chrono::steady_clock::now();
+  for (auto step = 0u; step < num_steps; ++step) {
+    ensemble.Simulate();
+  }
+  auto ensemble_ms = Milliseconds(start) / num_steps;
+
+  auto max_difference = 0.0f;
+  for (auto member = 0u; member < num_members; ++member) {
+    const auto &expected = separate[member]->Density();
+    const auto &actual = ensemble.Density(member);
+    for (size_t cell = 0; cell < expected.size(); ++cell) {
+      max_difference = std::max(max_difference, std::abs(expected[cell] - actual[cell]));
+    }
+  }
+
+  std::printf("%u members of %u x %u, %u steps, %u threads\n", num_members, size, size, num_steps, num_threads);
+  std::printf("%-28s %12s %16s\n", "", "ms/step", "member steps/s");
+  std::printf("%-28s %12.2f %16.0f\n", "separate, one at a time", separate_ms, 1000.0 * num_members / separate_ms);
+  std::printf("%-28s %12.2f %16.0f\n", "ensemble", ensemble_ms, 1000.0 * num_members / ensemble_ms);
+  std::printf("speedup %.2f, largest density difference %g\n", separate_ms / ensemble_ms, max_difference);
+  return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * Semi-Lagrangian advection with the fields read row major and from tiles.
+ *
+ *   LayoutBenchmark [grid size] [repeats] [max speed]
+ *
+ * Defaults to a 2048 x 2048 grid, 10 timed repeats and departure points up to 32 cells away.
+ * Each scene advects density and both velocity components on one thread:
+ *   shear   vertical flow that changes direction across the grid, so neighbouring columns read
+ *           rows far apart
+ *   vortex  solid body rotation about the centre
+ *   jets    GridFluidSimulator::Simulate() with the pair of jets the other benchmarks use, per
+ *           step rather than per advection
+ * Row major is timed with the scalar kernel, which is what the tiled path runs, and with the
+ * widest vector kernel. The tiled time includes copying the three fields into tiles.
+ */
+#include "grid_fluid_simulator.h"
+#include "semi_lagrangian_advector.h"
+#include "thread_pool.h"
+#include "tiled_field_2d.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+
+const uint32_t DEFAULT_GRID_SIZE = 2048;
+const uint32_t DEFAULT_NUM_REPEATS = 10;
+const float DEFAULT_MAX_SPEED = 32.0f;
+const uint32_t NUM_SIM_STEPS = 5;
+const float DELTA_T = 1.0f / 15.0f;
+const float DIFFUSION_RATE = 0.2f;
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+double MillisecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+struct Scene {
+  Field2D density;
+  Field2D velocity_x;
+  Field2D velocity_y;
+};
+
+/*
+ * Velocities are in cells per unit time and the benchmark advects with a unit time step, so
+ * max_speed is the furthest any departure point lies from its cell.
+ */
+Scene MakeScene(uint32_t size, bool vortex, float max_speed) {
+  Scene scene{Field2D(size, size, 1), Field2D(size, size, 1), Field2D(size, size, 1)};
+  auto centre = 0.5f * (float) size;
+  for (auto y = 0; y < (int32_t) size; ++y) {
+    for (auto x = 0; x < (int32_t) size; ++x) {
+      auto dx = ((float) x + 0.5f - centre) / centre;
+      auto dy = ((float) y + 0.5f - centre) / centre;
+      scene.density(x, y) = std::sin(8.0f * dx) * std::cos(8.0f * dy);
+      if (vortex) {
+        scene.velocity_x(x, y) = -max_speed * dy;
+        scene.velocity_y(x, y) = max_speed * dx;
+      } else {
+        scene.velocity_x(x, y) = 0.05f * max_speed * dy;
+        scene.velocity_y(x, y) = max_speed * std::sin(3.14159265f * dx * 4.0f);
+      }
+    }
+  }
+  scene.density.FillHalo(1.0f, 1.0f);
+  scene.velocity_x.FillHalo(0.0f, 1.0f);
+  scene.velocity_y.FillHalo(1.0f, 0.0f);
+  return scene;
+}
+
+void BenchmarkScene(const char *name, uint32_t size, uint32_t num_repeats, bool vortex, float max_speed) {
+  auto scene = MakeScene(size, vortex, max_speed);
+  Field2D out_density(size, size, 1);
+  Field2D out_velocity_x(size, size, 1);
+  Field2D out_velocity_y(size, size, 1);
+  const SemiLagrangianAdvector::Target targets[] = {
+          {&scene.density, &out_density},
+          {&scene.velocity_x, &out_velocity_x},
+          {&scene.velocity_y, &out_velocity_y},
+  };
+
+  auto time_row_major = [&](SemiLagrangianAdvector::Isa isa) {
+    SemiLagrangianAdvector advector(isa);
+    advector.Advect(scene.velocity_x, scene.velocity_y, 1.0f, targets, 3);
+    auto start = Clock::now();
+    for (auto repeat = 0u; repeat < num_repeats; ++repeat) {
+      advector.Advect(scene.velocity_x, scene.velocity_y, 1.0f, targets, 3);
+    }
+    return MillisecondsSince(start) / num_repeats;
+  };
+  auto scalar_ms = time_row_major(SemiLagrangianAdvector::SCALAR);
+  auto vector_isa = SemiLagrangianAdvector::DetectIsa();
+  auto vector_ms = time_row_major(vector_isa);
+
+  TileMap tile_map(size, size);
+  for (auto tile = 0; tile < tile_map.NumTiles(); ++tile) {
+    tile_map.Activate(tile);
+  }
+  tile_map.Compact();
+  TiledField2D tiled_density(tile_map);
+  TiledField2D tiled_velocity_x(tile_map);
+  TiledField2D tiled_velocity_y(tile_map);
+  const SemiLagrangianAdvector::TiledTarget tiled_targets[] = {
+          {&tiled_density, &out_density},
+          {&tiled_velocity_x, &out_velocity_x},
+          {&tiled_velocity_y, &out_velocity_y},
+  };
+  for (auto *field : {&tiled_density, &tiled_velocity_x, &tiled_velocity_y}) {
+    field->Reserve();
+  }
+  SemiLagrangianAdvector advector(SemiLagrangianAdvector::SCALAR);
+  auto copy_ms = 0.0;
+  auto tiled_ms = 0.0;
+  for (auto repeat = 0u; repeat <= num_repeats; ++repeat) {
+    auto start = Clock::now();
+    tiled_density.CopyFrom(nullptr, scene.density);
+    tiled_velocity_x.CopyFrom(nullptr, scene.velocity_x);
+    tiled_velocity_y.CopyFrom(nullptr, scene.velocity_y);
+    auto copied = Clock::now();
+    advector.AdvectRowsTiled(scene.velocity_x, scene.velocity_y, 1.0f, tile_map, tiled_targets, 3, 0, (int32_t) size);
+    // The first pass warms up like the row major ones
+    if (repeat > 0) {
+      copy_ms += std::chrono::duration<double, std::milli>(copied - start).count();
+      tiled_ms += MillisecondsSince(start);
+    }
+  }
+  copy_ms /= num_repeats;
+  tiled_ms /= num_repeats;
+
+  std::printf("%-8s %14.2f %14.2f %14.2f %10.2f %10.2f\n", name, scalar_ms, vector_ms, tiled_ms, copy_ms,
+              scalar_ms / tiled_ms);
+}
+
+double TimeSimulation(uint32_t size, GridFluidSimulator::AdvectionLayout layout) {
+  GridFluidSimulator sim{size, size, DELTA_T, DIFFUSION_RATE};
+  sim.SetNumThreads(1);
+  sim.SetAdvectionIsa(SemiLagrangianAdvector::SCALAR);
+  sim.SetAdvectionLayout(layout);
+  sim.SetPressureSolver(GridFluidSimulator::MULTIGRID);
+  sim.AddSource(size / 4, size / 2, 1.0f, 0.1f * (float) size, 0.02f * (float) size);
+  sim.AddSource(3 * size / 4, size / 3, 1.0f, -0.05f * (float) size, 0.1f * (float) size);
+  sim.Simulate();
+  auto start = Clock::now();
+  for (auto step = 0u; step < NUM_SIM_STEPS; ++step) {
+    sim.Simulate();
+  }
+  return MillisecondsSince(start) / NUM_SIM_STEPS;
+}
+}
+
+int main(int argc, char *argv[]) {
+  auto size = (argc > 1) ? (uint32_t) std::atoi(argv[1]) : DEFAULT_GRID_SIZE;
+  auto num_repeats = (argc > 2) ? (uint32_t) std::atoi(argv[2]) : DEFAULT_NUM_REPEATS;
+  auto max_speed = (argc > 3) ? (float) std::atof(argv[3]) : DEFAULT_MAX_SPEED;
+
+  std::printf("%u x %u interior, departure points up to %.0f cells away, ms per advection of 3 fields\n",
+              size, size, max_speed);
+  std::printf("%-8s %14s %14s %14s %10s %10s\n", "scene", "scalar rows", "vector rows", "scalar tiles",
+              "(copy)", "speedup");
+  BenchmarkScene("shear", size, num_repeats, false, max_speed);
+  BenchmarkScene("vortex", size, num_repeats, true, max_speed);
+
+  auto row_major_ms = TimeSimulation(size + 2, GridFluidSimulator::ROW_MAJOR);
+  auto tiled_ms = TimeSimulation(size + 2, GridFluidSimulator::TILED);
+  std::printf("%-8s %14.2f %14s %14.2f %10s %10.2f   (ms per step)\n", "jets", row_major_ms, "", tiled_ms, "",
+              row_major_ms / tiled_ms);
+  return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Strong scaling of GridFluidSimulator::Simulate() with thread count.
+ *
+ *   ScalingBenchmark [grid size] [steps] [max threads] [jacobi|multigrid|pcg|fft]
+ *                    [small|thp|hugetlb] [first-touch]
+ *
+ * Defaults to a 1024 x 1024 grid, 20 timed steps, every hardware thread and the multigrid
+ * pressure solver. fft runs on a periodic domain. Thread counts double from 1 up to the maximum.
+ * The fields use small pages placed by the constructing thread unless huge pages or first touch
+ * by the pool are asked for; where the grid fields' pages ended up is printed for the last run.
+ */
+#include "grid_fluid_simulator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+const uint32_t DEFAULT_GRID_SIZE = 1024;
+const uint32_t DEFAULT_NUM_STEPS = 20;
+const uint32_t NUM_WARMUP_STEPS = 3;
+const float DELTA_T = 1.0f / 15.0f;
+const float DIFFUSION_RATE = 0.2f;
+
+namespace {
+GridFluidSimulator::PressureSolver ParseSolver(const char *name) {
+  if (std::strcmp(name, "jacobi") == 0) return GridFluidSimulator::JACOBI;
+  if (std::strcmp(name, "multigrid") == 0) return GridFluidSimulator::MULTIGRID;
+  if (std::strcmp(name, "pcg") == 0) return GridFluidSimulator::PCG;
+  if (std::strcmp(name, "fft") == 0) return GridFluidSimulator::FFT;
+  throw std::runtime_error(std::string("Unknown pressure solver ") + name);
+}
+
+FieldMemoryConfig::PageSize ParsePageSize(const char *name) {
+  if (std::strcmp(name, "small") == 0) return FieldMemoryConfig::SMALL_PAGES;
+  if (std::strcmp(name, "thp") == 0) return FieldMemoryConfig::TRANSPARENT_HUGE_PAGES;
+  if (std::strcmp(name, "hugetlb") == 0) return FieldMemoryConfig::HUGETLBFS_PAGES;
+  throw std::runtime_error(std::string("Unknown page size ") + name);
+}
+
+void PrintPlacement(const FieldPagePlacement &placement, const FieldMemoryStats &stats) {
+  std::printf("field pages: %llu, not present %llu, unknown %llu",
+              (unsigned long long) placement.num_pages, (unsigned long long) placement.not_present,
+              (unsigned long long) placement.unknown);
+  for (size_t node = 0; node < placement.pages_per_node.size(); ++node) {
+    std::printf(", node %zu %llu", node, (unsigned long long) placement.pages_per_node[node]);
+  }
+  std::printf("\n");
+
+  const auto MIB = 1024.0 * 1024.0;
+  std::printf("allocated: heap %.1f MiB, THP %.1f MiB, hugetlbfs %.1f MiB (%u fell back to THP)\n",
+              stats.heap_bytes / MIB, stats.transparent_huge_page_bytes / MIB, stats.hugetlbfs_bytes / MIB,
+              stats.hugetlbfs_fallbacks);
+  std::printf("process huge pages: anonymous %.1f MiB, hugetlbfs %.1f MiB\n",
+              stats.process_anon_huge_page_bytes / MIB, stats.process_hugetlb_bytes / MIB);
+}
+
+/*
+ * Milliseconds per step for a fresh simulator with a pair of jets, so every run does the same work
+ */
+double TimeSteps(uint32_t size, uint32_t num_steps, uint32_t num_threads,
+                 GridFluidSimulator::PressureSolver solver, PoissonSolverStats &last_solve,
+                 FieldPagePlacement &placement, FieldMemoryStats &memory) {
+  GridFluidSimulator sim{size, size, DELTA_T, DIFFUSION_RATE};
+  sim.SetNumThreads(num_threads);
+  sim.SetPeriodicBoundaries(solver == GridFluidSimulator::FFT);
+  sim.SetPressureSolver(solver);
+  sim.AddSource(size / 4, size / 2, 1.0f, 0.1f * (float) size, 0.02f * (float) size);
+  sim.AddSource(3 * size / 4, size / 3, 1.0f, -0.05f * (float) size, 0.1f * (float) size);
+  for (auto step = 0u; step < NUM_WARMUP_STEPS; ++step) {
+    sim.Simulate();
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (auto step = 0u; step < num_steps; ++step) {
+    sim.Simulate();
+  }
+  auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+  last_solve = sim.LastPressureSolve();
+  placement = sim.PagePlacement();
+  memory = GetFieldMemoryStats();
+  return elapsed.count() / num_steps;
+}
+}
+
+int main(int argc, char *argv[]) {
+  auto size = (argc > 1) ? (uint32_t) std::atoi(argv[1]) : DEFAULT_GRID_SIZE;
+  auto num_steps = (argc > 2) ? (uint32_t) std::atoi(argv[2]) : DEFAULT_NUM_STEPS;
+  auto max_threads = (argc > 3) ? (uint32_t) std::atoi(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+  auto solver = (argc > 4) ? ParseSolver(argv[4]) : GridFluidSimulator::MULTIGRID;
+  auto page_size = (argc > 5) ? ParsePageSize(argv[5]) : FieldMemoryConfig::SMALL_PAGES;
+  auto first_touch = argc > 6 && std::strcmp(argv[6], "first-touch") == 0;
+  SetFieldMemoryConfig({page_size, first_touch});
+
+  std::vector<uint32_t> thread_counts;
+  for (auto n = 1u; n < max_threads; n *= 2) {
+    thread_counts.push_back(n);
+  }
+  thread_counts.push_back(max_threads);
+
+  std::printf("%u x %u grid, %u steps, %u hardware threads\n",
+              size, size, num_steps, std::thread::hardware_concurrency());
+  std::printf("%8s %12s %9s %11s %12s\n", "threads", "ms/step", "speedup", "efficiency", "pressure its");
+  auto serial_ms = 0.0;
+  FieldPagePlacement placement{0, 0, 0, {}};
+  FieldMemoryStats memory{};
+  for (auto num_threads : thread_counts) {
+    PoissonSolverStats last_solve{0, 0.0f};
+    auto ms = TimeSteps(size, num_steps, num_threads, solver, last_solve, placement, memory);
+    if (num_threads == 1) {
+      serial_ms = ms;
+    }
+    auto speedup = serial_ms / ms;
+    std::printf("%8u %12.2f %9.2f %10.0f%% %12u\n",
+                num_threads, ms, speedup, 100.0 * speedup / num_threads, last_solve.iterations);
+  }
+  PrintPlacement(placement, memory);
+  return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * Weak scaling of DistributedGridSimulator::Simulate(): every rank keeps a block of the same size,
+ * so the grid grows with the number of ranks and ideal scaling is a constant time per step.
+ *
+ *   mpirun -n N WeakScalingBenchmark [block size] [steps] [jacobi|sor]
+ *
+ * Defaults to 512 x 512 per rank, 20 timed steps and the Jacobi pressure solver. Rank counts
+ * double from 1 up to N. The pressure solve runs a fixed number of iterations so that every run
+ * does the same work per cell. Communication is the time the slowest rank spent waiting on halo
+ * messages and reductions.
+ */
+#include "distributed_grid_simulator.h"
+
+#include <mpi.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+const uint32_t DEFAULT_BLOCK_SIZE = 512;
+const uint32_t DEFAULT_NUM_STEPS = 20;
+const uint32_t NUM_WARMUP_STEPS = 3;
+const uint32_t NUM_PRESSURE_ITERATIONS = 50;
+const float DELTA_T = 1.0f / 15.0f;
+const float DIFFUSION_RATE = 0.2f;
+
+namespace {
+struct Timing {
+  double seconds_per_step;
+  double communication_share;
+  uint32_t dim_x;
+  uint32_t dim_y;
+};
+
+Timing Run(MPI_Comm comm, uint32_t block_size, uint32_t num_steps, DistributedGridSimulator::PressureSolver solver) {
+  int num_ranks;
+  MPI_Comm_size(comm, &num_ranks);
+  int dims[2] = {0, 0};
+  MPI_Dims_create(num_ranks, 2, dims);
+  auto dim_x = (uint32_t) dims[0] * block_size + 2;
+  auto dim_y = (uint32_t) dims[1] * block_size + 2;
+
+  DistributedGridSimulator sim{comm, dim_x, dim_y, DELTA_T, DIFFUSION_RATE};
+  sim.SetPressureSolver(solver);
+  sim.SetPressureTolerance(0.0f);
+  sim.SetMaxPressureIterations(NUM_PRESSURE_ITERATIONS);
+  // One jet per block, so that every rank has flow to advect
+  for (auto by = 0; by < dims[1]; ++by) {
+    for (auto bx = 0; bx < dims[0]; ++bx) {
+      auto x = (uint32_t) bx * block_size + block_size / 4;
+      auto y = (uint32_t) by * block_size + block_size / 2;
+      sim.AddSource(x, y, 1.0f, 2.0f, 0.5f);
+    }
+  }
+  for (auto step = 0u; step < NUM_WARMUP_STEPS; ++step) {
+    sim.Simulate();
+  }
+
+  MPI_Barrier(comm);
+  auto communication_start = sim.CommunicationSeconds();
+  auto start = MPI_Wtime();
+  for (auto step = 0u; step < num_steps; ++step) {
+    sim.Simulate();
+  }
+  double local[2] = {MPI_Wtime() - start, sim.CommunicationSeconds() - communication_start};
+  double slowest[2];
+  MPI_Allreduce(local, slowest, 2, MPI_DOUBLE, MPI_MAX, comm);
+  return {slowest[0] / num_steps, slowest[1] / slowest[0], dim_x, dim_y};
+}
+}
+
+int main(int argc, char *argv[]) {
+  MPI_Init(&argc, &argv);
+  auto block_size = (argc > 1) ? (uint32_t) std::atoi(argv[1]) : DEFAULT_BLOCK_SIZE;
+  auto num_steps = (argc > 2) ? (uint32_t) std::atoi(argv[2]) : DEFAULT_NUM_STEPS;
+  auto solver = (argc > 3 && std::strcmp(argv[3], "sor") == 0) ? DistributedGridSimulator::RED_BLACK_SOR
+                                                                 : DistributedGridSimulator::JACOBI;
+  int rank;
+  int world_size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+  if (rank == 0) {
+    std::printf("%u x %u per rank, %u steps, %s pressure solver with %u iterations\n", block_size, block_size,
+                num_steps, (solver == DistributedGridSimulator::JACOBI) ? "Jacobi" : "red-black SOR",
+                NUM_PRESSURE_ITERATIONS);
+    std::printf("%6s %14s %12s %12s %14s\n", "ranks", "grid", "ms/step", "efficiency", "communication");
+  }
+  auto base_seconds = 0.0;
+  for (auto num_ranks = 1; num_ranks <= world_size; num_ranks *= 2) {
+    // The ranks left out wait at the next split
+    MPI_Comm comm;
+    MPI_Comm_split(MPI_COMM_WORLD, (rank < num_ranks) ? 0 : MPI_UNDEFINED, rank, &comm);
+    if (comm != MPI_COMM_NULL) {
+      auto timing = Run(comm, block_size, num_steps, solver);
+      if (num_ranks == 1) {
+        base_seconds = timing.seconds_per_step;
+      }
+      if (rank == 0) {
+        char grid[32];
+        std::snprintf(grid, sizeof(grid), "%u x %u", timing.dim_x, timing.dim_y);
+        std::printf("%6d %14s %12.2f %11.0f%% %13.0f%%\n", num_ranks, grid, 1000.0 * timing.seconds_per_step,
+                    100.0 * base_seconds / timing.seconds_per_step, 100.0 * timing.communication_share);
+      }
+      MPI_Comm_free(&comm);
+    }
+  }
+  MPI_Finalize();
+  return 0;
+}
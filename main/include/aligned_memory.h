@@ -0,0 +1,81 @@
+#ifndef ALIGNED_MEMORY_H
+#define ALIGNED_MEMORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Rows start on a 64 byte boundary and are padded to a whole number of 16 float (AVX-512) vectors
+const uint32_t FIELD_ALIGNMENT_BYTES = 64;
+const uint32_t FIELD_ALIGNMENT_FLOATS = FIELD_ALIGNMENT_BYTES / sizeof(float);
+
+// Size of a transparent or hugetlbfs huge page on x86-64 and most arm64 kernels
+const size_t HUGE_PAGE_BYTES = 2 * 1024 * 1024;
+
+inline uint32_t RoundUp(uint32_t value, uint32_t multiple) {
+  return ((value + multiple - 1) / multiple) * multiple;
+}
+
+/*
+ * How field storage is backed, for the whole process. Applies to allocations made after it is
+ * set, so it is meant to be chosen once at startup before any simulator is built.
+ *
+ * With huge pages, allocations of at least HUGE_PAGE_BYTES are mapped on their own from a 2 MiB
+ * boundary, and either advised for transparent huge pages or taken from the hugetlbfs pool. When
+ * the pool has too few pages the allocation falls back to transparent huge pages and the
+ * fallback is counted. Smaller allocations, and every allocation on platforms without mmap, come
+ * from the heap.
+ *
+ * first_touch asks the simulators to write their fields from the threads that will work on each
+ * band of rows, so that under a first-touch NUMA policy each band's pages sit on the node of its
+ * thread (see BasicField2D::PlaceRows()).
+ */
+struct FieldMemoryConfig {
+  enum PageSize {
+    SMALL_PAGES,
+    TRANSPARENT_HUGE_PAGES,
+    HUGETLBFS_PAGES
+  };
+
+  PageSize page_size;
+  bool first_touch;
+};
+
+void SetFieldMemoryConfig(const FieldMemoryConfig &config);
+
+[[nodiscard]] FieldMemoryConfig GetFieldMemoryConfig();
+
+// Bytes currently allocated by backing, and what the kernel reports for the process
+struct FieldMemoryStats {
+  uint64_t heap_bytes;
+  uint64_t transparent_huge_page_bytes;
+  uint64_t hugetlbfs_bytes;
+  // hugetlbfs allocations that got transparent huge pages instead
+  uint32_t hugetlbfs_fallbacks;
+  // AnonHugePages and Private_Hugetlb + Shared_Hugetlb of /proc/self/smaps_rollup, or 0 elsewhere
+  uint64_t process_anon_huge_page_bytes;
+  uint64_t process_hugetlb_bytes;
+};
+
+[[nodiscard]] FieldMemoryStats GetFieldMemoryStats();
+
+/*
+ * The NUMA node of every 4 KiB page of some memory, from move_pages(2) without moving anything.
+ * Pages not yet touched are counted as not present. Elsewhere than Linux every page is unknown.
+ */
+struct FieldPagePlacement {
+  uint64_t num_pages;
+  uint64_t not_present;
+  uint64_t unknown;
+  // Pages on each node, indexed by node number
+  std::vector<uint64_t> pages_per_node;
+};
+
+void AddPagePlacement(const void *ptr, size_t num_bytes, FieldPagePlacement &placement);
+
+// FIELD_ALIGNMENT_BYTES aligned storage for num_floats floats. Throws std::bad_alloc on failure.
+float *AllocateAligned(size_t num_floats);
+
+void FreeAligned(float *ptr);
+
+#endif // ALIGNED_MEMORY_H
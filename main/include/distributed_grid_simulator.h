@@ -0,0 +1,231 @@
+#ifndef DISTRIBUTED_GRID_SIMULATOR_H
+#define DISTRIBUTED_GRID_SIMULATOR_H
+
+#include "field_2d.h"
+#include "poisson_solver_stats.h"
+#include "thread_pool.h"
+
+#include <mpi.h>
+
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+/*
+ * GridFluidSimulator inside walls, split across the processes of an MPI communicator for grids
+ * too large for one. The interior is cut into a rectangle per rank on a process grid chosen by
+ * MPI_Dims_create, and each rank keeps its rectangle as Field2D with a halo of halo cells that
+ * holds copies of its neighbours' edges, or the wall values on the sides that lie on the edge of
+ * the domain.
+ *
+ * Halos are exchanged between stages with non-blocking messages, and every stage updates the
+ * cells that do not read the halo while the messages are in flight, then the ring of cells next to
+ * the edges once they have arrived. The pressure solver's convergence check and the norm of its
+ * right hand side are reductions over every rank.
+ *
+ * Each step does what GridFluidSimulator::Step() does with walls, the JACOBI or RED_BLACK_SOR
+ * pressure solver and the scalar advection kernel, in the same order and with the same
+ * arithmetic per cell, except that a departure point is kept to within halo - 1 cells of its cell
+ * so that it lies in the halo. Below that speed the ranks together get the result of a single
+ * GridFluidSimulator, up to the order in which the residual sums are added.
+ *
+ * Every public method other than the accessors is collective: every rank must call it, with the
+ * same arguments. Grid coordinates are global and include the boundary ring, as in
+ * FluidSimulator2D.
+ */
+class DistributedGridSimulator {
+public:
+  enum PressureSolver {
+    JACOBI,
+    RED_BLACK_SOR
+  };
+
+  // halo must leave every rank's rectangle at least 2 * halo cells wide and high
+  DistributedGridSimulator(MPI_Comm comm,        //
+                           uint32_t dim_x,       //
+                           uint32_t dim_y,       //
+                           float delta_t,        //
+                           float diffusion_rate, //
+                           uint32_t halo = 4     //
+  );
+
+  DistributedGridSimulator(const DistributedGridSimulator &) = delete;
+
+  DistributedGridSimulator &operator=(const DistributedGridSimulator &) = delete;
+
+  ~DistributedGridSimulator();
+
+  void Simulate();
+
+  [[nodiscard]] uint32_t DimX() const { return dim_x_; }
+
+  [[nodiscard]] uint32_t DimY() const { return dim_y_; }
+
+  [[nodiscard]] int Rank() const { return rank_; }
+
+  [[nodiscard]] int NumRanks() const { return num_ranks_; }
+
+  // Ranks along x and y
+  [[nodiscard]] int RanksX() const { return dims_[0]; }
+
+  [[nodiscard]] int RanksY() const { return dims_[1]; }
+
+  // This rank's rectangle of the interior, in field coordinates
+  [[nodiscard]] uint32_t SubdomainX() const { return x0_; }
+
+  [[nodiscard]] uint32_t SubdomainY() const { return y0_; }
+
+  [[nodiscard]] uint32_t SubdomainWidth() const { return density_.Width(); }
+
+  [[nodiscard]] uint32_t SubdomainHeight() const { return density_.Height(); }
+
+  void SetPressureSolver(PressureSolver pressure_solver);
+
+  void SetPressureTolerance(float tolerance);
+
+  void SetMaxPressureIterations(uint32_t max_iterations);
+
+  // Over-relaxation for the RED_BLACK_SOR pressure solver. Defaults to the optimum for the grid.
+  void SetPressureOmega(float omega);
+
+  // Threads each rank uses for the cells away from its edges. Defaults to 1, for a rank per core.
+  void SetNumThreads(uint32_t num_threads);
+
+  // Only the rank that owns the cell keeps these
+  void AddDensity(uint32_t x, uint32_t y, float amount);
+
+  void AddSource(uint32_t x, uint32_t y, float amount, float velocity_x, float velocity_y);
+
+  void ClearSources();
+
+  // Dense dim_x * dim_y copies of the global fields, boundary ring included, assembled on root.
+  // dense is left alone on the other ranks.
+  void GatherDensity(std::vector<float> &dense, int root = 0) const;
+
+  void GatherVelocityX(std::vector<float> &dense, int root = 0) const;
+
+  void GatherVelocityY(std::vector<float> &dense, int root = 0) const;
+
+  // Iterations and relative residual of the most recent pressure solve, the same on every rank
+  [[nodiscard]] const PoissonSolverStats &LastPressureSolve() const { return last_pressure_solve_; }
+
+  // Seconds this rank has spent waiting on halo messages and reductions
+  [[nodiscard]] double CommunicationSeconds() const { return communication_seconds_; }
+
+private:
+  using Source = std::tuple<float, float, float>;
+
+  // A field whose halo is to be refreshed, with the wall factors of Field2D::FillHalo()
+  struct HaloUpdate {
+    Field2D *field;
+    float x_edge_factor;
+    float y_edge_factor;
+  };
+
+  // Whether grid cell (x, y) is kept by this rank: its interior, or the wall ring next to it
+  [[nodiscard]] bool Owns(uint32_t x, uint32_t y) const;
+
+  void ProcessSources();
+
+  /*
+   * Fill the wall sides of each field and exchange the whole halo, corners included, with the
+   * neighbours: columns first, then rows the full width of the halo so that the corners come from
+   * the diagonal neighbours by way of the side ones. overlap(0) runs while the columns are in
+   * flight and overlap(1) while the rows are.
+   */
+  template<typename Overlap>
+  void UpdateHalos(std::initializer_list<HaloUpdate> updates, const Overlap &overlap);
+
+  void UpdateHalos(std::initializer_list<HaloUpdate> updates);
+
+  void FillWallColumns(const HaloUpdate &update) const;
+
+  void FillWallRows(const HaloUpdate &update) const;
+
+  // Field2D::FillHalo() on the wall sides alone
+  void FillWalls(const HaloUpdate &update) const;
+
+  // Post the exchange of the first halo layer along each side, without the corners, which is all
+  // the five point stencils read
+  void BeginEdgeExchange(std::initializer_list<Field2D *> fields);
+
+  void FinishExchange();
+
+  // Call segment(y, x_begin, x_end) for the cells within width of an edge
+  template<typename Segment>
+  void ForRing(int32_t width, const Segment &segment) const;
+
+  double RedBlackSorSweep(const Field2D &rhs, float rhs_weight, float neighbour_weight, float omega, uint32_t colour,
+                          Field2D &u);
+
+  void Diffuse(const Field2D &current, Field2D &next);
+
+  void Advect();
+
+  // Advect cells [x_begin, x_end) of row y into the temp fields
+  void AdvectSegment(int32_t y, int32_t x_begin, int32_t x_end);
+
+  void SuppressDivergence();
+
+  void ComputePressure();
+
+  PoissonSolverStats ComputePressureJacobi();
+
+  PoissonSolverStats ComputePressureRedBlackSor();
+
+  // Sum over every rank
+  double AllSum(double value);
+
+  void Gather(const Field2D &field, float x_edge_factor, float y_edge_factor, std::vector<float> &dense,
+              int root) const;
+
+  MPI_Comm comm_;
+  int rank_;
+  int num_ranks_;
+  int dims_[2];
+  // Neighbouring ranks, or MPI_PROC_NULL at a wall
+  int left_;
+  int right_;
+  int below_;
+  int above_;
+  uint32_t dim_x_;
+  uint32_t dim_y_;
+  uint32_t x0_;
+  uint32_t y0_;
+  uint32_t halo_;
+  float delta_t_;
+  float diffusion_rate_;
+  PressureSolver pressure_solver_;
+  float pressure_tolerance_;
+  uint32_t max_pressure_iterations_;
+  float pressure_omega_;
+  PoissonSolverStats last_pressure_solve_;
+  double communication_seconds_;
+  std::unique_ptr<ThreadPool> thread_pool_;
+  // Halo columns and rows of a field: one layer along an edge, and all of them
+  MPI_Datatype edge_column_;
+  MPI_Datatype edge_row_;
+  MPI_Datatype halo_columns_;
+  MPI_Datatype halo_rows_;
+  std::vector<MPI_Request> requests_;
+  // Origin and size of every rank's rectangle, on every rank
+  std::vector<int> subdomains_;
+  // Density, velocity x and velocity y of the sources this rank owns, keyed by grid cell index
+  std::map<uint32_t, Source> sources_;
+  Field2D density_;
+  Field2D velocity_x_;
+  Field2D velocity_y_;
+  // Pressure solution, kept between steps
+  Field2D pressure_;
+  // Step workspace. Stages write into a temp buffer which is then swapped with the live field.
+  Field2D temp_pressure_;
+  Field2D divergence_;
+  Field2D temp_density_;
+  Field2D temp_velocity_x_;
+  Field2D temp_velocity_y_;
+};
+
+#endif // DISTRIBUTED_GRID_SIMULATOR_H
@@ -0,0 +1,89 @@
+#ifndef ENSEMBLE_FIELD_2D_H
+#define ENSEMBLE_FIELD_2D_H
+
+#include "aligned_memory.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * The same width * height field for every member of an ensemble, interleaved so that the values
+ * of one cell for all the members are contiguous. A stage written as a loop over cells around an
+ * inner loop over members applies one stencil to the whole ensemble at once, and the compiler can
+ * vectorise that inner loop however small the grid is.
+ *
+ * Each cell holds Lanes() values, the number of members rounded up to whole 64 byte vectors, so
+ * every cell starts on a vector boundary. Lanes past the last member belong to no one. As with
+ * Field2D there is a one cell halo, and coordinates are relative to the first interior cell.
+ */
+class EnsembleField2D {
+public:
+  EnsembleField2D();
+
+  EnsembleField2D(uint32_t width, uint32_t height, uint32_t members);
+
+  EnsembleField2D(const EnsembleField2D &) = delete;
+
+  EnsembleField2D &operator=(const EnsembleField2D &) = delete;
+
+  EnsembleField2D(EnsembleField2D &&other) noexcept;
+
+  EnsembleField2D &operator=(EnsembleField2D &&other) noexcept;
+
+  ~EnsembleField2D();
+
+  [[nodiscard]] uint32_t Width() const { return width_; }
+
+  [[nodiscard]] uint32_t Height() const { return height_; }
+
+  [[nodiscard]] uint32_t Members() const { return members_; }
+
+  [[nodiscard]] uint32_t Lanes() const { return lanes_; }
+
+  // Distance in floats between cell (x, y) and cell (x, y + 1)
+  [[nodiscard]] uint32_t RowStride() const { return row_stride_; }
+
+  // The lanes of cell (x, y). Either coordinate may be in the halo.
+  [[nodiscard]] inline float *Cell(int32_t x, int32_t y) {
+    assert(x >= -1 && x <= (int32_t) width_ && y >= -1 && y <= (int32_t) height_);
+    return origin_ + (intptr_t) y * row_stride_ + (intptr_t) x * lanes_;
+  }
+
+  [[nodiscard]] inline const float *Cell(int32_t x, int32_t y) const {
+    assert(x >= -1 && x <= (int32_t) width_ && y >= -1 && y <= (int32_t) height_);
+    return origin_ + (intptr_t) y * row_stride_ + (intptr_t) x * lanes_;
+  }
+
+  // Set every lane of every cell, halo included
+  void Fill(float value);
+
+  // Set every cell of one member, halo included
+  void FillMember(uint32_t member, float value);
+
+  void CopyFrom(const EnsembleField2D &other);
+
+  // Field2D::FillHalo() for every member
+  void FillHalo(float x_edge_factor, float y_edge_factor);
+
+  // One member's interior and halo as a dense row major (width + 2) * (height + 2) array
+  void CopyMemberTo(uint32_t member, std::vector<float> &dense) const;
+
+  void Swap(EnsembleField2D &other) noexcept;
+
+private:
+  uint32_t width_;
+  uint32_t height_;
+  uint32_t members_;
+  uint32_t lanes_;
+  uint32_t row_stride_;
+  size_t size_;
+  // Start of the allocation and cell (0, 0) within it
+  float *data_;
+  float *origin_;
+};
+
+inline void swap(EnsembleField2D &a, EnsembleField2D &b) noexcept { a.Swap(b); }
+
+#endif // ENSEMBLE_FIELD_2D_H
@@ -0,0 +1,142 @@
+#ifndef ENSEMBLE_GRID_SIMULATOR_H
+#define ENSEMBLE_GRID_SIMULATOR_H
+
+#include "ensemble_field_2d.h"
+#include "poisson_solver_stats.h"
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+/*
+ * An ensemble of independent dim_x * dim_y grids stepped together, for parameter studies over
+ * many small domains. Each member has its own timestep, diffusion rate, sources and fields, and
+ * follows GridFluidSimulator inside walls with the JACOBI pressure solver and scalar advection.
+ *
+ * The fields are EnsembleField2D, so every stage is one pass over the cells that updates all the
+ * members, vectorised across them. Rows are split across the thread pool with the work of every
+ * member counted, so grids too small to be worth splitting on their own still fill the machine.
+ * The pressure solve runs until the slowest member has converged; members that converge earlier
+ * keep their solution, so each stops where it would on its own. Nothing is allocated after
+ * construction.
+ *
+ * Grid coordinates include the boundary ring, as in FluidSimulator2D.
+ */
+class EnsembleGridSimulator {
+public:
+  EnsembleGridSimulator(uint32_t dim_x,        //
+                        uint32_t dim_y,        //
+                        uint32_t num_members,  //
+                        float delta_t,         //
+                        float diffusion_rate   //
+  );
+
+  // Advance every member by its own timestep
+  void Simulate();
+
+  [[nodiscard]] uint32_t DimX() const { return dim_x_; }
+
+  [[nodiscard]] uint32_t DimY() const { return dim_y_; }
+
+  [[nodiscard]] uint32_t NumMembers() const { return num_members_; }
+
+  void SetDeltaT(uint32_t member, float delta_t);
+
+  [[nodiscard]] float DeltaT(uint32_t member) const;
+
+  void SetDiffusionRate(uint32_t member, float diffusion_rate);
+
+  [[nodiscard]] float DiffusionRate(uint32_t member) const;
+
+  // Shared by every member, as in GridFluidSimulator
+  void SetPressureTolerance(float tolerance);
+
+  void SetMaxPressureIterations(uint32_t max_iterations);
+
+  // Threads used by every stage, including the calling thread. 0 means one per hardware thread.
+  void SetNumThreads(uint32_t num_threads);
+
+  [[nodiscard]] uint32_t NumThreads() const { return thread_pool_->NumThreads(); }
+
+  void AddDensity(uint32_t member, uint32_t x, uint32_t y, float amount);
+
+  // As FluidSimulator2D::AddSource(), for one member
+  void AddSource(uint32_t member, uint32_t x, uint32_t y, float amount, float velocity_x, float velocity_y);
+
+  void ClearSources(uint32_t member);
+
+  // Dense dim_x * dim_y copies of a member's fields, boundary ring included
+  [[nodiscard]] const std::vector<float> &Density(uint32_t member) const;
+
+  [[nodiscard]] const std::vector<float> &VelocityX(uint32_t member) const;
+
+  [[nodiscard]] const std::vector<float> &VelocityY(uint32_t member) const;
+
+  // Iterations and relative residual of a member's most recent pressure solve
+  [[nodiscard]] const PoissonSolverStats &LastPressureSolve(uint32_t member) const;
+
+private:
+  using Source = std::tuple<float, float, float>;
+
+  // Throw if there is no such member
+  void CheckMember(uint32_t member) const;
+
+  void CheckCell(uint32_t x, uint32_t y) const;
+
+  void ProcessSources();
+
+  void Diffuse(const EnsembleField2D &current, EnsembleField2D &next);
+
+  void Advect();
+
+  void SuppressDivergence();
+
+  void ComputePressure();
+
+  // Add up row_sums_ over the rows into lane_sums_
+  void SumRows();
+
+  void CorrectBoundaryDensities(EnsembleField2D &densities) const;
+
+  void CorrectBoundaryVelocities(EnsembleField2D &velocity_x, EnsembleField2D &velocity_y) const;
+
+  uint32_t dim_x_;
+  uint32_t dim_y_;
+  uint32_t num_members_;
+  float pressure_tolerance_;
+  uint32_t max_pressure_iterations_;
+  std::unique_ptr<ThreadPool> thread_pool_;
+  // Per lane; lanes past the last member stay at zero, which makes every stage leave them at zero
+  std::vector<float> delta_t_;
+  std::vector<float> diffusion_rate_;
+  std::vector<float> rhs_weight_;
+  std::vector<float> neighbour_weight_;
+  // 1 for the members whose pressure solve is still running, 0 for the others
+  std::vector<float> active_;
+  std::vector<double> rhs_norm_;
+  std::vector<double> lane_sums_;
+  // Per-row, per-lane partial sums of the pressure solve
+  std::vector<double> row_sums_;
+  std::vector<PoissonSolverStats> last_pressure_solve_;
+  // Density, velocity x and velocity y of each member's sources, keyed by grid cell index
+  std::vector<std::map<uint32_t, Source>> sources_;
+  EnsembleField2D density_;
+  EnsembleField2D velocity_x_;
+  EnsembleField2D velocity_y_;
+  // Pressure solution, kept between steps
+  EnsembleField2D pressure_;
+  // Step workspace. Stages write into a temp buffer which is then swapped with the live field.
+  EnsembleField2D temp_pressure_;
+  EnsembleField2D divergence_;
+  EnsembleField2D temp_density_;
+  EnsembleField2D temp_velocity_x_;
+  EnsembleField2D temp_velocity_y_;
+  mutable std::vector<float> density_view_;
+  mutable std::vector<float> velocity_x_view_;
+  mutable std::vector<float> velocity_y_view_;
+};
+
+#endif // ENSEMBLE_GRID_SIMULATOR_H
@@ -0,0 +1,49 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Complex discrete Fourier transforms of one fixed length.
+ *
+ * The length is factored into radix 4 and 2 stages, then any odd factors, and the twiddle factors
+ * for every stage are computed once on construction. Each transform is a sequence of Stockham
+ * autosort passes between the data and a caller supplied scratch buffer of the same length, so
+ * there is no bit reversal pass and nothing is allocated. Any length works; lengths with only
+ * small factors are fastest.
+ */
+class FftPlan {
+public:
+  explicit FftPlan(uint32_t length);
+
+  [[nodiscard]] uint32_t Length() const { return length_; }
+
+  // X[k] = sum_t x[t] exp(-2 pi i t k / n), in place. Not normalised.
+  void Forward(std::complex<float> *data, std::complex<float> *scratch) const;
+
+  // x[t] = sum_k X[k] exp(2 pi i t k / n), in place. Not normalised, so Inverse(Forward(x)) = n x.
+  void Inverse(std::complex<float> *data, std::complex<float> *scratch) const;
+
+private:
+  struct Stage {
+    uint32_t radix;
+    // Length of the sub-transforms the stage combines
+    uint32_t span;
+    // Start of this stage's (radix - 1) * span twiddle factors
+    size_t twiddle_offset;
+    // Start of this stage's radix roots of unity, for radices without a dedicated butterfly
+    size_t root_offset;
+  };
+
+  void Run(std::complex<float> *data, std::complex<float> *scratch) const;
+
+  uint32_t length_;
+  std::vector<Stage> stages_;
+  std::vector<std::complex<float>> twiddles_;
+  std::vector<std::complex<float>> roots_;
+};
+
+#endif // FFT_H
@@ -0,0 +1,73 @@
+#ifndef FFT_POISSON_SOLVER_H
+#define FFT_POISSON_SOLVER_H
+
+#include "fft.h"
+#include "field_2d.h"
+#include "poisson_solver_stats.h"
+#include "thread_pool.h"
+
+#include <complex>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+ * Direct solver for the pressure Poisson equation on a periodic domain
+ *   p(x-1,y) + p(x+1,y) + p(x,y-1) + p(x,y+1) - 4p(x,y) = divergence(x,y)
+ * where indices wrap around a width * height field. The 5-point operator is diagonal in Fourier
+ * space, with symbol 2cos(2 pi kx / width) + 2cos(2 pi ky / height) - 4, so a real to complex 2D
+ * FFT of the divergence, a division by the symbol and an inverse FFT give the solution with no
+ * iterations. The constant mode is in the null space and is set to zero.
+ *
+ * Rows are transformed two at a time as the real and imaginary parts of one complex transform.
+ * The half spectrum is then transposed so the column transforms are contiguous too. Plans,
+ * spectra and the inverse symbol are allocated once on construction.
+ */
+class FftPoissonSolver {
+public:
+  FftPoissonSolver(uint32_t width, uint32_t height);
+
+  [[nodiscard]] uint32_t Width() const { return width_; }
+
+  [[nodiscard]] uint32_t Height() const { return height_; }
+
+  // Split the row and column transforms across the pool's threads. nullptr runs serially.
+  void SetThreadPool(ThreadPool *thread_pool);
+
+  /*
+   * Overwrite pressure with the zero mean solution and fill its halo periodically. The residual
+   * reported is that of the single float precision solve.
+   */
+  PoissonSolverStats Solve(const Field2D &divergence, Field2D &pressure);
+
+private:
+  void ForwardRows(const Field2D &divergence);
+
+  void InverseRows(Field2D &pressure);
+
+  void Transpose(const std::complex<float> *from, uint32_t from_rows, uint32_t from_columns,
+                 std::complex<float> *to);
+
+  void TransformColumns(bool inverse);
+
+  [[nodiscard]] double Norm(const Field2D &field) const;
+
+  [[nodiscard]] double ResidualNorm(const Field2D &divergence, const Field2D &pressure) const;
+
+  uint32_t width_;
+  uint32_t height_;
+  // Bins kept from each real row transform, width / 2 + 1
+  uint32_t num_bins_;
+  // Shared when the domain is square
+  std::shared_ptr<const FftPlan> row_plan_;
+  std::shared_ptr<const FftPlan> column_plan_;
+  // height rows of num_bins_, plus a spare row so that a pair of rows can hold a full transform
+  std::vector<std::complex<float>> spectrum_;
+  // num_bins_ rows of height; each buffer is the other's scratch
+  std::vector<std::complex<float>> transposed_;
+  // 1 / (symbol * width * height), laid out as transposed_, with 0 for the constant mode
+  std::vector<float> inverse_symbol_;
+  ThreadPool *thread_pool_;
+};
+
+#endif // FFT_POISSON_SOLVER_H
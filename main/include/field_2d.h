@@ -0,0 +1,149 @@
+#ifndef FIELD_2D_H
+#define FIELD_2D_H
+
+#include "aligned_memory.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+/*
+ * How the halo beyond one edge of a field is filled: from the opposite edge when wrap is set,
+ * otherwise with factor times the neighbouring interior cell plus offset. Opposite edges either
+ * both wrap or neither does.
+ */
+struct EdgeFill {
+  bool wrap;
+  float factor;
+  float offset;
+};
+
+struct HaloFill {
+  EdgeFill left;
+  EdgeFill right;
+  EdgeFill bottom;
+  EdgeFill top;
+};
+
+/*
+ * A width * height scalar field surrounded by a halo of ghost cells.
+ *
+ * Coordinates are relative to the first interior cell, so x runs from -halo to width + halo - 1.
+ * The first interior cell of every row is 64 byte aligned. Boundary conditions are applied by
+ * filling the halo, after which stencils can read one cell past the interior without checks.
+ *
+ * Element access is unchecked in release builds.
+ *
+ * T is the storage type: float, double or Half (see precision_policy.h). Field2D is the float
+ * field every simulator uses unless it takes a precision policy.
+ */
+template<typename T>
+class BasicField2D {
+public:
+  BasicField2D();
+
+  BasicField2D(uint32_t width, uint32_t height, uint32_t halo);
+
+  BasicField2D(const BasicField2D &) = delete;
+
+  BasicField2D &operator=(const BasicField2D &) = delete;
+
+  BasicField2D(BasicField2D &&other) noexcept;
+
+  BasicField2D &operator=(BasicField2D &&other) noexcept;
+
+  ~BasicField2D();
+
+  [[nodiscard]] uint32_t Width() const { return width_; }
+
+  [[nodiscard]] uint32_t Height() const { return height_; }
+
+  [[nodiscard]] uint32_t Halo() const { return halo_; }
+
+  // Distance in cells between the start of consecutive rows
+  [[nodiscard]] uint32_t Stride() const { return stride_; }
+
+  // Pointer to cell (0, y). y may be in the halo.
+  [[nodiscard]] inline T *Row(int32_t y) {
+    assert(y >= -(int32_t) halo_ && y < (int32_t) (height_ + halo_));
+    return origin_ + (intptr_t) y * stride_;
+  }
+
+  [[nodiscard]] inline const T *Row(int32_t y) const {
+    assert(y >= -(int32_t) halo_ && y < (int32_t) (height_ + halo_));
+    return origin_ + (intptr_t) y * stride_;
+  }
+
+  inline T &operator()(int32_t x, int32_t y) {
+    assert(x >= -(int32_t) halo_ && x < (int32_t) (width_ + halo_));
+    return Row(y)[x];
+  }
+
+  inline T operator()(int32_t x, int32_t y) const {
+    assert(x >= -(int32_t) halo_ && x < (int32_t) (width_ + halo_));
+    return Row(y)[x];
+  }
+
+  // Set every cell, including the halo and row padding
+  void Fill(float value);
+
+  // Copy interior and halo from a field of the same shape
+  void CopyFrom(const BasicField2D &other);
+
+  /*
+   * Fill the halo from the outermost interior cells. Halo cells beyond the left and right edges
+   * take x_edge_factor times their neighbour, those above and below take y_edge_factor times theirs.
+   * 1 gives a zero gradient boundary and 0 a zero value. Corner cells average the two halo cells
+   * next to them. Further halo layers repeat the first.
+   */
+  void FillHalo(float x_edge_factor, float y_edge_factor);
+
+  // Fill the halo from the opposite edge of the interior, for a periodic domain
+  void WrapHalo();
+
+  /*
+   * Fill the halo edge by edge as fill says. Corner cells between two edges that do not wrap
+   * average the two halo cells next to them, as in FillHalo() above; along a wrapping edge they
+   * come from the opposite side with the rest of the row or column.
+   */
+  void FillHalo(const HaloFill &fill);
+
+  /*
+   * Copy the interior plus the first halo layer into a dense row major array of
+   * (width + 2) * (height + 2) values, converted to float.
+   */
+  void CopyTo(std::vector<float> &dense) const;
+
+  void Swap(BasicField2D &other) noexcept;
+
+  /*
+   * Move the field into fresh storage whose rows are first written, with their current values, by
+   * the thread of pool that ParallelFor(0, height, width) gives them to; the halo rows go with the
+   * first and last bands. Under a first-touch NUMA policy each band's pages then sit on the node of
+   * the thread that works on it. Pages shared by two bands go to whichever touches them first.
+   */
+  void PlaceRows(ThreadPool *pool);
+
+  // Add the NUMA placement of the field's pages to placement
+  void AddPagePlacement(FieldPagePlacement &placement) const;
+
+private:
+  uint32_t width_;
+  uint32_t height_;
+  uint32_t halo_;
+  uint32_t stride_;
+  size_t size_;
+  // Start of the allocation and cell (0, 0) within it
+  T *data_;
+  T *origin_;
+};
+
+template<typename T>
+inline void swap(BasicField2D<T> &a, BasicField2D<T> &b) noexcept { a.Swap(b); }
+
+using Field2D = BasicField2D<float>;
+
+#endif // FIELD_2D_H
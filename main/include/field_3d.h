@@ -0,0 +1,104 @@
+#ifndef FIELD_3D_H
+#define FIELD_3D_H
+
+#include "aligned_memory.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * A width * height * depth scalar field surrounded by a one cell halo of ghost cells.
+ *
+ * Coordinates are relative to the first interior cell, so x runs from -1 to width. Rows along x
+ * are laid out as in Field2D: the first interior cell of every row is 64 byte aligned and rows
+ * are padded to whole AVX-512 vectors. Each xy plane, halo rows included, is contiguous, so a
+ * pass that walks the volume in z order streams through memory and a 7-point stencil only needs
+ * the planes either side of the current one in cache.
+ *
+ * Element access is unchecked in release builds.
+ */
+class Field3D {
+public:
+  Field3D();
+
+  Field3D(uint32_t width, uint32_t height, uint32_t depth);
+
+  Field3D(const Field3D &) = delete;
+
+  Field3D &operator=(const Field3D &) = delete;
+
+  Field3D(Field3D &&other) noexcept;
+
+  Field3D &operator=(Field3D &&other) noexcept;
+
+  ~Field3D();
+
+  [[nodiscard]] uint32_t Width() const { return width_; }
+
+  [[nodiscard]] uint32_t Height() const { return height_; }
+
+  [[nodiscard]] uint32_t Depth() const { return depth_; }
+
+  // Distance in floats between the start of consecutive rows
+  [[nodiscard]] uint32_t RowStride() const { return row_stride_; }
+
+  // Distance in floats between the start of consecutive planes
+  [[nodiscard]] size_t PlaneStride() const { return plane_stride_; }
+
+  // Pointer to cell (0, y, z). y and z may be in the halo.
+  [[nodiscard]] inline float *Row(int32_t y, int32_t z) {
+    assert(y >= -1 && y <= (int32_t) height_ && z >= -1 && z <= (int32_t) depth_);
+    return origin_ + (intptr_t) z * (intptr_t) plane_stride_ + (intptr_t) y * row_stride_;
+  }
+
+  [[nodiscard]] inline const float *Row(int32_t y, int32_t z) const {
+    assert(y >= -1 && y <= (int32_t) height_ && z >= -1 && z <= (int32_t) depth_);
+    return origin_ + (intptr_t) z * (intptr_t) plane_stride_ + (intptr_t) y * row_stride_;
+  }
+
+  inline float &operator()(int32_t x, int32_t y, int32_t z) {
+    assert(x >= -1 && x <= (int32_t) width_);
+    return Row(y, z)[x];
+  }
+
+  inline float operator()(int32_t x, int32_t y, int32_t z) const {
+    assert(x >= -1 && x <= (int32_t) width_);
+    return Row(y, z)[x];
+  }
+
+  // Set every cell, including the halo and row padding
+  void Fill(float value);
+
+  // Copy interior and halo from a field of the same shape
+  void CopyFrom(const Field3D &other);
+
+  /*
+   * Fill the halo from the outermost interior cells. Halo cells beyond the x, y and z faces take
+   * the matching factor times their neighbour: 1 gives a zero gradient boundary and 0 a zero
+   * value. The x faces are filled first, then y and then z, so cells on the edges and corners of
+   * the halo take the product of the factors involved.
+   */
+  void FillHalo(float x_edge_factor, float y_edge_factor, float z_edge_factor);
+
+  // Copy the interior plus the halo into a dense (width + 2) * (height + 2) * (depth + 2) array
+  void CopyTo(std::vector<float> &dense) const;
+
+  void Swap(Field3D &other) noexcept;
+
+private:
+  uint32_t width_;
+  uint32_t height_;
+  uint32_t depth_;
+  uint32_t row_stride_;
+  size_t plane_stride_;
+  size_t size_;
+  // Start of the allocation and cell (0, 0, 0) within it
+  float *data_;
+  float *origin_;
+};
+
+inline void swap(Field3D &a, Field3D &b) noexcept { a.Swap(b); }
+
+#endif // FIELD_3D_H
@@ -1,9 +1,20 @@
 #ifndef FLUID_SIMULATOR_2D_H
 #define FLUID_SIMULATOR_2D_H
 
+#include "field_2d.h"
 #include "fluid_simulator.h"
-#include <map>
+#include "obstacle_mask.h"
 
+#include <cstdint>
+#include <map>
+#include <tuple>
+#include <vector>
+
+/*
+ * A dim_x * dim_y grid whose outermost ring of cells holds boundary values. Fields are stored as
+ * Field2D over the (dim_x - 2) * (dim_y - 2) interior with that ring as the halo, so grid cell
+ * (x, y) is field cell (x - 1, y - 1).
+ */
 class FluidSimulator2D : public FluidSimulator {
 public:
   [[maybe_unused]] FluidSimulator2D(uint32_t dim_x, uint32_t dim_y);
@@ -14,6 +25,7 @@ public:
 
   [[nodiscard]] uint32_t DimY() const { return dim_y_; }
 
+  // Dense dim_x * dim_y copies of the fields, boundary ring included
   [[nodiscard]] const std::vector<float> &Density() const override;
 
   [[nodiscard]] virtual const std::vector<float> &VelocityX() const;
@@ -28,22 +40,50 @@ public:
 
   [[maybe_unused]] void RemoveSource(uint32_t x, uint32_t y);
 
+  /*
+   * Mark an interior grid cell as solid or as fluid again. Simulators that support obstacles pick
+   * up changes at the start of the next step; the others ignore the mask.
+   */
+  void SetSolid(uint32_t x, uint32_t y, bool solid);
+
+  [[nodiscard]] bool IsSolid(uint32_t x, uint32_t y) const;
+
+  void ClearSolids();
+
+  // Solid cells, in field coordinates
+  [[nodiscard]] const ObstacleMask &Obstacles() const { return obstacles_; }
+
 protected:
+  /*
+   * For subclasses that keep the fields in storage of their own. density_, velocity_x_ and
+   * velocity_y_ are left empty, so the field views and AddDensity() must be overridden.
+   */
+  FluidSimulator2D(uint32_t dim_x, uint32_t dim_y, bool allocate_fields);
+
+  using Source = std::tuple<float, float, float>;
+
   [[maybe_unused]] void ProcessSources();
 
+  // Density, velocity x and velocity y of each source, keyed by grid cell index
+  [[nodiscard]] const std::map<uint32_t, Source> &Sources() const { return sources_; }
+
   [[nodiscard]] inline uint32_t Index(uint32_t x, uint32_t y) const { return y * dim_x_ + x; };
 
   uint32_t dim_x_;
   uint32_t dim_y_;
   uint32_t num_cells_;
-  std::vector<float> density_;
-  std::vector<float> velocity_x_;
-  std::vector<float> velocity_y_;
+  Field2D density_;
+  Field2D velocity_x_;
+  Field2D velocity_y_;
 
 private:
   void AllocateStorage();
 
-  std::map<uint32_t, std::tuple<float, float, float>> sources_;
+  std::map<uint32_t, Source> sources_;
+  ObstacleMask obstacles_;
+  mutable std::vector<float> density_view_;
+  mutable std::vector<float> velocity_x_view_;
+  mutable std::vector<float> velocity_y_view_;
 };
 
 #endif // FLUID_SIMULATOR_2D_H
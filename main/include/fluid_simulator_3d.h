@@ -0,0 +1,71 @@
+#ifndef FLUID_SIMULATOR_3D_H
+#define FLUID_SIMULATOR_3D_H
+
+#include "field_3d.h"
+#include "fluid_simulator.h"
+
+#include <cstdint>
+#include <map>
+#include <tuple>
+#include <vector>
+
+/*
+ * A dim_x * dim_y * dim_z grid whose outermost shell of cells holds boundary values. Fields are
+ * stored as Field3D over the (dim_x - 2) * (dim_y - 2) * (dim_z - 2) interior with that shell as
+ * the halo, so grid cell (x, y, z) is field cell (x - 1, y - 1, z - 1).
+ */
+class FluidSimulator3D : public FluidSimulator {
+public:
+  FluidSimulator3D(uint32_t dim_x, uint32_t dim_y, uint32_t dim_z);
+
+  void Simulate() override = 0;
+
+  [[nodiscard]] uint32_t DimX() const { return dim_x_; }
+
+  [[nodiscard]] uint32_t DimY() const { return dim_y_; }
+
+  [[nodiscard]] uint32_t DimZ() const { return dim_z_; }
+
+  // Dense dim_x * dim_y * dim_z copies of the fields, boundary shell included, x fastest
+  [[nodiscard]] const std::vector<float> &Density() const override;
+
+  [[nodiscard]] virtual const std::vector<float> &VelocityX() const;
+
+  [[nodiscard]] virtual const std::vector<float> &VelocityY() const;
+
+  [[nodiscard]] virtual const std::vector<float> &VelocityZ() const;
+
+  virtual void AddDensity(uint32_t x, uint32_t y, uint32_t z, float amount);
+
+  void AddSource(uint32_t x, uint32_t y, uint32_t z, float amount, float velocity_x, float velocity_y, float velocity_z);
+
+  void ClearSources();
+
+  void RemoveSource(uint32_t x, uint32_t y, uint32_t z);
+
+protected:
+  using Source = std::tuple<float, float, float, float>;
+
+  void ProcessSources();
+
+  [[nodiscard]] inline size_t Index(uint32_t x, uint32_t y, uint32_t z) const {
+    return ((size_t) z * dim_y_ + y) * dim_x_ + x;
+  }
+
+  uint32_t dim_x_;
+  uint32_t dim_y_;
+  uint32_t dim_z_;
+  Field3D density_;
+  Field3D velocity_x_;
+  Field3D velocity_y_;
+  Field3D velocity_z_;
+
+private:
+  std::map<size_t, Source> sources_;
+  mutable std::vector<float> density_view_;
+  mutable std::vector<float> velocity_x_view_;
+  mutable std::vector<float> velocity_y_view_;
+  mutable std::vector<float> velocity_z_view_;
+};
+
+#endif // FLUID_SIMULATOR_3D_H
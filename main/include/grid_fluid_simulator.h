@@ -1,13 +1,73 @@
 #ifndef GRID_FLUID_SIMULATOR_H
 #define GRID_FLUID_SIMULATOR_H
 
+#include "fft_poisson_solver.h"
+#include "field_2d.h"
+#include "grid_kernels.h"
 #include "fluid_simulator_2d.h"
+#include "multigrid_poisson_solver.h"
+#include "pcg_poisson_solver.h"
+#include "poisson_solver_stats.h"
+#include "semi_lagrangian_advector.h"
+#include "thread_pool.h"
+#include "tiled_field_2d.h"
 
 #include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
 #include <vector>
 
+/*
+ * Stable fluids on a cell-centred grid. Each edge of the domain is a wall, periodic, an inflow or
+ * an outflow (see SetBoundaryModes()). The modes become halo fill tables when they are set, so the
+ * stencils read one cell past the interior whatever the edges are and never test where they are.
+ *
+ * Solid cells (see FluidSimulator2D::SetSolid()) are skipped by every stage, which walks the fluid
+ * runs of each row instead, and their boundary values are set from a list of the solid cells next
+ * to the fluid. Obstacles need the JACOBI or RED_BLACK_SOR pressure solver, and the tiled
+ * diffusion, tiled advection and fused projection options are not used while there are any.
+ */
 class GridFluidSimulator : public FluidSimulator2D {
 public:
+  enum PressureSolver {
+    JACOBI,
+    MULTIGRID,
+    PCG,
+    RED_BLACK_SOR,
+    // Direct spectral solve; periodic boundaries only
+    FFT
+  };
+
+  /*
+   * What lies beyond an edge. WALL: no flow through it, tangential velocity and scalars copied.
+   * PERIODIC: the opposite edge, which must be periodic too. INFLOW: fluid entering at a set speed
+   * and density (see SetInflow()). OUTFLOW: velocity and scalars copied, so that fluid leaves
+   * freely. The pressure is wrapped across periodic edges and zero beyond outflow edges. Beyond
+   * walls it is zero too unless some edge is an inflow, when it is copied beyond walls and inflow
+   * edges alike, so that the outflow edges alone take the fluid out.
+   */
+  enum BoundaryMode {
+    WALL,
+    PERIODIC,
+    INFLOW,
+    OUTFLOW
+  };
+
+  enum Edge {
+    LEFT,
+    RIGHT,
+    BOTTOM,
+    TOP
+  };
+
+  // Where advection reads its stencils from
+  enum AdvectionLayout {
+    ROW_MAJOR,
+    // Tiled copies of the fields, made each step. Always uses the scalar kernel.
+    TILED
+  };
+
   GridFluidSimulator(uint32_t width,      //
                      uint32_t height,     //
                      float delta_t,       //
@@ -20,40 +80,266 @@ public:
 
   void InitialiseVelocity();
 
+  // Throws if the solver does not handle the current boundaries: FFT needs every edge periodic,
+  // and only JACOBI and RED_BLACK_SOR handle a domain that is periodic along one axis or has an
+  // inflow edge.
+  void SetPressureSolver(PressureSolver pressure_solver);
+
+  // Solves stop once the relative residual is below tolerance. An iteration is a sweep for Jacobi,
+  // a red and a black sweep for SOR, a V-cycle for multigrid and a CG step for PCG.
+  void SetPressureTolerance(float tolerance);
+
+  void SetMaxPressureIterations(uint32_t max_iterations);
+
+  // When set the previous step's pressure is the initial guess for the next solve
+  void SetWarmStartPressure(bool warm_start);
+
+  // Over-relaxation for the diffusion sweeps; 1 (the default) is plain Gauss-Seidel
+  void SetDiffuseOmega(float omega);
+
+  // Run the diffusion iterations on cache-sized tiles rather than a sweep at a time. Both give the
+  // same result; tiling pays off once a field no longer fits in the last level cache.
+  void SetDiffuseTiling(bool tiling);
+
+  // Over-relaxation for the RED_BLACK_SOR pressure solver. Defaults to the optimum for the grid.
+  void SetPressureOmega(float omega);
+
+  /*
+   * Fold the projection into the RED_BLACK_SOR pressure solve: the first sweep computes the
+   * divergence as it goes and the last one subtracts the pressure gradient a row behind, which
+   * saves the separate divergence, norm and projection passes. The last sweep is picked when the
+   * red half of an iteration predicts convergence, so a solve can stop an iteration either side
+   * of where it would otherwise. The other solvers, and SOR with a periodic or inflow edge, always
+   * run the passes separately.
+   */
+  void SetFusedProjection(bool fused);
+
+  /*
+   * Throws unless opposite edges are either both periodic or neither is. The pressure solver
+   * switches to FFT when every edge is periodic, and to JACOBI when the current solver does not
+   * handle the new boundaries. The pressure starts again from zero.
+   */
+  void SetBoundaryModes(BoundaryMode left, BoundaryMode right, BoundaryMode bottom, BoundaryMode top);
+
+  [[nodiscard]] BoundaryMode GetBoundaryMode(Edge edge) const { return boundary_modes_[edge]; }
+
+  // Speed into the domain and density of the fluid entering through an INFLOW edge. Both are 0
+  // until set.
+  void SetInflow(Edge edge, float speed, float density);
+
+  // Every edge PERIODIC, or every edge a WALL
+  void SetPeriodicBoundaries(bool periodic);
+
+  // Whether every edge is periodic
+  [[nodiscard]] bool PeriodicBoundaries() const { return periodic_; }
+
+  // Threads used by every stage, including the calling thread. 0 means one per hardware thread.
+  void SetNumThreads(uint32_t num_threads);
+
+  [[nodiscard]] uint32_t NumThreads() const { return thread_pool_->NumThreads(); }
+
+  // NUMA placement of the pages of every grid field, scalar fields included
+  [[nodiscard]] FieldPagePlacement PagePlacement() const;
+
+  // Advection uses the widest vector kernel the CPU supports unless another is chosen here
+  void SetAdvectionIsa(SemiLagrangianAdvector::Isa isa);
+
+  /*
+   * With TILED every step copies the fields into TILE_SIZE square tiles before advecting, so that
+   * departure points several rows away still find their stencil in one small block of memory.
+   * The result is that of the scalar advection kernel either way; the other stages always use
+   * the row major fields, which they stream through in order.
+   */
+  void SetAdvectionLayout(AdvectionLayout layout);
+
+  /*
+   * Register a passive scalar, such as a dye colour or a temperature, that is diffused at its own
+   * rate and carried by the flow as the density is, with the same boundaries. Every scalar is
+   * advected in the pass that advects the density and velocity, reusing each cell's backtrace, and
+   * they are diffused together a band of rows at a time, so each one adds its own stencil work and
+   * little else. Names must be unique. Returns the new field's index.
+   */
+  uint32_t AddScalarField(const std::string &name, float diffusion_rate);
+
+  [[nodiscard]] uint32_t NumScalarFields() const { return (uint32_t) scalars_.size(); }
+
+  // Index of the field registered as name. Throws if there is none.
+  [[nodiscard]] uint32_t ScalarFieldIndex(const std::string &name) const;
+
+  [[nodiscard]] const std::string &ScalarFieldName(uint32_t field) const;
+
+  // Dense dim_x * dim_y copy of a scalar field, boundary ring included, as Density()
+  [[nodiscard]] const std::vector<float> &ScalarField(uint32_t field) const;
+
+  void AddScalarAmount(uint32_t field, uint32_t x, uint32_t y, float amount);
+
+  // Set a scalar to amount in a cell at the start of every step, as AddSource() does the density
+  void AddScalarSource(uint32_t field, uint32_t x, uint32_t y, float amount);
+
+  void ClearScalarSources();
+
+  // Iterations and relative residual of the most recent pressure solve
+  [[nodiscard]] const PoissonSolverStats &LastPressureSolve() const { return last_pressure_solve_; }
+
+  /*
+   * In adaptive mode Simulate() still advances delta_t, but in as many equal substeps as it takes
+   * for no velocity component to cross more than the CFL number of cells in one, up to
+   * max_substeps. The speed comes from the end of the previous substep and the sources.
+   */
+  void SetAdaptiveTimestep(bool adaptive);
+
+  void SetCflNumber(float cfl_number);
+
+  void SetMaxSubsteps(uint32_t max_substeps);
+
+  // Substeps taken by the most recent Simulate(); always 1 with a fixed timestep
+  [[nodiscard]] uint32_t LastSubsteps() const { return last_substeps_; }
+
 protected:
-  void Diffuse(const std::vector<float> &current_density, std::vector<float> &next_density);
+  // For subclasses that bring kernels built for their grid size
+  GridFluidSimulator(uint32_t width,              //
+                     uint32_t height,             //
+                     float delta_t,               //
+                     float diffusion_rate,        //
+                     const GridKernels &kernels   //
+  );
+
+  // Relax towards the implicit diffusion of current, with fill for the halo between iterations
+  void Diffuse(const Field2D &current, Field2D &next, const HaloFill &fill);
 
   void SuppressDivergence();
 
 private:
-  [[nodiscard]] float AdvectValue(const std::vector<float> &velocity_x,
-                    const std::vector<float> &velocity_y,
-                    const std::vector<float> &source_data,
-                    uint32_t x, uint32_t y) const;
+  // A scalar registered with AddScalarField()
+  struct PassiveScalar {
+    std::string name;
+    float diffusion_rate;
+    Field2D field;
+    Field2D temp_field;
+    // Held values, keyed by grid cell index
+    std::map<uint32_t, float> sources;
+    std::unique_ptr<TiledField2D> tiled_field;
+    mutable std::vector<float> view;
+  };
+
+  void AllocateWorkspace();
+
+  // With FieldMemoryConfig::first_touch, move every grid field's rows to the threads of the pool
+  void PlaceFields();
+
+  // Throw if there is no such field
+  [[nodiscard]] const PassiveScalar &Scalar(uint32_t field) const;
+
+  [[nodiscard]] PassiveScalar &Scalar(uint32_t field);
+
+  void ProcessScalarSources();
+
+  void DiffuseScalars();
+
+  void ReserveTiledScalars();
+
+  void Step(float delta_t);
+
+  void UpdateFluidRegion();
+
+  // Rebuild the halo fill tables from the boundary modes and refill the halos of every field
+  void UpdateBoundaries();
+
+  [[nodiscard]] float MaxSourceSpeed() const;
+
+  void AdvectFields();
+
+  void ComputeDivergence(Field2D &divergence) const;
+
+  void SuppressDivergenceFused();
 
-  void AdvectDensity(const std::vector<float> &curr_density,
-                     std::vector<float> &next_density) const;
+  [[nodiscard]] double SumRows() const;
 
-  void AdvectVelocity(std::vector<float>& advected_velocity_x,
-                      std::vector<float>& advected_velocity_y) const;
+  void ComputePressure(const Field2D &divergence, Field2D &pressure);
 
-  void ComputeDivergence(std::vector<float> &divergence) const;
+  PoissonSolverStats ComputePressureJacobi(const Field2D &divergence, Field2D &pressure);
 
-  void ComputePressure(const std::vector<float> &divergence, std::vector<float> &pressure) const;
+  PoissonSolverStats ComputePressureRedBlackSor(const Field2D &divergence, Field2D &pressure);
 
-  void ComputeCurlField(const std::vector<float> &pressure,
-                        std::vector<float> &curl_x,
-                        std::vector<float> &curl_y) const;
+  double RedBlackSorSweep(const Field2D &rhs, float rhs_weight, float neighbour_weight, float omega, uint32_t colour,
+                          Field2D &u) const;
 
-  void CorrectBoundaryDensities(std::vector<float>& densities) const;
+  [[nodiscard]] double Norm(const Field2D &field) const;
 
-  void CorrectBoundaryVelocities(std::vector<float>& velocity_x,
-                                 std::vector<float>& velocity_y) const;
+  void CorrectBoundaryDensities(Field2D &densities) const;
 
-  static inline float Lerp(float from, float to, float pct) { return from + pct * (to - from); }
+  void CorrectBoundaryVelocities(Field2D &velocity_x, Field2D &velocity_y) const;
 
   float delta_t_;
+  // Time advanced by the step in progress: delta_t_, or a substep of it
+  float step_delta_t_;
   float diffusion_rate_;
+  const GridKernels *kernels_;
+  PressureSolver pressure_solver_;
+  float pressure_tolerance_;
+  uint32_t max_pressure_iterations_;
+  PoissonSolverStats last_pressure_solve_;
+  bool warm_start_pressure_;
+  float diffuse_omega_;
+  bool diffuse_tiling_;
+  BoundaryMode boundary_modes_[4];
+  // Per edge, in Edge order
+  float inflow_speeds_[4];
+  float inflow_densities_[4];
+  // Every edge periodic, and at least one
+  bool periodic_;
+  // Some edge periodic or inflow, so the pressure halo is not all zero and the JACOBI and
+  // RED_BLACK_SOR solvers refill it after every sweep. The other solvers assume a zero halo.
+  bool refill_pressure_halo_;
+  // No edge periodic or inflow, so every diffused field has the zero gradient halo the tiled
+  // diffusion assumes
+  bool zero_gradient_halo_;
+  // Halo fills for the scalars, for each velocity component, for each velocity component while it
+  // is diffused, and for the pressure
+  HaloFill density_fill_;
+  HaloFill velocity_x_fill_;
+  HaloFill velocity_y_fill_;
+  HaloFill diffuse_velocity_x_fill_;
+  HaloFill diffuse_velocity_y_fill_;
+  HaloFill pressure_fill_;
+  float pressure_omega_;
+  bool fused_projection_;
+  bool adaptive_timestep_;
+  float cfl_number_;
+  uint32_t max_substeps_;
+  uint32_t last_substeps_;
+  // Largest velocity component at the end of the last step
+  float max_speed_;
+  SemiLagrangianAdvector advector_;
+  AdvectionLayout advection_layout_;
+  std::unique_ptr<ThreadPool> thread_pool_;
+  // Pressure solution, kept between steps
+  Field2D pressure_;
+  // Step workspace. Stages write into a temp buffer which is then swapped with the live field.
+  Field2D temp_pressure_;
+  Field2D divergence_;
+  Field2D temp_density_;
+  Field2D temp_velocity_x_;
+  Field2D temp_velocity_y_;
+  // Per-row partial sums of the fused projection, and the first and last rows of its bands
+  std::vector<double> row_sums_;
+  std::vector<uint8_t> band_edge_rows_;
+  std::vector<PassiveScalar> scalars_;
+  // Rebuilt every step; the capacity is kept so that steps do not allocate
+  std::vector<SemiLagrangianAdvector::Target> advection_targets_;
+  std::vector<SemiLagrangianAdvector::TiledTarget> tiled_advection_targets_;
+  // Fluid runs and obstacle boundary when any cell is solid, as of obstacles_version_
+  std::unique_ptr<FluidRegion> fluid_region_;
+  uint64_t obstacles_version_;
+  // Created on first use; sized for this grid
+  std::unique_ptr<MultigridPoissonSolver> multigrid_solver_;
+  std::unique_ptr<PcgPoissonSolver> pcg_solver_;
+  std::unique_ptr<FftPoissonSolver> fft_solver_;
+  // Every tile active, and the tiled copies of the advected fields
+  std::unique_ptr<TileMap> tile_map_;
+  std::unique_ptr<TiledField2D> tiled_density_;
+  std::unique_ptr<TiledField2D> tiled_velocity_x_;
+  std::unique_ptr<TiledField2D> tiled_velocity_y_;
 };
 
 #endif // GRID_FLUID_SIMULATOR_H
@@ -0,0 +1,87 @@
+#ifndef GRID_KERNELS_H
+#define GRID_KERNELS_H
+
+#include "field_2d.h"
+
+#include <cstdint>
+
+/*
+ * The stencil loops of GridFluidSimulator, each over the rows [y_begin, y_end) of the interior so
+ * that the caller can split them across a thread pool. A table is either built for any width, or
+ * for one fixed interior width, in which case every row loop has a trip count known at compile
+ * time and the compiler fully unrolls and vectorises it without remainder handling. Both give
+ * bitwise the same results. Whole steps with the fixed tables time within noise of the dynamic
+ * one, so GridFluidSimulator uses the dynamic table and the fixed ones are only reached through
+ * its protected constructor.
+ */
+struct GridKernels {
+  // Rows of a RedBlackSorSweep. Returns the sum of squared Gauss-Seidel corrections.
+  double (*red_black_sor_rows)(const Field2D &rhs,
+                               float rhs_weight,
+                               float neighbour_weight,
+                               float omega,
+                               uint32_t colour,
+                               int32_t y_begin,
+                               int32_t y_end,
+                               Field2D &u);
+
+  // Rows of a Jacobi pressure sweep from pressure into next. Returns the sum of squared changes.
+  double (*jacobi_rows)(const Field2D &divergence,
+                        const Field2D &pressure,
+                        int32_t y_begin,
+                        int32_t y_end,
+                        Field2D &next);
+
+  // d(x,y) = [ vx(x+1,y) - vx(x-1,y) + vy(x,y+1) - vy(x,y-1) ] * 0.5f
+  void (*divergence_rows)(const Field2D &velocity_x,
+                          const Field2D &velocity_y,
+                          int32_t y_begin,
+                          int32_t y_end,
+                          Field2D &divergence);
+
+  // Subtract the central pressure gradient from the velocity. Returns the largest |component| left.
+  double (*project_rows)(const Field2D &pressure,
+                         int32_t y_begin,
+                         int32_t y_end,
+                         Field2D &velocity_x,
+                         Field2D &velocity_y);
+
+  /*
+   * Rows of the first, colour 0, sweep of a red-black SOR pressure solve that computes its
+   * right-hand side as it goes: each divergence row is written and its sum of squares stored in
+   * row_sums[y] before the row is relaxed. Returns the sum of squared Gauss-Seidel corrections.
+   */
+  double (*divergence_sor_rows)(const Field2D &velocity_x,
+                                const Field2D &velocity_y,
+                                float omega,
+                                int32_t y_begin,
+                                int32_t y_end,
+                                Field2D &divergence,
+                                double *row_sums,
+                                Field2D &pressure);
+
+  /*
+   * Rows of the last, colour 1, sweep of a red-black SOR pressure solve, storing each row's squared
+   * corrections in row_sums[y]. Rows y_begin + 1 to y_end - 2 are projected as in project_rows one
+   * row behind the sweep; the first and last rows need the neighbouring bands and are left to the
+   * caller. Returns the largest |component| left in the projected rows.
+   */
+  double (*sor_project_rows)(const Field2D &divergence,
+                             float omega,
+                             int32_t y_begin,
+                             int32_t y_end,
+                             double *row_sums,
+                             Field2D &pressure,
+                             Field2D &velocity_x,
+                             Field2D &velocity_y);
+};
+
+// Kernels for any interior width
+const GridKernels &DynamicGridKernels();
+
+// Kernels for an interior exactly Width cells wide. Instantiated for the 128, 256, 512 and 1024
+// cell grids only.
+template<int32_t Width>
+const GridKernels &FixedGridKernels();
+
+#endif // GRID_KERNELS_H
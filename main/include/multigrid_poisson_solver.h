@@ -0,0 +1,101 @@
+#ifndef MULTIGRID_POISSON_SOLVER_H
+#define MULTIGRID_POISSON_SOLVER_H
+
+#include "field_2d.h"
+#include "poisson_solver_stats.h"
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * Geometric multigrid solver for the pressure Poisson equation
+ *   p(x-1,y) + p(x+1,y) + p(x,y-1) + p(x,y+1) - 4p(x,y) = divergence(x,y)
+ * over the interior of a dim_x * dim_y grid, with p = 0 on the outer ring of cells. Fields passed in
+ * cover the (dim_x - 2) * (dim_y - 2) interior.
+ *
+ * Levels are cell-centred and coarsen 2:1 in each direction. Coarse cell centres do not line up
+ * with the fine boundary ring so the coarse operators extrapolate a ghost value that is zero at the
+ * true boundary position; this is folded into a per-cell diagonal. Coarsening stops when either
+ * axis is down to a couple of cells, so on a long thin grid the coarsest level can still be long;
+ * it is solved with conjugate gradients, which take at most one iteration per coarse cell. The
+ * hierarchy is allocated once on construction so repeated solves on the same grid do not touch the
+ * allocator.
+ */
+class MultigridPoissonSolver {
+public:
+  MultigridPoissonSolver(uint32_t dim_x, uint32_t dim_y);
+
+  [[nodiscard]] uint32_t DimX() const { return levels_.front().dim_x; }
+
+  [[nodiscard]] uint32_t DimY() const { return levels_.front().dim_y; }
+
+  [[nodiscard]] uint32_t NumLevels() const { return (uint32_t) levels_.size(); }
+
+  // Split the work on each level across the pool's threads. nullptr runs serially.
+  void SetThreadPool(ThreadPool *thread_pool);
+
+  /*
+   * One full multigrid pass. pressure is overwritten with the estimate, which is a good starting
+   * point for Solve() when no previous solution is available.
+   */
+  void FullMultigrid(const Field2D &divergence, Field2D &pressure);
+
+  /*
+   * Run V-cycles from the initial guess in pressure until the relative residual drops below
+   * tolerance or max_v_cycles have been run.
+   */
+  PoissonSolverStats Solve(const Field2D &divergence,
+                           Field2D &pressure,
+                           float tolerance,
+                           uint32_t max_v_cycles);
+
+private:
+  struct Level {
+    uint32_t dim_x;
+    uint32_t dim_y;
+    // Grid spacing squared
+    float h2;
+    // Ghost extrapolation factors: ring value = -k * adjacent interior value
+    float k_left;
+    float k_right;
+    float k_bottom;
+    float k_top;
+    // Diagonal of the operator scaled by h^2 (4 away from the boundary)
+    std::vector<float> diag;
+    // Solution, right hand side and residual
+    std::vector<float> u;
+    std::vector<float> f;
+    std::vector<float> r;
+  };
+
+  void LoadRightHandSide(const Field2D &divergence);
+
+  void StoreSolution(Field2D &pressure) const;
+
+  double RelativeResidual(double rhs_norm);
+
+  void Smooth(Level &level, uint32_t num_sweeps);
+
+  void ComputeResidual(Level &level);
+
+  void Restrict(const std::vector<float> &fine_values, const Level &fine, std::vector<float> &coarse_values,
+                const Level &coarse);
+
+  static void FillGhosts(Level &level);
+
+  void Prolong(Level &coarse, Level &fine, bool add);
+
+  // diag * u - neighbours = -h^2 f on the coarsest level, by conjugate gradients from u
+  void SolveCoarsest(Level &level);
+
+  void VCycle(uint32_t level_idx);
+
+  std::vector<Level> levels_;
+  // Search direction and operator times it for SolveCoarsest()
+  std::vector<float> coarse_direction_;
+  std::vector<float> coarse_product_;
+  ThreadPool *thread_pool_;
+};
+
+#endif // MULTIGRID_POISSON_SOLVER_H
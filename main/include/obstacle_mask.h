@@ -0,0 +1,168 @@
+#ifndef OBSTACLE_MASK_H
+#define OBSTACLE_MASK_H
+
+#include "field_2d.h"
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Which cells of a width * height interior are solid, one bit per cell. Each row is a whole number
+ * of 64 bit words, cell x of a row being bit x % 64 of word x / 64.
+ *
+ * Version() changes whenever a cell changes, so that users can tell when to rebuild anything they
+ * derived from the mask.
+ */
+class ObstacleMask {
+public:
+  ObstacleMask();
+
+  ObstacleMask(uint32_t width, uint32_t height);
+
+  [[nodiscard]] uint32_t Width() const { return width_; }
+
+  [[nodiscard]] uint32_t Height() const { return height_; }
+
+  [[nodiscard]] inline bool IsSolid(int32_t x, int32_t y) const {
+    assert(x >= 0 && x < (int32_t) width_ && y >= 0 && y < (int32_t) height_);
+    return (bits_[(size_t) y * words_per_row_ + (uint32_t) x / 64] >> ((uint32_t) x % 64)) & 1u;
+  }
+
+  // The words of row y
+  [[nodiscard]] inline const uint64_t *Row(int32_t y) const { return bits_.data() + (size_t) y * words_per_row_; }
+
+  void Set(int32_t x, int32_t y, bool solid);
+
+  void Clear();
+
+  [[nodiscard]] uint32_t NumSolid() const { return num_solid_; }
+
+  [[nodiscard]] uint64_t Version() const { return version_; }
+
+private:
+  uint32_t width_;
+  uint32_t height_;
+  uint32_t words_per_row_;
+  uint32_t num_solid_;
+  uint64_t version_;
+  std::vector<uint64_t> bits_;
+};
+
+// Cells [x_begin, x_end) of a row
+struct CellRun {
+  int32_t x_begin;
+  int32_t x_end;
+};
+
+/*
+ * The fluid cells of an ObstacleMask as runs along each row, which the kernels below walk instead
+ * of testing every cell, and the solid cells that border the fluid, which carry the boundary
+ * values at obstacle faces. Both are built once per mask change.
+ *
+ * At an obstacle face the scalars have zero gradient and the velocity has no normal component, as
+ * at the walls: a boundary cell holds the mean of its fluid neighbours for a scalar, zero for a
+ * velocity component along which it has a fluid neighbour, and the mean of its other fluid
+ * neighbours for the tangential one. Pressure in solid cells stays zero, as in the wall halo.
+ *
+ * A cell with fluid on opposite sides, as in a wall one cell thick, would pass values from one
+ * side to the other through those means, so it leaves that pair out of them. With no neighbour
+ * left it holds zero, which keeps the sides apart at the cost of a fixed value at the face.
+ */
+class FluidRegion {
+public:
+  FluidRegion();
+
+  explicit FluidRegion(const ObstacleMask &mask);
+
+  [[nodiscard]] uint32_t Width() const { return width_; }
+
+  [[nodiscard]] uint32_t Height() const { return height_; }
+
+  // Runs of fluid cells in row y, left to right
+  [[nodiscard]] inline const CellRun *RunsBegin(int32_t y) const { return runs_.data() + row_runs_[y]; }
+
+  [[nodiscard]] inline const CellRun *RunsEnd(int32_t y) const { return runs_.data() + row_runs_[y + 1]; }
+
+  [[nodiscard]] size_t NumBoundaryCells() const { return boundary_cells_.size(); }
+
+  // Zero every solid cell of the field
+  void ClearSolid(Field2D &field) const;
+
+  void ApplyScalarBoundary(Field2D &field) const;
+
+  void ApplyVelocityBoundary(Field2D &velocity_x, Field2D &velocity_y) const;
+
+private:
+  // A solid cell with at least one fluid neighbour
+  struct BoundaryCell {
+    int32_t x;
+    int32_t y;
+    // Which neighbours are fluid: left, right, below and above as bits 0 to 3
+    uint32_t fluid_neighbours;
+    // The fluid neighbours whose opposite neighbour is solid, which the means are taken over
+    uint32_t mean_neighbours;
+    // 1 / the number of mean_neighbours, or 0 with none
+    float inv_mean;
+  };
+
+  [[nodiscard]] inline const CellRun *SolidRunsBegin(int32_t y) const {
+    return solid_runs_.data() + row_solid_runs_[y];
+  }
+
+  [[nodiscard]] inline const CellRun *SolidRunsEnd(int32_t y) const {
+    return solid_runs_.data() + row_solid_runs_[y + 1];
+  }
+
+  uint32_t width_;
+  uint32_t height_;
+  // Runs of row y are runs_[row_runs_[y]] to runs_[row_runs_[y + 1] - 1]
+  std::vector<uint32_t> row_runs_;
+  std::vector<CellRun> runs_;
+  // Solid runs, for ClearSolid()
+  std::vector<uint32_t> row_solid_runs_;
+  std::vector<CellRun> solid_runs_;
+  std::vector<BoundaryCell> boundary_cells_;
+};
+
+/*
+ * The stencils of GridFluidSimulator over the fluid runs of rows [y_begin, y_end) only, with the
+ * same arithmetic per cell as the kernels in grid_kernels.h. Solid cells are neither read as
+ * stencil centres nor written, so they keep their boundary values.
+ */
+
+// Red-black SOR half sweep. Returns the sum of squared Gauss-Seidel corrections.
+double RedBlackSorRuns(const FluidRegion &region,
+                       const Field2D &rhs,
+                       float rhs_weight,
+                       float neighbour_weight,
+                       float omega,
+                       uint32_t colour,
+                       int32_t y_begin,
+                       int32_t y_end,
+                       Field2D &u);
+
+// Jacobi pressure sweep from pressure into next. Returns the sum of squared changes.
+double JacobiRuns(const FluidRegion &region,
+                  const Field2D &divergence,
+                  const Field2D &pressure,
+                  int32_t y_begin,
+                  int32_t y_end,
+                  Field2D &next);
+
+void DivergenceRuns(const FluidRegion &region,
+                    const Field2D &velocity_x,
+                    const Field2D &velocity_y,
+                    int32_t y_begin,
+                    int32_t y_end,
+                    Field2D &divergence);
+
+// Subtract the pressure gradient. Returns the largest |component| left in the fluid.
+double ProjectRuns(const FluidRegion &region,
+                   const Field2D &pressure,
+                   int32_t y_begin,
+                   int32_t y_end,
+                   Field2D &velocity_x,
+                   Field2D &velocity_y);
+
+#endif // OBSTACLE_MASK_H
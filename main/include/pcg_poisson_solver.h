@@ -0,0 +1,64 @@
+#ifndef PCG_POISSON_SOLVER_H
+#define PCG_POISSON_SOLVER_H
+
+#include "field_2d.h"
+#include "poisson_solver_stats.h"
+#include "thread_pool.h"
+
+#include <cstdint>
+
+/*
+ * Conjugate gradient solver for the pressure Poisson equation, preconditioned with modified
+ * incomplete Cholesky, MIC(0). Solves the same system as MultigridPoissonSolver:
+ *   p(x-1,y) + p(x+1,y) + p(x,y-1) + p(x,y+1) - 4p(x,y) = divergence(x,y)
+ * over the interior of a dim_x * dim_y grid, with p = 0 on the outer ring of cells.
+ *
+ * Fields are (dim_x - 2) * (dim_y - 2) with a one cell halo standing in for the ring.
+ * The 5-point matrix is never stored; only the preconditioner diagonal is kept. Work fields
+ * are allocated once on construction.
+ */
+class PcgPoissonSolver {
+public:
+  PcgPoissonSolver(uint32_t dim_x, uint32_t dim_y);
+
+  [[nodiscard]] uint32_t DimX() const { return dim_x_; }
+
+  [[nodiscard]] uint32_t DimY() const { return dim_y_; }
+
+  /*
+   * Split each step across the pool's threads. nullptr runs serially. With more than one band
+   * the preconditioner is factorised per band, which costs a few extra iterations.
+   */
+  void SetThreadPool(ThreadPool *thread_pool);
+
+  /*
+   * Iterate from the initial guess in pressure until the relative residual drops below tolerance
+   * or max_iterations is reached.
+   */
+  PoissonSolverStats Solve(const Field2D &divergence,
+                           Field2D &pressure,
+                           float tolerance,
+                           uint32_t max_iterations);
+
+private:
+  void ComputePreconditioner();
+
+  void ApplyPreconditioner(const Field2D &r, Field2D &z);
+
+  void ApplyMatrix(const Field2D &s, Field2D &z) const;
+
+  float TrueResidual(const Field2D &divergence, const Field2D &pressure, double rhs_norm);
+
+  [[nodiscard]] double Dot(const Field2D &a, const Field2D &b) const;
+
+  uint32_t dim_x_;
+  uint32_t dim_y_;
+  Field2D precon_;
+  Field2D residual_;
+  Field2D aux_;
+  Field2D search_;
+  Field2D temp_;
+  ThreadPool *thread_pool_;
+};
+
+#endif // PCG_POISSON_SOLVER_H
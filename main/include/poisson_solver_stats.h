@@ -0,0 +1,14 @@
+#ifndef POISSON_SOLVER_STATS_H
+#define POISSON_SOLVER_STATS_H
+
+#include <cstdint>
+
+/*
+ * Outcome of a single pressure solve. residual is ||b - Ax|| / ||b||.
+ */
+struct PoissonSolverStats {
+  uint32_t iterations;
+  float residual;
+};
+
+#endif // POISSON_SOLVER_STATS_H
@@ -0,0 +1,114 @@
+#ifndef PRECISION_GRID_SIMULATOR_H
+#define PRECISION_GRID_SIMULATOR_H
+
+#include "field_2d.h"
+#include "fluid_simulator_2d.h"
+#include "poisson_solver_stats.h"
+#include "precision_policy.h"
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+ * GridFluidSimulator with walls and the red-black SOR pressure solver, with the fields stored as
+ * Policy::Storage and every stage computed in Policy::Compute (see precision_policy.h).
+ *
+ * When the two types differ, each stencil converts a chunk of every row it reads as it loads it
+ * and converts its results back as it stores them, so sweeps move Storage-sized cells through
+ * memory. With SinglePrecision the result matches GridFluidSimulator with the scalar advection
+ * kernel exactly.
+ *
+ * The field views still hand out floats. Instantiated for DoublePrecision, SinglePrecision and
+ * HalfStorage.
+ */
+template<typename Policy>
+class PrecisionGridSimulator : public FluidSimulator2D {
+public:
+  using Storage = typename Policy::Storage;
+  using Compute = typename Policy::Compute;
+
+  PrecisionGridSimulator(uint32_t width,      //
+                         uint32_t height,     //
+                         float delta_t,       //
+                         float diffusion_rate //
+  );
+
+  void Simulate() override;
+
+  [[nodiscard]] const std::vector<float> &Density() const override;
+
+  [[nodiscard]] const std::vector<float> &VelocityX() const override;
+
+  [[nodiscard]] const std::vector<float> &VelocityY() const override;
+
+  void AddDensity(uint32_t x, uint32_t y, float amount) override;
+
+  /*
+   * Solves stop once the relative residual estimate is below tolerance. An iteration is a red and
+   * a black sweep. The default is GridFluidSimulator's, or Policy::MinTolerance() if that is larger.
+   */
+  void SetPressureTolerance(float tolerance);
+
+  void SetMaxPressureIterations(uint32_t max_iterations);
+
+  // Threads used by every stage, including the calling thread. 0 means one per hardware thread.
+  void SetNumThreads(uint32_t num_threads);
+
+  [[nodiscard]] uint32_t NumThreads() const { return thread_pool_->NumThreads(); }
+
+  // Iterations and relative residual of the most recent pressure solve
+  [[nodiscard]] const PoissonSolverStats &LastPressureSolve() const { return last_pressure_solve_; }
+
+private:
+  using Field = BasicField2D<Storage>;
+
+  void ProcessStoredSources();
+
+  void Diffuse(const Field &current, Field &next);
+
+  void AdvectFields();
+
+  void SuppressDivergence();
+
+  void ComputeDivergence(Field &divergence);
+
+  PoissonSolverStats ComputePressure(const Field &divergence, Field &pressure);
+
+  double RedBlackSorSweep(const Field &rhs,
+                          Compute rhs_weight,
+                          Compute neighbour_weight,
+                          Compute omega,
+                          uint32_t colour,
+                          Field &u);
+
+  double Norm(const Field &field) const;
+
+  void CorrectBoundaryDensities(Field &densities) const;
+
+  void CorrectBoundaryVelocities(Field &velocity_x, Field &velocity_y) const;
+
+  float delta_t_;
+  float diffusion_rate_;
+  float pressure_tolerance_;
+  uint32_t max_pressure_iterations_;
+  float pressure_omega_;
+  PoissonSolverStats last_pressure_solve_;
+  std::unique_ptr<ThreadPool> thread_pool_;
+  Field stored_density_;
+  Field stored_velocity_x_;
+  Field stored_velocity_y_;
+  // Pressure solution, kept between steps as the next initial guess
+  Field pressure_;
+  // Step workspace
+  Field divergence_;
+  Field temp_density_;
+  Field temp_velocity_x_;
+  Field temp_velocity_y_;
+  mutable std::vector<float> density_view_;
+  mutable std::vector<float> velocity_x_view_;
+  mutable std::vector<float> velocity_y_view_;
+};
+
+#endif // PRECISION_GRID_SIMULATOR_H
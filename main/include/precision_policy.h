@@ -0,0 +1,142 @@
+#ifndef PRECISION_POLICY_H
+#define PRECISION_POLICY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * Floating point precision of a simulator: the type its fields are stored in and the type its
+ * kernels compute in. Rows are converted from Storage to Compute as they are loaded and back as
+ * they are stored, so a narrower storage type cuts the memory traffic of every sweep without
+ * changing the arithmetic.
+ *
+ * MinTolerance() is about the smallest relative residual an iterative solve can get to before
+ * the rounding of stored values stops it improving.
+ */
+
+// Storage and arithmetic in double, for long runs where rounding error builds up
+struct DoublePrecision {
+  using Storage = double;
+  using Compute = double;
+
+  static const char *Name() { return "double"; }
+
+  static float MinTolerance() { return 1e-10f; }
+};
+
+// Storage and arithmetic in float, as GridFluidSimulator
+struct SinglePrecision {
+  using Storage = float;
+  using Compute = float;
+
+  static const char *Name() { return "float"; }
+
+  static float MinTolerance() { return 1e-5f; }
+};
+
+struct Half;
+
+// Fields stored as IEEE half precision and computed in float, for bandwidth bound runs
+struct HalfStorage {
+  using Storage = Half;
+  using Compute = float;
+
+  static const char *Name() { return "half"; }
+
+  static float MinTolerance() { return 3e-3f; }
+};
+
+/*
+ * Nearest IEEE binary16 value to f, ties to even. Values beyond the half range become infinity.
+ */
+inline uint16_t FloatToHalfBits(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  auto sign = (uint16_t) ((x >> 16) & 0x8000u);
+  auto abs = x & 0x7fffffffu;
+  if (abs >= 0x7f800000u) {
+    // Infinity stays infinity, NaN stays a quiet NaN
+    return (uint16_t) (sign | 0x7c00u | (abs > 0x7f800000u ? 0x200u : 0u));
+  }
+  if (abs >= 0x477ff000u) {
+    // At or above 65520, halfway between the largest half and the next power of two
+    return (uint16_t) (sign | 0x7c00u);
+  }
+  if (abs < 0x38800000u) {
+    // Below the smallest normal half; at most half the smallest subnormal rounds to zero
+    if (abs <= 0x33000000u) {
+      return sign;
+    }
+    auto shift = 126u - (abs >> 23);
+    auto mantissa = (abs & 0x7fffffu) | 0x800000u;
+    auto result = mantissa >> shift;
+    auto remainder = mantissa & ((1u << shift) - 1u);
+    auto halfway = 1u << (shift - 1u);
+    if (remainder > halfway || (remainder == halfway && (result & 1u))) {
+      ++result;
+    }
+    return (uint16_t) (sign | result);
+  }
+  // Rebias the exponent from 127 to 15 and round off 13 mantissa bits. A carry out of the mantissa
+  // correctly moves up to the next exponent.
+  auto result = (abs - 0x38000000u) >> 13;
+  auto remainder = abs & 0x1fffu;
+  if (remainder > 0x1000u || (remainder == 0x1000u && (result & 1u))) {
+    ++result;
+  }
+  return (uint16_t) (sign | result);
+}
+
+inline float HalfBitsToFloat(uint16_t h) {
+  auto sign = (uint32_t) (h & 0x8000u) << 16;
+  auto exponent = (uint32_t) (h >> 10) & 0x1fu;
+  auto mantissa = (uint32_t) h & 0x3ffu;
+  uint32_t x;
+  if (exponent == 0x1fu) {
+    x = sign | 0x7f800000u | (mantissa << 13);
+  } else if (exponent != 0) {
+    x = sign | ((exponent + 112u) << 23) | (mantissa << 13);
+  } else if (mantissa == 0) {
+    x = sign;
+  } else {
+    // Subnormal: mantissa units of 2^-24, exact in float
+    auto value = (float) mantissa * 5.9604644775390625e-8f;
+    std::memcpy(&x, &value, sizeof(x));
+    x |= sign;
+  }
+  float f;
+  std::memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+/*
+ * An IEEE binary16 value. Only for storage: it converts to float for any arithmetic, and must be
+ * constructed explicitly from a float since that rounds.
+ */
+struct Half {
+  uint16_t bits;
+
+  Half() = default;
+
+  explicit Half(float value) : bits{FloatToHalfBits(value)} {}
+
+  operator float() const { return HalfBitsToFloat(bits); }
+};
+
+/*
+ * Convert n values between storage and compute types. Same-type and float/double conversions
+ * are plain loops the compiler vectorises; half/float conversions use F16C when the CPU has it.
+ */
+template<typename From, typename To>
+inline void ConvertRow(const From *src, To *dst, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    dst[i] = (To) src[i];
+  }
+}
+
+void ConvertRow(const Half *src, float *dst, size_t n);
+
+void ConvertRow(const float *src, Half *dst, size_t n);
+
+#endif // PRECISION_POLICY_H
@@ -0,0 +1,106 @@
+#ifndef RED_BLACK_SOR_H
+#define RED_BLACK_SOR_H
+
+#include "field_2d.h"
+#include "thread_pool.h"
+#include "tiled_field_2d.h"
+
+#include <cstdint>
+
+/*
+ * Over-relaxation factor that minimises the SOR spectral radius for the 5-point Poisson problem
+ * with Dirichlet boundaries on a width * height interior. Close to optimal for Neumann walls too.
+ */
+float OptimalSorOmega(uint32_t width, uint32_t height);
+
+/*
+ * The cells of one colour in a row of a red-black sweep, which sit at every other x from parity.
+ * Written as a unit-stride loop over pairs of cells with the neighbour rows marked as not
+ * aliasing the row being updated, so the compiler can vectorise it with interleaved loads.
+ * Squared corrections for the row are summed in T and returned as double.
+ *
+ * T is float or double. Width is int32_t, or a std::integral_constant when the row length is
+ * known at compile time.
+ */
+template<typename T, typename Width>
+inline double RedBlackSorRow(const T *__restrict below,
+                             T *row,
+                             const T *__restrict above,
+                             const T *__restrict rhs,
+                             Width width,
+                             int32_t parity,
+                             T rhs_weight,
+                             T neighbour_weight,
+                             T omega) {
+  // Independent of parity for even widths, which makes it a constant for a fixed one
+  auto num_cells = (width % 2 == 0) ? width / 2 : (width - parity + 1) / 2;
+  auto *cells = row + parity;
+  const auto *cells_below = below + parity;
+  const auto *cells_above = above + parity;
+  const auto *cells_rhs = rhs + parity;
+  auto change_sq = T(0);
+  for (auto i = 0; i < num_cells; ++i) {
+    auto gs = rhs_weight * cells_rhs[2 * i]
+              + neighbour_weight * (cells[2 * i - 1] + cells[2 * i + 1] + cells_below[2 * i] + cells_above[2 * i]);
+    auto delta = gs - cells[2 * i];
+    cells[2 * i] += omega * delta;
+    change_sq += delta * delta;
+  }
+  return change_sq;
+}
+
+/*
+ * One colour of a red-black successive over-relaxation sweep for systems of the form
+ *   u(x,y) = rhs_weight * rhs(x,y) + neighbour_weight * [u(x-1,y) + u(x+1,y) + u(x,y-1) + u(x,y+1)]
+ * Only cells with (x + y) % 2 == colour are updated, each moving omega of the way to its
+ * Gauss-Seidel value; omega = 1 is plain Gauss-Seidel. Cells of one colour only read cells of the
+ * other, so rows are split across the pool and each row is a branch-free stride-2 loop.
+ *
+ * The halo of u supplies the boundary values and is not written.
+ *
+ * Returns the sum of squared Gauss-Seidel corrections over the updated cells.
+ */
+double RedBlackSorSweep(ThreadPool *thread_pool,
+                        const Field2D &rhs,
+                        float rhs_weight,
+                        float neighbour_weight,
+                        float omega,
+                        uint32_t colour,
+                        Field2D &u);
+
+/*
+ * num_iterations red-black iterations, each a colour 0 and a colour 1 sweep followed by
+ * u.FillHalo(x_edge_factor, y_edge_factor), with the same result as running them one sweep at a
+ * time.
+ *
+ * The rows are cut into tiles that fit in L2 and several iterations are run on a tile before
+ * moving on (trapezoidal temporal blocking). Each half sweep a tile gives up a row at each edge it
+ * shares with another tile; inverted triangles over the edges then catch those rows up. Because a
+ * half sweep only reads the other colour, rows one sweep ahead of their neighbours are still
+ * read correctly, so u can be updated in place.
+ */
+void RedBlackSorTiled(ThreadPool *thread_pool,
+                      const Field2D &rhs,
+                      float rhs_weight,
+                      float neighbour_weight,
+                      float omega,
+                      uint32_t num_iterations,
+                      float x_edge_factor,
+                      float y_edge_factor,
+                      Field2D &u);
+
+/*
+ * RedBlackSorSweep over the active tiles of a TiledField2D. Each tile reads its neighbours through
+ * its ring, so u.ExchangeHalo() must run between half sweeps. The colouring is by interior
+ * coordinates, so with every tile active the result matches RedBlackSorSweep on a Field2D.
+ */
+double RedBlackSorSweep(ThreadPool *thread_pool,
+                        const TileMap &tile_map,
+                        const TiledField2D &rhs,
+                        float rhs_weight,
+                        float neighbour_weight,
+                        float omega,
+                        uint32_t colour,
+                        TiledField2D &u);
+
+#endif // RED_BLACK_SOR_H
@@ -0,0 +1,147 @@
+#ifndef SEMI_LAGRANGIAN_ADVECTOR_H
+#define SEMI_LAGRANGIAN_ADVECTOR_H
+
+#include "field_2d.h"
+#include "obstacle_mask.h"
+#include "tiled_field_2d.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Semi-Lagrangian advection of a cell-centred scalar through a cell-centred velocity field.
+ * Each cell is traced back along its velocity for one time step and the source field is
+ * bilinearly interpolated at the departure point, which is clamped to the centres of the
+ * first halo layer. Along a periodic axis the departure point is wrapped back into the interior
+ * instead, and the halo must have been filled from the opposite edge.
+ *
+ * The kernel is vectorised for SSE4.2, AVX2 and AVX-512 on x86-64 and picked at runtime from
+ * the features the CPU reports. Other targets use the scalar kernel. Kernels agree to within
+ * floating point rounding.
+ *
+ * The sources can also be read from tiled copies (see AdvectRowsTiled()), which keeps the cells of
+ * a stencil close together when departure points lie rows away.
+ */
+class SemiLagrangianAdvector {
+public:
+  enum Isa {
+    SCALAR,
+    SSE42,
+    AVX2,
+    AVX512
+  };
+
+  // Use the widest kernel the CPU supports
+  SemiLagrangianAdvector();
+
+  // Use a specific kernel. Throws if the CPU does not support it.
+  explicit SemiLagrangianAdvector(Isa isa);
+
+  [[nodiscard]] static Isa DetectIsa();
+
+  [[nodiscard]] static const char *IsaName(Isa isa);
+
+  [[nodiscard]] Isa GetIsa() const { return isa_; }
+
+  // Which axes wrap around
+  struct Periodicity {
+    bool x;
+    bool y;
+  };
+
+  // Periodic along both axes or neither
+  void SetPeriodic(bool periodic);
+
+  void SetPeriodic(bool periodic_x, bool periodic_y);
+
+  [[nodiscard]] const Periodicity &GetPeriodicity() const { return periodic_; }
+
+  // A field to advect and the field that receives the result
+  struct Target {
+    const Field2D *source;
+    Field2D *destination;
+  };
+
+  /*
+   * destination(x, y) = source(departure point of (x, y)) for every interior cell. All fields
+   * must have the same shape and a halo of at least one cell that has already been filled.
+   * The destination halo is not written.
+   */
+  void Advect(const Field2D &velocity_x,
+              const Field2D &velocity_y,
+              float delta_t,
+              const Field2D &source,
+              Field2D &destination) const;
+
+  /*
+   * Advect several fields through the same velocity in one pass. Each cell's departure point
+   * and interpolation weights are computed once and applied to every target. Destinations must
+   * not alias a source or the velocity fields.
+   */
+  void Advect(const Field2D &velocity_x,
+              const Field2D &velocity_y,
+              float delta_t,
+              const Target *targets,
+              size_t num_targets) const;
+
+  // Advect rows [y_begin, y_end) only. Bands of rows can be advected concurrently.
+  void AdvectRows(const Field2D &velocity_x,
+                  const Field2D &velocity_y,
+                  float delta_t,
+                  const Target *targets,
+                  size_t num_targets,
+                  int32_t y_begin,
+                  int32_t y_end) const;
+
+  // A tiled copy of a field to advect and the field that receives the result
+  struct TiledTarget {
+    const TiledField2D *source;
+    Field2D *destination;
+  };
+
+  /*
+   * As AdvectRows, with the stencils read from tiled copies of the sources. Every tile of the map
+   * must be active and the copies' rings must hold the halo and neighbouring cells, as
+   * TiledField2D::CopyFrom() of a Field2D leaves them. Always uses the scalar kernel, whose
+   * result it matches exactly.
+   */
+  void AdvectRowsTiled(const Field2D &velocity_x,
+                       const Field2D &velocity_y,
+                       float delta_t,
+                       const TileMap &tile_map,
+                       const TiledTarget *targets,
+                       size_t num_targets,
+                       int32_t y_begin,
+                       int32_t y_end) const;
+
+  /*
+   * As AdvectRows, for the fluid runs of each row only. Cells outside the runs are not written;
+   * departure points may still land in them, so they should hold boundary values.
+   */
+  void AdvectRuns(const Field2D &velocity_x,
+                  const Field2D &velocity_y,
+                  float delta_t,
+                  const FluidRegion &region,
+                  const Target *targets,
+                  size_t num_targets,
+                  int32_t y_begin,
+                  int32_t y_end) const;
+
+private:
+  // Advects cells [x_begin, x_end) of row y
+  using RowKernel = void (*)(const float *velocity_x,
+                             const float *velocity_y,
+                             int32_t y,
+                             float delta_t,
+                             const Target *targets,
+                             size_t num_targets,
+                             Periodicity periodic,
+                             int32_t x_begin,
+                             int32_t x_end);
+
+  Isa isa_;
+  Periodicity periodic_;
+  RowKernel kernel_;
+};
+
+#endif // SEMI_LAGRANGIAN_ADVECTOR_H
@@ -0,0 +1,125 @@
+#ifndef SPARSE_GRID_SIMULATOR_H
+#define SPARSE_GRID_SIMULATOR_H
+
+#include "fluid_simulator_2d.h"
+#include "poisson_solver_stats.h"
+#include "thread_pool.h"
+#include "tiled_field_2d.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+ * GridFluidSimulator with the red-black SOR pressure solver, storing and simulating only the
+ * tiles where something is happening.
+ *
+ * The interior is cut into TILE_SIZE * TILE_SIZE tiles. A tile is busy while its density or the
+ * distance its fluid moves in a step exceeds a threshold somewhere, or it holds a source. Busy
+ * tiles keep the tiles around them active, as far as the fastest cell can cross in a step plus
+ * one. Every stage runs over the active tiles only; everywhere else the fields are zero, which
+ * the pressure solve treats like the walls. Memory and time per step therefore follow the size
+ * of the plume rather than of the grid, apart from a few bytes of tile table per tile of the grid.
+ *
+ * With every tile active and a fixed number of pressure iterations the fields are those of
+ * GridFluidSimulator with red-black SOR and scalar advection. Under a tolerance the residual
+ * estimates are summed in a different order, so the two solves may stop an iteration apart.
+ */
+class SparseGridSimulator : public FluidSimulator2D {
+public:
+  SparseGridSimulator(uint32_t width,      //
+                      uint32_t height,     //
+                      float delta_t,       //
+                      float diffusion_rate //
+  );
+
+  void Simulate() override;
+
+  [[nodiscard]] const std::vector<float> &Density() const override;
+
+  [[nodiscard]] const std::vector<float> &VelocityX() const override;
+
+  [[nodiscard]] const std::vector<float> &VelocityY() const override;
+
+  void AddDensity(uint32_t x, uint32_t y, float amount) override;
+
+  /*
+   * Tiles are retired once no cell's density exceeds density_threshold and no cell moves more than
+   * velocity_threshold cells per step along either axis. A negative threshold makes every tile active
+   * from the next step on.
+   */
+  void SetActivityThresholds(float density_threshold, float velocity_threshold);
+
+  // Solves stop once the relative residual estimate is below tolerance. An iteration is a red
+  // and a black sweep.
+  void SetPressureTolerance(float tolerance);
+
+  void SetMaxPressureIterations(uint32_t max_iterations);
+
+  // Threads used by every stage, including the calling thread. 0 means one per hardware thread.
+  void SetNumThreads(uint32_t num_threads);
+
+  [[nodiscard]] uint32_t NumThreads() const { return thread_pool_->NumThreads(); }
+
+  // Iterations and relative residual of the most recent pressure solve
+  [[nodiscard]] const PoissonSolverStats &LastPressureSolve() const { return last_pressure_solve_; }
+
+  [[nodiscard]] uint32_t NumActiveTiles() const { return (uint32_t) tile_map_.ActiveTiles().size(); }
+
+  // Tiles held by each field's pool
+  [[nodiscard]] uint32_t NumAllocatedTiles() const { return (uint32_t) tile_map_.NumSlots(); }
+
+private:
+  int32_t ActivateTile(int32_t tile);
+
+  void UpdateActiveTiles();
+
+  void ProcessTiledSources();
+
+  void Diffuse(const TiledField2D &current, TiledField2D &next);
+
+  void AdvectFields();
+
+  void SuppressDivergence();
+
+  void ComputeDivergence(TiledField2D &divergence);
+
+  PoissonSolverStats ComputePressure(const TiledField2D &divergence, TiledField2D &pressure);
+
+  double Norm(const TiledField2D &field) const;
+
+  void CorrectBoundaryDensities(TiledField2D &densities) const;
+
+  void CorrectBoundaryVelocities(TiledField2D &velocity_x, TiledField2D &velocity_y) const;
+
+  float delta_t_;
+  float diffusion_rate_;
+  float density_threshold_;
+  float velocity_threshold_;
+  float pressure_tolerance_;
+  uint32_t max_pressure_iterations_;
+  float pressure_omega_;
+  PoissonSolverStats last_pressure_solve_;
+  std::unique_ptr<ThreadPool> thread_pool_;
+  TileMap tile_map_;
+  TiledField2D tiled_density_;
+  TiledField2D tiled_velocity_x_;
+  TiledField2D tiled_velocity_y_;
+  // Pressure solution, kept between steps as the next initial guess. Zero outside the interior.
+  TiledField2D pressure_;
+  // Step workspace
+  TiledField2D divergence_;
+  TiledField2D temp_density_;
+  TiledField2D temp_velocity_x_;
+  TiledField2D temp_velocity_y_;
+  // Per active tile results of the activity scan, and the tiles wanted for the next step
+  std::vector<uint8_t> tile_is_busy_;
+  std::vector<float> tile_max_speed_;
+  std::vector<uint8_t> tile_is_wanted_;
+  std::vector<int32_t> wanted_tiles_;
+  mutable std::vector<float> density_view_;
+  mutable std::vector<float> velocity_x_view_;
+  mutable std::vector<float> velocity_y_view_;
+};
+
+#endif // SPARSE_GRID_SIMULATOR_H
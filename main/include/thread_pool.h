@@ -0,0 +1,138 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * A fixed set of worker threads for splitting row loops into contiguous bands. The calling
+ * thread always runs the first band itself, so a pool of one thread runs everything inline.
+ *
+ * Dispatch does not allocate. Only one loop runs at a time; bodies must not throw or start
+ * another loop on the same pool.
+ */
+class ThreadPool {
+public:
+  // num_threads counts the calling thread; 0 means one per hardware thread
+  explicit ThreadPool(uint32_t num_threads);
+
+  ThreadPool(const ThreadPool &) = delete;
+
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  ~ThreadPool();
+
+  [[nodiscard]] uint32_t NumThreads() const { return (uint32_t) workers_.size() + 1; }
+
+  /*
+   * Run body(band_begin, band_end) over contiguous bands covering rows [begin, end). row_cells
+   * is the work per row; bands are kept large enough that dispatch costs little next to the
+   * work, so small loops run inline in a single band.
+   */
+  template<typename Body>
+  void ParallelFor(int32_t begin, int32_t end, uint32_t row_cells, const Body &body) {
+    Run(begin, end, NumBands(end - begin, row_cells), &ForBand<Body>, &body);
+  }
+
+  /*
+   * As ParallelFor, where body returns a partial sum for its band. The partial sums are added
+   * in band order.
+   */
+  template<typename Body>
+  double ParallelSum(int32_t begin, int32_t end, uint32_t row_cells, const Body &body) {
+    auto num_bands = NumBands(end - begin, row_cells);
+    Run(begin, end, num_bands, &ReduceBand<Body>, &body);
+    auto sum = 0.0;
+    for (auto band = 0u; band < num_bands; ++band) {
+      sum += band_results_[band];
+    }
+    return sum;
+  }
+
+  /*
+   * As ParallelFor, where body returns a non-negative maximum for its band. Returns the largest,
+   * or 0 for an empty range.
+   */
+  template<typename Body>
+  double ParallelMax(int32_t begin, int32_t end, uint32_t row_cells, const Body &body) {
+    auto num_bands = NumBands(end - begin, row_cells);
+    Run(begin, end, num_bands, &ReduceBand<Body>, &body);
+    auto max = 0.0;
+    for (auto band = 0u; band < num_bands; ++band) {
+      max = std::max(max, band_results_[band]);
+    }
+    return max;
+  }
+
+private:
+  using BandFunction = void (*)(ThreadPool &pool, const void *body, uint32_t band, int32_t begin, int32_t end);
+
+  template<typename Body>
+  static void ForBand(ThreadPool &, const void *body, uint32_t, int32_t begin, int32_t end) {
+    (*static_cast<const Body *>(body))(begin, end);
+  }
+
+  template<typename Body>
+  static void ReduceBand(ThreadPool &pool, const void *body, uint32_t band, int32_t begin, int32_t end) {
+    pool.band_results_[band] = (*static_cast<const Body *>(body))(begin, end);
+  }
+
+  [[nodiscard]] uint32_t NumBands(int32_t num_rows, uint32_t row_cells) const;
+
+  void Run(int32_t begin, int32_t end, uint32_t num_bands, BandFunction function, const void *body);
+
+  void RunBand(uint32_t band);
+
+  void WorkerLoop(uint32_t band);
+
+  std::vector<std::thread> workers_;
+  // Partial result of each band of a reduction
+  std::vector<double> band_results_;
+  std::mutex mutex_;
+  std::condition_variable work_ready_;
+  std::condition_variable work_done_;
+  // Incremented for each loop so that workers can tell a new one has been posted
+  uint64_t generation_;
+  uint32_t bands_pending_;
+  bool stopping_;
+  // The loop being run
+  BandFunction function_;
+  const void *body_;
+  int32_t begin_;
+  int32_t end_;
+  uint32_t num_bands_;
+};
+
+/*
+ * Serial fallbacks for code that may be given no pool
+ */
+template<typename Body>
+void ParallelFor(ThreadPool *pool, int32_t begin, int32_t end, uint32_t row_cells, const Body &body) {
+  if (pool) {
+    pool->ParallelFor(begin, end, row_cells, body);
+  } else if (begin < end) {
+    body(begin, end);
+  }
+}
+
+template<typename Body>
+double ParallelSum(ThreadPool *pool, int32_t begin, int32_t end, uint32_t row_cells, const Body &body) {
+  if (pool) {
+    return pool->ParallelSum(begin, end, row_cells, body);
+  }
+  return (begin < end) ? body(begin, end) : 0.0;
+}
+
+template<typename Body>
+double ParallelMax(ThreadPool *pool, int32_t begin, int32_t end, uint32_t row_cells, const Body &body) {
+  if (pool) {
+    return pool->ParallelMax(begin, end, row_cells, body);
+  }
+  return (begin < end) ? body(begin, end) : 0.0;
+}
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,170 @@
+#ifndef TILED_FIELD_2D_H
+#define TILED_FIELD_2D_H
+
+#include "aligned_memory.h"
+#include "field_2d.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Tiles cover TILE_SIZE * TILE_SIZE cells; a tile row is one AVX-512 vector
+const int32_t TILE_SIZE = 16;
+// Each tile is stored with a one cell ring of its neighbours' cells around it
+const int32_t TILE_STRIDE = TILE_SIZE + 2;
+// Floats per tile, rounded up so that every tile starts on a 64 byte boundary
+const uint32_t TILE_FLOATS =
+        (TILE_STRIDE * TILE_STRIDE + FIELD_ALIGNMENT_FLOATS - 1) / FIELD_ALIGNMENT_FLOATS * FIELD_ALIGNMENT_FLOATS;
+
+/*
+ * Which TILE_SIZE * TILE_SIZE tiles of a width * height interior are active, and where their data
+ * lives. Active tiles get a slot, an index into the tile pools of every TiledField2D sharing the
+ * map; slots of retired tiles are reused before new ones are handed out. Tiles along the right and
+ * top of the interior are clipped to it when width or height is not a multiple of TILE_SIZE.
+ *
+ * Tiles are numbered tile_y * TilesX() + tile_x.
+ */
+class TileMap {
+public:
+  TileMap(uint32_t width, uint32_t height);
+
+  [[nodiscard]] uint32_t Width() const { return width_; }
+
+  [[nodiscard]] uint32_t Height() const { return height_; }
+
+  [[nodiscard]] int32_t TilesX() const { return tiles_x_; }
+
+  [[nodiscard]] int32_t TilesY() const { return tiles_y_; }
+
+  [[nodiscard]] int32_t NumTiles() const { return tiles_x_ * tiles_y_; }
+
+  // Tile holding interior cell (x, y)
+  [[nodiscard]] inline int32_t TileAt(int32_t x, int32_t y) const {
+    return (y / TILE_SIZE) * tiles_x_ + x / TILE_SIZE;
+  }
+
+  // Interior coordinates of the first cell of a tile
+  [[nodiscard]] inline int32_t OriginX(int32_t tile) const { return (tile % tiles_x_) * TILE_SIZE; }
+
+  [[nodiscard]] inline int32_t OriginY(int32_t tile) const { return (tile / tiles_x_) * TILE_SIZE; }
+
+  // Cells of the tile inside the interior along x and y
+  [[nodiscard]] inline int32_t ExtentX(int32_t tile) const {
+    return std::min(TILE_SIZE, (int32_t) width_ - OriginX(tile));
+  }
+
+  [[nodiscard]] inline int32_t ExtentY(int32_t tile) const {
+    return std::min(TILE_SIZE, (int32_t) height_ - OriginY(tile));
+  }
+
+  // Slot of an active tile, or -1
+  [[nodiscard]] inline int32_t Slot(int32_t tile) const { return slot_of_tile_[tile]; }
+
+  // Active tiles in ascending order, as of the last Compact()
+  [[nodiscard]] const std::vector<int32_t> &ActiveTiles() const { return active_tiles_; }
+
+  // Slots handed out so far. Fields sharing the map hold this many tiles.
+  [[nodiscard]] int32_t NumSlots() const { return num_slots_; }
+
+  // Give an inactive tile a slot and list it as active. Returns the slot.
+  int32_t Activate(int32_t tile);
+
+  // Free the slot of an active tile. It stays in ActiveTiles() until the next Compact().
+  void Retire(int32_t tile);
+
+  // Drop retired and repeated tiles from ActiveTiles() and sort it, so passes walk memory in order
+  void Compact();
+
+private:
+  uint32_t width_;
+  uint32_t height_;
+  int32_t tiles_x_;
+  int32_t tiles_y_;
+  int32_t num_slots_;
+  std::vector<int32_t> slot_of_tile_;
+  std::vector<int32_t> active_tiles_;
+  std::vector<int32_t> free_slots_;
+};
+
+/*
+ * A scalar field over the interior of a TileMap that only stores its active tiles. Inactive tiles
+ * read as zero.
+ *
+ * Each tile is TILE_STRIDE * TILE_STRIDE floats starting on a 64 byte boundary, with cell (0, 0)
+ * at Tile(slot) and a ring of ghost cells around it. The ring holds copies of the neighbouring
+ * cells, refreshed by ExchangeHalo(), and where it lies outside the interior it holds the
+ * boundary values written by FillBoundary(), just like the halo of a Field2D. Tiles come from a
+ * pool that grows in chunks and is never shrunk, so memory follows the largest number of tiles
+ * active at once.
+ */
+class TiledField2D {
+public:
+  explicit TiledField2D(const TileMap &tile_map);
+
+  TiledField2D(const TiledField2D &) = delete;
+
+  TiledField2D &operator=(const TiledField2D &) = delete;
+
+  ~TiledField2D();
+
+  // Pointer to cell (0, 0) of the tile in slot. Row y starts TILE_STRIDE * y floats further on.
+  [[nodiscard]] inline float *Tile(int32_t slot) {
+    assert(slot >= 0 && slot < (int32_t) tiles_.size());
+    return tiles_[slot];
+  }
+
+  [[nodiscard]] inline const float *Tile(int32_t slot) const {
+    assert(slot >= 0 && slot < (int32_t) tiles_.size());
+    return tiles_[slot];
+  }
+
+  // Grow the pool to cover every slot the map has handed out
+  void Reserve();
+
+  // Zero a tile, ring included
+  void ClearTile(int32_t slot);
+
+  // Copy every active tile, ring included, from a field on the same map
+  void CopyFrom(ThreadPool *thread_pool, const TiledField2D &other);
+
+  /*
+   * Copy every active tile and its ring from a Field2D over the same interior with a one cell
+   * halo, so rings outside the interior get the halo. This turns a row major field into a tiled
+   * one in a single pass.
+   */
+  void CopyFrom(ThreadPool *thread_pool, const Field2D &dense);
+
+  // Copy the cells of neighbouring tiles into the ring of every active tile, zero for inactive ones
+  void ExchangeHalo(ThreadPool *thread_pool);
+
+  /*
+   * Fill the ring cells outside the interior as Field2D::FillHalo does, from the interior and the
+   * ring cells just inside it, so ExchangeHalo() must have run first.
+   */
+  void FillBoundary(float x_edge_factor, float y_edge_factor);
+
+  /*
+   * Value of cell (x, y) for x in [-1, width] and y in [-1, height], the boundary ring included.
+   * Boundary cells are read from the ring of the tile next to them.
+   */
+  [[nodiscard]] float Value(int32_t x, int32_t y) const;
+
+  // Copy the interior plus the boundary ring into a dense (width + 2) * (height + 2) array
+  void CopyTo(std::vector<float> &dense) const;
+
+  // Exchange storage with a field on the same map
+  void Swap(TiledField2D &other) noexcept;
+
+private:
+  const TileMap &tile_map_;
+  // Pool chunks, and cell (0, 0) of each slot within them
+  std::vector<float *> chunks_;
+  std::vector<float *> tiles_;
+};
+
+inline void swap(TiledField2D &a, TiledField2D &b) noexcept { a.Swap(b); }
+
+#endif // TILED_FIELD_2D_H
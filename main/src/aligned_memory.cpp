@@ -0,0 +1,217 @@
+#include "aligned_memory.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <string>
+
+#ifdef __linux__
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define FIELD_MEMORY_MMAP 1
+#endif
+
+namespace {
+/*
+ * Kept in the FIELD_ALIGNMENT_BYTES in front of every allocation, so that FreeAligned() knows how
+ * to release it
+ */
+struct AllocationHeader {
+  void *base;
+  size_t length;
+  FieldMemoryConfig::PageSize backing;
+};
+static_assert(sizeof(AllocationHeader) <= FIELD_ALIGNMENT_BYTES, "Header must fit in front of the allocation");
+
+std::atomic<int> config_page_size{FieldMemoryConfig::SMALL_PAGES};
+std::atomic<bool> config_first_touch{false};
+
+// Live bytes by backing, indexed by FieldMemoryConfig::PageSize
+std::atomic<uint64_t> live_bytes[3] = {{0}, {0}, {0}};
+std::atomic<uint32_t> hugetlbfs_fallbacks{0};
+// Counts mapped allocations, to stagger where each one starts
+std::atomic<uint32_t> num_mappings{0};
+
+/*
+ * Every mapping starts on a huge page boundary, so without an offset the same cell of every field
+ * would fall in the same cache sets and stencils over several fields would evict each other.
+ * Mappings start MAPPING_COLOUR_BYTES apart over NUM_MAPPING_COLOURS, which spans a 4 KiB page.
+ */
+const size_t MAPPING_COLOUR_BYTES = 4 * FIELD_ALIGNMENT_BYTES;
+const uint32_t NUM_MAPPING_COLOURS = 16;
+
+float *Finish(void *base, size_t length, FieldMemoryConfig::PageSize backing, size_t offset) {
+  auto *start = static_cast<char *>(base) + offset;
+  auto *header = reinterpret_cast<AllocationHeader *>(start);
+  header->base = base;
+  header->length = length;
+  header->backing = backing;
+  live_bytes[backing] += length;
+  return reinterpret_cast<float *>(start + FIELD_ALIGNMENT_BYTES);
+}
+
+#ifdef FIELD_MEMORY_MMAP
+/*
+ * A mapping of length bytes starting on a huge page boundary, advised for transparent huge pages.
+ * Maps a huge page more than needed and trims the ends, as mmap only promises small page alignment.
+ */
+void *MapTransparentHugePages(size_t length) {
+  auto padded = length + HUGE_PAGE_BYTES;
+  auto *mapping = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) {
+    return nullptr;
+  }
+  auto address = reinterpret_cast<uintptr_t>(mapping);
+  auto aligned = (address + HUGE_PAGE_BYTES - 1) & ~(uintptr_t) (HUGE_PAGE_BYTES - 1);
+  if (aligned > address) {
+    munmap(mapping, aligned - address);
+  }
+  auto end = aligned + length;
+  if (address + padded > end) {
+    munmap(reinterpret_cast<void *>(end), address + padded - end);
+  }
+  auto *base = reinterpret_cast<void *>(aligned);
+  // Only advice: the kernel may still give small pages if THP is off or memory is fragmented
+  madvise(base, length, MADV_HUGEPAGE);
+  return base;
+}
+
+void *MapHugetlbfsPages(size_t length) {
+  auto *mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  return (mapping == MAP_FAILED) ? nullptr : mapping;
+}
+#endif
+}
+
+void SetFieldMemoryConfig(const FieldMemoryConfig &config) {
+  config_page_size = config.page_size;
+  config_first_touch = config.first_touch;
+}
+
+FieldMemoryConfig GetFieldMemoryConfig() {
+  return {(FieldMemoryConfig::PageSize) config_page_size.load(), config_first_touch.load()};
+}
+
+FieldMemoryStats GetFieldMemoryStats() {
+  FieldMemoryStats stats{live_bytes[FieldMemoryConfig::SMALL_PAGES],            //
+                         live_bytes[FieldMemoryConfig::TRANSPARENT_HUGE_PAGES], //
+                         live_bytes[FieldMemoryConfig::HUGETLBFS_PAGES],        //
+                         hugetlbfs_fallbacks,                                   //
+                         0,                                                     //
+                         0};
+  std::ifstream rollup("/proc/self/smaps_rollup");
+  std::string key;
+  uint64_t kilobytes;
+  std::string unit;
+  while (rollup >> key >> kilobytes >> unit) {
+    if (key == "AnonHugePages:") {
+      stats.process_anon_huge_page_bytes += kilobytes * 1024;
+    } else if (key == "Private_Hugetlb:" || key == "Shared_Hugetlb:") {
+      stats.process_hugetlb_bytes += kilobytes * 1024;
+    }
+  }
+  return stats;
+}
+
+void AddPagePlacement(const void *ptr, size_t num_bytes, FieldPagePlacement &placement) {
+  if (num_bytes == 0) {
+    return;
+  }
+#ifdef FIELD_MEMORY_MMAP
+  const auto page_bytes = (uintptr_t) sysconf(_SC_PAGESIZE);
+  auto first = reinterpret_cast<uintptr_t>(ptr) & ~(page_bytes - 1);
+  auto end = reinterpret_cast<uintptr_t>(ptr) + num_bytes;
+  // Queried a batch at a time, so that a large field does not need a status per page at once
+  const size_t BATCH = 4096;
+  void *pages[BATCH];
+  int status[BATCH];
+  for (auto address = first; address < end;) {
+    size_t count = 0;
+    for (; count < BATCH && address < end; ++count, address += page_bytes) {
+      pages[count] = reinterpret_cast<void *>(address);
+    }
+    // nodes == nullptr only reports where each page is
+    auto result = syscall(SYS_move_pages, 0, (unsigned long) count, pages, nullptr, status, 0);
+    for (size_t page = 0; page < count; ++page) {
+      ++placement.num_pages;
+      if (result != 0) {
+        ++placement.unknown;
+      } else if (status[page] >= 0) {
+        if ((size_t) status[page] >= placement.pages_per_node.size()) {
+          placement.pages_per_node.resize((size_t) status[page] + 1, 0);
+        }
+        ++placement.pages_per_node[(size_t) status[page]];
+      } else if (status[page] == -ENOENT) {
+        ++placement.not_present;
+      } else {
+        ++placement.unknown;
+      }
+    }
+  }
+#else
+  (void) ptr;
+  auto num_pages = (num_bytes + 4095) / 4096;
+  placement.num_pages += num_pages;
+  placement.unknown += num_pages;
+#endif
+}
+
+float *AllocateAligned(size_t num_floats) {
+  auto length = num_floats * sizeof(float) + FIELD_ALIGNMENT_BYTES;
+#ifdef FIELD_MEMORY_MMAP
+  auto page_size = (FieldMemoryConfig::PageSize) config_page_size.load();
+  if (page_size != FieldMemoryConfig::SMALL_PAGES && length >= HUGE_PAGE_BYTES) {
+    auto offset = MAPPING_COLOUR_BYTES * (num_mappings++ % NUM_MAPPING_COLOURS);
+    if (page_size == FieldMemoryConfig::HUGETLBFS_PAGES) {
+      // hugetlbfs mappings are whole huge pages
+      auto mapped_length = (offset + length + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+      if (auto *base = MapHugetlbfsPages(mapped_length)) {
+        return Finish(base, mapped_length, FieldMemoryConfig::HUGETLBFS_PAGES, offset);
+      }
+      ++hugetlbfs_fallbacks;
+    }
+    // The partial huge page at the end is left to small pages rather than padded out
+    auto small_page_bytes = (size_t) sysconf(_SC_PAGESIZE);
+    auto mapped_length = (offset + length + small_page_bytes - 1) / small_page_bytes * small_page_bytes;
+    if (auto *base = MapTransparentHugePages(mapped_length)) {
+      return Finish(base, mapped_length, FieldMemoryConfig::TRANSPARENT_HUGE_PAGES, offset);
+    }
+    throw std::bad_alloc();
+  }
+#endif
+
+  void *ptr = nullptr;
+#ifdef _WIN32
+  ptr = _aligned_malloc(length, FIELD_ALIGNMENT_BYTES);
+#else
+  if (posix_memalign(&ptr, FIELD_ALIGNMENT_BYTES, length) != 0) {
+    ptr = nullptr;
+  }
+#endif
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return Finish(ptr, length, FieldMemoryConfig::SMALL_PAGES, 0);
+}
+
+void FreeAligned(float *ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+  auto *header = reinterpret_cast<AllocationHeader *>(reinterpret_cast<char *>(ptr) - FIELD_ALIGNMENT_BYTES);
+  live_bytes[header->backing] -= header->length;
+#ifdef FIELD_MEMORY_MMAP
+  if (header->backing != FieldMemoryConfig::SMALL_PAGES) {
+    munmap(header->base, header->length);
+    return;
+  }
+#endif
+#ifdef _WIN32
+  _aligned_free(header->base);
+#else
+  free(header->base);
+#endif
+}
@@ -0,0 +1,704 @@
+#include "distributed_grid_simulator.h"
+#include "red_black_sor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+// As GridFluidSimulator
+const uint32_t NUM_GS_ITERS = 10;
+const float DEFAULT_PRESSURE_TOLERANCE = 1e-4f;
+const uint32_t DEFAULT_MAX_PRESSURE_ITERATIONS = 200;
+
+// Message tags by the direction the data travels, so that each receive matches its send
+const int TAG_LEFTWARD = 1;
+const int TAG_RIGHTWARD = 2;
+const int TAG_DOWNWARD = 3;
+const int TAG_UPWARD = 4;
+
+/*
+ * The stencils of grid_kernels.cpp over cells [x_begin, x_end) of row y, so that a stage can do
+ * the cells away from the edges and the ring next to them separately
+ */
+namespace {
+inline float Lerp(float from, float to, float pct) { return from + pct * (to - from); }
+
+double JacobiSegment(const Field2D &divergence,
+                     const Field2D &pressure,
+                     int32_t y,
+                     int32_t x_begin,
+                     int32_t x_end,
+                     Field2D &next) {
+  const auto *p = pressure.Row(y);
+  const auto *p_below = pressure.Row(y - 1);
+  const auto *p_above = pressure.Row(y + 1);
+  const auto *div = divergence.Row(y);
+  auto *p_next = next.Row(y);
+  auto sum = 0.0;
+  for (auto x = x_begin; x < x_end; ++x) {
+    auto p_new = (p[x - 1] + p[x + 1] + p_below[x] + p_above[x] - div[x]) * 0.25f;
+    auto change = (double) (p_new - p[x]);
+    sum += change * change;
+    p_next[x] = p_new;
+  }
+  return sum;
+}
+
+void DivergenceSegment(const Field2D &velocity_x,
+                       const Field2D &velocity_y,
+                       int32_t y,
+                       int32_t x_begin,
+                       int32_t x_end,
+                       Field2D &divergence) {
+  const auto *vx = velocity_x.Row(y);
+  const auto *vy_below = velocity_y.Row(y - 1);
+  const auto *vy_above = velocity_y.Row(y + 1);
+  auto *div = divergence.Row(y);
+  for (auto x = x_begin; x < x_end; ++x) {
+    div[x] = (vx[x + 1] - vx[x - 1] + vy_above[x] - vy_below[x]) * 0.5f;
+  }
+}
+
+void ProjectSegment(const Field2D &pressure,
+                    int32_t y,
+                    int32_t x_begin,
+                    int32_t x_end,
+                    Field2D &velocity_x,
+                    Field2D &velocity_y) {
+  const auto *p = pressure.Row(y);
+  const auto *p_below = pressure.Row(y - 1);
+  const auto *p_above = pressure.Row(y + 1);
+  auto *vx = velocity_x.Row(y);
+  auto *vy = velocity_y.Row(y);
+  for (auto x = x_begin; x < x_end; ++x) {
+    vx[x] -= (p[x + 1] - p[x - 1]) * 0.5f;
+    vy[x] -= (p_above[x] - p_below[x]) * 0.5f;
+  }
+}
+
+inline float Interpolate(const Field2D &field, int32_t base_x, int32_t base_y, float frac_x, float frac_y) {
+  const auto *btm = field.Row(base_y) + base_x;
+  const auto *top = field.Row(base_y + 1) + base_x;
+  return Lerp(Lerp(btm[0], btm[1], frac_x), Lerp(top[0], top[1], frac_x), frac_y);
+}
+}
+
+DistributedGridSimulator::DistributedGridSimulator(MPI_Comm comm,        //
+                                                   uint32_t dim_x,       //
+                                                   uint32_t dim_y,       //
+                                                   float delta_t,        //
+                                                   float diffusion_rate, //
+                                                   uint32_t halo         //
+)                                                                        //
+        : comm_{MPI_COMM_NULL}                                           //
+        , rank_{0}                                                       //
+        , num_ranks_{1}                                                  //
+        , dims_{0, 0}                                                    //
+        , left_{MPI_PROC_NULL}                                           //
+        , right_{MPI_PROC_NULL}                                          //
+        , below_{MPI_PROC_NULL}                                          //
+        , above_{MPI_PROC_NULL}                                          //
+        , dim_x_{dim_x}                                                  //
+        , dim_y_{dim_y}                                                  //
+        , x0_{0}                                                         //
+        , y0_{0}                                                         //
+        , halo_{halo}                                                    //
+        , delta_t_{delta_t}                                              //
+        , diffusion_rate_{diffusion_rate}                                //
+        , pressure_solver_{JACOBI}                                       //
+        , pressure_tolerance_{DEFAULT_PRESSURE_TOLERANCE}                //
+        , max_pressure_iterations_{DEFAULT_MAX_PRESSURE_ITERATIONS}      //
+        , pressure_omega_{1.0f}                                          //
+        , last_pressure_solve_{0, 0.0f}                                  //
+        , communication_seconds_{0.0}                                    //
+        , thread_pool_{std::make_unique<ThreadPool>(1)}                  //
+        , edge_column_{MPI_DATATYPE_NULL}                                //
+        , edge_row_{MPI_DATATYPE_NULL}                                   //
+        , halo_columns_{MPI_DATATYPE_NULL}                               //
+        , halo_rows_{MPI_DATATYPE_NULL}                                  //
+{
+  if (dim_x < 3 || dim_y < 3) {
+    throw std::runtime_error("Width and height must be at least 3 to leave an interior");
+  }
+  if (halo < 2) {
+    throw std::runtime_error("The halo must be at least 2 cells wide for advection");
+  }
+  // The same checks on every rank, so that they all throw or none does
+  auto width = dim_x - 2;
+  auto height = dim_y - 2;
+  MPI_Comm_size(comm, &num_ranks_);
+  MPI_Dims_create(num_ranks_, 2, dims_);
+  if (width / (uint32_t) dims_[0] < 2 * halo || height / (uint32_t) dims_[1] < 2 * halo) {
+    throw std::runtime_error("The grid is too small to give every rank a rectangle twice the halo across");
+  }
+  pressure_omega_ = OptimalSorOmega(width, height);
+
+  int periods[2] = {0, 0};
+  int coords[2];
+  MPI_Cart_create(comm, 2, dims_, periods, 1, &comm_);
+  MPI_Comm_rank(comm_, &rank_);
+  MPI_Cart_coords(comm_, rank_, 2, coords);
+  MPI_Cart_shift(comm_, 0, 1, &left_, &right_);
+  MPI_Cart_shift(comm_, 1, 1, &below_, &above_);
+  x0_ = (uint32_t) ((uint64_t) width * coords[0] / dims_[0]);
+  y0_ = (uint32_t) ((uint64_t) height * coords[1] / dims_[1]);
+  auto local_width = (uint32_t) ((uint64_t) width * (coords[0] + 1) / dims_[0]) - x0_;
+  auto local_height = (uint32_t) ((uint64_t) height * (coords[1] + 1) / dims_[1]) - y0_;
+
+  density_ = Field2D(local_width, local_height, halo);
+  velocity_x_ = Field2D(local_width, local_height, halo);
+  velocity_y_ = Field2D(local_width, local_height, halo);
+  pressure_ = Field2D(local_width, local_height, halo);
+  temp_pressure_ = Field2D(local_width, local_height, halo);
+  divergence_ = Field2D(local_width, local_height, halo);
+  temp_density_ = Field2D(local_width, local_height, halo);
+  temp_velocity_x_ = Field2D(local_width, local_height, halo);
+  temp_velocity_y_ = Field2D(local_width, local_height, halo);
+
+  // Every field has the same shape, so one set of types describes the halo of any of them
+  auto stride = (int) density_.Stride();
+  MPI_Type_vector((int) local_height, 1, stride, MPI_FLOAT, &edge_column_);
+  MPI_Type_contiguous((int) local_width, MPI_FLOAT, &edge_row_);
+  MPI_Type_vector((int) local_height, (int) halo, stride, MPI_FLOAT, &halo_columns_);
+  MPI_Type_vector((int) halo, (int) (local_width + 2 * halo), stride, MPI_FLOAT, &halo_rows_);
+  for (auto *type : {&edge_column_, &edge_row_, &halo_columns_, &halo_rows_}) {
+    MPI_Type_commit(type);
+  }
+  // Enough for the most fields any stage exchanges at once
+  requests_.reserve(3 * 8);
+
+  int subdomain[4] = {(int) x0_, (int) y0_, (int) local_width, (int) local_height};
+  subdomains_.resize(4 * (size_t) num_ranks_);
+  MPI_Allgather(subdomain, 4, MPI_INT, subdomains_.data(), 4, MPI_INT, comm_);
+}
+
+DistributedGridSimulator::~DistributedGridSimulator() {
+  for (auto *type : {&edge_column_, &edge_row_, &halo_columns_, &halo_rows_}) {
+    MPI_Type_free(type);
+  }
+  MPI_Comm_free(&comm_);
+}
+
+void DistributedGridSimulator::SetPressureSolver(PressureSolver pressure_solver) {
+  pressure_solver_ = pressure_solver;
+}
+
+void DistributedGridSimulator::SetPressureTolerance(float tolerance) {
+  pressure_tolerance_ = tolerance;
+}
+
+void DistributedGridSimulator::SetMaxPressureIterations(uint32_t max_iterations) {
+  max_pressure_iterations_ = max_iterations;
+}
+
+void DistributedGridSimulator::SetPressureOmega(float omega) {
+  pressure_omega_ = omega;
+}
+
+void DistributedGridSimulator::SetNumThreads(uint32_t num_threads) {
+  thread_pool_ = std::make_unique<ThreadPool>(num_threads);
+}
+
+bool DistributedGridSimulator::Owns(uint32_t x, uint32_t y) const {
+  if (x >= dim_x_ || y >= dim_y_) {
+    throw std::out_of_range("Cell is outside the grid");
+  }
+  auto local_x = (int32_t) x - 1 - (int32_t) x0_;
+  auto local_y = (int32_t) y - 1 - (int32_t) y0_;
+  auto w = (int32_t) density_.Width();
+  auto h = (int32_t) density_.Height();
+  return local_x >= (left_ == MPI_PROC_NULL ? -1 : 0) && local_x < (right_ == MPI_PROC_NULL ? w + 1 : w)
+         && local_y >= (below_ == MPI_PROC_NULL ? -1 : 0) && local_y < (above_ == MPI_PROC_NULL ? h + 1 : h);
+}
+
+void DistributedGridSimulator::AddDensity(uint32_t x, uint32_t y, float amount) {
+  if (Owns(x, y)) {
+    density_((int32_t) x - 1 - (int32_t) x0_, (int32_t) y - 1 - (int32_t) y0_) += amount;
+  }
+}
+
+void DistributedGridSimulator::AddSource(uint32_t x, uint32_t y, float amount, float velocity_x, float velocity_y) {
+  if (Owns(x, y)) {
+    sources_[y * dim_x_ + x] = {amount, velocity_x, velocity_y};
+  }
+}
+
+void DistributedGridSimulator::ClearSources() {
+  sources_.clear();
+}
+
+void DistributedGridSimulator::ProcessSources() {
+  for (const auto &source : sources_) {
+    auto x = (int32_t) (source.first % dim_x_) - 1 - (int32_t) x0_;
+    auto y = (int32_t) (source.first / dim_x_) - 1 - (int32_t) y0_;
+    density_(x, y) = std::get<0>(source.second);
+    velocity_x_(x, y) = std::get<1>(source.second);
+    velocity_y_(x, y) = std::get<2>(source.second);
+  }
+}
+
+void DistributedGridSimulator::FillWallColumns(const HaloUpdate &update) const {
+  auto &field = *update.field;
+  auto w = (int32_t) field.Width();
+  auto h = (int32_t) field.Height();
+  auto halo = (int32_t) halo_;
+  for (auto y = 0; y < h; ++y) {
+    auto *row = field.Row(y);
+    if (left_ == MPI_PROC_NULL) {
+      row[-1] = update.x_edge_factor * row[0];
+      for (auto layer = 2; layer <= halo; ++layer) {
+        row[-layer] = row[1 - layer];
+      }
+    }
+    if (right_ == MPI_PROC_NULL) {
+      row[w] = update.x_edge_factor * row[w - 1];
+      for (auto layer = 2; layer <= halo; ++layer) {
+        row[w + layer - 1] = row[w + layer - 2];
+      }
+    }
+  }
+}
+
+/*
+ * Where a wall meets a neighbour's side the halo row continues the neighbour's columns; where two
+ * walls meet the corner is the average of Field2D::FillHalo().
+ */
+void DistributedGridSimulator::FillWallRows(const HaloUpdate &update) const {
+  auto &field = *update.field;
+  auto w = (int32_t) field.Width();
+  auto h = (int32_t) field.Height();
+  auto halo = (int32_t) halo_;
+  auto fill_row = [&](const float *edge, float *row) {
+    for (auto x = 0; x < w; ++x) {
+      row[x] = update.y_edge_factor * edge[x];
+    }
+    if (left_ == MPI_PROC_NULL) {
+      row[-1] = 0.5f * (row[0] + edge[-1]);
+      for (auto layer = 2; layer <= halo; ++layer) {
+        row[-layer] = row[1 - layer];
+      }
+    } else {
+      for (auto x = -halo; x < 0; ++x) {
+        row[x] = update.y_edge_factor * edge[x];
+      }
+    }
+    if (right_ == MPI_PROC_NULL) {
+      row[w] = 0.5f * (row[w - 1] + edge[w]);
+      for (auto layer = 2; layer <= halo; ++layer) {
+        row[w + layer - 1] = row[w + layer - 2];
+      }
+    } else {
+      for (auto x = w; x < w + halo; ++x) {
+        row[x] = update.y_edge_factor * edge[x];
+      }
+    }
+  };
+  auto row_bytes = (size_t) (w + 2 * halo) * sizeof(float);
+  if (below_ == MPI_PROC_NULL) {
+    fill_row(field.Row(0), field.Row(-1));
+    for (auto layer = 2; layer <= halo; ++layer) {
+      std::memcpy(field.Row(-layer) - halo, field.Row(1 - layer) - halo, row_bytes);
+    }
+  }
+  if (above_ == MPI_PROC_NULL) {
+    fill_row(field.Row(h - 1), field.Row(h));
+    for (auto layer = 2; layer <= halo; ++layer) {
+      std::memcpy(field.Row(h + layer - 1) - halo, field.Row(h + layer - 2) - halo, row_bytes);
+    }
+  }
+}
+
+void DistributedGridSimulator::FillWalls(const HaloUpdate &update) const {
+  FillWallColumns(update);
+  FillWallRows(update);
+}
+
+template<typename Overlap>
+void DistributedGridSimulator::UpdateHalos(std::initializer_list<HaloUpdate> updates, const Overlap &overlap) {
+  auto halo = (int32_t) halo_;
+  auto post = [&](bool send, float *buffer, MPI_Datatype type, int rank, int tag) {
+    requests_.emplace_back();
+    if (send) {
+      MPI_Isend(buffer, 1, type, rank, tag, comm_, &requests_.back());
+    } else {
+      MPI_Irecv(buffer, 1, type, rank, tag, comm_, &requests_.back());
+    }
+  };
+
+  for (const auto &update : updates) {
+    FillWallColumns(update);
+    auto &field = *update.field;
+    auto w = (int32_t) field.Width();
+    post(false, field.Row(0) - halo, halo_columns_, left_, TAG_RIGHTWARD);
+    post(false, field.Row(0) + w, halo_columns_, right_, TAG_LEFTWARD);
+    post(true, field.Row(0), halo_columns_, left_, TAG_LEFTWARD);
+    post(true, field.Row(0) + w - halo, halo_columns_, right_, TAG_RIGHTWARD);
+  }
+  overlap(0);
+  FinishExchange();
+
+  for (const auto &update : updates) {
+    FillWallRows(update);
+    auto &field = *update.field;
+    auto h = (int32_t) field.Height();
+    post(false, field.Row(-halo) - halo, halo_rows_, below_, TAG_UPWARD);
+    post(false, field.Row(h) - halo, halo_rows_, above_, TAG_DOWNWARD);
+    post(true, field.Row(0) - halo, halo_rows_, below_, TAG_DOWNWARD);
+    post(true, field.Row(h - halo) - halo, halo_rows_, above_, TAG_UPWARD);
+  }
+  overlap(1);
+  FinishExchange();
+}
+
+void DistributedGridSimulator::UpdateHalos(std::initializer_list<HaloUpdate> updates) {
+  UpdateHalos(updates, [](int32_t) {});
+}
+
+void DistributedGridSimulator::BeginEdgeExchange(std::initializer_list<Field2D *> fields) {
+  auto post = [&](bool send, float *buffer, MPI_Datatype type, int rank, int tag) {
+    requests_.emplace_back();
+    if (send) {
+      MPI_Isend(buffer, 1, type, rank, tag, comm_, &requests_.back());
+    } else {
+      MPI_Irecv(buffer, 1, type, rank, tag, comm_, &requests_.back());
+    }
+  };
+  for (auto *field : fields) {
+    auto w = (int32_t) field->Width();
+    auto h = (int32_t) field->Height();
+    post(false, field->Row(0) - 1, edge_column_, left_, TAG_RIGHTWARD);
+    post(false, field->Row(0) + w, edge_column_, right_, TAG_LEFTWARD);
+    post(false, field->Row(-1), edge_row_, below_, TAG_UPWARD);
+    post(false, field->Row(h), edge_row_, above_, TAG_DOWNWARD);
+    post(true, field->Row(0), edge_column_, left_, TAG_LEFTWARD);
+    post(true, field->Row(0) + w - 1, edge_column_, right_, TAG_RIGHTWARD);
+    post(true, field->Row(0), edge_row_, below_, TAG_DOWNWARD);
+    post(true, field->Row(h - 1), edge_row_, above_, TAG_UPWARD);
+  }
+}
+
+void DistributedGridSimulator::FinishExchange() {
+  auto start = MPI_Wtime();
+  MPI_Waitall((int) requests_.size(), requests_.data(), MPI_STATUSES_IGNORE);
+  communication_seconds_ += MPI_Wtime() - start;
+  requests_.clear();
+}
+
+double DistributedGridSimulator::AllSum(double value) {
+  auto start = MPI_Wtime();
+  auto sum = 0.0;
+  MPI_Allreduce(&value, &sum, 1, MPI_DOUBLE, MPI_SUM, comm_);
+  communication_seconds_ += MPI_Wtime() - start;
+  return sum;
+}
+
+template<typename Segment>
+void DistributedGridSimulator::ForRing(int32_t width, const Segment &segment) const {
+  auto w = (int32_t) density_.Width();
+  auto h = (int32_t) density_.Height();
+  for (auto y = 0; y < width; ++y) {
+    segment(y, 0, w);
+  }
+  for (auto y = width; y < h - width; ++y) {
+    segment(y, 0, width);
+    segment(y, w - width, w);
+  }
+  for (auto y = h - width; y < h; ++y) {
+    segment(y, 0, w);
+  }
+}
+
+/*
+ * Parity is taken from global coordinates, so the colours line up across the ranks
+ */
+double DistributedGridSimulator::RedBlackSorSweep(const Field2D &rhs,
+                                                  float rhs_weight,
+                                                  float neighbour_weight,
+                                                  float omega,
+                                                  uint32_t colour,
+                                                  Field2D &u) {
+  auto relax = [&](int32_t y, int32_t x_begin, int32_t x_end) {
+    auto parity = (int32_t) ((colour + y0_ + (uint32_t) y + x0_ + (uint32_t) x_begin) & 1);
+    return RedBlackSorRow(u.Row(y - 1) + x_begin, u.Row(y) + x_begin, u.Row(y + 1) + x_begin, rhs.Row(y) + x_begin,
+                          x_end - x_begin, parity, rhs_weight, neighbour_weight, omega);
+  };
+  auto w = (int32_t) u.Width();
+  auto h = (int32_t) u.Height();
+
+  BeginEdgeExchange({&u});
+  auto sum = thread_pool_->ParallelSum(1, h - 1, w, [&](int32_t y_begin, int32_t y_end) {
+    auto band_sum = 0.0;
+    for (auto y = y_begin; y < y_end; ++y) {
+      band_sum += relax(y, 1, w - 1);
+    }
+    return band_sum;
+  });
+  FinishExchange();
+  ForRing(1, [&](int32_t y, int32_t x_begin, int32_t x_end) { sum += relax(y, x_begin, x_end); });
+  return sum;
+}
+
+/*
+ * Halos at the walls are refreshed once an iteration, as GridFluidSimulator::Diffuse() does, and
+ * those along the neighbours before every half sweep, which is when the other colour has changed.
+ */
+void DistributedGridSimulator::Diffuse(const Field2D &current, Field2D &next) {
+  next.CopyFrom(current);
+  auto k = delta_t_ * diffusion_rate_;
+  auto inv_k1 = 1.0f / (k + 1.0f);
+  for (auto iter = 0u; iter < NUM_GS_ITERS; ++iter) {
+    for (auto colour = 0u; colour < 2; ++colour) {
+      RedBlackSorSweep(current, inv_k1, 0.25f * k * inv_k1, 1.0f, colour, next);
+    }
+    FillWalls({&next, 1.0f, 1.0f});
+  }
+}
+
+/*
+ * SemiLagrangianAdvector's Trace() in global coordinates, with the departure point first kept
+ * within halo - 1 cells of the cell so that its stencil lies in this rank's fields.
+ */
+void DistributedGridSimulator::AdvectSegment(int32_t y, int32_t x_begin, int32_t x_end) {
+  auto global_w = (int32_t) dim_x_ - 2;
+  auto global_h = (int32_t) dim_y_ - 2;
+  auto reach = (float) halo_ - 1.0f;
+  auto global_y = (float) (y0_ + (uint32_t) y);
+  const auto *vx = velocity_x_.Row(y);
+  const auto *vy = velocity_y_.Row(y);
+  for (auto x = x_begin; x < x_end; ++x) {
+    auto global_x = (float) (x0_ + (uint32_t) x);
+    auto source_x = (global_x + 0.5f) - vx[x] * delta_t_;
+    auto source_y = (global_y + 0.5f) - vy[x] * delta_t_;
+    source_x = std::max(global_x + 0.5f - reach, std::min(global_x + 0.5f + reach, source_x));
+    source_y = std::max(global_y + 0.5f - reach, std::min(global_y + 0.5f + reach, source_y));
+    source_x = std::max(-0.5f, std::min((float) global_w + 0.5f, source_x));
+    source_y = std::max(-0.5f, std::min((float) global_h + 0.5f, source_y));
+    auto base_x = std::min(std::floor(source_x - 0.5f), (float) (global_w - 1));
+    auto base_y = std::min(std::floor(source_y - 0.5f), (float) (global_h - 1));
+    auto frac_x = source_x - base_x - 0.5f;
+    auto frac_y = source_y - base_y - 0.5f;
+
+    auto local_x = (int32_t) base_x - (int32_t) x0_;
+    auto local_y = (int32_t) base_y - (int32_t) y0_;
+    temp_density_.Row(y)[x] = Interpolate(density_, local_x, local_y, frac_x, frac_y);
+    temp_velocity_x_.Row(y)[x] = Interpolate(velocity_x_, local_x, local_y, frac_x, frac_y);
+    temp_velocity_y_.Row(y)[x] = Interpolate(velocity_y_, local_x, local_y, frac_x, frac_y);
+  }
+}
+
+/*
+ * Cells more than halo - 1 from every edge only read this rank's interior, so they are advected
+ * while the halos travel, half during each phase of the exchange.
+ */
+void DistributedGridSimulator::Advect() {
+  auto w = (int32_t) density_.Width();
+  auto h = (int32_t) density_.Height();
+  auto halo = (int32_t) halo_;
+  auto middle = h / 2;
+  UpdateHalos({{&density_, 1.0f, 1.0f}, {&velocity_x_, 0.0f, 1.0f}, {&velocity_y_, 1.0f, 0.0f}},
+              [&](int32_t phase) {
+                auto y_begin = (phase == 0) ? halo : middle;
+                auto y_end = (phase == 0) ? middle : h - halo;
+                thread_pool_->ParallelFor(y_begin, y_end, 3 * w, [&](int32_t band_begin, int32_t band_end) {
+                  for (auto y = band_begin; y < band_end; ++y) {
+                    AdvectSegment(y, halo, w - halo);
+                  }
+                });
+              });
+  ForRing(halo, [&](int32_t y, int32_t x_begin, int32_t x_end) { AdvectSegment(y, x_begin, x_end); });
+  density_.Swap(temp_density_);
+  velocity_x_.Swap(temp_velocity_x_);
+  velocity_y_.Swap(temp_velocity_y_);
+}
+
+void DistributedGridSimulator::SuppressDivergence() {
+  auto w = (int32_t) velocity_x_.Width();
+  auto h = (int32_t) velocity_x_.Height();
+
+  FillWalls({&velocity_x_, 0.0f, 1.0f});
+  FillWalls({&velocity_y_, 1.0f, 0.0f});
+  BeginEdgeExchange({&velocity_x_, &velocity_y_});
+  thread_pool_->ParallelFor(1, h - 1, w, [&](int32_t y_begin, int32_t y_end) {
+    for (auto y = y_begin; y < y_end; ++y) {
+      DivergenceSegment(velocity_x_, velocity_y_, y, 1, w - 1, divergence_);
+    }
+  });
+  FinishExchange();
+  ForRing(1, [&](int32_t y, int32_t x_begin, int32_t x_end) {
+    DivergenceSegment(velocity_x_, velocity_y_, y, x_begin, x_end, divergence_);
+  });
+
+  ComputePressure();
+
+  BeginEdgeExchange({&pressure_});
+  thread_pool_->ParallelFor(1, h - 1, w, [&](int32_t y_begin, int32_t y_end) {
+    for (auto y = y_begin; y < y_end; ++y) {
+      ProjectSegment(pressure_, y, 1, w - 1, velocity_x_, velocity_y_);
+    }
+  });
+  FinishExchange();
+  ForRing(1, [&](int32_t y, int32_t x_begin, int32_t x_end) {
+    ProjectSegment(pressure_, y, x_begin, x_end, velocity_x_, velocity_y_);
+  });
+}
+
+void DistributedGridSimulator::ComputePressure() {
+  last_pressure_solve_ = (pressure_solver_ == RED_BLACK_SOR) ? ComputePressureRedBlackSor() : ComputePressureJacobi();
+}
+
+/*
+ * GridFluidSimulator::ComputePressureJacobi with the sums taken over every rank. The halo is
+ * exchanged from the iterate each sweep reads while it updates the cells away from the edges.
+ */
+PoissonSolverStats DistributedGridSimulator::ComputePressureJacobi() {
+  auto w = (int32_t) divergence_.Width();
+  auto h = (int32_t) divergence_.Height();
+  auto local_norm_sq = 0.0;
+  for (auto y = 0; y < h; ++y) {
+    const auto *row = divergence_.Row(y);
+    for (auto x = 0; x < w; ++x) {
+      local_norm_sq += (double) row[x] * (double) row[x];
+    }
+  }
+  auto rhs_norm = std::sqrt(AllSum(local_norm_sq));
+  if (rhs_norm == 0.0) {
+    pressure_.Fill(0.0f);
+    return {0, 0.0f};
+  }
+
+  auto relative_residual = 1.0;
+  auto iter = 0u;
+  while (iter < max_pressure_iterations_) {
+    BeginEdgeExchange({&pressure_});
+    auto change_sq = thread_pool_->ParallelSum(1, h - 1, w, [&](int32_t y_begin, int32_t y_end) {
+      auto sum = 0.0;
+      for (auto y = y_begin; y < y_end; ++y) {
+        sum += JacobiSegment(divergence_, pressure_, y, 1, w - 1, temp_pressure_);
+      }
+      return sum;
+    });
+    FinishExchange();
+    ForRing(1, [&](int32_t y, int32_t x_begin, int32_t x_end) {
+      change_sq += JacobiSegment(divergence_, pressure_, y, x_begin, x_end, temp_pressure_);
+    });
+
+    // Both buffers hold zero in the halo at the walls; the rest is exchanged before it is read
+    pressure_.Swap(temp_pressure_);
+    ++iter;
+    relative_residual = 4.0 * std::sqrt(AllSum(change_sq)) / rhs_norm;
+    if (relative_residual <= pressure_tolerance_) {
+      break;
+    }
+  }
+  return {iter, (float) relative_residual};
+}
+
+PoissonSolverStats DistributedGridSimulator::ComputePressureRedBlackSor() {
+  auto w = (int32_t) divergence_.Width();
+  auto h = (int32_t) divergence_.Height();
+  auto local_norm_sq = 0.0;
+  for (auto y = 0; y < h; ++y) {
+    const auto *row = divergence_.Row(y);
+    for (auto x = 0; x < w; ++x) {
+      local_norm_sq += (double) row[x] * (double) row[x];
+    }
+  }
+  auto rhs_norm = std::sqrt(AllSum(local_norm_sq));
+  if (rhs_norm == 0.0) {
+    pressure_.Fill(0.0f);
+    return {0, 0.0f};
+  }
+
+  auto relative_residual = 1.0;
+  auto iter = 0u;
+  while (iter < max_pressure_iterations_) {
+    auto change_sq = 0.0;
+    for (auto colour = 0u; colour < 2; ++colour) {
+      change_sq += RedBlackSorSweep(divergence_, -0.25f, 0.25f, pressure_omega_, colour, pressure_);
+    }
+    ++iter;
+    relative_residual = 4.0 * std::sqrt(AllSum(change_sq)) / rhs_norm;
+    if (relative_residual <= pressure_tolerance_) {
+      break;
+    }
+  }
+  return {iter, (float) relative_residual};
+}
+
+void DistributedGridSimulator::Simulate() {
+  ProcessSources();
+  UpdateHalos({{&density_, 1.0f, 1.0f}, {&velocity_x_, 0.0f, 1.0f}, {&velocity_y_, 1.0f, 0.0f}});
+
+  Diffuse(density_, temp_density_);
+  density_.Swap(temp_density_);
+
+  Diffuse(velocity_x_, temp_velocity_x_);
+  Diffuse(velocity_y_, temp_velocity_y_);
+  velocity_x_.Swap(temp_velocity_x_);
+  velocity_y_.Swap(temp_velocity_y_);
+
+  // Refills the wall halos of the velocity, which GridFluidSimulator does at this point too
+  Advect();
+
+  SuppressDivergence();
+}
+
+/*
+ * The interiors are gathered and the boundary ring is filled on root, as the last stage to touch
+ * each field would have filled it
+ */
+void DistributedGridSimulator::Gather(const Field2D &field,
+                                      float x_edge_factor,
+                                      float y_edge_factor,
+                                      std::vector<float> &dense,
+                                      int root) const {
+  auto w = (int32_t) field.Width();
+  auto h = (int32_t) field.Height();
+  std::vector<float> local((size_t) w * h);
+  for (auto y = 0; y < h; ++y) {
+    std::copy(field.Row(y), field.Row(y) + w, local.begin() + (size_t) y * w);
+  }
+
+  std::vector<int> counts;
+  std::vector<int> offsets;
+  std::vector<float> all;
+  if (rank_ == root) {
+    auto offset = 0;
+    for (auto rank = 0; rank < num_ranks_; ++rank) {
+      counts.push_back(subdomains_[4 * rank + 2] * subdomains_[4 * rank + 3]);
+      offsets.push_back(offset);
+      offset += counts.back();
+    }
+    all.resize((size_t) offset);
+  }
+  MPI_Gatherv(local.data(), (int) local.size(), MPI_FLOAT, all.data(), counts.data(), offsets.data(), MPI_FLOAT, root,
+              comm_);
+  if (rank_ != root) {
+    return;
+  }
+
+  Field2D global(dim_x_ - 2, dim_y_ - 2, 1);
+  for (auto rank = 0; rank < num_ranks_; ++rank) {
+    const auto *subdomain = &subdomains_[4 * rank];
+    const auto *values = all.data() + offsets[rank];
+    for (auto y = 0; y < subdomain[3]; ++y) {
+      std::copy(values + (size_t) y * subdomain[2], values + (size_t) (y + 1) * subdomain[2],
+                global.Row(subdomain[1] + y) + subdomain[0]);
+    }
+  }
+  global.FillHalo(x_edge_factor, y_edge_factor);
+  global.CopyTo(dense);
+}
+
+void DistributedGridSimulator::GatherDensity(std::vector<float> &dense, int root) const {
+  Gather(density_, 1.0f, 1.0f, dense, root);
+}
+
+void DistributedGridSimulator::GatherVelocityX(std::vector<float> &dense, int root) const {
+  Gather(velocity_x_, 0.0f, 1.0f, dense, root);
+}
+
+void DistributedGridSimulator::GatherVelocityY(std::vector<float> &dense, int root) const {
+  Gather(velocity_y_, 1.0f, 0.0f, dense, root);
+}
@@ -0,0 +1,119 @@
+#include "ensemble_field_2d.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+// to[lane] = factor * from[lane] for every lane of a cell
+inline void ScaleLanes(const float *__restrict from, float factor, uint32_t lanes, float *__restrict to) {
+  for (auto lane = 0u; lane < lanes; ++lane) {
+    to[lane] = factor * from[lane];
+  }
+}
+
+inline void AverageLanes(const float *__restrict a, const float *__restrict b, uint32_t lanes, float *__restrict to) {
+  for (auto lane = 0u; lane < lanes; ++lane) {
+    to[lane] = 0.5f * (a[lane] + b[lane]);
+  }
+}
+}
+
+EnsembleField2D::EnsembleField2D()
+        : width_{0}        //
+        , height_{0}       //
+        , members_{0}      //
+        , lanes_{0}        //
+        , row_stride_{0}   //
+        , size_{0}         //
+        , data_{nullptr}   //
+        , origin_{nullptr} //
+{}
+
+EnsembleField2D::EnsembleField2D(uint32_t width, uint32_t height, uint32_t members) //
+        : width_{width}                                                             //
+        , height_{height}                                                           //
+        , members_{members}                                                         //
+        , lanes_{RoundUp(members, FIELD_ALIGNMENT_FLOATS)}                          //
+{
+  if (width == 0 || height == 0 || members == 0) {
+    throw std::runtime_error("Ensemble field width, height and members must be non-zero");
+  }
+  row_stride_ = (width_ + 2) * lanes_;
+  size_ = (size_t) row_stride_ * (height_ + 2);
+  data_ = AllocateAligned(size_);
+  origin_ = data_ + row_stride_ + lanes_;
+  Fill(0.0f);
+}
+
+EnsembleField2D::EnsembleField2D(EnsembleField2D &&other) noexcept: EnsembleField2D() {
+  Swap(other);
+}
+
+EnsembleField2D &EnsembleField2D::operator=(EnsembleField2D &&other) noexcept {
+  Swap(other);
+  return *this;
+}
+
+EnsembleField2D::~EnsembleField2D() {
+  if (data_) {
+    FreeAligned(data_);
+  }
+}
+
+void EnsembleField2D::Swap(EnsembleField2D &other) noexcept {
+  std::swap(width_, other.width_);
+  std::swap(height_, other.height_);
+  std::swap(members_, other.members_);
+  std::swap(lanes_, other.lanes_);
+  std::swap(row_stride_, other.row_stride_);
+  std::swap(size_, other.size_);
+  std::swap(data_, other.data_);
+  std::swap(origin_, other.origin_);
+}
+
+void EnsembleField2D::Fill(float value) {
+  std::fill(data_, data_ + size_, value);
+}
+
+void EnsembleField2D::FillMember(uint32_t member, float value) {
+  assert(member < members_);
+  for (auto cell = (size_t) member; cell < size_; cell += lanes_) {
+    data_[cell] = value;
+  }
+}
+
+void EnsembleField2D::CopyFrom(const EnsembleField2D &other) {
+  assert(other.width_ == width_ && other.height_ == height_ && other.lanes_ == lanes_);
+  std::memcpy(data_, other.data_, size_ * sizeof(float));
+}
+
+void EnsembleField2D::FillHalo(float x_edge_factor, float y_edge_factor) {
+  auto w = (int32_t) width_;
+  auto h = (int32_t) height_;
+  for (auto x = 0; x < w; ++x) {
+    ScaleLanes(Cell(x, 0), y_edge_factor, lanes_, Cell(x, -1));
+    ScaleLanes(Cell(x, h - 1), y_edge_factor, lanes_, Cell(x, h));
+  }
+  for (auto y = 0; y < h; ++y) {
+    ScaleLanes(Cell(0, y), x_edge_factor, lanes_, Cell(-1, y));
+    ScaleLanes(Cell(w - 1, y), x_edge_factor, lanes_, Cell(w, y));
+  }
+  AverageLanes(Cell(0, -1), Cell(-1, 0), lanes_, Cell(-1, -1));
+  AverageLanes(Cell(w - 1, -1), Cell(w, 0), lanes_, Cell(w, -1));
+  AverageLanes(Cell(0, h), Cell(-1, h - 1), lanes_, Cell(-1, h));
+  AverageLanes(Cell(w - 1, h), Cell(w, h - 1), lanes_, Cell(w, h));
+}
+
+void EnsembleField2D::CopyMemberTo(uint32_t member, std::vector<float> &dense) const {
+  assert(member < members_);
+  auto dense_width = width_ + 2;
+  dense.resize((size_t) dense_width * (height_ + 2));
+  auto *out = dense.data();
+  for (auto y = -1; y <= (int32_t) height_; ++y) {
+    const auto *cell = Cell(-1, y) + member;
+    for (auto x = 0u; x < dense_width; ++x) {
+      *out++ = cell[(size_t) x * lanes_];
+    }
+  }
+}
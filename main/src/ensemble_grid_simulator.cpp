@@ -0,0 +1,454 @@
+#include "ensemble_grid_simulator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+// As GridFluidSimulator
+const uint32_t NUM_GS_ITERS = 10;
+const float DEFAULT_PRESSURE_TOLERANCE = 1e-4f;
+const uint32_t DEFAULT_MAX_PRESSURE_ITERATIONS = 200;
+
+/*
+ * The per-cell kernels below work on every lane of a cell, with the arithmetic of their
+ * counterparts in grid_kernels.cpp and semi_lagrangian_advector.cpp applied lane by lane, so each
+ * member gets the result it would from GridFluidSimulator. Neighbouring cells are a whole cell of
+ * lanes apart, so the pointers never overlap.
+ */
+namespace {
+inline float Lerp(float from, float to, float pct) { return from + pct * (to - from); }
+
+// Cells of one colour in row y of a red-black Gauss-Seidel sweep: RedBlackSorRow with omega 1
+void RelaxRow(const EnsembleField2D &rhs,
+              const float *__restrict rhs_weight,
+              const float *__restrict neighbour_weight,
+              uint32_t colour,
+              int32_t y,
+              EnsembleField2D &u) {
+  auto w = (int32_t) u.Width();
+  auto lanes = u.Lanes();
+  for (auto x = (int32_t) ((colour + y) & 1); x < w; x += 2) {
+    const auto *__restrict left = u.Cell(x - 1, y);
+    const auto *__restrict right = u.Cell(x + 1, y);
+    const auto *__restrict below = u.Cell(x, y - 1);
+    const auto *__restrict above = u.Cell(x, y + 1);
+    const auto *__restrict source = rhs.Cell(x, y);
+    auto *__restrict cell = u.Cell(x, y);
+    for (auto lane = 0u; lane < lanes; ++lane) {
+      auto gs = rhs_weight[lane] * source[lane]
+                + neighbour_weight[lane] * (left[lane] + right[lane] + below[lane] + above[lane]);
+      auto delta = gs - cell[lane];
+      cell[lane] += delta;
+    }
+  }
+}
+
+// Advect density and velocity for every cell of row y, each lane along its own velocity
+void AdvectRow(const EnsembleField2D &density,
+               const EnsembleField2D &velocity_x,
+               const EnsembleField2D &velocity_y,
+               const float *__restrict delta_t,
+               int32_t y,
+               EnsembleField2D &next_density,
+               EnsembleField2D &next_velocity_x,
+               EnsembleField2D &next_velocity_y) {
+  auto w = (int32_t) density.Width();
+  auto h = (int32_t) density.Height();
+  auto lanes = density.Lanes();
+  auto row_stride = (intptr_t) density.RowStride();
+  const auto *__restrict density_origin = density.Cell(0, 0);
+  const auto *__restrict velocity_x_origin = velocity_x.Cell(0, 0);
+  const auto *__restrict velocity_y_origin = velocity_y.Cell(0, 0);
+  for (auto x = 0; x < w; ++x) {
+    const auto *__restrict vx = velocity_x.Cell(x, y);
+    const auto *__restrict vy = velocity_y.Cell(x, y);
+    auto *__restrict out_density = next_density.Cell(x, y);
+    auto *__restrict out_velocity_x = next_velocity_x.Cell(x, y);
+    auto *__restrict out_velocity_y = next_velocity_y.Cell(x, y);
+    for (auto lane = 0u; lane < lanes; ++lane) {
+      // Trace() for a domain inside walls
+      auto source_x = ((float) x + 0.5f) - vx[lane] * delta_t[lane];
+      auto source_y = ((float) y + 0.5f) - vy[lane] * delta_t[lane];
+      source_x = std::max(-0.5f, std::min((float) w + 0.5f, source_x));
+      source_y = std::max(-0.5f, std::min((float) h + 0.5f, source_y));
+      auto base_x = std::min(std::floor(source_x - 0.5f), (float) (w - 1));
+      auto base_y = std::min(std::floor(source_y - 0.5f), (float) (h - 1));
+      auto frac_x = source_x - base_x - 0.5f;
+      auto frac_y = source_y - base_y - 0.5f;
+
+      auto btm = (intptr_t) base_y * row_stride + (intptr_t) base_x * lanes + lane;
+      auto top = btm + row_stride;
+      auto right = (intptr_t) lanes;
+      out_density[lane] = Lerp(Lerp(density_origin[btm], density_origin[btm + right], frac_x),
+                               Lerp(density_origin[top], density_origin[top + right], frac_x), frac_y);
+      out_velocity_x[lane] = Lerp(Lerp(velocity_x_origin[btm], velocity_x_origin[btm + right], frac_x),
+                                  Lerp(velocity_x_origin[top], velocity_x_origin[top + right], frac_x), frac_y);
+      out_velocity_y[lane] = Lerp(Lerp(velocity_y_origin[btm], velocity_y_origin[btm + right], frac_x),
+                                  Lerp(velocity_y_origin[top], velocity_y_origin[top + right], frac_x), frac_y);
+    }
+  }
+}
+
+// Divergence of row y, adding the square of each lane's values to its row sum
+void DivergenceRow(const EnsembleField2D &velocity_x,
+                   const EnsembleField2D &velocity_y,
+                   int32_t y,
+                   double *__restrict row_sums,
+                   EnsembleField2D &divergence) {
+  auto w = (int32_t) divergence.Width();
+  auto lanes = divergence.Lanes();
+  std::fill(row_sums, row_sums + lanes, 0.0);
+  for (auto x = 0; x < w; ++x) {
+    const auto *__restrict vx_left = velocity_x.Cell(x - 1, y);
+    const auto *__restrict vx_right = velocity_x.Cell(x + 1, y);
+    const auto *__restrict vy_below = velocity_y.Cell(x, y - 1);
+    const auto *__restrict vy_above = velocity_y.Cell(x, y + 1);
+    auto *__restrict div = divergence.Cell(x, y);
+    for (auto lane = 0u; lane < lanes; ++lane) {
+      div[lane] = (vx_right[lane] - vx_left[lane] + vy_above[lane] - vy_below[lane]) * 0.5f;
+      row_sums[lane] += (double) div[lane] * (double) div[lane];
+    }
+  }
+}
+
+// Jacobi sweep of row y for the active lanes; the others are copied. Adds the squared changes.
+void JacobiRow(const EnsembleField2D &divergence,
+               const EnsembleField2D &pressure,
+               const float *__restrict active,
+               int32_t y,
+               double *__restrict row_sums,
+               EnsembleField2D &next) {
+  auto w = (int32_t) next.Width();
+  auto lanes = next.Lanes();
+  std::fill(row_sums, row_sums + lanes, 0.0);
+  for (auto x = 0; x < w; ++x) {
+    const auto *__restrict left = pressure.Cell(x - 1, y);
+    const auto *__restrict right = pressure.Cell(x + 1, y);
+    const auto *__restrict below = pressure.Cell(x, y - 1);
+    const auto *__restrict above = pressure.Cell(x, y + 1);
+    const auto *__restrict p = pressure.Cell(x, y);
+    const auto *__restrict div = divergence.Cell(x, y);
+    auto *__restrict p_next = next.Cell(x, y);
+    for (auto lane = 0u; lane < lanes; ++lane) {
+      auto p_new = (left[lane] + right[lane] + below[lane] + above[lane] - div[lane]) * 0.25f;
+      auto change = (double) (p_new - p[lane]);
+      row_sums[lane] += change * change;
+      p_next[lane] = (active[lane] != 0.0f) ? p_new : p[lane];
+    }
+  }
+}
+
+void ProjectRow(const EnsembleField2D &pressure, int32_t y, EnsembleField2D &velocity_x, EnsembleField2D &velocity_y) {
+  auto w = (int32_t) pressure.Width();
+  auto lanes = pressure.Lanes();
+  for (auto x = 0; x < w; ++x) {
+    const auto *__restrict left = pressure.Cell(x - 1, y);
+    const auto *__restrict right = pressure.Cell(x + 1, y);
+    const auto *__restrict below = pressure.Cell(x, y - 1);
+    const auto *__restrict above = pressure.Cell(x, y + 1);
+    auto *__restrict vx = velocity_x.Cell(x, y);
+    auto *__restrict vy = velocity_y.Cell(x, y);
+    for (auto lane = 0u; lane < lanes; ++lane) {
+      vx[lane] -= (right[lane] - left[lane]) * 0.5f;
+      vy[lane] -= (above[lane] - below[lane]) * 0.5f;
+    }
+  }
+}
+}
+
+EnsembleGridSimulator::EnsembleGridSimulator(uint32_t dim_x,        //
+                                             uint32_t dim_y,        //
+                                             uint32_t num_members,  //
+                                             float delta_t,         //
+                                             float diffusion_rate   //
+)                                                                   //
+        : dim_x_{dim_x}                                             //
+        , dim_y_{dim_y}                                             //
+        , num_members_{num_members}                                 //
+        , pressure_tolerance_{DEFAULT_PRESSURE_TOLERANCE}           //
+        , max_pressure_iterations_{DEFAULT_MAX_PRESSURE_ITERATIONS} //
+        , thread_pool_{std::make_unique<ThreadPool>(0)}             //
+{
+  if (dim_x < 3 || dim_y < 3) {
+    throw std::runtime_error("Width and height must be at least 3 to leave an interior");
+  }
+  if (num_members == 0) {
+    throw std::runtime_error("An ensemble needs at least one member");
+  }
+  density_ = EnsembleField2D(dim_x - 2, dim_y - 2, num_members);
+  velocity_x_ = EnsembleField2D(dim_x - 2, dim_y - 2, num_members);
+  velocity_y_ = EnsembleField2D(dim_x - 2, dim_y - 2, num_members);
+  pressure_ = EnsembleField2D(dim_x - 2, dim_y - 2, num_members);
+  temp_pressure_ = EnsembleField2D(dim_x - 2, dim_y - 2, num_members);
+  divergence_ = EnsembleField2D(dim_x - 2, dim_y - 2, num_members);
+  temp_density_ = EnsembleField2D(dim_x - 2, dim_y - 2, num_members);
+  temp_velocity_x_ = EnsembleField2D(dim_x - 2, dim_y - 2, num_members);
+  temp_velocity_y_ = EnsembleField2D(dim_x - 2, dim_y - 2, num_members);
+
+  auto lanes = density_.Lanes();
+  delta_t_.assign(lanes, 0.0f);
+  diffusion_rate_.assign(lanes, 0.0f);
+  std::fill(delta_t_.begin(), delta_t_.begin() + num_members, delta_t);
+  std::fill(diffusion_rate_.begin(), diffusion_rate_.begin() + num_members, diffusion_rate);
+  rhs_weight_.assign(lanes, 0.0f);
+  neighbour_weight_.assign(lanes, 0.0f);
+  active_.assign(lanes, 0.0f);
+  rhs_norm_.assign(lanes, 0.0);
+  lane_sums_.assign(lanes, 0.0);
+  row_sums_.assign((size_t) density_.Height() * lanes, 0.0);
+  last_pressure_solve_.assign(num_members, {0, 0.0f});
+  sources_.resize(num_members);
+  density_view_.resize((size_t) dim_x * dim_y, 0.0f);
+  velocity_x_view_.resize((size_t) dim_x * dim_y, 0.0f);
+  velocity_y_view_.resize((size_t) dim_x * dim_y, 0.0f);
+}
+
+void EnsembleGridSimulator::CheckMember(uint32_t member) const {
+  if (member >= num_members_) {
+    throw std::out_of_range("There is no ensemble member with that index");
+  }
+}
+
+void EnsembleGridSimulator::CheckCell(uint32_t x, uint32_t y) const {
+  if (x >= dim_x_ || y >= dim_y_) {
+    throw std::out_of_range("Cell is outside the grid");
+  }
+}
+
+void EnsembleGridSimulator::SetDeltaT(uint32_t member, float delta_t) {
+  CheckMember(member);
+  delta_t_[member] = delta_t;
+}
+
+float EnsembleGridSimulator::DeltaT(uint32_t member) const {
+  CheckMember(member);
+  return delta_t_[member];
+}
+
+void EnsembleGridSimulator::SetDiffusionRate(uint32_t member, float diffusion_rate) {
+  CheckMember(member);
+  diffusion_rate_[member] = diffusion_rate;
+}
+
+float EnsembleGridSimulator::DiffusionRate(uint32_t member) const {
+  CheckMember(member);
+  return diffusion_rate_[member];
+}
+
+void EnsembleGridSimulator::SetPressureTolerance(float tolerance) {
+  pressure_tolerance_ = tolerance;
+}
+
+void EnsembleGridSimulator::SetMaxPressureIterations(uint32_t max_iterations) {
+  max_pressure_iterations_ = max_iterations;
+}
+
+void EnsembleGridSimulator::SetNumThreads(uint32_t num_threads) {
+  thread_pool_ = std::make_unique<ThreadPool>(num_threads);
+}
+
+void EnsembleGridSimulator::AddDensity(uint32_t member, uint32_t x, uint32_t y, float amount) {
+  CheckMember(member);
+  CheckCell(x, y);
+  density_.Cell((int32_t) x - 1, (int32_t) y - 1)[member] += amount;
+}
+
+void EnsembleGridSimulator::AddSource(uint32_t member,
+                                      uint32_t x,
+                                      uint32_t y,
+                                      float amount,
+                                      float velocity_x,
+                                      float velocity_y) {
+  CheckMember(member);
+  CheckCell(x, y);
+  sources_[member][y * dim_x_ + x] = {amount, velocity_x, velocity_y};
+}
+
+void EnsembleGridSimulator::ClearSources(uint32_t member) {
+  CheckMember(member);
+  sources_[member].clear();
+}
+
+const std::vector<float> &EnsembleGridSimulator::Density(uint32_t member) const {
+  CheckMember(member);
+  density_.CopyMemberTo(member, density_view_);
+  return density_view_;
+}
+
+const std::vector<float> &EnsembleGridSimulator::VelocityX(uint32_t member) const {
+  CheckMember(member);
+  velocity_x_.CopyMemberTo(member, velocity_x_view_);
+  return velocity_x_view_;
+}
+
+const std::vector<float> &EnsembleGridSimulator::VelocityY(uint32_t member) const {
+  CheckMember(member);
+  velocity_y_.CopyMemberTo(member, velocity_y_view_);
+  return velocity_y_view_;
+}
+
+const PoissonSolverStats &EnsembleGridSimulator::LastPressureSolve(uint32_t member) const {
+  CheckMember(member);
+  return last_pressure_solve_[member];
+}
+
+void EnsembleGridSimulator::ProcessSources() {
+  for (auto member = 0u; member < num_members_; ++member) {
+    for (const auto &source : sources_[member]) {
+      auto x = (int32_t) (source.first % dim_x_) - 1;
+      auto y = (int32_t) (source.first / dim_x_) - 1;
+      density_.Cell(x, y)[member] = std::get<0>(source.second);
+      velocity_x_.Cell(x, y)[member] = std::get<1>(source.second);
+      velocity_y_.Cell(x, y)[member] = std::get<2>(source.second);
+    }
+  }
+}
+
+void EnsembleGridSimulator::Diffuse(const EnsembleField2D &current, EnsembleField2D &next) {
+  next.CopyFrom(current);
+  for (auto lane = 0u; lane < num_members_; ++lane) {
+    auto k = delta_t_[lane] * diffusion_rate_[lane];
+    auto inv_k1 = 1.0f / (k + 1.0f);
+    rhs_weight_[lane] = inv_k1;
+    neighbour_weight_[lane] = 0.25f * k * inv_k1;
+  }
+
+  auto h = (int32_t) next.Height();
+  auto row_cells = next.Width() * next.Lanes();
+  for (auto iter = 0u; iter < NUM_GS_ITERS; ++iter) {
+    for (auto colour = 0u; colour < 2; ++colour) {
+      thread_pool_->ParallelFor(0, h, row_cells, [&](int32_t y_begin, int32_t y_end) {
+        for (auto y = y_begin; y < y_end; ++y) {
+          RelaxRow(current, rhs_weight_.data(), neighbour_weight_.data(), colour, y, next);
+        }
+      });
+    }
+    CorrectBoundaryDensities(next);
+  }
+}
+
+void EnsembleGridSimulator::Advect() {
+  auto h = (int32_t) density_.Height();
+  thread_pool_->ParallelFor(0, h, 3 * density_.Width() * density_.Lanes(), [&](int32_t y_begin, int32_t y_end) {
+    for (auto y = y_begin; y < y_end; ++y) {
+      AdvectRow(density_, velocity_x_, velocity_y_, delta_t_.data(), y, temp_density_, temp_velocity_x_,
+                temp_velocity_y_);
+    }
+  });
+  CorrectBoundaryDensities(temp_density_);
+  CorrectBoundaryVelocities(temp_velocity_x_, temp_velocity_y_);
+  density_.Swap(temp_density_);
+  velocity_x_.Swap(temp_velocity_x_);
+  velocity_y_.Swap(temp_velocity_y_);
+}
+
+void EnsembleGridSimulator::SumRows() {
+  auto lanes = density_.Lanes();
+  std::fill(lane_sums_.begin(), lane_sums_.end(), 0.0);
+  for (auto y = 0u; y < density_.Height(); ++y) {
+    const auto *row_sums = row_sums_.data() + (size_t) y * lanes;
+    for (auto lane = 0u; lane < lanes; ++lane) {
+      lane_sums_[lane] += row_sums[lane];
+    }
+  }
+}
+
+void EnsembleGridSimulator::SuppressDivergence() {
+  auto h = (int32_t) velocity_x_.Height();
+  auto row_cells = velocity_x_.Width() * velocity_x_.Lanes();
+  thread_pool_->ParallelFor(0, h, row_cells, [&](int32_t y_begin, int32_t y_end) {
+    for (auto y = y_begin; y < y_end; ++y) {
+      DivergenceRow(velocity_x_, velocity_y_, y, row_sums_.data() + (size_t) y * divergence_.Lanes(), divergence_);
+    }
+  });
+  ComputePressure();
+  thread_pool_->ParallelFor(0, h, row_cells, [&](int32_t y_begin, int32_t y_end) {
+    for (auto y = y_begin; y < y_end; ++y) {
+      ProjectRow(pressure_, y, velocity_x_, velocity_y_);
+    }
+  });
+  CorrectBoundaryVelocities(velocity_x_, velocity_y_);
+}
+
+/*
+ * GridFluidSimulator::ComputePressureJacobi for every member, warm started. A member leaves the
+ * active set once its own residual is within tolerance, and the sweeps stop when none is left.
+ * The row sums of the divergence pass give the norms of the right hand sides.
+ */
+void EnsembleGridSimulator::ComputePressure() {
+  SumRows();
+  auto num_active = 0u;
+  for (auto member = 0u; member < num_members_; ++member) {
+    rhs_norm_[member] = std::sqrt(lane_sums_[member]);
+    if (rhs_norm_[member] == 0.0) {
+      pressure_.FillMember(member, 0.0f);
+      active_[member] = 0.0f;
+      last_pressure_solve_[member] = {0, 0.0f};
+    } else {
+      active_[member] = 1.0f;
+      last_pressure_solve_[member] = {0, 1.0f};
+      ++num_active;
+    }
+  }
+
+  auto lanes = pressure_.Lanes();
+  auto h = (int32_t) pressure_.Height();
+  auto iter = 0u;
+  while (num_active > 0 && iter < max_pressure_iterations_) {
+    thread_pool_->ParallelFor(0, h, pressure_.Width() * lanes, [&](int32_t y_begin, int32_t y_end) {
+      for (auto y = y_begin; y < y_end; ++y) {
+        JacobiRow(divergence_, pressure_, active_.data(), y, row_sums_.data() + (size_t) y * lanes, temp_pressure_);
+      }
+    });
+    // Both buffers hold zero in the halo so they can trade places
+    pressure_.Swap(temp_pressure_);
+    ++iter;
+
+    SumRows();
+    for (auto member = 0u; member < num_members_; ++member) {
+      if (active_[member] == 0.0f) {
+        continue;
+      }
+      auto relative_residual = 4.0 * std::sqrt(lane_sums_[member]) / rhs_norm_[member];
+      last_pressure_solve_[member] = {iter, (float) relative_residual};
+      if (relative_residual <= pressure_tolerance_) {
+        active_[member] = 0.0f;
+        --num_active;
+      }
+    }
+  }
+}
+
+/*
+ * Zero gradient at the walls
+ */
+void EnsembleGridSimulator::CorrectBoundaryDensities(EnsembleField2D &densities) const {
+  densities.FillHalo(1.0f, 1.0f);
+}
+
+/*
+ * No flow through the walls; tangential velocity is copied
+ */
+void EnsembleGridSimulator::CorrectBoundaryVelocities(EnsembleField2D &velocity_x, EnsembleField2D &velocity_y) const {
+  velocity_x.FillHalo(0.0f, 1.0f);
+  velocity_y.FillHalo(1.0f, 0.0f);
+}
+
+void EnsembleGridSimulator::Simulate() {
+  ProcessSources();
+  CorrectBoundaryDensities(density_);
+  CorrectBoundaryVelocities(velocity_x_, velocity_y_);
+
+  Diffuse(density_, temp_density_);
+  density_.Swap(temp_density_);
+
+  Diffuse(velocity_x_, temp_velocity_x_);
+  Diffuse(velocity_y_, temp_velocity_y_);
+  CorrectBoundaryVelocities(temp_velocity_x_, temp_velocity_y_);
+  velocity_x_.Swap(temp_velocity_x_);
+  velocity_y_.Swap(temp_velocity_y_);
+
+  Advect();
+
+  SuppressDivergence();
+}
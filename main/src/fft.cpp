@@ -0,0 +1,153 @@
+#include "fft.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+using Complex = std::complex<float>;
+
+// std::complex multiplication guards against infinities and NaNs, which costs a library call
+inline Complex Mul(Complex a, Complex b) {
+  return {a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real()};
+}
+
+// Multiply by -i
+inline Complex RotateNegative(Complex a) { return {a.imag(), -a.real()}; }
+
+Complex UnitRoot(uint64_t numerator, uint64_t denominator) {
+  auto angle = -2.0 * M_PI * (double) numerator / (double) denominator;
+  return {(float) std::cos(angle), (float) std::sin(angle)};
+}
+
+std::vector<uint32_t> Factorise(uint32_t length) {
+  std::vector<uint32_t> radices;
+  while (length % 4 == 0) {
+    radices.push_back(4);
+    length /= 4;
+  }
+  if (length % 2 == 0) {
+    radices.push_back(2);
+    length /= 2;
+  }
+  for (auto factor = 3u; factor * factor <= length; factor += 2) {
+    while (length % factor == 0) {
+      radices.push_back(factor);
+      length /= factor;
+    }
+  }
+  if (length > 1) {
+    radices.push_back(length);
+  }
+  return radices;
+}
+}
+
+FftPlan::FftPlan(uint32_t length) //
+        : length_{length}          //
+{
+  if (length == 0) {
+    throw std::runtime_error("FFT length must be positive");
+  }
+  auto span = 1u;
+  for (auto radix : Factorise(length)) {
+    Stage stage{radix, span, twiddles_.size(), roots_.size()};
+    for (auto q = 1u; q < radix; ++q) {
+      for (auto k = 0u; k < span; ++k) {
+        twiddles_.push_back(UnitRoot((uint64_t) q * k, (uint64_t) span * radix));
+      }
+    }
+    if (radix != 2 && radix != 4) {
+      for (auto j = 0u; j < radix; ++j) {
+        roots_.push_back(UnitRoot(j, radix));
+      }
+    }
+    stages_.push_back(stage);
+    span *= radix;
+  }
+}
+
+void FftPlan::Forward(Complex *data, Complex *scratch) const {
+  Run(data, scratch);
+}
+
+// Conjugating before and after a forward transform flips the sign of the exponent
+void FftPlan::Inverse(Complex *data, Complex *scratch) const {
+  for (auto t = 0u; t < length_; ++t) {
+    data[t] = std::conj(data[t]);
+  }
+  Run(data, scratch);
+  for (auto t = 0u; t < length_; ++t) {
+    data[t] = std::conj(data[t]);
+  }
+}
+
+/*
+ * Decimation in time. Before a stage of radix p and span L, input[j * L + k] holds bin k of the
+ * length L transform of the samples x[j + m t], where m = n / L. The stage combines the p
+ * sub-transforms with residues j, j + m / p, ... into one of length L * p for each residue j
+ * below m / p, writing them out contiguously. The final stage leaves the full transform in order.
+ */
+void FftPlan::Run(Complex *data, Complex *scratch) const {
+  auto *input = data;
+  auto *output = scratch;
+  for (const auto &stage : stages_) {
+    auto radix = stage.radix;
+    auto span = stage.span;
+    auto num_groups = length_ / (span * radix);
+    const auto *twiddles = twiddles_.data() + stage.twiddle_offset;
+    for (auto j = 0u; j < num_groups; ++j) {
+      const auto *in = input + (size_t) j * span;
+      auto *out = output + (size_t) j * span * radix;
+      auto in_step = (size_t) num_groups * span;
+      if (radix == 2) {
+        for (auto k = 0u; k < span; ++k) {
+          auto a0 = in[k];
+          auto a1 = Mul(twiddles[k], in[in_step + k]);
+          out[k] = a0 + a1;
+          out[span + k] = a0 - a1;
+        }
+      } else if (radix == 4) {
+        for (auto k = 0u; k < span; ++k) {
+          auto a0 = in[k];
+          auto a1 = Mul(twiddles[k], in[in_step + k]);
+          auto a2 = Mul(twiddles[span + k], in[2 * in_step + k]);
+          auto a3 = Mul(twiddles[2 * span + k], in[3 * in_step + k]);
+          auto t0 = a0 + a2;
+          auto t1 = a0 - a2;
+          auto t2 = a1 + a3;
+          auto t3 = RotateNegative(a1 - a3);
+          out[k] = t0 + t2;
+          out[span + k] = t1 + t3;
+          out[2 * span + k] = t0 - t2;
+          out[3 * span + k] = t1 - t3;
+        }
+      } else {
+        // Each input is read by exactly one butterfly, so it can take its twiddle in place
+        const auto *roots = roots_.data() + stage.root_offset;
+        auto *twiddled = input + (size_t) j * span;
+        for (auto k = 0u; k < span; ++k) {
+          for (auto q = 1u; q < radix; ++q) {
+            twiddled[q * in_step + k] = Mul(twiddles[(q - 1) * span + k], twiddled[q * in_step + k]);
+          }
+          for (auto r = 0u; r < radix; ++r) {
+            auto sum = twiddled[k];
+            auto root = 0u;
+            for (auto q = 1u; q < radix; ++q) {
+              root += r;
+              if (root >= radix) {
+                root -= radix;
+              }
+              sum += Mul(roots[root], twiddled[q * in_step + k]);
+            }
+            out[r * span + k] = sum;
+          }
+        }
+      }
+    }
+    std::swap(input, output);
+  }
+  if (input != data) {
+    std::copy(input, input + length_, data);
+  }
+}
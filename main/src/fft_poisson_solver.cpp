@@ -0,0 +1,201 @@
+#include "fft_poisson_solver.h"
+
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+using Complex = std::complex<float>;
+
+// Multiply by -i/2
+inline Complex HalfRotateNegative(Complex a) { return {0.5f * a.imag(), -0.5f * a.real()}; }
+}
+
+FftPoissonSolver::FftPoissonSolver(uint32_t width, uint32_t height) //
+        : width_{width}                                              //
+        , height_{height}                                            //
+        , num_bins_{width / 2 + 1}                                   //
+        , thread_pool_{nullptr}                                      //
+{
+  if (width == 0 || height == 0) {
+    throw std::runtime_error("FFT Poisson solver needs at least one cell");
+  }
+  row_plan_ = std::make_shared<const FftPlan>(width);
+  column_plan_ = (height == width) ? row_plan_ : std::make_shared<const FftPlan>(height);
+  spectrum_.resize((size_t) (height + 1) * num_bins_);
+  transposed_.resize(spectrum_.size());
+
+  inverse_symbol_.resize((size_t) num_bins_ * height);
+  auto scale = 1.0 / ((double) width * (double) height);
+  for (auto kx = 0u; kx < num_bins_; ++kx) {
+    auto symbol_x = 2.0 * std::cos(2.0 * M_PI * kx / width) - 2.0;
+    for (auto ky = 0u; ky < height; ++ky) {
+      auto symbol = symbol_x + 2.0 * std::cos(2.0 * M_PI * ky / height) - 2.0;
+      inverse_symbol_[(size_t) kx * height + ky] = (kx == 0 && ky == 0) ? 0.0f : (float) (scale / symbol);
+    }
+  }
+}
+
+void FftPoissonSolver::SetThreadPool(ThreadPool *thread_pool) {
+  thread_pool_ = thread_pool;
+}
+
+PoissonSolverStats FftPoissonSolver::Solve(const Field2D &divergence, Field2D &pressure) {
+  assert(divergence.Width() == width_ && divergence.Height() == height_);
+  assert(pressure.Width() == width_ && pressure.Height() == height_);
+  auto rhs_norm = Norm(divergence);
+  if (rhs_norm == 0.0) {
+    pressure.Fill(0.0f);
+    return {0, 0.0f};
+  }
+
+  ForwardRows(divergence);
+  Transpose(spectrum_.data(), height_, num_bins_, transposed_.data());
+  TransformColumns(false);
+  ParallelFor(thread_pool_, 0, (int32_t) num_bins_, height_, [&](int32_t kx_begin, int32_t kx_end) {
+    for (auto i = (size_t) kx_begin * height_; i < (size_t) kx_end * height_; ++i) {
+      transposed_[i] *= inverse_symbol_[i];
+    }
+  });
+  TransformColumns(true);
+  Transpose(transposed_.data(), num_bins_, height_, spectrum_.data());
+  InverseRows(pressure);
+
+  pressure.WrapHalo();
+  return {1, (float) (ResidualNorm(divergence, pressure) / rhs_norm)};
+}
+
+/*
+ * For z = a + ib with a and b real, the transforms of a and b are recovered from Z as
+ *   A[k] = (Z[k] + conj(Z[n-k])) / 2,  B[k] = (Z[k] - conj(Z[n-k])) / 2i
+ * and only bins up to n / 2 are kept, the rest being their conjugates.
+ */
+void FftPoissonSolver::ForwardRows(const Field2D &divergence) {
+  auto w = (int32_t) width_;
+  auto h = (int32_t) height_;
+  auto num_pairs = (h + 1) / 2;
+  ParallelFor(thread_pool_, 0, num_pairs, 2 * width_, [&](int32_t pair_begin, int32_t pair_end) {
+    for (auto pair = pair_begin; pair < pair_end; ++pair) {
+      auto y = 2 * pair;
+      // The pair's two spectrum rows are the scratch, and are then overwritten with the result
+      auto *z = transposed_.data() + (size_t) y * num_bins_;
+      auto *rows = spectrum_.data() + (size_t) y * num_bins_;
+      const auto *a = divergence.Row(y);
+      const auto *b = (y + 1 < h) ? divergence.Row(y + 1) : nullptr;
+      for (auto x = 0; x < w; ++x) {
+        z[x] = {a[x], b ? b[x] : 0.0f};
+      }
+      row_plan_->Forward(z, rows);
+
+      for (auto k = 0; k < (int32_t) num_bins_; ++k) {
+        auto z_mirror = std::conj(z[(k == 0) ? 0 : w - k]);
+        rows[k] = 0.5f * (z[k] + z_mirror);
+        rows[num_bins_ + k] = HalfRotateNegative(z[k] - z_mirror);
+      }
+    }
+  });
+}
+
+/*
+ * The reverse of ForwardRows: Z[k] = A[k] + iB[k], with bins above n / 2 taken from the conjugates.
+ * The imaginary parts of the constant and Nyquist bins are rounding noise from the column
+ * transforms and are dropped so that they cannot leak between the two rows.
+ */
+void FftPoissonSolver::InverseRows(Field2D &pressure) {
+  auto w = (int32_t) width_;
+  auto h = (int32_t) height_;
+  auto num_pairs = (h + 1) / 2;
+  ParallelFor(thread_pool_, 0, num_pairs, 2 * width_, [&](int32_t pair_begin, int32_t pair_end) {
+    for (auto pair = pair_begin; pair < pair_end; ++pair) {
+      auto y = 2 * pair;
+      auto *z = transposed_.data() + (size_t) y * num_bins_;
+      auto *rows = spectrum_.data() + (size_t) y * num_bins_;
+      const auto *a = rows;
+      const auto *b = rows + num_bins_;
+      for (auto k = 0; k < w; ++k) {
+        Complex a_k;
+        Complex b_k;
+        if (k < (int32_t) num_bins_) {
+          a_k = a[k];
+          b_k = b[k];
+          if (k == 0 || 2 * k == w) {
+            a_k = a_k.real();
+            b_k = b_k.real();
+          }
+        } else {
+          a_k = std::conj(a[w - k]);
+          b_k = std::conj(b[w - k]);
+        }
+        z[k] = {a_k.real() - b_k.imag(), a_k.imag() + b_k.real()};
+      }
+      row_plan_->Inverse(z, rows);
+
+      auto *p_a = pressure.Row(y);
+      for (auto x = 0; x < w; ++x) {
+        p_a[x] = z[x].real();
+      }
+      if (y + 1 < h) {
+        auto *p_b = pressure.Row(y + 1);
+        for (auto x = 0; x < w; ++x) {
+          p_b[x] = z[x].imag();
+        }
+      }
+    }
+  });
+}
+
+void FftPoissonSolver::Transpose(const Complex *from, uint32_t from_rows, uint32_t from_columns, Complex *to) {
+  ParallelFor(thread_pool_, 0, (int32_t) from_columns, from_rows, [&](int32_t column_begin, int32_t column_end) {
+    for (auto column = column_begin; column < column_end; ++column) {
+      auto *to_row = to + (size_t) column * from_rows;
+      for (auto row = 0u; row < from_rows; ++row) {
+        to_row[row] = from[(size_t) row * from_columns + column];
+      }
+    }
+  });
+}
+
+void FftPoissonSolver::TransformColumns(bool inverse) {
+  ParallelFor(thread_pool_, 0, (int32_t) num_bins_, height_, [&](int32_t kx_begin, int32_t kx_end) {
+    for (auto kx = kx_begin; kx < kx_end; ++kx) {
+      auto *column = transposed_.data() + (size_t) kx * height_;
+      auto *scratch = spectrum_.data() + (size_t) kx * height_;
+      if (inverse) {
+        column_plan_->Inverse(column, scratch);
+      } else {
+        column_plan_->Forward(column, scratch);
+      }
+    }
+  });
+}
+
+double FftPoissonSolver::Norm(const Field2D &field) const {
+  auto w = (int32_t) width_;
+  return std::sqrt(ParallelSum(thread_pool_, 0, (int32_t) height_, width_, [&](int32_t y_begin, int32_t y_end) {
+    auto sum = 0.0;
+    for (auto y = y_begin; y < y_end; ++y) {
+      const auto *row = field.Row(y);
+      for (auto x = 0; x < w; ++x) {
+        sum += (double) row[x] * (double) row[x];
+      }
+    }
+    return sum;
+  }));
+}
+
+double FftPoissonSolver::ResidualNorm(const Field2D &divergence, const Field2D &pressure) const {
+  auto w = (int32_t) width_;
+  return std::sqrt(ParallelSum(thread_pool_, 0, (int32_t) height_, width_, [&](int32_t y_begin, int32_t y_end) {
+    auto sum = 0.0;
+    for (auto y = y_begin; y < y_end; ++y) {
+      const auto *p = pressure.Row(y);
+      const auto *p_below = pressure.Row(y - 1);
+      const auto *p_above = pressure.Row(y + 1);
+      const auto *div = divergence.Row(y);
+      for (auto x = 0; x < w; ++x) {
+        auto r = (double) div[x] - ((double) p[x - 1] + p[x + 1] + p_below[x] + p_above[x] - 4.0 * p[x]);
+        sum += r * r;
+      }
+    }
+    return sum;
+  }));
+}
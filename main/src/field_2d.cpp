@@ -0,0 +1,254 @@
+#include "field_2d.h"
+#include "precision_policy.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+template<typename T>
+BasicField2D<T>::BasicField2D()
+        : width_{0}        //
+        , height_{0}       //
+        , halo_{0}         //
+        , stride_{0}       //
+        , size_{0}         //
+        , data_{nullptr}   //
+        , origin_{nullptr} //
+{}
+
+template<typename T>
+BasicField2D<T>::BasicField2D(uint32_t width, uint32_t height, uint32_t halo) //
+        : width_{width}                                                       //
+        , height_{height}                                                     //
+        , halo_{halo}                                                         //
+{
+  if (width == 0 || height == 0) {
+    throw std::runtime_error("Field width and height must be non-zero");
+  }
+
+  // Left padding keeps cell (0, y) aligned; right padding rounds the row up to whole vectors
+  const auto alignment = (uint32_t) (FIELD_ALIGNMENT_BYTES / sizeof(T));
+  auto left_pad = RoundUp(halo_, alignment);
+  stride_ = RoundUp(left_pad + width_ + halo_, alignment);
+  size_ = (size_t) stride_ * (height_ + 2 * halo_);
+  // Rows are a whole number of alignment blocks, so the size is too
+  data_ = reinterpret_cast<T *>(AllocateAligned(size_ * sizeof(T) / sizeof(float)));
+  origin_ = data_ + (size_t) halo_ * stride_ + left_pad;
+  Fill(0.0f);
+}
+
+template<typename T>
+BasicField2D<T>::BasicField2D(BasicField2D &&other) noexcept: BasicField2D() {
+  Swap(other);
+}
+
+template<typename T>
+BasicField2D<T> &BasicField2D<T>::operator=(BasicField2D &&other) noexcept {
+  Swap(other);
+  return *this;
+}
+
+template<typename T>
+BasicField2D<T>::~BasicField2D() {
+  if (data_) {
+    FreeAligned(reinterpret_cast<float *>(data_));
+  }
+}
+
+template<typename T>
+void BasicField2D<T>::Swap(BasicField2D &other) noexcept {
+  std::swap(width_, other.width_);
+  std::swap(height_, other.height_);
+  std::swap(halo_, other.halo_);
+  std::swap(stride_, other.stride_);
+  std::swap(size_, other.size_);
+  std::swap(data_, other.data_);
+  std::swap(origin_, other.origin_);
+}
+
+template<typename T>
+void BasicField2D<T>::PlaceRows(ThreadPool *pool) {
+  if (!data_) {
+    return;
+  }
+  auto *placed = reinterpret_cast<T *>(AllocateAligned(size_ * sizeof(T) / sizeof(float)));
+  auto height = (int32_t) height_;
+  auto halo = (int32_t) halo_;
+  ParallelFor(pool, 0, height, width_, [&](int32_t y_begin, int32_t y_end) {
+    auto row_begin = (y_begin == 0) ? -halo : y_begin;
+    auto row_end = (y_end == height) ? height + halo : y_end;
+    auto offset = (size_t) (row_begin + halo) * stride_;
+    std::memcpy(placed + offset, data_ + offset, (size_t) (row_end - row_begin) * stride_ * sizeof(T));
+  });
+  FreeAligned(reinterpret_cast<float *>(data_));
+  origin_ = placed + (origin_ - data_);
+  data_ = placed;
+}
+
+template<typename T>
+void BasicField2D<T>::AddPagePlacement(FieldPagePlacement &placement) const {
+  ::AddPagePlacement(data_, size_ * sizeof(T), placement);
+}
+
+template<typename T>
+void BasicField2D<T>::Fill(float value) {
+  std::fill(data_, data_ + size_, T(value));
+}
+
+template<typename T>
+void BasicField2D<T>::CopyFrom(const BasicField2D &other) {
+  assert(other.width_ == width_ && other.height_ == height_ && other.halo_ == halo_);
+  std::memcpy(data_, other.data_, size_ * sizeof(T));
+}
+
+template<typename T>
+void BasicField2D<T>::FillHalo(float x_edge_factor, float y_edge_factor) {
+  if (halo_ == 0) {
+    return;
+  }
+  auto w = (int32_t) width_;
+  auto h = (int32_t) height_;
+
+  // Top and bottom rows are contiguous
+  auto *bottom = Row(0);
+  auto *below = Row(-1);
+  auto *top = Row(h - 1);
+  auto *above = Row(h);
+  for (auto x = 0; x < w; ++x) {
+    below[x] = T(y_edge_factor * bottom[x]);
+    above[x] = T(y_edge_factor * top[x]);
+  }
+  for (auto y = 0; y < h; ++y) {
+    auto *row = Row(y);
+    row[-1] = T(x_edge_factor * row[0]);
+    row[w] = T(x_edge_factor * row[w - 1]);
+  }
+  below[-1] = T(0.5f * (below[0] + Row(0)[-1]));
+  below[w] = T(0.5f * (below[w - 1] + Row(0)[w]));
+  above[-1] = T(0.5f * (above[0] + Row(h - 1)[-1]));
+  above[w] = T(0.5f * (above[w - 1] + Row(h - 1)[w]));
+
+  // Replicate the first layer outwards
+  for (auto layer = 2; layer <= (int32_t) halo_; ++layer) {
+    for (auto y = 1 - layer; y < h + layer - 1; ++y) {
+      auto *row = Row(y);
+      row[-layer] = row[1 - layer];
+      row[w + layer - 1] = row[w + layer - 2];
+    }
+    std::memcpy(Row(-layer) - layer, Row(1 - layer) - layer, (w + 2 * layer) * sizeof(T));
+    std::memcpy(Row(h + layer - 1) - layer, Row(h + layer - 2) - layer, (w + 2 * layer) * sizeof(T));
+  }
+}
+
+template<typename T>
+void BasicField2D<T>::WrapHalo() {
+  assert(halo_ <= width_ && halo_ <= height_);
+  auto w = (int32_t) width_;
+  auto h = (int32_t) height_;
+  auto halo = (int32_t) halo_;
+
+  // Rows first, then columns over the full height so that the corners wrap in both directions
+  for (auto layer = 1; layer <= halo; ++layer) {
+    std::memcpy(Row(-layer), Row(h - layer), w * sizeof(T));
+    std::memcpy(Row(h + layer - 1), Row(layer - 1), w * sizeof(T));
+  }
+  for (auto y = -halo; y < h + halo; ++y) {
+    auto *row = Row(y);
+    for (auto layer = 1; layer <= halo; ++layer) {
+      row[-layer] = row[w - layer];
+      row[w + layer - 1] = row[layer - 1];
+    }
+  }
+}
+
+/*
+ * Columns over the interior rows first, then whole rows, corners included, so that a wrapping
+ * bottom or top copies the side halo of the rows it wraps from. Only the corners between two
+ * edges that do not wrap are left to fill after that.
+ */
+template<typename T>
+void BasicField2D<T>::FillHalo(const HaloFill &fill) {
+  assert(fill.left.wrap == fill.right.wrap && fill.bottom.wrap == fill.top.wrap);
+  if (halo_ == 0) {
+    return;
+  }
+  assert(halo_ <= width_ && halo_ <= height_);
+  auto w = (int32_t) width_;
+  auto h = (int32_t) height_;
+  auto halo = (int32_t) halo_;
+
+  const auto &left = fill.left;
+  const auto &right = fill.right;
+  for (auto y = 0; y < h; ++y) {
+    auto *row = Row(y);
+    if (left.wrap) {
+      for (auto layer = 1; layer <= halo; ++layer) {
+        row[-layer] = row[w - layer];
+        row[w + layer - 1] = row[layer - 1];
+      }
+    } else {
+      row[-1] = T(left.factor * row[0] + left.offset);
+      row[w] = T(right.factor * row[w - 1] + right.offset);
+      for (auto layer = 2; layer <= halo; ++layer) {
+        row[-layer] = row[1 - layer];
+        row[w + layer - 1] = row[w + layer - 2];
+      }
+    }
+  }
+
+  const auto &bottom = fill.bottom;
+  const auto &top = fill.top;
+  if (bottom.wrap) {
+    for (auto layer = 1; layer <= halo; ++layer) {
+      std::memcpy(Row(-layer) - halo, Row(h - layer) - halo, (w + 2 * halo) * sizeof(T));
+      std::memcpy(Row(h + layer - 1) - halo, Row(layer - 1) - halo, (w + 2 * halo) * sizeof(T));
+    }
+    return;
+  }
+  auto *below = Row(-1);
+  auto *above = Row(h);
+  const auto *first = Row(0);
+  const auto *last = Row(h - 1);
+  for (auto x = 0; x < w; ++x) {
+    below[x] = T(bottom.factor * first[x] + bottom.offset);
+    above[x] = T(top.factor * last[x] + top.offset);
+  }
+  if (left.wrap) {
+    for (auto layer = 1; layer <= halo; ++layer) {
+      below[-layer] = below[w - layer];
+      below[w + layer - 1] = below[layer - 1];
+      above[-layer] = above[w - layer];
+      above[w + layer - 1] = above[layer - 1];
+    }
+  } else {
+    below[-1] = T(0.5f * (below[0] + first[-1]));
+    below[w] = T(0.5f * (below[w - 1] + first[w]));
+    above[-1] = T(0.5f * (above[0] + last[-1]));
+    above[w] = T(0.5f * (above[w - 1] + last[w]));
+    for (auto layer = 2; layer <= halo; ++layer) {
+      below[-layer] = below[1 - layer];
+      below[w + layer - 1] = below[w + layer - 2];
+      above[-layer] = above[1 - layer];
+      above[w + layer - 1] = above[w + layer - 2];
+    }
+  }
+  for (auto layer = 2; layer <= halo; ++layer) {
+    std::memcpy(Row(-layer) - halo, Row(1 - layer) - halo, (w + 2 * halo) * sizeof(T));
+    std::memcpy(Row(h + layer - 1) - halo, Row(h + layer - 2) - halo, (w + 2 * halo) * sizeof(T));
+  }
+}
+
+template<typename T>
+void BasicField2D<T>::CopyTo(std::vector<float> &dense) const {
+  assert(halo_ > 0);
+  auto dense_width = width_ + 2;
+  dense.resize((size_t) dense_width * (height_ + 2));
+  for (auto y = -1; y <= (int32_t) height_; ++y) {
+    ConvertRow(Row(y) - 1, dense.data() + (size_t) (y + 1) * dense_width, dense_width);
+  }
+}
+
+template class BasicField2D<float>;
+template class BasicField2D<double>;
+template class BasicField2D<Half>;
@@ -0,0 +1,115 @@
+#include "field_3d.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+Field3D::Field3D()
+        : width_{0}         //
+        , height_{0}        //
+        , depth_{0}         //
+        , row_stride_{0}    //
+        , plane_stride_{0}  //
+        , size_{0}          //
+        , data_{nullptr}    //
+        , origin_{nullptr}  //
+{}
+
+Field3D::Field3D(uint32_t width, uint32_t height, uint32_t depth) //
+        : width_{width}                                            //
+        , height_{height}                                          //
+        , depth_{depth}                                            //
+{
+  if (width == 0 || height == 0 || depth == 0) {
+    throw std::runtime_error("Field width, height and depth must be non-zero");
+  }
+
+  // Left padding keeps cell (0, y, z) aligned; right padding rounds the row up to whole vectors
+  auto left_pad = FIELD_ALIGNMENT_FLOATS;
+  row_stride_ = RoundUp(left_pad + width_ + 1, FIELD_ALIGNMENT_FLOATS);
+  plane_stride_ = (size_t) row_stride_ * (height_ + 2);
+  size_ = plane_stride_ * (depth_ + 2);
+  data_ = AllocateAligned(size_);
+  origin_ = data_ + plane_stride_ + row_stride_ + left_pad;
+  Fill(0.0f);
+}
+
+Field3D::Field3D(Field3D &&other) noexcept: Field3D() {
+  Swap(other);
+}
+
+Field3D &Field3D::operator=(Field3D &&other) noexcept {
+  Swap(other);
+  return *this;
+}
+
+Field3D::~Field3D() {
+  if (data_) {
+    FreeAligned(data_);
+  }
+}
+
+void Field3D::Swap(Field3D &other) noexcept {
+  std::swap(width_, other.width_);
+  std::swap(height_, other.height_);
+  std::swap(depth_, other.depth_);
+  std::swap(row_stride_, other.row_stride_);
+  std::swap(plane_stride_, other.plane_stride_);
+  std::swap(size_, other.size_);
+  std::swap(data_, other.data_);
+  std::swap(origin_, other.origin_);
+}
+
+void Field3D::Fill(float value) {
+  std::fill(data_, data_ + size_, value);
+}
+
+void Field3D::CopyFrom(const Field3D &other) {
+  assert(other.width_ == width_ && other.height_ == height_ && other.depth_ == depth_);
+  std::memcpy(data_, other.data_, size_ * sizeof(float));
+}
+
+void Field3D::FillHalo(float x_edge_factor, float y_edge_factor, float z_edge_factor) {
+  auto w = (int32_t) width_;
+  auto h = (int32_t) height_;
+  auto d = (int32_t) depth_;
+
+  for (auto z = 0; z < d; ++z) {
+    for (auto y = 0; y < h; ++y) {
+      auto *row = Row(y, z);
+      row[-1] = x_edge_factor * row[0];
+      row[w] = x_edge_factor * row[w - 1];
+    }
+    auto *bottom = Row(0, z);
+    auto *below = Row(-1, z);
+    auto *top = Row(h - 1, z);
+    auto *above = Row(h, z);
+    for (auto x = -1; x <= w; ++x) {
+      below[x] = y_edge_factor * bottom[x];
+      above[x] = y_edge_factor * top[x];
+    }
+  }
+
+  // Whole planes, padding included, are contiguous from the start of their first halo row
+  auto plane_start = [&](int32_t z) { return Row(-1, z) - FIELD_ALIGNMENT_FLOATS; };
+  auto *front = plane_start(0);
+  auto *in_front = plane_start(-1);
+  auto *back = plane_start(d - 1);
+  auto *behind = plane_start(d);
+  for (size_t i = 0; i < plane_stride_; ++i) {
+    in_front[i] = z_edge_factor * front[i];
+    behind[i] = z_edge_factor * back[i];
+  }
+}
+
+void Field3D::CopyTo(std::vector<float> &dense) const {
+  auto dense_width = width_ + 2;
+  auto dense_height = height_ + 2;
+  dense.resize((size_t) dense_width * dense_height * (depth_ + 2));
+  for (auto z = -1; z <= (int32_t) depth_; ++z) {
+    for (auto y = -1; y <= (int32_t) height_; ++y) {
+      auto dense_row = ((size_t) (z + 1) * dense_height + (y + 1)) * dense_width;
+      std::memcpy(dense.data() + dense_row, Row(y, z) - 1, dense_width * sizeof(float));
+    }
+  }
+}
@@ -1,42 +1,66 @@
 #include "fluid_simulator_2d.h"
 
+#include <stdexcept>
+
+// Ghost cells around each field. The first layer is the boundary ring of the grid.
+const uint32_t FIELD_HALO = 1;
+
 [[maybe_unused]] FluidSimulator2D::FluidSimulator2D(uint32_t dim_x, uint32_t dim_y) //
-        : FluidSimulator()                                             //
-        , dim_x_{dim_x}                                                //
-        , dim_y_{dim_y}                                                //
-        , num_cells_{dim_x_ * dim_y_}                                  //
+        : FluidSimulator2D(dim_x, dim_y, true)                         //
+{}
+
+FluidSimulator2D::FluidSimulator2D(uint32_t dim_x, uint32_t dim_y, bool allocate_fields) //
+        : FluidSimulator()                                                                //
+        , dim_x_{dim_x}                                                                   //
+        , dim_y_{dim_y}                                                                   //
+        , num_cells_{dim_x_ * dim_y_}                                                     //
 
 {
-  if (dim_x == 0 || dim_y == 0) {
-    throw std::runtime_error("Width and height must be non-zero");
+  if (dim_x < 3 || dim_y < 3) {
+    throw std::runtime_error("Width and height must be at least 3 to leave an interior");
   }
+  obstacles_ = ObstacleMask(dim_x - 2, dim_y - 2);
 
-  AllocateStorage();
+  if (allocate_fields) {
+    AllocateStorage();
+  }
 }
 
 void FluidSimulator2D::AllocateStorage() {
-  density_.resize(num_cells_, 0);
-  velocity_x_.resize(num_cells_, 0);
-  velocity_y_.resize(num_cells_, 0);
+  density_ = Field2D(dim_x_ - 2, dim_y_ - 2, FIELD_HALO);
+  velocity_x_ = Field2D(dim_x_ - 2, dim_y_ - 2, FIELD_HALO);
+  velocity_y_ = Field2D(dim_x_ - 2, dim_y_ - 2, FIELD_HALO);
+  density_view_.resize(num_cells_, 0);
+  velocity_x_view_.resize(num_cells_, 0);
+  velocity_y_view_.resize(num_cells_, 0);
 }
 
 const std::vector<float> &FluidSimulator2D::Density() const {
-  return density_;
+  density_.CopyTo(density_view_);
+  return density_view_;
 }
 
 const std::vector<float> &FluidSimulator2D::VelocityX() const {
-  return velocity_x_;
+  velocity_x_.CopyTo(velocity_x_view_);
+  return velocity_x_view_;
 }
 
 const std::vector<float> &FluidSimulator2D::VelocityY() const {
-  return velocity_y_;
+  velocity_y_.CopyTo(velocity_y_view_);
+  return velocity_y_view_;
 }
 
 void FluidSimulator2D::AddDensity(uint32_t x, uint32_t y, float amount) {
-  density_.at(Index(x, y)) += amount;
+  if (x >= dim_x_ || y >= dim_y_) {
+    throw std::out_of_range("Cell is outside the grid");
+  }
+  density_((int32_t) x - 1, (int32_t) y - 1) += amount;
 }
 
 [[maybe_unused]] void FluidSimulator2D::AddSource(uint32_t x, uint32_t y, float amount, float velocity_x, float velocity_y) {
+  if (x >= dim_x_ || y >= dim_y_) {
+    throw std::out_of_range("Cell is outside the grid");
+  }
   sources_[Index(x, y)] = {amount, velocity_x, velocity_y};
 }
 
@@ -49,14 +73,33 @@ void FluidSimulator2D::AddDensity(uint32_t x, uint32_t y, float amount) {
   if( sources_.count(idx)) sources_.erase(idx);
 }
 
+void FluidSimulator2D::SetSolid(uint32_t x, uint32_t y, bool solid) {
+  if (x < 1 || y < 1 || x + 1 >= dim_x_ || y + 1 >= dim_y_) {
+    throw std::out_of_range("Only interior cells can be solid");
+  }
+  obstacles_.Set((int32_t) x - 1, (int32_t) y - 1, solid);
+}
+
+bool FluidSimulator2D::IsSolid(uint32_t x, uint32_t y) const {
+  if (x < 1 || y < 1 || x + 1 >= dim_x_ || y + 1 >= dim_y_) {
+    return false;
+  }
+  return obstacles_.IsSolid((int32_t) x - 1, (int32_t) y - 1);
+}
+
+void FluidSimulator2D::ClearSolids() {
+  obstacles_.Clear();
+}
+
 [[maybe_unused]] void FluidSimulator2D::ProcessSources(){
   for( const auto & source : sources_){
-    auto idx = source.first;
+    auto x = (int32_t) (source.first % dim_x_) - 1;
+    auto y = (int32_t) (source.first / dim_x_) - 1;
     auto amount = std::get<0>(source.second);
     auto vx = std::get<1>(source.second);
     auto vy = std::get<2>(source.second);
-    density_.at(idx) = amount;
-    velocity_x_.at(idx) = vx;
-    velocity_y_.at(idx) = vy;
+    density_(x, y) = amount;
+    velocity_x_(x, y) = vx;
+    velocity_y_(x, y) = vy;
   }
 }
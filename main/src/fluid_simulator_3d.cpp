@@ -0,0 +1,73 @@
+#include "fluid_simulator_3d.h"
+
+#include <stdexcept>
+
+FluidSimulator3D::FluidSimulator3D(uint32_t dim_x, uint32_t dim_y, uint32_t dim_z) //
+        : FluidSimulator()                                                        //
+        , dim_x_{dim_x}                                                           //
+        , dim_y_{dim_y}                                                           //
+        , dim_z_{dim_z}                                                           //
+{
+  if (dim_x < 3 || dim_y < 3 || dim_z < 3) {
+    throw std::runtime_error("Width, height and depth must be at least 3 to leave an interior");
+  }
+  density_ = Field3D(dim_x_ - 2, dim_y_ - 2, dim_z_ - 2);
+  velocity_x_ = Field3D(dim_x_ - 2, dim_y_ - 2, dim_z_ - 2);
+  velocity_y_ = Field3D(dim_x_ - 2, dim_y_ - 2, dim_z_ - 2);
+  velocity_z_ = Field3D(dim_x_ - 2, dim_y_ - 2, dim_z_ - 2);
+}
+
+const std::vector<float> &FluidSimulator3D::Density() const {
+  density_.CopyTo(density_view_);
+  return density_view_;
+}
+
+const std::vector<float> &FluidSimulator3D::VelocityX() const {
+  velocity_x_.CopyTo(velocity_x_view_);
+  return velocity_x_view_;
+}
+
+const std::vector<float> &FluidSimulator3D::VelocityY() const {
+  velocity_y_.CopyTo(velocity_y_view_);
+  return velocity_y_view_;
+}
+
+const std::vector<float> &FluidSimulator3D::VelocityZ() const {
+  velocity_z_.CopyTo(velocity_z_view_);
+  return velocity_z_view_;
+}
+
+void FluidSimulator3D::AddDensity(uint32_t x, uint32_t y, uint32_t z, float amount) {
+  if (x >= dim_x_ || y >= dim_y_ || z >= dim_z_) {
+    throw std::out_of_range("Cell is outside the grid");
+  }
+  density_((int32_t) x - 1, (int32_t) y - 1, (int32_t) z - 1) += amount;
+}
+
+void FluidSimulator3D::AddSource(uint32_t x, uint32_t y, uint32_t z,
+                                 float amount, float velocity_x, float velocity_y, float velocity_z) {
+  if (x >= dim_x_ || y >= dim_y_ || z >= dim_z_) {
+    throw std::out_of_range("Cell is outside the grid");
+  }
+  sources_[Index(x, y, z)] = Source{amount, velocity_x, velocity_y, velocity_z};
+}
+
+void FluidSimulator3D::ClearSources() {
+  sources_.clear();
+}
+
+void FluidSimulator3D::RemoveSource(uint32_t x, uint32_t y, uint32_t z) {
+  sources_.erase(Index(x, y, z));
+}
+
+void FluidSimulator3D::ProcessSources() {
+  for (const auto &source : sources_) {
+    auto x = (int32_t) (source.first % dim_x_) - 1;
+    auto y = (int32_t) ((source.first / dim_x_) % dim_y_) - 1;
+    auto z = (int32_t) (source.first / ((size_t) dim_x_ * dim_y_)) - 1;
+    density_(x, y, z) = std::get<0>(source.second);
+    velocity_x_(x, y, z) = std::get<1>(source.second);
+    velocity_y_(x, y, z) = std::get<2>(source.second);
+    velocity_z_(x, y, z) = std::get<3>(source.second);
+  }
+}
@@ -1,22 +1,116 @@
 #include "grid_fluid_simulator.h"
-#include <QThread>
+#include "red_black_sor.h"
 #include "spdlog/spdlog.h"
 
+#include <algorithm>
 #include <cmath>
+#include <initializer_list>
+#include <stdexcept>
 
 const uint32_t NUM_GS_ITERS = 10;
+const float DEFAULT_PRESSURE_TOLERANCE = 1e-4f;
+const uint32_t DEFAULT_MAX_PRESSURE_ITERATIONS = 200;
+const float DEFAULT_CFL_NUMBER = 1.0f;
+const uint32_t DEFAULT_MAX_SUBSTEPS = 8;
 
 GridFluidSimulator::GridFluidSimulator(uint32_t width,      //
                                        uint32_t height,     //
                                        float delta_t,       //
                                        float diffusion_rate //
-)                    //
+)                                                           //
+        : GridFluidSimulator(width, height, delta_t, diffusion_rate, DynamicGridKernels()) //
+{}
+
+GridFluidSimulator::GridFluidSimulator(uint32_t width,            //
+                                       uint32_t height,           //
+                                       float delta_t,             //
+                                       float diffusion_rate,      //
+                                       const GridKernels &kernels //
+)                                                                 //
         : FluidSimulator2D{width, height}                       //
         , delta_t_{delta_t}                                     //
+        , step_delta_t_{delta_t}                                //
         , diffusion_rate_{diffusion_rate}                       //
+        , kernels_{&kernels}                                    //
+        , pressure_solver_{JACOBI}                              //
+        , pressure_tolerance_{DEFAULT_PRESSURE_TOLERANCE}       //
+        , max_pressure_iterations_{DEFAULT_MAX_PRESSURE_ITERATIONS} //
+        , last_pressure_solve_{0, 0.0f}                         //
+        , warm_start_pressure_{true}                            //
+        , diffuse_omega_{1.0f}                                  //
+        , diffuse_tiling_{false}                                //
+        , boundary_modes_{WALL, WALL, WALL, WALL}               //
+        , inflow_speeds_{}                                      //
+        , inflow_densities_{}                                   //
+        , periodic_{false}                                      //
+        , refill_pressure_halo_{false}                          //
+        , zero_gradient_halo_{true}                             //
+        , pressure_omega_{OptimalSorOmega(width - 2, height - 2)} //
+        , fused_projection_{false}                              //
+        , adaptive_timestep_{false}                             //
+        , cfl_number_{DEFAULT_CFL_NUMBER}                       //
+        , max_substeps_{DEFAULT_MAX_SUBSTEPS}                   //
+        , last_substeps_{0}                                     //
+        , max_speed_{0.0f}                                      //
+        , advector_{}                                           //
+        , advection_layout_{ROW_MAJOR}                          //
+        , thread_pool_{std::make_unique<ThreadPool>(0)}         //
+        , obstacles_version_{0}                                 //
 {
+  spdlog::info("Advection kernel: {}", SemiLagrangianAdvector::IsaName(advector_.GetIsa()));
+  AllocateWorkspace();
+  UpdateBoundaries();
   InitialiseDensity();
   InitialiseVelocity();
+  PlaceFields();
+}
+
+/*
+ * Every buffer a step needs is allocated here so that Simulate() never touches the heap.
+ */
+void GridFluidSimulator::AllocateWorkspace() {
+  auto width = density_.Width();
+  auto height = density_.Height();
+  auto halo = density_.Halo();
+  pressure_ = Field2D(width, height, halo);
+  temp_pressure_ = Field2D(width, height, halo);
+  divergence_ = Field2D(width, height, halo);
+  temp_density_ = Field2D(width, height, halo);
+  temp_velocity_x_ = Field2D(width, height, halo);
+  temp_velocity_y_ = Field2D(width, height, halo);
+  row_sums_.assign(height, 0.0);
+  band_edge_rows_.assign(height, 0);
+}
+
+/*
+ * The stages split their rows the same way for every field, so each band's rows stay with one
+ * thread from step to step. Done again whenever the pool changes.
+ */
+void GridFluidSimulator::PlaceFields() {
+  if (!GetFieldMemoryConfig().first_touch) {
+    return;
+  }
+  for (auto *field : {&density_, &velocity_x_, &velocity_y_, &pressure_, &temp_pressure_, &divergence_,
+                      &temp_density_, &temp_velocity_x_, &temp_velocity_y_}) {
+    field->PlaceRows(thread_pool_.get());
+  }
+  for (auto &scalar : scalars_) {
+    scalar.field.PlaceRows(thread_pool_.get());
+    scalar.temp_field.PlaceRows(thread_pool_.get());
+  }
+}
+
+FieldPagePlacement GridFluidSimulator::PagePlacement() const {
+  FieldPagePlacement placement{0, 0, 0, {}};
+  for (const auto *field : {&density_, &velocity_x_, &velocity_y_, &pressure_, &temp_pressure_, &divergence_,
+                            &temp_density_, &temp_velocity_x_, &temp_velocity_y_}) {
+    field->AddPagePlacement(placement);
+  }
+  for (const auto &scalar : scalars_) {
+    scalar.field.AddPagePlacement(placement);
+    scalar.temp_field.AddPagePlacement(placement);
+  }
+  return placement;
 }
 
 void GridFluidSimulator::InitialiseDensity() {
@@ -27,290 +121,810 @@ void GridFluidSimulator::InitialiseDensity() {
 void GridFluidSimulator::InitialiseVelocity() {
   // Initialise with a blob in the middle
   // TODO: Initialise velocity field here
+
+  // The last pressure solution is no use as a guess for a new flow
+  pressure_.Fill(0.0f);
 }
 
-void GridFluidSimulator::Diffuse(const std::vector<float> &current_density,
-                                 std::vector<float> &next_density) {
-  // Initialise target_density with current values because why not
-  std::memcpy(next_density.data(), current_density.data(), num_cells_ * sizeof(float));
+void GridFluidSimulator::SetPressureSolver(PressureSolver pressure_solver) {
+  if ((pressure_solver == FFT) != periodic_) {
+    throw std::runtime_error(periodic_ ? "Only the FFT pressure solver handles periodic boundaries"
+                                       : "The FFT pressure solver needs periodic boundaries");
+  }
+  if (refill_pressure_halo_ && !periodic_ && pressure_solver != JACOBI && pressure_solver != RED_BLACK_SOR) {
+    throw std::runtime_error(
+        "A domain periodic along one axis or with an inflow edge needs the JACOBI or RED_BLACK_SOR pressure solver");
+  }
+  pressure_solver_ = pressure_solver;
+}
 
-  // Run four iterations of GS
-  // Dn(x,y) = Dc(x,y) + (k*0.25*(Dn(x+1,y)+Dn(x-1,y)+Dn(x,y+1)+Dn(x,y-1)))/(1+k)
+void GridFluidSimulator::SetPressureTolerance(float tolerance) {
+  pressure_tolerance_ = tolerance;
+}
 
-  auto k = delta_t_ * diffusion_rate_;
-  for (auto iter = 0; iter < NUM_GS_ITERS; ++iter) {
-    for (auto y = 1; y < dim_y_ - 1; ++y) {
-      for (auto x = 1; x < dim_x_ - 1; ++x) {
-        auto idx = Index(x, y);
-
-        float total_nbrs = 0.0f;
-        float nbr_count = 0.0f;
-        if (x > 1) {
-          total_nbrs += next_density.at(idx - 1);
-          nbr_count += 1.0f;
-        }
-        if (x < dim_x_ - 1) {
-          total_nbrs += next_density.at(idx + 1);
-          nbr_count += 1.0f;
-        }
-        if (y > 0) {
-          total_nbrs += next_density.at(idx - dim_x_);
-          nbr_count += 1.0f;
-        }
-        if (y < dim_y_ - 1) {
-          total_nbrs += next_density.at(idx + dim_x_);
-          nbr_count += 1.0f;
-        }
-        auto mean_nbr = total_nbrs / nbr_count;
+void GridFluidSimulator::SetMaxPressureIterations(uint32_t max_iterations) {
+  max_pressure_iterations_ = max_iterations;
+}
+
+void GridFluidSimulator::SetWarmStartPressure(bool warm_start) {
+  warm_start_pressure_ = warm_start;
+}
+
+void GridFluidSimulator::SetDiffuseOmega(float omega) {
+  diffuse_omega_ = omega;
+}
+
+void GridFluidSimulator::SetDiffuseTiling(bool tiling) {
+  diffuse_tiling_ = tiling;
+}
+
+void GridFluidSimulator::SetPressureOmega(float omega) {
+  pressure_omega_ = omega;
+}
 
-        //x[IX(i,j)] = (x0[IX(i,j)] + a*(x[IX(i-1,j)]+x[IX(i+1,j)]+x[IX(i,j-1)]+x[IX(i,j+1)]))/(1+4*a)
+void GridFluidSimulator::SetFusedProjection(bool fused) {
+  fused_projection_ = fused;
+}
+
+/*
+ * The pressure halo is filled differently for each mode, so the pressure starts again from zero
+ * whenever the boundaries change.
+ */
+void GridFluidSimulator::SetBoundaryModes(BoundaryMode left,   //
+                                          BoundaryMode right,  //
+                                          BoundaryMode bottom, //
+                                          BoundaryMode top     //
+) {
+  if ((left == PERIODIC) != (right == PERIODIC) || (bottom == PERIODIC) != (top == PERIODIC)) {
+    throw std::runtime_error("Periodic edges must come in opposite pairs");
+  }
+  boundary_modes_[LEFT] = left;
+  boundary_modes_[RIGHT] = right;
+  boundary_modes_[BOTTOM] = bottom;
+  boundary_modes_[TOP] = top;
+  UpdateBoundaries();
+  if (periodic_) {
+    pressure_solver_ = FFT;
+  } else if (pressure_solver_ == FFT || (refill_pressure_halo_ && pressure_solver_ != RED_BLACK_SOR)) {
+    pressure_solver_ = JACOBI;
+  }
+  pressure_.Fill(0.0f);
+}
 
-        auto new_val = (current_density.at(idx) + (k * mean_nbr)) / (k + 1.0f);
-        next_density.at(idx) = new_val;
+void GridFluidSimulator::SetInflow(Edge edge, float speed, float density) {
+  inflow_speeds_[edge] = speed;
+  inflow_densities_[edge] = density;
+  UpdateBoundaries();
+}
+
+void GridFluidSimulator::SetPeriodicBoundaries(bool periodic) {
+  auto mode = periodic ? PERIODIC : WALL;
+  SetBoundaryModes(mode, mode, mode, mode);
+}
+
+/*
+ * The halo beyond each edge, by mode:
+ *
+ *              scalars    normal velocity     tangential velocity   pressure
+ *   WALL       copied     zero                copied                zero, or copied with an inflow
+ *   PERIODIC   wrapped    wrapped             wrapped               wrapped
+ *   INFLOW     density    speed, inwards      zero                  copied
+ *   OUTFLOW    copied     copied              copied                zero
+ *
+ * Velocity is diffused with every wall and outflow edge copied, as a scalar, and only corrected
+ * to the table above afterwards. A zero pressure beyond the walls of a channel would draw the
+ * inflow out through them, so with an inflow only the outflow edges hold the pressure at zero.
+ */
+void GridFluidSimulator::UpdateBoundaries() {
+  const EdgeFill wrap{true, 0.0f, 0.0f};
+  const EdgeFill copy{false, 1.0f, 0.0f};
+  const EdgeFill zero{false, 0.0f, 0.0f};
+  // The member of a HaloFill for each Edge
+  EdgeFill HaloFill::*const sides[] = {&HaloFill::left, &HaloFill::right, &HaloFill::bottom, &HaloFill::top};
+  auto any_inflow = false;
+  for (auto mode : boundary_modes_) {
+    any_inflow = any_inflow || mode == INFLOW;
+  }
+  for (auto edge = 0; edge < 4; ++edge) {
+    auto across_x = edge == LEFT || edge == RIGHT;
+    // Velocity into the domain is positive through the left and bottom edges
+    auto inwards = (edge == LEFT || edge == BOTTOM) ? 1.0f : -1.0f;
+    EdgeFill density = copy;
+    EdgeFill normal = copy;
+    EdgeFill tangential = copy;
+    EdgeFill diffuse_normal = copy;
+    EdgeFill diffuse_tangential = copy;
+    EdgeFill pressure = zero;
+    switch (boundary_modes_[edge]) {
+    case WALL:
+      normal = zero;
+      if (any_inflow) {
+        pressure = copy;
       }
+      break;
+    case PERIODIC:
+      density = normal = tangential = diffuse_normal = diffuse_tangential = pressure = wrap;
+      break;
+    case INFLOW:
+      density = {false, 0.0f, inflow_densities_[edge]};
+      normal = diffuse_normal = {false, 0.0f, inwards * inflow_speeds_[edge]};
+      tangential = diffuse_tangential = zero;
+      pressure = copy;
+      break;
+    case OUTFLOW:
+      break;
+    }
+    density_fill_.*sides[edge] = density;
+    velocity_x_fill_.*sides[edge] = across_x ? normal : tangential;
+    velocity_y_fill_.*sides[edge] = across_x ? tangential : normal;
+    diffuse_velocity_x_fill_.*sides[edge] = across_x ? diffuse_normal : diffuse_tangential;
+    diffuse_velocity_y_fill_.*sides[edge] = across_x ? diffuse_tangential : diffuse_normal;
+    pressure_fill_.*sides[edge] = pressure;
+  }
+
+  periodic_ = true;
+  refill_pressure_halo_ = false;
+  zero_gradient_halo_ = true;
+  for (auto mode : boundary_modes_) {
+    periodic_ = periodic_ && mode == PERIODIC;
+    refill_pressure_halo_ = refill_pressure_halo_ || mode == PERIODIC || mode == INFLOW;
+    zero_gradient_halo_ = zero_gradient_halo_ && (mode == WALL || mode == OUTFLOW);
+  }
+  advector_.SetPeriodic(boundary_modes_[LEFT] == PERIODIC, boundary_modes_[BOTTOM] == PERIODIC);
+
+  CorrectBoundaryDensities(density_);
+  CorrectBoundaryVelocities(velocity_x_, velocity_y_);
+  for (auto &scalar : scalars_) {
+    CorrectBoundaryDensities(scalar.field);
+  }
+}
+
+void GridFluidSimulator::SetAdaptiveTimestep(bool adaptive) {
+  adaptive_timestep_ = adaptive;
+}
+
+void GridFluidSimulator::SetCflNumber(float cfl_number) {
+  if (cfl_number <= 0.0f) {
+    throw std::runtime_error("CFL number must be positive");
+  }
+  cfl_number_ = cfl_number;
+}
+
+void GridFluidSimulator::SetMaxSubsteps(uint32_t max_substeps) {
+  max_substeps_ = std::max(1u, max_substeps);
+}
+
+void GridFluidSimulator::SetNumThreads(uint32_t num_threads) {
+  thread_pool_ = std::make_unique<ThreadPool>(num_threads);
+  if (multigrid_solver_) {
+    multigrid_solver_->SetThreadPool(thread_pool_.get());
+  }
+  if (pcg_solver_) {
+    pcg_solver_->SetThreadPool(thread_pool_.get());
+  }
+  if (fft_solver_) {
+    fft_solver_->SetThreadPool(thread_pool_.get());
+  }
+  PlaceFields();
+}
+
+void GridFluidSimulator::SetAdvectionIsa(SemiLagrangianAdvector::Isa isa) {
+  advector_ = SemiLagrangianAdvector(isa);
+  advector_.SetPeriodic(boundary_modes_[LEFT] == PERIODIC, boundary_modes_[BOTTOM] == PERIODIC);
+}
+
+void GridFluidSimulator::SetAdvectionLayout(AdvectionLayout layout) {
+  advection_layout_ = layout;
+  if (layout == TILED && !tile_map_) {
+    tile_map_ = std::make_unique<TileMap>(density_.Width(), density_.Height());
+    for (auto tile = 0; tile < tile_map_->NumTiles(); ++tile) {
+      tile_map_->Activate(tile);
+    }
+    tile_map_->Compact();
+    tiled_density_ = std::make_unique<TiledField2D>(*tile_map_);
+    tiled_velocity_x_ = std::make_unique<TiledField2D>(*tile_map_);
+    tiled_velocity_y_ = std::make_unique<TiledField2D>(*tile_map_);
+    for (auto *field : {tiled_density_.get(), tiled_velocity_x_.get(), tiled_velocity_y_.get()}) {
+      field->Reserve();
+    }
+  }
+  ReserveTiledScalars();
+}
+
+void GridFluidSimulator::ReserveTiledScalars() {
+  if (!tile_map_) {
+    return;
+  }
+  for (auto &scalar : scalars_) {
+    if (!scalar.tiled_field) {
+      scalar.tiled_field = std::make_unique<TiledField2D>(*tile_map_);
+      scalar.tiled_field->Reserve();
+    }
+  }
+}
+
+uint32_t GridFluidSimulator::AddScalarField(const std::string &name, float diffusion_rate) {
+  for (const auto &scalar : scalars_) {
+    if (scalar.name == name) {
+      throw std::runtime_error("There is already a scalar field named " + name);
     }
-    CorrectBoundaryDensities(next_density);
-  }
-}
-
-float GridFluidSimulator::AdvectValue(const std::vector<float> &velocity_x,
-                                      const std::vector<float> &velocity_y,
-                                      const std::vector<float> &source_data,
-                                      uint32_t x, uint32_t y) const {
-  auto idx = Index(x, y);
-
-  // Get the velocity for this cell
-  auto vx = velocity_x.at(idx);
-  auto vy = velocity_y.at(idx);
-
-  // Get the source point for that flow
-  auto source_x = ((float) x + 0.5f) - vx * delta_t_;
-  auto source_y = ((float) y + 0.5f) - vy * delta_t_;
-  source_x = std::fmaxf(0.5f, std::fminf((float) dim_x_ - 0.5f, source_x));
-  source_y = std::fmaxf(0.5f, std::fminf((float) dim_y_ - 0.5f, source_y));
-
-  /* 0     1     2     3
-   * +-----+-----+-----+  0
-   * |     |     |     |
-   * |     |     |     |
-   * |     |     |     |
-   * +-----+-----+-----+  1
-   * |     |     |     |
-   * |  o  |  o  |     |
-   * |     |x    |     |
-   * +-----+-----+-----+  2
-   * |     |     |     |
-   * |  o  |  o  |     |
-   * |     |     |     |
-   * +-----+-----+-----+  3
-   */
-  // Get the base coord
-  auto base_x = std::floorf(source_x - 0.5f);
-  auto base_y = std::floorf(source_y - 0.5f);
-
-  // And the fractional offset
-  auto frac_x = source_x - base_x - 0.5f;
-  auto frac_y = source_y - base_y - 0.5f;
-
-  // Interpolate top and bottom
-  auto bl = source_data.at(Index((uint32_t) base_x, (uint32_t) base_y));
-  auto br = source_data.at(Index((uint32_t) base_x + 1, (uint32_t) base_y));
-  auto tl = source_data.at(Index((uint32_t) base_x, (uint32_t) base_y + 1));
-  auto tr = source_data.at(Index((uint32_t) base_x + 1, (uint32_t) base_y + 1));
-  auto top_lerp = Lerp(tl, tr, frac_x);
-  auto btm_lerp = Lerp(bl, br, frac_x);
-  auto final_val = Lerp(btm_lerp, top_lerp, frac_y);
-  // interpolate top to bottom
-  return final_val;
-}
-
-void GridFluidSimulator::AdvectDensity(const std::vector<float> &curr_density,
-                                       std::vector<float> &advected_density) const {
-  std::fill(advected_density.begin(), advected_density.end(), 0.0f);
-  for (auto y = 1; y < dim_y_ - 1; ++y) {
-    for (auto x = 1; x < dim_x_ - 1; ++x) {
-      advected_density.at(Index(x, y)) = AdvectValue(velocity_x_, velocity_y_, curr_density, x, y);
+  }
+  auto width = density_.Width();
+  auto height = density_.Height();
+  auto halo = density_.Halo();
+  scalars_.push_back({name,                            //
+                      diffusion_rate,                  //
+                      Field2D(width, height, halo),    //
+                      Field2D(width, height, halo),    //
+                      {},                              //
+                      nullptr,                         //
+                      std::vector<float>(num_cells_, 0.0f)});
+  if (GetFieldMemoryConfig().first_touch) {
+    scalars_.back().field.PlaceRows(thread_pool_.get());
+    scalars_.back().temp_field.PlaceRows(thread_pool_.get());
+  }
+  ReserveTiledScalars();
+  advection_targets_.reserve(3 + scalars_.size());
+  tiled_advection_targets_.reserve(3 + scalars_.size());
+  return (uint32_t) scalars_.size() - 1;
+}
+
+uint32_t GridFluidSimulator::ScalarFieldIndex(const std::string &name) const {
+  for (auto field = 0u; field < scalars_.size(); ++field) {
+    if (scalars_[field].name == name) {
+      return field;
     }
   }
-  CorrectBoundaryDensities(advected_density);
+  throw std::runtime_error("There is no scalar field named " + name);
+}
+
+const GridFluidSimulator::PassiveScalar &GridFluidSimulator::Scalar(uint32_t field) const {
+  if (field >= scalars_.size()) {
+    throw std::out_of_range("There is no scalar field with that index");
+  }
+  return scalars_[field];
+}
+
+GridFluidSimulator::PassiveScalar &GridFluidSimulator::Scalar(uint32_t field) {
+  return const_cast<PassiveScalar &>(static_cast<const GridFluidSimulator *>(this)->Scalar(field));
+}
+
+const std::string &GridFluidSimulator::ScalarFieldName(uint32_t field) const {
+  return Scalar(field).name;
+}
+
+const std::vector<float> &GridFluidSimulator::ScalarField(uint32_t field) const {
+  const auto &scalar = Scalar(field);
+  scalar.field.CopyTo(scalar.view);
+  return scalar.view;
 }
 
-void GridFluidSimulator::AdvectVelocity(std::vector<float> &advected_velocity_x,
-                                        std::vector<float> &advected_velocity_y) const {
-  for (auto y = 1; y < dim_y_ - 1; ++y) {
-    for (auto x = 1; x < dim_x_ - 1; ++x) {
-      auto idx = Index(x, y);
-      advected_velocity_x.at(idx) = AdvectValue(velocity_x_, velocity_y_, velocity_x_, x, y);
-      advected_velocity_y.at(idx) = AdvectValue(velocity_x_, velocity_y_, velocity_y_, x, y);
+void GridFluidSimulator::AddScalarAmount(uint32_t field, uint32_t x, uint32_t y, float amount) {
+  auto &scalar = Scalar(field);
+  if (x >= dim_x_ || y >= dim_y_) {
+    throw std::out_of_range("Cell is outside the grid");
+  }
+  scalar.field((int32_t) x - 1, (int32_t) y - 1) += amount;
+}
+
+void GridFluidSimulator::AddScalarSource(uint32_t field, uint32_t x, uint32_t y, float amount) {
+  auto &scalar = Scalar(field);
+  if (x >= dim_x_ || y >= dim_y_) {
+    throw std::out_of_range("Cell is outside the grid");
+  }
+  scalar.sources[Index(x, y)] = amount;
+}
+
+void GridFluidSimulator::ClearScalarSources() {
+  for (auto &scalar : scalars_) {
+    scalar.sources.clear();
+  }
+}
+
+void GridFluidSimulator::ProcessScalarSources() {
+  for (auto &scalar : scalars_) {
+    for (const auto &source : scalar.sources) {
+      auto x = (int32_t) (source.first % dim_x_) - 1;
+      auto y = (int32_t) (source.first / dim_x_) - 1;
+      scalar.field(x, y) = source.second;
     }
   }
-  CorrectBoundaryVelocities(advected_velocity_x, advected_velocity_y);
 }
 
 /*
- * d(x,y) = [ vx(x+1,y) - vx(x-1,y) + vy(x,y+1)-vy(x,y-1) ] * 0.5f
+ * Red-black SOR: every cell of one colour only reads cells of the other, so each half sweep can
+ * be split across threads without changing the result.
+ */
+void GridFluidSimulator::Diffuse(const Field2D &current, Field2D &next, const HaloFill &fill) {
+  // Initialise next with current values because why not
+  next.CopyFrom(current);
+
+  // Dn(x,y) = (Dc(x,y) + k*0.25*(Dn(x+1,y)+Dn(x-1,y)+Dn(x,y+1)+Dn(x,y-1)))/(1+k)
+  // The halo holds the boundary values so every cell sees four neighbours.
+  auto k = step_delta_t_ * diffusion_rate_;
+  auto inv_k1 = 1.0f / (k + 1.0f);
+  if (diffuse_tiling_ && zero_gradient_halo_ && !fluid_region_) {
+    // Same halo as fill; tiles cannot see across a periodic wrap
+    RedBlackSorTiled(thread_pool_.get(), current, inv_k1, 0.25f * k * inv_k1, diffuse_omega_, NUM_GS_ITERS, 1.0f,
+                     1.0f, next);
+    return;
+  }
+  for (auto iter = 0; iter < NUM_GS_ITERS; ++iter) {
+    for (auto colour = 0u; colour < 2; ++colour) {
+      RedBlackSorSweep(current, inv_k1, 0.25f * k * inv_k1, diffuse_omega_, colour, next);
+    }
+    next.FillHalo(fill);
+    if (fluid_region_) {
+      fluid_region_->ApplyScalarBoundary(next);
+    }
+  }
+}
+
+/*
+ * Diffuse() for every scalar field at once. Each half sweep relaxes a band of rows of every field
+ * in one parallel loop, so the dispatch and synchronisation are paid once per sweep rather than
+ * once per field. The result for each field is the same as Diffuse() at its rate.
  */
-void GridFluidSimulator::ComputeDivergence(std::vector<float> &divergence) const {
-  for (auto y = 1; y < dim_y_ - 1; ++y) {
-    for (auto x = 1; x < dim_x_ - 1; ++x) {
-      auto idx = Index(x, y);
-      divergence.at(idx) =                   //
-              (                                  //
-                      velocity_x_.at(idx + 1) -      //
-                      velocity_x_.at(idx - 1) +      //
-                      velocity_y_.at(idx + dim_x_) - //
-                      velocity_y_.at(idx - dim_x_)   //
-              )
-              * 0.5f;
+void GridFluidSimulator::DiffuseScalars() {
+  if (scalars_.empty()) {
+    return;
+  }
+  for (auto &scalar : scalars_) {
+    scalar.temp_field.CopyFrom(scalar.field);
+  }
+  if (diffuse_tiling_ && zero_gradient_halo_ && !fluid_region_) {
+    for (auto &scalar : scalars_) {
+      auto k = step_delta_t_ * scalar.diffusion_rate;
+      auto inv_k1 = 1.0f / (k + 1.0f);
+      RedBlackSorTiled(thread_pool_.get(), scalar.field, inv_k1, 0.25f * k * inv_k1, diffuse_omega_, NUM_GS_ITERS,
+                       1.0f, 1.0f, scalar.temp_field);
     }
+    return;
   }
+
+  auto w = density_.Width() * (uint32_t) scalars_.size();
+  auto h = (int32_t) density_.Height();
+  for (auto iter = 0u; iter < NUM_GS_ITERS; ++iter) {
+    for (auto colour = 0u; colour < 2; ++colour) {
+      thread_pool_->ParallelFor(0, h, w, [&](int32_t y_begin, int32_t y_end) {
+        for (auto &scalar : scalars_) {
+          auto k = step_delta_t_ * scalar.diffusion_rate;
+          auto inv_k1 = 1.0f / (k + 1.0f);
+          if (fluid_region_) {
+            RedBlackSorRuns(*fluid_region_, scalar.field, inv_k1, 0.25f * k * inv_k1, diffuse_omega_, colour, y_begin,
+                            y_end, scalar.temp_field);
+          } else {
+            kernels_->red_black_sor_rows(scalar.field, inv_k1, 0.25f * k * inv_k1, diffuse_omega_, colour, y_begin,
+                                         y_end, scalar.temp_field);
+          }
+        }
+      });
+    }
+    for (auto &scalar : scalars_) {
+      CorrectBoundaryDensities(scalar.temp_field);
+    }
+  }
+}
+
+/*
+ * Density, both velocity components and the scalars are carried by the same (diffused) velocity
+ * field, so they share one backtrace per cell.
+ */
+void GridFluidSimulator::AdvectFields() {
+  auto h = (int32_t) density_.Height();
+  if (advection_layout_ == TILED && !fluid_region_) {
+    tiled_advection_targets_.clear();
+    tiled_advection_targets_.push_back({tiled_density_.get(), &temp_density_});
+    tiled_advection_targets_.push_back({tiled_velocity_x_.get(), &temp_velocity_x_});
+    tiled_advection_targets_.push_back({tiled_velocity_y_.get(), &temp_velocity_y_});
+    tiled_density_->CopyFrom(thread_pool_.get(), density_);
+    tiled_velocity_x_->CopyFrom(thread_pool_.get(), velocity_x_);
+    tiled_velocity_y_->CopyFrom(thread_pool_.get(), velocity_y_);
+    for (auto &scalar : scalars_) {
+      scalar.tiled_field->CopyFrom(thread_pool_.get(), scalar.field);
+      tiled_advection_targets_.push_back({scalar.tiled_field.get(), &scalar.temp_field});
+    }
+    const auto *targets = tiled_advection_targets_.data();
+    auto num_targets = tiled_advection_targets_.size();
+    thread_pool_->ParallelFor(0, h, density_.Width() * (uint32_t) num_targets, [&](int32_t y_begin, int32_t y_end) {
+      advector_.AdvectRowsTiled(velocity_x_, velocity_y_, step_delta_t_, *tile_map_, targets, num_targets, y_begin,
+                                y_end);
+    });
+  } else {
+    advection_targets_.clear();
+    advection_targets_.push_back({&density_, &temp_density_});
+    advection_targets_.push_back({&velocity_x_, &temp_velocity_x_});
+    advection_targets_.push_back({&velocity_y_, &temp_velocity_y_});
+    for (auto &scalar : scalars_) {
+      advection_targets_.push_back({&scalar.field, &scalar.temp_field});
+    }
+    const auto *targets = advection_targets_.data();
+    auto num_targets = advection_targets_.size();
+    thread_pool_->ParallelFor(0, h, density_.Width() * (uint32_t) num_targets, [&](int32_t y_begin, int32_t y_end) {
+      if (fluid_region_) {
+        advector_.AdvectRuns(velocity_x_, velocity_y_, step_delta_t_, *fluid_region_, targets, num_targets, y_begin,
+                             y_end);
+      } else {
+        advector_.AdvectRows(velocity_x_, velocity_y_, step_delta_t_, targets, num_targets, y_begin, y_end);
+      }
+    });
+  }
+  CorrectBoundaryDensities(temp_density_);
+  CorrectBoundaryVelocities(temp_velocity_x_, temp_velocity_y_);
+  density_.Swap(temp_density_);
+  velocity_x_.Swap(temp_velocity_x_);
+  velocity_y_.Swap(temp_velocity_y_);
+  for (auto &scalar : scalars_) {
+    CorrectBoundaryDensities(scalar.temp_field);
+    scalar.field.Swap(scalar.temp_field);
+  }
+}
+
+/*
+ * d(x,y) = [ vx(x+1,y) - vx(x-1,y) + vy(x,y+1)-vy(x,y-1) ] * 0.5f
+ */
+void GridFluidSimulator::ComputeDivergence(Field2D &divergence) const {
+  thread_pool_->ParallelFor(0, (int32_t) divergence.Height(), divergence.Width(), [&](int32_t y_begin, int32_t y_end) {
+    if (fluid_region_) {
+      DivergenceRuns(*fluid_region_, velocity_x_, velocity_y_, y_begin, y_end, divergence);
+    } else {
+      kernels_->divergence_rows(velocity_x_, velocity_y_, y_begin, y_end, divergence);
+    }
+  });
 }
 
 /*
  * Compute pressure and solve to obtain stable field
  * 0.25f * [p(x-1,y)+p(x+1,y)+p(x,y-1)+p(x,y+1)- divergence(x,y)] =p(x,y)
+ * pressure holds the initial guess, which is the previous step's solution when warm starting.
+ * The pressure halo is zero unless some edge is periodic or an inflow (see UpdateBoundaries()).
+ * The FFT solver wraps it on a periodic domain, and the Jacobi and SOR solvers refill it after
+ * each sweep otherwise.
  */
-void GridFluidSimulator::ComputePressure(const std::vector<float> &divergence,
-                                         std::vector<float> &pressure) const {
-  // Set pressure to zero everywhere
-  std::fill(pressure.begin(), pressure.end(), 0);
-  std::vector<float> temp_pressure(num_cells_, 0);
-  std::fill(temp_pressure.begin(), temp_pressure.end(), 0);
-
-  // TODO: Parameterise this count
-  for (auto iter = 0; iter < NUM_GS_ITERS; ++iter) {
-    for (auto y = 1; y < dim_y_ - 1; ++y) {
-      for (auto x = 1; x < dim_x_ - 1; ++x) {
-        auto idx = Index(x, y);
-
-        auto p = (                               //
-                         pressure.at(idx - 1) +      //
-                         pressure.at(idx + 1) +      //
-                         pressure.at(idx - dim_x_) + //
-                         pressure.at(idx + dim_x_) - //
-                         divergence.at(idx)          //
-                 )
-                 * 0.25f;
-        temp_pressure.at(idx) = p;
-      }
+void GridFluidSimulator::ComputePressure(const Field2D &divergence, Field2D &pressure) {
+  if (!warm_start_pressure_) {
+    pressure.Fill(0.0f);
+  }
+
+  if (pressure_solver_ == FFT) {
+    if (!fft_solver_) {
+      fft_solver_ = std::make_unique<FftPoissonSolver>(divergence.Width(), divergence.Height());
+      fft_solver_->SetThreadPool(thread_pool_.get());
+    }
+    last_pressure_solve_ = fft_solver_->Solve(divergence, pressure);
+  } else if (pressure_solver_ == MULTIGRID) {
+    if (!multigrid_solver_) {
+      multigrid_solver_ = std::make_unique<MultigridPoissonSolver>(dim_x_, dim_y_);
+      multigrid_solver_->SetThreadPool(thread_pool_.get());
+    }
+    if (!warm_start_pressure_) {
+      multigrid_solver_->FullMultigrid(divergence, pressure);
     }
+    last_pressure_solve_ = multigrid_solver_->Solve(divergence, pressure, pressure_tolerance_, max_pressure_iterations_);
+  } else if (pressure_solver_ == PCG) {
+    if (!pcg_solver_) {
+      pcg_solver_ = std::make_unique<PcgPoissonSolver>(dim_x_, dim_y_);
+      pcg_solver_->SetThreadPool(thread_pool_.get());
+    }
+    last_pressure_solve_ = pcg_solver_->Solve(divergence, pressure, pressure_tolerance_, max_pressure_iterations_);
+  } else if (pressure_solver_ == RED_BLACK_SOR) {
+    last_pressure_solve_ = ComputePressureRedBlackSor(divergence, pressure);
+  } else {
+    last_pressure_solve_ = ComputePressureJacobi(divergence, pressure);
+  }
+  spdlog::debug("Pressure solve: {} iterations, residual {}",
+                last_pressure_solve_.iterations,
+                last_pressure_solve_.residual);
+}
+
+/*
+ * The Jacobi update gives the residual of the incoming iterate for free:
+ * r = divergence - (sum(nbrs) - 4p) = -4 * (p_next - p)
+ * so the loop stops once the previous sweep was already within tolerance.
+ */
+PoissonSolverStats GridFluidSimulator::ComputePressureJacobi(const Field2D &divergence, Field2D &pressure) {
+  auto w = (int32_t) divergence.Width();
+  auto h = (int32_t) divergence.Height();
+  auto rhs_norm = Norm(divergence);
+  if (rhs_norm == 0.0) {
+    pressure.Fill(0.0f);
+    return {0, 0.0f};
+  }
 
-    std::memcpy(pressure.data(), temp_pressure.data(), num_cells_ * sizeof(float));
+  auto &temp_pressure = temp_pressure_;
+  if (refill_pressure_halo_) {
+    pressure.FillHalo(pressure_fill_);
   }
+  auto relative_residual = 1.0;
+  auto iter = 0u;
+  while (iter < max_pressure_iterations_) {
+    auto change_sq = thread_pool_->ParallelSum(0, h, w, [&](int32_t y_begin, int32_t y_end) {
+      if (fluid_region_) {
+        return JacobiRuns(*fluid_region_, divergence, pressure, y_begin, y_end, temp_pressure);
+      }
+      return kernels_->jacobi_rows(divergence, pressure, y_begin, y_end, temp_pressure);
+    });
+
+    // Both buffers hold a zero halo unless it has to be refilled
+    pressure.Swap(temp_pressure);
+    if (refill_pressure_halo_) {
+      pressure.FillHalo(pressure_fill_);
+    }
+    ++iter;
+    relative_residual = 4.0 * std::sqrt(change_sq) / rhs_norm;
+    if (relative_residual <= pressure_tolerance_) {
+      break;
+    }
+  }
+  return {iter, (float) relative_residual};
 }
 
 /*
- * \nabla p(x,y) =0.5f * [  p(x+1,y) - p(x-1),y), p(x,y+1)-p(x,y-1) ]
+ * As with Jacobi, each cell's Gauss-Seidel correction is a quarter of its residual just before it
+ * is updated, so the corrections give a residual estimate at no extra cost.
  */
-void GridFluidSimulator::ComputeCurlField(const std::vector<float> &pressure,
-                                          std::vector<float> &curl_x,
-                                          std::vector<float> &curl_y) const {
-  for (auto y = 1; y < dim_y_ - 1; ++y) {
-    for (auto x = 1; x < dim_x_ - 1; ++x) {
-      auto idx = Index(x, y);
-      curl_x.at(idx) = (pressure.at(idx + 1) - pressure.at(idx - 1)) * 0.5f;
-      curl_y.at(idx) = (pressure.at(idx + dim_x_) - pressure.at(idx - dim_x_)) * 0.5f;
+PoissonSolverStats GridFluidSimulator::ComputePressureRedBlackSor(const Field2D &divergence, Field2D &pressure) {
+  auto rhs_norm = Norm(divergence);
+  if (rhs_norm == 0.0) {
+    pressure.Fill(0.0f);
+    return {0, 0.0f};
+  }
+
+  if (refill_pressure_halo_) {
+    pressure.FillHalo(pressure_fill_);
+  }
+  auto relative_residual = 1.0;
+  auto iter = 0u;
+  while (iter < max_pressure_iterations_) {
+    auto change_sq = 0.0;
+    for (auto colour = 0u; colour < 2; ++colour) {
+      change_sq += RedBlackSorSweep(divergence, -0.25f, 0.25f, pressure_omega_, colour, pressure);
+      if (refill_pressure_halo_) {
+        pressure.FillHalo(pressure_fill_);
+      }
+    }
+    ++iter;
+    relative_residual = 4.0 * std::sqrt(change_sq) / rhs_norm;
+    if (relative_residual <= pressure_tolerance_) {
+      break;
     }
   }
+  return {iter, (float) relative_residual};
+}
+
+double GridFluidSimulator::RedBlackSorSweep(const Field2D &rhs,
+                                            float rhs_weight,
+                                            float neighbour_weight,
+                                            float omega,
+                                            uint32_t colour,
+                                            Field2D &u) const {
+  return thread_pool_->ParallelSum(0, (int32_t) u.Height(), u.Width(), [&](int32_t y_begin, int32_t y_end) {
+    if (fluid_region_) {
+      return RedBlackSorRuns(*fluid_region_, rhs, rhs_weight, neighbour_weight, omega, colour, y_begin, y_end, u);
+    }
+    return kernels_->red_black_sor_rows(rhs, rhs_weight, neighbour_weight, omega, colour, y_begin, y_end, u);
+  });
+}
+
+double GridFluidSimulator::Norm(const Field2D &field) const {
+  auto w = (int32_t) field.Width();
+  return std::sqrt(thread_pool_->ParallelSum(0, (int32_t) field.Height(), w, [&](int32_t y_begin, int32_t y_end) {
+    auto sum = 0.0;
+    for (auto y = y_begin; y < y_end; ++y) {
+      const auto *row = field.Row(y);
+      for (auto x = 0; x < w; ++x) {
+        sum += (double) row[x] * (double) row[x];
+      }
+    }
+    return sum;
+  }));
 }
 
 void GridFluidSimulator::SuppressDivergence() {
-  std::vector<float> divergence(num_cells_, 0);
-  ComputeDivergence(divergence);
-  std::vector<float> pressure(num_cells_, 0);
-  ComputePressure(divergence, pressure);
-  std::vector<float> curl_x(num_cells_, 0);
-  std::vector<float> curl_y(num_cells_, 0);
-  ComputeCurlField(pressure, curl_x, curl_y);
-
-  for (auto i = 0; i < num_cells_; ++i) {
-    velocity_x_.at(i) -= curl_x.at(i);
-    velocity_y_.at(i) -= curl_y.at(i);
+  if (fused_projection_ && pressure_solver_ == RED_BLACK_SOR && max_pressure_iterations_ > 0 && !fluid_region_
+      && !refill_pressure_halo_) {
+    SuppressDivergenceFused();
+    CorrectBoundaryVelocities(velocity_x_, velocity_y_);
+    return;
   }
+
+  ComputeDivergence(divergence_);
+  ComputePressure(divergence_, pressure_);
+
+  // The largest velocity component for the next CFL check falls out of the same pass
+  auto h = (int32_t) velocity_x_.Height();
+  max_speed_ = (float) thread_pool_->ParallelMax(0, h, velocity_x_.Width(), [&](int32_t y_begin, int32_t y_end) {
+    if (fluid_region_) {
+      return ProjectRuns(*fluid_region_, pressure_, y_begin, y_end, velocity_x_, velocity_y_);
+    }
+    return kernels_->project_rows(pressure_, y_begin, y_end, velocity_x_, velocity_y_);
+  });
   CorrectBoundaryVelocities(velocity_x_, velocity_y_);
 }
 
-void GridFluidSimulator::CorrectBoundaryDensities(std::vector<float> &densities) const {
-  // Horizontal boundaries
-  for (auto x = 1; x < dim_x_ - 1; ++x) {
-    // Top
-    densities.at(Index(x, 0)) = densities.at(Index(x, 1));
-    densities.at(Index(x, dim_y_ - 1)) = densities.at(Index(x, dim_y_ - 2));
-  }
-  // Vertical boundaries
-  for (auto y = 1; y < dim_y_ - 1; ++y) {
-    densities.at(Index(0, y)) = densities.at(Index(1, y));
-    densities.at(Index(dim_x_ - 1, y)) = densities.at(Index(dim_x_ - 2, y));
-  }
-  densities.at(Index(0, 0)) = 0.5f * (densities.at(Index(1, 0)) + densities.at(Index(0, 1)));
-  densities.at(Index(0, dim_y_ - 1)) = 0.5f * (densities.at(Index(0, dim_y_ - 2)) + densities.at(Index(1, dim_y_ - 1)));
-  densities.at(Index(dim_x_ - 1, 0)) = 0.5f * (densities.at(Index(dim_x_ - 2, 0)) + densities.at(Index(dim_x_ - 1, 1)));
-  densities.at(Index(dim_x_ - 1, dim_y_ - 1)) =
-          0.5f * (densities.at(Index(dim_x_ - 2, dim_y_ - 1)) + densities.at(Index(dim_x_ - 1, dim_y_ - 2)));
-}
-
-void GridFluidSimulator::CorrectBoundaryVelocities(std::vector<float> &velocity_x,
-                                                   std::vector<float> &velocity_y) const {
-  // Horizontal boundaries
-  for (auto x = 1; x < dim_x_ - 1; ++x) {
-    // Top
-    velocity_x.at(Index(x, 0)) = velocity_x.at(Index(x, 1));
-    velocity_y.at(Index(x, 0)) = 0; //-velocity_y.at(Index(x, 1));
-
-    // Bottom
-    velocity_x.at(Index(x, dim_y_ - 1)) = velocity_x.at(Index(x, dim_y_ - 2));
-    velocity_y.at(Index(x, dim_y_ - 1)) = 0; //-velocity_y.at(Index(x, dim_y_ - 2));
-  }
-  // Vertical boundaries
-  for (auto y = 1; y < dim_y_ - 1; ++y) {
-    // Left
-    velocity_x.at(Index(0, y)) = 0; //-velocity_x.at(Index(1, y));
-    velocity_y.at(Index(0, y)) = velocity_y.at(Index(1, y));
-    // Right
-    velocity_x.at(Index(dim_x_ - 1, y)) = 0; //-velocity_x.at(Index(dim_x_ - 2, y));
-    velocity_y.at(Index(dim_x_ - 1, y)) = velocity_y.at(Index(dim_x_ - 2, y));
-  }
-  velocity_x.at(Index(0, 0)) = 0.5f * (velocity_x.at(Index(1, 0)) + velocity_x.at(Index(0, 1)));
-  velocity_x.at(Index(0, dim_y_ - 1)) =
-          0.5f * (velocity_x.at(Index(0, dim_y_ - 2)) + velocity_x.at(Index(1, dim_y_ - 1)));
-  velocity_x.at(Index(dim_x_ - 1, 0)) =
-          0.5f * (velocity_x.at(Index(dim_x_ - 2, 0)) + velocity_x.at(Index(dim_x_ - 1, 1)));
-  velocity_x.at(Index(dim_x_ - 1, dim_y_ - 1)) =
-          0.5f * (velocity_x.at(Index(dim_x_ - 2, dim_y_ - 1)) + velocity_x.at(Index(dim_x_ - 1, dim_y_ - 2)));
-
-  velocity_y.at(Index(0, 0)) = 0.5f * (velocity_y.at(Index(1, 0)) + velocity_y.at(Index(0, 1)));
-  velocity_y.at(Index(0, dim_y_ - 1)) =
-          0.5f * (velocity_y.at(Index(0, dim_y_ - 2)) + velocity_y.at(Index(1, dim_y_ - 1)));
-  velocity_y.at(Index(dim_x_ - 1, 0)) =
-          0.5f * (velocity_y.at(Index(dim_x_ - 2, 0)) + velocity_y.at(Index(dim_x_ - 1, 1)));
-  velocity_y.at(Index(dim_x_ - 1, dim_y_ - 1)) =
-          0.5f * (velocity_y.at(Index(dim_x_ - 2, dim_y_ - 1)) + velocity_y.at(Index(dim_x_ - 1, dim_y_ - 2)));
+/*
+ * ComputePressureRedBlackSor with the divergence computed in its first sweep and the projection
+ * done in its last. An iteration ends with that last sweep when its red half alone puts the
+ * residual estimate within tolerance, counting the black half as about as large, or when it is
+ * the last one allowed. If the full estimate is within tolerance first, the velocity is projected
+ * in a pass of its own as usual.
+ */
+void GridFluidSimulator::SuppressDivergenceFused() {
+  if (!warm_start_pressure_) {
+    pressure_.Fill(0.0f);
+  }
+
+  auto w = velocity_x_.Width();
+  auto h = (int32_t) velocity_x_.Height();
+  auto change_sq = thread_pool_->ParallelSum(0, h, w, [&](int32_t y_begin, int32_t y_end) {
+    return kernels_->divergence_sor_rows(velocity_x_, velocity_y_, pressure_omega_, y_begin, y_end, divergence_,
+                                         row_sums_.data(), pressure_);
+  });
+  auto rhs_norm = std::sqrt(SumRows());
+  if (rhs_norm == 0.0) {
+    pressure_.Fill(0.0f);
+    last_pressure_solve_ = {0, 0.0f};
+  }
+
+  auto iter = 0u;
+  auto fused = false;
+  while (rhs_norm != 0.0) {
+    ++iter;
+    if (iter == max_pressure_iterations_ || 4.0 * std::sqrt(2.0 * change_sq) / rhs_norm <= pressure_tolerance_) {
+      fused = true;
+      max_speed_ = (float) thread_pool_->ParallelMax(0, h, w, [&](int32_t y_begin, int32_t y_end) {
+        band_edge_rows_[y_begin] = 1;
+        band_edge_rows_[y_end - 1] = 1;
+        return kernels_->sor_project_rows(divergence_, pressure_omega_, y_begin, y_end, row_sums_.data(), pressure_,
+                                          velocity_x_, velocity_y_);
+      });
+      change_sq += SumRows();
+      last_pressure_solve_ = {iter, (float) (4.0 * std::sqrt(change_sq) / rhs_norm)};
+      break;
+    }
+
+    change_sq += RedBlackSorSweep(divergence_, -0.25f, 0.25f, pressure_omega_, 1, pressure_);
+    auto relative_residual = 4.0 * std::sqrt(change_sq) / rhs_norm;
+    if (relative_residual <= pressure_tolerance_) {
+      last_pressure_solve_ = {iter, (float) relative_residual};
+      break;
+    }
+    change_sq = RedBlackSorSweep(divergence_, -0.25f, 0.25f, pressure_omega_, 0, pressure_);
+  }
+  spdlog::debug("Pressure solve: {} iterations, residual {}",
+                last_pressure_solve_.iterations,
+                last_pressure_solve_.residual);
+
+  if (!fused) {
+    max_speed_ = (float) thread_pool_->ParallelMax(0, h, w, [&](int32_t y_begin, int32_t y_end) {
+      return kernels_->project_rows(pressure_, y_begin, y_end, velocity_x_, velocity_y_);
+    });
+    return;
+  }
+
+  // The rows at the edges of the bands, now that every band has finished its sweep
+  for (auto y = 0; y < h; ++y) {
+    if (band_edge_rows_[y]) {
+      band_edge_rows_[y] = 0;
+      max_speed_ = std::max(max_speed_, (float) kernels_->project_rows(pressure_, y, y + 1, velocity_x_, velocity_y_));
+    }
+  }
+}
+
+double GridFluidSimulator::SumRows() const {
+  auto sum = 0.0;
+  for (auto row_sum : row_sums_) {
+    sum += row_sum;
+  }
+  return sum;
+}
+
+/*
+ * As the boundary modes say; see UpdateBoundaries()
+ */
+void GridFluidSimulator::CorrectBoundaryDensities(Field2D &densities) const {
+  densities.FillHalo(density_fill_);
+  if (fluid_region_) {
+    fluid_region_->ApplyScalarBoundary(densities);
+  }
+}
+
+void GridFluidSimulator::CorrectBoundaryVelocities(Field2D &velocity_x, Field2D &velocity_y) const {
+  velocity_x.FillHalo(velocity_x_fill_);
+  velocity_y.FillHalo(velocity_y_fill_);
+  if (fluid_region_) {
+    fluid_region_->ApplyVelocityBoundary(velocity_x, velocity_y);
+  }
+}
+
+float GridFluidSimulator::MaxSourceSpeed() const {
+  auto max_speed = 0.0f;
+  for (const auto &source : Sources()) {
+    auto speed = std::max(std::abs(std::get<1>(source.second)), std::abs(std::get<2>(source.second)));
+    max_speed = std::max(max_speed, speed);
+  }
+  return max_speed;
 }
 
+/*
+ * Each substep takes the largest timestep that meets the CFL number and splits the time left
+ * evenly, so there is no sliver of a step at the end. If the substep budget would be exceeded the
+ * remaining substeps share the time left regardless.
+ */
 void GridFluidSimulator::Simulate() {
-  std::vector<float> temp_density(num_cells_, 0);
-  std::vector<float> temp_velocity_x(num_cells_, 0);
-  std::vector<float> temp_velocity_y(num_cells_, 0);
+  if (!adaptive_timestep_) {
+    Step(delta_t_);
+    last_substeps_ = 1;
+    return;
+  }
 
+  auto remaining = delta_t_;
+  auto substeps = 0u;
+  while (true) {
+    auto speed = std::max(max_speed_, MaxSourceSpeed());
+    auto needed = (uint32_t) std::max(1.0f, std::ceil(remaining * speed / cfl_number_));
+    auto num_substeps = std::min(needed, max_substeps_ - substeps);
+    auto delta_t = remaining / (float) num_substeps;
+    Step(delta_t);
+    ++substeps;
+    if (num_substeps == 1) {
+      break;
+    }
+    remaining -= delta_t;
+  }
+  last_substeps_ = substeps;
+}
+
+/*
+ * The fluid runs are rebuilt when the obstacles have changed. Cells that have just become solid
+ * are cleared in every field, pressure and divergence included, so that solid cells only ever
+ * hold boundary values and zero pressure.
+ */
+void GridFluidSimulator::UpdateFluidRegion() {
+  if (Obstacles().Version() != obstacles_version_) {
+    obstacles_version_ = Obstacles().Version();
+    fluid_region_.reset();
+    if (Obstacles().NumSolid() > 0) {
+      fluid_region_ = std::make_unique<FluidRegion>(Obstacles());
+      for (auto *field : {&density_, &velocity_x_, &velocity_y_, &pressure_, &temp_pressure_, &divergence_}) {
+        fluid_region_->ClearSolid(*field);
+      }
+      for (auto &scalar : scalars_) {
+        fluid_region_->ClearSolid(scalar.field);
+      }
+    }
+  }
+  if (fluid_region_ && pressure_solver_ != JACOBI && pressure_solver_ != RED_BLACK_SOR) {
+    throw std::runtime_error("Obstacles need the JACOBI or RED_BLACK_SOR pressure solver");
+  }
+}
+
+void GridFluidSimulator::Step(float delta_t) {
+  step_delta_t_ = delta_t;
+  UpdateFluidRegion();
   ProcessSources();
+  ProcessScalarSources();
   CorrectBoundaryDensities(density_);
   CorrectBoundaryVelocities(velocity_x_, velocity_y_);
+  for (auto &scalar : scalars_) {
+    CorrectBoundaryDensities(scalar.field);
+  }
 
-  Diffuse(density_, temp_density);
-  std::memcpy(density_.data(), temp_density.data(), num_cells_ * sizeof(float));
+  Diffuse(density_, temp_density_, density_fill_);
+  density_.Swap(temp_density_);
 
-  AdvectDensity(density_, temp_density);
-  std::memcpy(density_.data(), temp_density.data(), num_cells_ * sizeof(float));
+  DiffuseScalars();
+  for (auto &scalar : scalars_) {
+    scalar.field.Swap(scalar.temp_field);
+  }
 
-  Diffuse(velocity_x_, temp_velocity_x);
-  Diffuse(velocity_y_, temp_velocity_y);
-  CorrectBoundaryVelocities(temp_velocity_x, temp_velocity_y);
-  std::memcpy(velocity_x_.data(), temp_velocity_x.data(), num_cells_ * sizeof(float));
-  std::memcpy(velocity_y_.data(), temp_velocity_y.data(), num_cells_ * sizeof(float));
+  Diffuse(velocity_x_, temp_velocity_x_, diffuse_velocity_x_fill_);
+  Diffuse(velocity_y_, temp_velocity_y_, diffuse_velocity_y_fill_);
+  CorrectBoundaryVelocities(temp_velocity_x_, temp_velocity_y_);
+  velocity_x_.Swap(temp_velocity_x_);
+  velocity_y_.Swap(temp_velocity_y_);
 
-  AdvectVelocity(temp_velocity_x, temp_velocity_y);
-  std::memcpy(velocity_x_.data(), temp_velocity_x.data(), num_cells_ * sizeof(float));
-  std::memcpy(velocity_y_.data(), temp_velocity_y.data(), num_cells_ * sizeof(float));
+  AdvectFields();
 
   SuppressDivergence();
-}
\ No newline at end of file
+}
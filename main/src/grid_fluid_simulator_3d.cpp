@@ -0,0 +1,349 @@
+#include "grid_fluid_simulator_3d.h"
+#include "red_black_sor.h"
+
+#include <algorithm>
+#include <cmath>
+
+const uint32_t NUM_GS_ITERS = 10;
+const float DEFAULT_PRESSURE_TOLERANCE = 1e-4f;
+const uint32_t DEFAULT_MAX_PRESSURE_ITERATIONS = 200;
+
+namespace {
+// A field to advect and the field that receives the result
+struct Target {
+  const Field3D *source;
+  Field3D *destination;
+};
+
+/*
+ * Red-black update of one row for systems of the form
+ *   u = rhs_weight * rhs + neighbour_weight * (sum of the 6 face neighbours)
+ * over the cells of one colour, which sit at every other x from parity. As in the 2D sweep the
+ * neighbour rows are marked as not aliasing the row being updated so the loop vectorises.
+ */
+float SorRow(const float *__restrict back,
+             const float *__restrict below,
+             float *row,
+             const float *__restrict above,
+             const float *__restrict front,
+             const float *__restrict rhs,
+             int32_t width,
+             int32_t parity,
+             float rhs_weight,
+             float neighbour_weight,
+             float omega) {
+  auto num_cells = (width - parity + 1) / 2;
+  auto *cells = row + parity;
+  back += parity;
+  below += parity;
+  above += parity;
+  front += parity;
+  rhs += parity;
+  auto change_sq = 0.0f;
+  for (auto i = 0; i < num_cells; ++i) {
+    auto gs = rhs_weight * rhs[2 * i]
+              + neighbour_weight * (cells[2 * i - 1] + cells[2 * i + 1] + below[2 * i] + above[2 * i]
+                                    + back[2 * i] + front[2 * i]);
+    auto delta = gs - cells[2 * i];
+    cells[2 * i] += omega * delta;
+    change_sq += delta * delta;
+  }
+  return change_sq;
+}
+
+// One colour, (x + y + z) % 2 == colour, over the whole volume. Returns the sum of squared corrections.
+double SorSweep(ThreadPool *thread_pool,
+                const Field3D &rhs,
+                float rhs_weight,
+                float neighbour_weight,
+                float omega,
+                uint32_t colour,
+                Field3D &u) {
+  auto w = (int32_t) u.Width();
+  auto h = (int32_t) u.Height();
+  return ParallelSum(thread_pool, 0, (int32_t) u.Depth(), w * h, [&](int32_t z_begin, int32_t z_end) {
+    auto sum = 0.0;
+    for (auto z = z_begin; z < z_end; ++z) {
+      for (auto y = 0; y < h; ++y) {
+        auto parity = (int32_t) ((colour + y + z) & 1);
+        sum += SorRow(u.Row(y, z - 1), u.Row(y - 1, z), u.Row(y, z), u.Row(y + 1, z), u.Row(y, z + 1),
+                      rhs.Row(y, z), w, parity, rhs_weight, neighbour_weight, omega);
+      }
+    }
+    return sum;
+  });
+}
+
+double Norm(ThreadPool *thread_pool, const Field3D &field) {
+  auto w = (int32_t) field.Width();
+  auto h = (int32_t) field.Height();
+  return std::sqrt(ParallelSum(thread_pool, 0, (int32_t) field.Depth(), w * h, [&](int32_t z_begin, int32_t z_end) {
+    auto sum = 0.0;
+    for (auto z = z_begin; z < z_end; ++z) {
+      for (auto y = 0; y < h; ++y) {
+        const auto *row = field.Row(y, z);
+        for (auto x = 0; x < w; ++x) {
+          sum += (double) row[x] * (double) row[x];
+        }
+      }
+    }
+    return sum;
+  }));
+}
+
+inline float Lerp(float from, float to, float pct) { return from + pct * (to - from); }
+
+/*
+ * Trace each cell of planes [z_begin, z_end) back along its velocity and trilinearly interpolate
+ * every target there. Departure points are clamped to the centres of the halo cells, as in 2D.
+ */
+void AdvectPlanes(const Field3D &velocity_x,
+                  const Field3D &velocity_y,
+                  const Field3D &velocity_z,
+                  float delta_t,
+                  const Target *targets,
+                  size_t num_targets,
+                  int32_t z_begin,
+                  int32_t z_end) {
+  const auto &shape = *targets[0].source;
+  auto w = (int32_t) shape.Width();
+  auto h = (int32_t) shape.Height();
+  auto d = (int32_t) shape.Depth();
+  auto row_stride = (intptr_t) shape.RowStride();
+  auto plane_stride = (intptr_t) shape.PlaneStride();
+  for (auto z = z_begin; z < z_end; ++z) {
+    for (auto y = 0; y < h; ++y) {
+      const auto *vx = velocity_x.Row(y, z);
+      const auto *vy = velocity_y.Row(y, z);
+      const auto *vz = velocity_z.Row(y, z);
+      for (auto x = 0; x < w; ++x) {
+        auto source_x = std::max(-0.5f, std::min((float) w + 0.5f, ((float) x + 0.5f) - vx[x] * delta_t));
+        auto source_y = std::max(-0.5f, std::min((float) h + 0.5f, ((float) y + 0.5f) - vy[x] * delta_t));
+        auto source_z = std::max(-0.5f, std::min((float) d + 0.5f, ((float) z + 0.5f) - vz[x] * delta_t));
+
+        // Base of the 2x2x2 stencil, clamped so that base + 1 is still in the halo
+        auto base_x = std::min(std::floor(source_x - 0.5f), (float) (w - 1));
+        auto base_y = std::min(std::floor(source_y - 0.5f), (float) (h - 1));
+        auto base_z = std::min(std::floor(source_z - 0.5f), (float) (d - 1));
+        auto frac_x = source_x - base_x - 0.5f;
+        auto frac_y = source_y - base_y - 0.5f;
+        auto frac_z = source_z - base_z - 0.5f;
+        auto offset = (intptr_t) base_z * plane_stride + (intptr_t) base_y * row_stride + (intptr_t) base_x;
+
+        for (size_t t = 0; t < num_targets; ++t) {
+          const auto *c = targets[t].source->Row(0, 0) + offset;
+          const auto *c_up = c + row_stride;
+          auto near = Lerp(Lerp(c[0], c[1], frac_x), Lerp(c_up[0], c_up[1], frac_x), frac_y);
+          const auto *c_far = c + plane_stride;
+          const auto *c_far_up = c_far + row_stride;
+          auto far = Lerp(Lerp(c_far[0], c_far[1], frac_x), Lerp(c_far_up[0], c_far_up[1], frac_x), frac_y);
+          targets[t].destination->Row(y, z)[x] = Lerp(near, far, frac_z);
+        }
+      }
+    }
+  }
+}
+}
+
+GridFluidSimulator3D::GridFluidSimulator3D(uint32_t width,      //
+                                           uint32_t height,     //
+                                           uint32_t depth,      //
+                                           float delta_t,       //
+                                           float diffusion_rate //
+)                    //
+        : FluidSimulator3D{width, height, depth}                                           //
+        , delta_t_{delta_t}                                                                //
+        , diffusion_rate_{diffusion_rate}                                                  //
+        , pressure_tolerance_{DEFAULT_PRESSURE_TOLERANCE}                                  //
+        , max_pressure_iterations_{DEFAULT_MAX_PRESSURE_ITERATIONS}                        //
+        , pressure_omega_{OptimalSorOmega(std::max(width, height) - 2, depth - 2)}         //
+        , last_pressure_solve_{0, 0.0f}                                                    //
+        , thread_pool_{std::make_unique<ThreadPool>(0)}                                    //
+{
+  // Every buffer a step needs is allocated here so that Simulate() never touches the heap
+  auto w = density_.Width();
+  auto h = density_.Height();
+  auto d = density_.Depth();
+  pressure_ = Field3D(w, h, d);
+  divergence_ = Field3D(w, h, d);
+  temp_density_ = Field3D(w, h, d);
+  temp_velocity_x_ = Field3D(w, h, d);
+  temp_velocity_y_ = Field3D(w, h, d);
+  temp_velocity_z_ = Field3D(w, h, d);
+}
+
+void GridFluidSimulator3D::SetPressureTolerance(float tolerance) {
+  pressure_tolerance_ = tolerance;
+}
+
+void GridFluidSimulator3D::SetMaxPressureIterations(uint32_t max_iterations) {
+  max_pressure_iterations_ = max_iterations;
+}
+
+void GridFluidSimulator3D::SetPressureOmega(float omega) {
+  pressure_omega_ = omega;
+}
+
+void GridFluidSimulator3D::SetNumThreads(uint32_t num_threads) {
+  thread_pool_ = std::make_unique<ThreadPool>(num_threads);
+}
+
+/*
+ * Dn = (Dc + k/6 * sum of the 6 neighbours of Dn) / (1 + k)
+ */
+void GridFluidSimulator3D::Diffuse(const Field3D &current, Field3D &next) {
+  next.CopyFrom(current);
+  auto k = delta_t_ * diffusion_rate_;
+  auto inv_k1 = 1.0f / (k + 1.0f);
+  for (auto iter = 0u; iter < NUM_GS_ITERS; ++iter) {
+    for (auto colour = 0u; colour < 2; ++colour) {
+      SorSweep(thread_pool_.get(), current, inv_k1, k / 6.0f * inv_k1, 1.0f, colour, next);
+    }
+    CorrectBoundaryDensities(next);
+  }
+}
+
+/*
+ * Density and the three velocity components share one backtrace per cell
+ */
+void GridFluidSimulator3D::AdvectFields() {
+  const Target targets[] = {
+          {&density_, &temp_density_},
+          {&velocity_x_, &temp_velocity_x_},
+          {&velocity_y_, &temp_velocity_y_},
+          {&velocity_z_, &temp_velocity_z_},
+  };
+  auto num_targets = sizeof(targets) / sizeof(targets[0]);
+  auto plane_cells = density_.Width() * density_.Height();
+  thread_pool_->ParallelFor(0, (int32_t) density_.Depth(), plane_cells, [&](int32_t z_begin, int32_t z_end) {
+    AdvectPlanes(velocity_x_, velocity_y_, velocity_z_, delta_t_, targets, num_targets, z_begin, z_end);
+  });
+  CorrectBoundaryDensities(temp_density_);
+  CorrectBoundaryVelocities(temp_velocity_x_, temp_velocity_y_, temp_velocity_z_);
+  density_.Swap(temp_density_);
+  velocity_x_.Swap(temp_velocity_x_);
+  velocity_y_.Swap(temp_velocity_y_);
+  velocity_z_.Swap(temp_velocity_z_);
+}
+
+/*
+ * d = [ vx(x+1) - vx(x-1) + vy(y+1) - vy(y-1) + vz(z+1) - vz(z-1) ] * 0.5
+ */
+void GridFluidSimulator3D::ComputeDivergence(Field3D &divergence) const {
+  auto w = (int32_t) divergence.Width();
+  auto h = (int32_t) divergence.Height();
+  thread_pool_->ParallelFor(0, (int32_t) divergence.Depth(), w * h, [&](int32_t z_begin, int32_t z_end) {
+    for (auto z = z_begin; z < z_end; ++z) {
+      for (auto y = 0; y < h; ++y) {
+        const auto *vx = velocity_x_.Row(y, z);
+        const auto *vy_below = velocity_y_.Row(y - 1, z);
+        const auto *vy_above = velocity_y_.Row(y + 1, z);
+        const auto *vz_back = velocity_z_.Row(y, z - 1);
+        const auto *vz_front = velocity_z_.Row(y, z + 1);
+        auto *div = divergence.Row(y, z);
+        for (auto x = 0; x < w; ++x) {
+          div[x] = (vx[x + 1] - vx[x - 1] + vy_above[x] - vy_below[x] + vz_front[x] - vz_back[x]) * 0.5f;
+        }
+      }
+    }
+  });
+}
+
+/*
+ * p(x-1) + p(x+1) + p(y-1) + p(y+1) + p(z-1) + p(z+1) - 6p = divergence, warm started from the
+ * last step. Each cell's Gauss-Seidel correction is a sixth of its residual just before it is
+ * updated, which gives a residual estimate at no extra cost.
+ */
+PoissonSolverStats GridFluidSimulator3D::ComputePressure(const Field3D &divergence, Field3D &pressure) {
+  auto rhs_norm = Norm(thread_pool_.get(), divergence);
+  if (rhs_norm == 0.0) {
+    pressure.Fill(0.0f);
+    return {0, 0.0f};
+  }
+
+  auto relative_residual = 1.0;
+  auto iter = 0u;
+  while (iter < max_pressure_iterations_) {
+    auto change_sq = 0.0;
+    for (auto colour = 0u; colour < 2; ++colour) {
+      change_sq += SorSweep(thread_pool_.get(), divergence, -1.0f / 6.0f, 1.0f / 6.0f, pressure_omega_, colour,
+                            pressure);
+    }
+    ++iter;
+    relative_residual = 6.0 * std::sqrt(change_sq) / rhs_norm;
+    if (relative_residual <= pressure_tolerance_) {
+      break;
+    }
+  }
+  return {iter, (float) relative_residual};
+}
+
+/*
+ * Subtract the central difference pressure gradient from the velocity
+ */
+void GridFluidSimulator3D::SuppressDivergence() {
+  ComputeDivergence(divergence_);
+  last_pressure_solve_ = ComputePressure(divergence_, pressure_);
+
+  auto w = (int32_t) pressure_.Width();
+  auto h = (int32_t) pressure_.Height();
+  thread_pool_->ParallelFor(0, (int32_t) pressure_.Depth(), w * h, [&](int32_t z_begin, int32_t z_end) {
+    for (auto z = z_begin; z < z_end; ++z) {
+      for (auto y = 0; y < h; ++y) {
+        const auto *p = pressure_.Row(y, z);
+        const auto *p_below = pressure_.Row(y - 1, z);
+        const auto *p_above = pressure_.Row(y + 1, z);
+        const auto *p_back = pressure_.Row(y, z - 1);
+        const auto *p_front = pressure_.Row(y, z + 1);
+        auto *vx = velocity_x_.Row(y, z);
+        auto *vy = velocity_y_.Row(y, z);
+        auto *vz = velocity_z_.Row(y, z);
+        for (auto x = 0; x < w; ++x) {
+          vx[x] -= (p[x + 1] - p[x - 1]) * 0.5f;
+          vy[x] -= (p_above[x] - p_below[x]) * 0.5f;
+          vz[x] -= (p_front[x] - p_back[x]) * 0.5f;
+        }
+      }
+    }
+  });
+  CorrectBoundaryVelocities(velocity_x_, velocity_y_, velocity_z_);
+}
+
+/*
+ * Zero gradient at the walls
+ */
+void GridFluidSimulator3D::CorrectBoundaryDensities(Field3D &densities) const {
+  densities.FillHalo(1.0f, 1.0f, 1.0f);
+}
+
+/*
+ * No flow through the walls; tangential velocity is copied
+ */
+void GridFluidSimulator3D::CorrectBoundaryVelocities(Field3D &velocity_x,
+                                                     Field3D &velocity_y,
+                                                     Field3D &velocity_z) const {
+  velocity_x.FillHalo(0.0f, 1.0f, 1.0f);
+  velocity_y.FillHalo(1.0f, 0.0f, 1.0f);
+  velocity_z.FillHalo(1.0f, 1.0f, 0.0f);
+}
+
+void GridFluidSimulator3D::Simulate() {
+  ProcessSources();
+  CorrectBoundaryDensities(density_);
+  CorrectBoundaryVelocities(velocity_x_, velocity_y_, velocity_z_);
+
+  Diffuse(density_, temp_density_);
+  density_.Swap(temp_density_);
+
+  Diffuse(velocity_x_, temp_velocity_x_);
+  Diffuse(velocity_y_, temp_velocity_y_);
+  Diffuse(velocity_z_, temp_velocity_z_);
+  CorrectBoundaryVelocities(temp_velocity_x_, temp_velocity_y_, temp_velocity_z_);
+  velocity_x_.Swap(temp_velocity_x_);
+  velocity_y_.Swap(temp_velocity_y_);
+  velocity_z_.Swap(temp_velocity_z_);
+
+  AdvectFields();
+
+  SuppressDivergence();
+}
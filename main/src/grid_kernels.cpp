@@ -0,0 +1,189 @@
+#include "grid_kernels.h"
+#include "red_black_sor.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <type_traits>
+
+namespace {
+/*
+ * The row width each kernel loops to: the field's own, or a compile-time constant that is
+ * asserted to match it.
+ */
+inline int32_t RowWidth(const Field2D &field, int32_t) {
+  return (int32_t) field.Width();
+}
+
+template<int32_t Width>
+inline std::integral_constant<int32_t, Width> RowWidth(const Field2D &field, std::integral_constant<int32_t, Width>) {
+  assert((int32_t) field.Width() == Width);
+  (void) field;
+  return {};
+}
+
+template<typename Width>
+double RedBlackSorRows(const Field2D &rhs,
+                       float rhs_weight,
+                       float neighbour_weight,
+                       float omega,
+                       uint32_t colour,
+                       int32_t y_begin,
+                       int32_t y_end,
+                       Field2D &u) {
+  auto w = RowWidth(u, Width{});
+  auto sum = 0.0;
+  for (auto y = y_begin; y < y_end; ++y) {
+    auto parity = (int32_t) ((colour + y) & 1);
+    sum += RedBlackSorRow(u.Row(y - 1), u.Row(y), u.Row(y + 1), rhs.Row(y), w, parity, rhs_weight, neighbour_weight, omega);
+  }
+  return sum;
+}
+
+template<typename Width>
+double JacobiRows(const Field2D &divergence, const Field2D &pressure, int32_t y_begin, int32_t y_end, Field2D &next) {
+  auto w = RowWidth(pressure, Width{});
+  auto sum = 0.0;
+  for (auto y = y_begin; y < y_end; ++y) {
+    const auto *p = pressure.Row(y);
+    const auto *p_below = pressure.Row(y - 1);
+    const auto *p_above = pressure.Row(y + 1);
+    const auto *div = divergence.Row(y);
+    auto *p_next = next.Row(y);
+    for (auto x = 0; x < w; ++x) {
+      auto p_new = (p[x - 1] + p[x + 1] + p_below[x] + p_above[x] - div[x]) * 0.25f;
+      auto change = (double) (p_new - p[x]);
+      sum += change * change;
+      p_next[x] = p_new;
+    }
+  }
+  return sum;
+}
+
+template<typename Width>
+inline void DivergenceRow(const float *vx, const float *vy_below, const float *vy_above, Width w, float *div) {
+  for (auto x = 0; x < w; ++x) {
+    div[x] = (vx[x + 1] - vx[x - 1] + vy_above[x] - vy_below[x]) * 0.5f;
+  }
+}
+
+template<typename Width>
+void DivergenceRows(const Field2D &velocity_x,
+                    const Field2D &velocity_y,
+                    int32_t y_begin,
+                    int32_t y_end,
+                    Field2D &divergence) {
+  auto w = RowWidth(divergence, Width{});
+  for (auto y = y_begin; y < y_end; ++y) {
+    DivergenceRow(velocity_x.Row(y), velocity_y.Row(y - 1), velocity_y.Row(y + 1), w, divergence.Row(y));
+  }
+}
+
+/*
+ * \nabla p(x,y) = 0.5f * [ p(x+1,y) - p(x-1,y), p(x,y+1) - p(x,y-1) ]
+ */
+template<typename Width>
+inline float ProjectRow(const float *p_below, const float *p, const float *p_above, Width w, float *vx, float *vy) {
+  auto max_speed = 0.0f;
+  for (auto x = 0; x < w; ++x) {
+    vx[x] -= (p[x + 1] - p[x - 1]) * 0.5f;
+    vy[x] -= (p_above[x] - p_below[x]) * 0.5f;
+    max_speed = std::max(max_speed, std::max(std::abs(vx[x]), std::abs(vy[x])));
+  }
+  return max_speed;
+}
+
+template<typename Width>
+double ProjectRows(const Field2D &pressure, int32_t y_begin, int32_t y_end, Field2D &velocity_x, Field2D &velocity_y) {
+  auto w = RowWidth(pressure, Width{});
+  auto max_speed = 0.0f;
+  for (auto y = y_begin; y < y_end; ++y) {
+    auto row_max = ProjectRow(pressure.Row(y - 1), pressure.Row(y), pressure.Row(y + 1), w, velocity_x.Row(y),
+                              velocity_y.Row(y));
+    max_speed = std::max(max_speed, row_max);
+  }
+  return (double) max_speed;
+}
+
+template<typename Width>
+double DivergenceSorRows(const Field2D &velocity_x,
+                         const Field2D &velocity_y,
+                         float omega,
+                         int32_t y_begin,
+                         int32_t y_end,
+                         Field2D &divergence,
+                         double *row_sums,
+                         Field2D &pressure) {
+  auto w = RowWidth(pressure, Width{});
+  auto sum = 0.0;
+  for (auto y = y_begin; y < y_end; ++y) {
+    auto *div = divergence.Row(y);
+    DivergenceRow(velocity_x.Row(y), velocity_y.Row(y - 1), velocity_y.Row(y + 1), w, div);
+    auto norm_sq = 0.0;
+    for (auto x = 0; x < w; ++x) {
+      norm_sq += (double) div[x] * (double) div[x];
+    }
+    row_sums[y] = norm_sq;
+    auto parity = (int32_t) (y & 1);
+    sum += RedBlackSorRow(pressure.Row(y - 1), pressure.Row(y), pressure.Row(y + 1), div, w, parity, -0.25f, 0.25f,
+                          omega);
+  }
+  return sum;
+}
+
+/*
+ * A colour 1 sweep only writes row y, so once it has moved on to row y + 1 the rows around y hold
+ * their final values as far as this band is concerned.
+ */
+template<typename Width>
+double SorProjectRows(const Field2D &divergence,
+                      float omega,
+                      int32_t y_begin,
+                      int32_t y_end,
+                      double *row_sums,
+                      Field2D &pressure,
+                      Field2D &velocity_x,
+                      Field2D &velocity_y) {
+  auto w = RowWidth(pressure, Width{});
+  auto max_speed = 0.0f;
+  for (auto y = y_begin; y < y_end; ++y) {
+    auto parity = (int32_t) ((y + 1) & 1);
+    row_sums[y] = RedBlackSorRow(pressure.Row(y - 1), pressure.Row(y), pressure.Row(y + 1), divergence.Row(y), w, parity,
+                                 -0.25f, 0.25f, omega);
+    if (y - 1 > y_begin) {
+      auto row_max = ProjectRow(pressure.Row(y - 2), pressure.Row(y - 1), pressure.Row(y), w, velocity_x.Row(y - 1),
+                                velocity_y.Row(y - 1));
+      max_speed = std::max(max_speed, row_max);
+    }
+  }
+  return (double) max_speed;
+}
+
+template<typename Width>
+const GridKernels &KernelTable() {
+  static const GridKernels kernels{
+          &RedBlackSorRows<Width>,
+          &JacobiRows<Width>,
+          &DivergenceRows<Width>,
+          &ProjectRows<Width>,
+          &DivergenceSorRows<Width>,
+          &SorProjectRows<Width>,
+  };
+  return kernels;
+}
+}
+
+const GridKernels &DynamicGridKernels() {
+  return KernelTable<int32_t>();
+}
+
+template<int32_t Width>
+const GridKernels &FixedGridKernels() {
+  return KernelTable<std::integral_constant<int32_t, Width>>();
+}
+
+// Interiors of the 128, 256, 512 and 1024 cell grids
+template const GridKernels &FixedGridKernels<126>();
+template const GridKernels &FixedGridKernels<254>();
+template const GridKernels &FixedGridKernels<510>();
+template const GridKernels &FixedGridKernels<1022>();
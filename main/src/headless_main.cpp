@@ -0,0 +1,98 @@
+/*
+ * Runs GridFluidSimulator3D without the Qt UI.
+ *
+ *   FluidSimHeadless [grid size] [steps] [threads] [output file]
+ *
+ * Defaults to a 128^3 grid, 100 steps and every hardware thread. The grid needs at least 3 cells
+ * a side and the run at least one step; other arguments print the usage and fail. A smoke source
+ * near the floor of the box blows upwards. Prints the time per step and, if an output file is
+ * given, writes the final density volume to it as raw float32 in x, y, z order, boundary shell
+ * included.
+ */
+#include "grid_fluid_simulator_3d.h"
+
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+const uint32_t DEFAULT_GRID_SIZE = 128;
+const uint32_t DEFAULT_NUM_STEPS = 100;
+// Smallest grid that leaves an interior inside the boundary shell
+const uint32_t MIN_GRID_SIZE = 3;
+const float DELTA_T = 1.0f / 15.0f;
+const float DIFFUSION_RATE = 0.2f;
+
+namespace {
+void PrintUsage(const char *program) {
+  std::fprintf(stderr, "usage: %s [grid size >= %u] [steps >= 1] [threads, 0 for all] [output file]\n", program,
+               MIN_GRID_SIZE);
+}
+
+// A whole decimal argument that fits in 32 bits, or false
+bool ParseCount(const char *text, uint32_t &value) {
+  if (!std::isdigit((unsigned char) text[0])) {
+    return false;
+  }
+  errno = 0;
+  char *end = nullptr;
+  auto parsed = std::strtoul(text, &end, 10);
+  if (errno != 0 || *end != '\0' || parsed > UINT32_MAX) {
+    return false;
+  }
+  value = (uint32_t) parsed;
+  return true;
+}
+}
+
+int main(int argc, char *argv[]) {
+  auto size = DEFAULT_GRID_SIZE;
+  auto num_steps = DEFAULT_NUM_STEPS;
+  auto num_threads = 0u;
+  const char *output_path = (argc > 4) ? argv[4] : nullptr;
+  if (argc > 1 && (std::strcmp(argv[1], "-h") == 0 || std::strcmp(argv[1], "--help") == 0)) {
+    PrintUsage(argv[0]);
+    return EXIT_SUCCESS;
+  }
+  if (argc > 5 || (argc > 1 && (!ParseCount(argv[1], size) || size < MIN_GRID_SIZE))
+      || (argc > 2 && (!ParseCount(argv[2], num_steps) || num_steps == 0))
+      || (argc > 3 && !ParseCount(argv[3], num_threads))) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    GridFluidSimulator3D sim{size, size, size, DELTA_T, DIFFUSION_RATE};
+    sim.SetNumThreads(num_threads);
+    sim.AddSource(size / 2, size / 8, size / 2, 1.0f, 0.0f, 0.1f * (float) size, 0.0f);
+
+    std::printf("%u^3 grid, %u steps, %u threads\n", size, num_steps, sim.NumThreads());
+    auto start = std::chrono::steady_clock::now();
+    for (auto step = 0u; step < num_steps; ++step) {
+      sim.Simulate();
+    }
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+    const auto &last_solve = sim.LastPressureSolve();
+    std::printf("%.2f ms/step, last pressure solve %u iterations, residual %.2e\n",
+                elapsed.count() / num_steps, last_solve.iterations, (double) last_solve.residual);
+
+    if (output_path) {
+      const auto &density = sim.Density();
+      std::ofstream out(output_path, std::ios::binary);
+      out.write(reinterpret_cast<const char *>(density.data()), (std::streamsize) (density.size() * sizeof(float)));
+      if (!out) {
+        throw std::runtime_error(std::string("Failed to write ") + output_path);
+      }
+      std::printf("Wrote %zu floats to %s\n", density.size(), output_path);
+    }
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,316 @@
+#include "mac_grid_simulator.h"
+#include "red_black_sor.h"
+
+#include <cmath>
+#include <initializer_list>
+#include <stdexcept>
+
+const uint32_t NUM_GS_ITERS = 10;
+const float DEFAULT_PRESSURE_TOLERANCE = 1e-4f;
+const uint32_t DEFAULT_MAX_PRESSURE_ITERATIONS = 200;
+
+namespace {
+double Norm(ThreadPool *thread_pool, const Field2D &field) {
+  auto w = (int32_t) field.Width();
+  return std::sqrt(ParallelSum(thread_pool, 0, (int32_t) field.Height(), w, [&](int32_t y_begin, int32_t y_end) {
+    auto sum = 0.0;
+    for (auto y = y_begin; y < y_end; ++y) {
+      const auto *row = field.Row(y);
+      for (auto x = 0; x < w; ++x) {
+        sum += (double) row[x] * (double) row[x];
+      }
+    }
+    return sum;
+  }));
+}
+}
+
+MACGridSimulator::MACGridSimulator(uint32_t width,      //
+                                   uint32_t height,     //
+                                   float delta_t,       //
+                                   float diffusion_rate //
+)                    //
+        : FluidSimulator2D{width, height}                           //
+        , delta_t_{delta_t}                                         //
+        , diffusion_rate_{diffusion_rate}                           //
+        , pressure_tolerance_{DEFAULT_PRESSURE_TOLERANCE}           //
+        , max_pressure_iterations_{DEFAULT_MAX_PRESSURE_ITERATIONS} //
+        , pressure_omega_{OptimalSorOmega(width - 2, height - 2)}   //
+        , last_pressure_solve_{0, 0.0f}                             //
+        , advector_{}                                               //
+        , thread_pool_{std::make_unique<ThreadPool>(0)}             //
+{
+  if (width < 4 || height < 4) {
+    throw std::runtime_error("A MAC grid needs at least two interior cells in each direction");
+  }
+
+  // Every buffer a step needs is allocated here so that Simulate() never touches the heap
+  auto cells_x = density_.Width();
+  auto cells_y = density_.Height();
+  auto halo = density_.Halo();
+  face_velocity_x_ = Field2D(cells_x - 1, cells_y, halo);
+  face_velocity_y_ = Field2D(cells_x, cells_y - 1, halo);
+  pressure_ = Field2D(cells_x, cells_y, halo);
+  divergence_ = Field2D(cells_x, cells_y, halo);
+  temp_density_ = Field2D(cells_x, cells_y, halo);
+  temp_face_velocity_x_ = Field2D(cells_x - 1, cells_y, halo);
+  temp_face_velocity_y_ = Field2D(cells_x, cells_y - 1, halo);
+  face_velocity_y_at_x_ = Field2D(cells_x - 1, cells_y, halo);
+  face_velocity_x_at_y_ = Field2D(cells_x, cells_y - 1, halo);
+}
+
+void MACGridSimulator::SetPressureTolerance(float tolerance) {
+  pressure_tolerance_ = tolerance;
+}
+
+void MACGridSimulator::SetMaxPressureIterations(uint32_t max_iterations) {
+  max_pressure_iterations_ = max_iterations;
+}
+
+void MACGridSimulator::SetNumThreads(uint32_t num_threads) {
+  thread_pool_ = std::make_unique<ThreadPool>(num_threads);
+}
+
+/*
+ * A source sets the density of its cell and the velocity on the cell's faces. Faces on the walls
+ * stay closed.
+ */
+void MACGridSimulator::ProcessFaceSources() {
+  auto num_faces_x = (int32_t) face_velocity_x_.Width();
+  auto num_faces_y = (int32_t) face_velocity_y_.Height();
+  auto cells_x = (int32_t) density_.Width();
+  auto cells_y = (int32_t) density_.Height();
+  for (const auto &source : Sources()) {
+    auto x = (int32_t) (source.first % dim_x_) - 1;
+    auto y = (int32_t) (source.first / dim_x_) - 1;
+    density_(x, y) = std::get<0>(source.second);
+    if (y >= 0 && y < cells_y) {
+      for (auto face_x : {x - 1, x}) {
+        if (face_x >= 0 && face_x < num_faces_x) {
+          face_velocity_x_(face_x, y) = std::get<1>(source.second);
+        }
+      }
+    }
+    if (x >= 0 && x < cells_x) {
+      for (auto face_y : {y - 1, y}) {
+        if (face_y >= 0 && face_y < num_faces_y) {
+          face_velocity_y_(x, face_y) = std::get<2>(source.second);
+        }
+      }
+    }
+  }
+}
+
+/*
+ * Implicit diffusion by red-black Gauss-Seidel, as in GridFluidSimulator. The halo is refilled
+ * with the field's boundary condition after every iteration.
+ */
+void MACGridSimulator::Diffuse(const Field2D &current, Field2D &next, float x_edge_factor, float y_edge_factor) {
+  next.CopyFrom(current);
+  auto k = delta_t_ * diffusion_rate_;
+  auto inv_k1 = 1.0f / (k + 1.0f);
+  for (auto iter = 0u; iter < NUM_GS_ITERS; ++iter) {
+    for (auto colour = 0u; colour < 2; ++colour) {
+      RedBlackSorSweep(thread_pool_.get(), current, inv_k1, 0.25f * k * inv_k1, 1.0f, colour, next);
+    }
+    next.FillHalo(x_edge_factor, y_edge_factor);
+  }
+}
+
+/*
+ * Each field is traced back through the velocity at its own sample points: the cell centre
+ * average for density, and for each set of faces its own component plus the average of the four
+ * nearest faces of the other. The face fields are advected as grids of their own, so departure
+ * points are clamped to the walls.
+ */
+void MACGridSimulator::Advect() {
+  ComputeCellVelocities(velocity_x_, velocity_y_);
+
+  auto num_faces_x = (int32_t) face_velocity_x_.Width();
+  thread_pool_->ParallelFor(0, (int32_t) face_velocity_x_.Height(), num_faces_x, [&](int32_t y_begin, int32_t y_end) {
+    for (auto y = y_begin; y < y_end; ++y) {
+      const auto *vy_below = face_velocity_y_.Row(y - 1);
+      const auto *vy_above = face_velocity_y_.Row(y);
+      auto *vy = face_velocity_y_at_x_.Row(y);
+      for (auto x = 0; x < num_faces_x; ++x) {
+        vy[x] = 0.25f * (vy_below[x] + vy_below[x + 1] + vy_above[x] + vy_above[x + 1]);
+      }
+    }
+  });
+  auto cells_x = (int32_t) face_velocity_y_.Width();
+  thread_pool_->ParallelFor(0, (int32_t) face_velocity_y_.Height(), cells_x, [&](int32_t y_begin, int32_t y_end) {
+    for (auto y = y_begin; y < y_end; ++y) {
+      const auto *vx_below = face_velocity_x_.Row(y);
+      const auto *vx_above = face_velocity_x_.Row(y + 1);
+      auto *vx = face_velocity_x_at_y_.Row(y);
+      for (auto x = 0; x < cells_x; ++x) {
+        vx[x] = 0.25f * (vx_below[x - 1] + vx_below[x] + vx_above[x - 1] + vx_above[x]);
+      }
+    }
+  });
+
+  const SemiLagrangianAdvector::Target density{&density_, &temp_density_};
+  const SemiLagrangianAdvector::Target faces_x{&face_velocity_x_, &temp_face_velocity_x_};
+  const SemiLagrangianAdvector::Target faces_y{&face_velocity_y_, &temp_face_velocity_y_};
+  thread_pool_->ParallelFor(0, (int32_t) density_.Height(), density_.Width(), [&](int32_t y_begin, int32_t y_end) {
+    advector_.AdvectRows(velocity_x_, velocity_y_, delta_t_, &density, 1, y_begin, y_end);
+  });
+  thread_pool_->ParallelFor(0, (int32_t) face_velocity_x_.Height(), num_faces_x, [&](int32_t y_begin, int32_t y_end) {
+    advector_.AdvectRows(face_velocity_x_, face_velocity_y_at_x_, delta_t_, &faces_x, 1, y_begin, y_end);
+  });
+  thread_pool_->ParallelFor(0, (int32_t) face_velocity_y_.Height(), cells_x, [&](int32_t y_begin, int32_t y_end) {
+    advector_.AdvectRows(face_velocity_x_at_y_, face_velocity_y_, delta_t_, &faces_y, 1, y_begin, y_end);
+  });
+
+  temp_density_.FillHalo(1.0f, 1.0f);
+  CorrectBoundaryFaceVelocities(temp_face_velocity_x_, temp_face_velocity_y_);
+  density_.Swap(temp_density_);
+  face_velocity_x_.Swap(temp_face_velocity_x_);
+  face_velocity_y_.Swap(temp_face_velocity_y_);
+}
+
+/*
+ * Average of the two faces either side of each cell. The halo follows GridFluidSimulator: no
+ * flow through the walls, tangential velocity copied.
+ */
+void MACGridSimulator::ComputeCellVelocities(Field2D &velocity_x, Field2D &velocity_y) const {
+  auto w = (int32_t) velocity_x.Width();
+  thread_pool_->ParallelFor(0, (int32_t) velocity_x.Height(), w, [&](int32_t y_begin, int32_t y_end) {
+    for (auto y = y_begin; y < y_end; ++y) {
+      const auto *faces_x = face_velocity_x_.Row(y);
+      const auto *faces_below = face_velocity_y_.Row(y - 1);
+      const auto *faces_above = face_velocity_y_.Row(y);
+      auto *vx = velocity_x.Row(y);
+      auto *vy = velocity_y.Row(y);
+      for (auto x = 0; x < w; ++x) {
+        vx[x] = 0.5f * (faces_x[x - 1] + faces_x[x]);
+        vy[x] = 0.5f * (faces_below[x] + faces_above[x]);
+      }
+    }
+  });
+  velocity_x.FillHalo(0.0f, 1.0f);
+  velocity_y.FillHalo(1.0f, 0.0f);
+}
+
+/*
+ * Subtract the gradient of the pressure that cancels the divergence. Both use one-cell
+ * differences across the faces, so the result is divergence free to the solver tolerance.
+ */
+void MACGridSimulator::Project() {
+  ComputeDivergence(divergence_);
+  last_pressure_solve_ = ComputePressure(divergence_, pressure_);
+
+  auto num_faces_x = (int32_t) face_velocity_x_.Width();
+  thread_pool_->ParallelFor(0, (int32_t) face_velocity_x_.Height(), num_faces_x, [&](int32_t y_begin, int32_t y_end) {
+    for (auto y = y_begin; y < y_end; ++y) {
+      const auto *p = pressure_.Row(y);
+      auto *vx = face_velocity_x_.Row(y);
+      for (auto x = 0; x < num_faces_x; ++x) {
+        vx[x] -= p[x + 1] - p[x];
+      }
+    }
+  });
+  auto cells_x = (int32_t) face_velocity_y_.Width();
+  thread_pool_->ParallelFor(0, (int32_t) face_velocity_y_.Height(), cells_x, [&](int32_t y_begin, int32_t y_end) {
+    for (auto y = y_begin; y < y_end; ++y) {
+      const auto *p_below = pressure_.Row(y);
+      const auto *p_above = pressure_.Row(y + 1);
+      auto *vy = face_velocity_y_.Row(y);
+      for (auto x = 0; x < cells_x; ++x) {
+        vy[x] -= p_above[x] - p_below[x];
+      }
+    }
+  });
+  CorrectBoundaryFaceVelocities(face_velocity_x_, face_velocity_y_);
+}
+
+/*
+ * d(x,y) = vx(x+1/2,y) - vx(x-1/2,y) + vy(x,y+1/2) - vy(x,y-1/2)
+ * The wall faces are closed so the total is zero; the rounding left over is removed so that the
+ * Neumann problem stays solvable.
+ */
+void MACGridSimulator::ComputeDivergence(Field2D &divergence) const {
+  auto w = (int32_t) divergence.Width();
+  auto h = (int32_t) divergence.Height();
+  auto total = thread_pool_->ParallelSum(0, h, w, [&](int32_t y_begin, int32_t y_end) {
+    auto sum = 0.0;
+    for (auto y = y_begin; y < y_end; ++y) {
+      const auto *faces_x = face_velocity_x_.Row(y);
+      const auto *faces_below = face_velocity_y_.Row(y - 1);
+      const auto *faces_above = face_velocity_y_.Row(y);
+      auto *div = divergence.Row(y);
+      for (auto x = 0; x < w; ++x) {
+        div[x] = faces_x[x] - faces_x[x - 1] + faces_above[x] - faces_below[x];
+        sum += div[x];
+      }
+    }
+    return sum;
+  });
+  auto mean = (float) (total / ((double) w * h));
+  thread_pool_->ParallelFor(0, h, w, [&](int32_t y_begin, int32_t y_end) {
+    for (auto y = y_begin; y < y_end; ++y) {
+      auto *div = divergence.Row(y);
+      for (auto x = 0; x < w; ++x) {
+        div[x] -= mean;
+      }
+    }
+  });
+}
+
+/*
+ * Solve p(x-1,y) + p(x+1,y) + p(x,y-1) + p(x,y+1) - 4p(x,y) = divergence(x,y) with zero normal
+ * gradient at the walls, warm started from the last step. Refilling the halo with the edge
+ * values after each half sweep drops the missing neighbour from the stencil. The residual
+ * estimate is the one GridFluidSimulator uses for red-black SOR.
+ */
+PoissonSolverStats MACGridSimulator::ComputePressure(const Field2D &divergence, Field2D &pressure) {
+  auto rhs_norm = Norm(thread_pool_.get(), divergence);
+  if (rhs_norm == 0.0) {
+    pressure.Fill(0.0f);
+    return {0, 0.0f};
+  }
+
+  auto relative_residual = 1.0;
+  auto iter = 0u;
+  while (iter < max_pressure_iterations_) {
+    auto change_sq = 0.0;
+    for (auto colour = 0u; colour < 2; ++colour) {
+      change_sq += RedBlackSorSweep(thread_pool_.get(), divergence, -0.25f, 0.25f, pressure_omega_, colour, pressure);
+      pressure.FillHalo(1.0f, 1.0f);
+    }
+    ++iter;
+    relative_residual = 4.0 * std::sqrt(change_sq) / rhs_norm;
+    if (relative_residual <= pressure_tolerance_) {
+      break;
+    }
+  }
+  return {iter, (float) relative_residual};
+}
+
+/*
+ * The face fields' halo is the walls: no flow through them, tangential velocity copied
+ */
+void MACGridSimulator::CorrectBoundaryFaceVelocities(Field2D &face_velocity_x, Field2D &face_velocity_y) const {
+  face_velocity_x.FillHalo(0.0f, 1.0f);
+  face_velocity_y.FillHalo(1.0f, 0.0f);
+}
+
+void MACGridSimulator::Simulate() {
+  ProcessFaceSources();
+  density_.FillHalo(1.0f, 1.0f);
+  CorrectBoundaryFaceVelocities(face_velocity_x_, face_velocity_y_);
+
+  Diffuse(density_, temp_density_, 1.0f, 1.0f);
+  density_.Swap(temp_density_);
+
+  Diffuse(face_velocity_x_, temp_face_velocity_x_, 0.0f, 1.0f);
+  Diffuse(face_velocity_y_, temp_face_velocity_y_, 1.0f, 0.0f);
+  face_velocity_x_.Swap(temp_face_velocity_x_);
+  face_velocity_y_.Swap(temp_face_velocity_y_);
+
+  Advect();
+
+  Project();
+
+  ComputeCellVelocities(velocity_x_, velocity_y_);
+}
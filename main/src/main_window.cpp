@@ -2,6 +2,8 @@
 #include "control_panel_widget.h"
 #include "fluid_display_widget.h"
 
+#include <algorithm>
+#include <cmath>
 #include <QDockWidget>
 
 const uint32_t SIM_GRID_SIZE = 128;
@@ -18,6 +20,9 @@ MainWindow::MainWindow(QWidget *parent)
   addDockWidget(Qt::TopDockWidgetArea, dock);
 
   fluid_sim_ = new GridFluidSimulator(SIM_GRID_SIZE, SIM_GRID_SIZE, 1.0f / 15.0f, 0.2f);
+  fluid_sim_->SetPressureSolver(GridFluidSimulator::MULTIGRID);
+  // Clicks inject fast jets; substep through them rather than backtrace across many cells
+  fluid_sim_->SetAdaptiveTimestep(true);
 
   // Add some central content to the main window
   display_ = new FluidDisplayWidget(this);
@@ -83,7 +88,7 @@ void MainWindow::StopSim() {
 }
 
 void MainWindow::HandleClick(float px, float py) {
-  auto x = (uint32_t) std::roundf(px * (float)fluid_sim_->DimX());
-  auto y = (uint32_t) std::roundf(py * (float)fluid_sim_->DimY());
+  auto x = std::min((uint32_t) std::roundf(px * (float)fluid_sim_->DimX()), fluid_sim_->DimX() - 1);
+  auto y = std::min((uint32_t) std::roundf(py * (float)fluid_sim_->DimY()), fluid_sim_->DimY() - 1);
   fluid_sim_->AddSource(x, y, 1.0f, (0.5f - px) * fluid_sim_->DimX() * 0.2f, (0.5f - py) * 0.2f * fluid_sim_->DimY());
 }
@@ -0,0 +1,376 @@
+#include "multigrid_poisson_solver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+const uint32_t NUM_PRE_SMOOTH_SWEEPS = 2;
+const uint32_t NUM_POST_SMOOTH_SWEEPS = 2;
+// Stop coarsening once either interior dimension is this small
+const uint32_t MIN_COARSE_INTERIOR = 2;
+// Reduction in the coarsest level's residual at which its conjugate gradient solve stops
+const double COARSE_TOLERANCE = 1e-6;
+
+namespace {
+/*
+ * Centre of each interior cell along one axis, in finest grid cell units, for every level.
+ * A coarse cell sits at the mean of the fine children it covers, ignoring any child that falls
+ * on the boundary ring.
+ */
+std::vector<float> CoarsenCentres(const std::vector<float> &fine_centres) {
+  auto num_fine = (uint32_t) fine_centres.size();
+  std::vector<float> coarse_centres((num_fine + 1) / 2);
+  for (size_t c = 0; c < coarse_centres.size(); ++c) {
+    auto first = 2 * c;
+    coarse_centres[c] = (first + 1 < num_fine)
+                        ? 0.5f * (fine_centres[first] + fine_centres[first + 1])
+                        : fine_centres[first];
+  }
+  return coarse_centres;
+}
+
+/*
+ * For a boundary lying distance d (in units of h) from the adjacent cell centre, the ghost value
+ * one cell out that makes the linear interpolant vanish at the boundary is -((1 - d) / d) * u.
+ */
+float GhostFactor(float distance, float h) {
+  auto d = distance / h;
+  return (1.0f - d) / d;
+}
+}
+
+MultigridPoissonSolver::MultigridPoissonSolver(uint32_t dim_x, uint32_t dim_y) //
+        : thread_pool_{nullptr}                                                 //
+{
+  if (dim_x < 3 || dim_y < 3) {
+    throw std::runtime_error("Multigrid needs at least one interior cell");
+  }
+
+  // The true boundary is the centre of the outer ring of the finest grid
+  auto extent_x = (float) (dim_x - 1);
+  auto extent_y = (float) (dim_y - 1);
+  std::vector<float> centres_x(dim_x - 2);
+  std::vector<float> centres_y(dim_y - 2);
+  for (size_t i = 0; i < centres_x.size(); ++i) centres_x[i] = (float) (i + 1);
+  for (size_t i = 0; i < centres_y.size(); ++i) centres_y[i] = (float) (i + 1);
+
+  auto h = 1.0f;
+  while (true) {
+    auto level_dim_x = (uint32_t) centres_x.size() + 2;
+    auto level_dim_y = (uint32_t) centres_y.size() + 2;
+    Level level{level_dim_x,                                 //
+                level_dim_y,                                 //
+                h * h,                                       //
+                GhostFactor(centres_x.front(), h),           //
+                GhostFactor(extent_x - centres_x.back(), h), //
+                GhostFactor(centres_y.front(), h),           //
+                GhostFactor(extent_y - centres_y.back(), h), //
+                {}, {}, {}, {}};
+    level.diag.resize(level_dim_x * level_dim_y, 4.0f);
+    for (auto y = 1u; y < level_dim_y - 1; ++y) {
+      level.diag[y * level_dim_x + 1] += level.k_left;
+      level.diag[y * level_dim_x + level_dim_x - 2] += level.k_right;
+    }
+    for (auto x = 1u; x < level_dim_x - 1; ++x) {
+      level.diag[level_dim_x + x] += level.k_bottom;
+      level.diag[(level_dim_y - 2) * level_dim_x + x] += level.k_top;
+    }
+    level.u.resize(level_dim_x * level_dim_y, 0.0f);
+    level.f.resize(level_dim_x * level_dim_y, 0.0f);
+    level.r.resize(level_dim_x * level_dim_y, 0.0f);
+    levels_.push_back(std::move(level));
+
+    // Each coarse interior cell covers a 2x2 block of fine interior cells
+    if (centres_x.size() <= MIN_COARSE_INTERIOR || centres_y.size() <= MIN_COARSE_INTERIOR) {
+      break;
+    }
+    centres_x = CoarsenCentres(centres_x);
+    centres_y = CoarsenCentres(centres_y);
+    h *= 2.0f;
+  }
+  coarse_direction_.resize(levels_.back().u.size(), 0.0f);
+  coarse_product_.resize(levels_.back().u.size(), 0.0f);
+}
+
+void MultigridPoissonSolver::SetThreadPool(ThreadPool *thread_pool) {
+  thread_pool_ = thread_pool;
+}
+
+/*
+ * Red-black Gauss-Seidel
+ * u(x,y) = [u(x-1,y)+u(x+1,y)+u(x,y-1)+u(x,y+1) - h^2 f(x,y)] / diag(x,y)
+ */
+void MultigridPoissonSolver::Smooth(Level &level, uint32_t num_sweeps) {
+  auto dim_x = level.dim_x;
+  auto *u = level.u.data();
+  const auto *f = level.f.data();
+  const auto *diag = level.diag.data();
+  for (auto sweep = 0u; sweep < num_sweeps; ++sweep) {
+    for (auto colour = 0; colour < 2; ++colour) {
+      ParallelFor(thread_pool_, 1, (int32_t) level.dim_y - 1, dim_x / 2, [&](int32_t y_begin, int32_t y_end) {
+        for (auto y = y_begin; y < y_end; ++y) {
+          auto x_start = 1 + ((y + 1 + colour) & 1);
+          for (auto x = x_start; x < (int32_t) level.dim_x - 1; x += 2) {
+            auto idx = y * dim_x + x;
+            u[idx] = (u[idx - 1] + u[idx + 1] + u[idx - dim_x] + u[idx + dim_x] - level.h2 * f[idx]) / diag[idx];
+          }
+        }
+      });
+    }
+  }
+}
+
+/*
+ * r = f - Lu
+ */
+void MultigridPoissonSolver::ComputeResidual(Level &level) {
+  auto dim_x = level.dim_x;
+  const auto *u = level.u.data();
+  const auto *f = level.f.data();
+  const auto *diag = level.diag.data();
+  auto *r = level.r.data();
+  auto inv_h2 = 1.0f / level.h2;
+  ParallelFor(thread_pool_, 1, (int32_t) level.dim_y - 1, dim_x, [&](int32_t y_begin, int32_t y_end) {
+    for (auto y = y_begin; y < y_end; ++y) {
+      for (auto x = 1; x < (int32_t) level.dim_x - 1; ++x) {
+        auto idx = y * dim_x + x;
+        auto lap = (u[idx - 1] + u[idx + 1] + u[idx - dim_x] + u[idx + dim_x] - diag[idx] * u[idx]) * inv_h2;
+        r[idx] = f[idx] - lap;
+      }
+    }
+  });
+}
+
+/*
+ * Average each 2x2 block of fine interior cells into the coarse cell that covers it.
+ * When a fine interior dimension is odd the last block overlaps the boundary ring, which is zero.
+ */
+void MultigridPoissonSolver::Restrict(const std::vector<float> &fine_values, const Level &fine,
+                                      std::vector<float> &coarse_values, const Level &coarse) {
+  ParallelFor(thread_pool_, 1, (int32_t) coarse.dim_y - 1, fine.dim_x, [&](int32_t cy_begin, int32_t cy_end) {
+    for (auto cy = cy_begin; cy < cy_end; ++cy) {
+      auto fy = 2 * cy - 1;
+      for (auto cx = 1; cx < (int32_t) coarse.dim_x - 1; ++cx) {
+        auto fx = 2 * cx - 1;
+        auto fidx = fy * fine.dim_x + fx;
+        coarse_values[cy * coarse.dim_x + cx] = 0.25f * (fine_values[fidx] +
+                                                         fine_values[fidx + 1] +
+                                                         fine_values[fidx + fine.dim_x] +
+                                                         fine_values[fidx + fine.dim_x + 1]);
+      }
+    }
+  });
+}
+
+/*
+ * Write the extrapolated ghost values into the boundary ring so that interpolation sees them.
+ */
+void MultigridPoissonSolver::FillGhosts(Level &level) {
+  auto dim_x = level.dim_x;
+  auto dim_y = level.dim_y;
+  auto *u = level.u.data();
+  for (auto y = 1u; y < dim_y - 1; ++y) {
+    u[y * dim_x] = -level.k_left * u[y * dim_x + 1];
+    u[y * dim_x + dim_x - 1] = -level.k_right * u[y * dim_x + dim_x - 2];
+  }
+  for (auto x = 1u; x < dim_x - 1; ++x) {
+    u[x] = -level.k_bottom * u[dim_x + x];
+    u[(dim_y - 1) * dim_x + x] = -level.k_top * u[(dim_y - 2) * dim_x + x];
+  }
+  // Corners are only read by the diagonal interpolation weight
+  u[0] = -level.k_left * u[1];
+  u[dim_x - 1] = -level.k_right * u[dim_x - 2];
+  u[(dim_y - 1) * dim_x] = -level.k_left * u[(dim_y - 1) * dim_x + 1];
+  u[dim_y * dim_x - 1] = -level.k_right * u[dim_y * dim_x - 2];
+}
+
+/*
+ * Bilinear interpolation of coarse cell centres onto fine cell centres. Each fine cell takes
+ * 9/16 of its parent, 3/16 of each edge neighbour on its side and 1/16 of the diagonal.
+ * When add is true the result is added to the fine solution, otherwise it replaces it.
+ */
+void MultigridPoissonSolver::Prolong(Level &coarse, Level &fine, bool add) {
+  FillGhosts(coarse);
+  const auto *cu = coarse.u.data();
+  auto *fu = fine.u.data();
+  ParallelFor(thread_pool_, 1, (int32_t) fine.dim_y - 1, fine.dim_x, [&](int32_t fy_begin, int32_t fy_end) {
+    for (auto fy = fy_begin; fy < fy_end; ++fy) {
+      auto cy = (fy + 1) / 2;
+      auto ny = (fy & 1) ? cy - 1 : cy + 1;
+      for (auto fx = 1; fx < (int32_t) fine.dim_x - 1; ++fx) {
+        auto cx = (fx + 1) / 2;
+        auto nx = (fx & 1) ? cx - 1 : cx + 1;
+        auto value = 0.5625f * cu[cy * coarse.dim_x + cx] +
+                     0.1875f * cu[cy * coarse.dim_x + nx] +
+                     0.1875f * cu[ny * coarse.dim_x + cx] +
+                     0.0625f * cu[ny * coarse.dim_x + nx];
+        auto idx = fy * fine.dim_x + fx;
+        fu[idx] = add ? fu[idx] + value : value;
+      }
+    }
+  });
+}
+
+/*
+ * The operator is symmetric positive definite, so conjugate gradients converge in at most one
+ * iteration per interior cell, however long the level is. Smoothing it to convergence instead
+ * takes a number of sweeps that grows with the square of its length. The level is small enough
+ * to run serially. The boundary ring of u and of the search direction stays zero, as the ghost
+ * values are folded into diag.
+ */
+void MultigridPoissonSolver::SolveCoarsest(Level &level) {
+  auto dim_x = level.dim_x;
+  auto dim_y = level.dim_y;
+  auto *u = level.u.data();
+  auto *r = level.r.data();
+  auto *p = coarse_direction_.data();
+  auto *q = coarse_product_.data();
+  const auto *f = level.f.data();
+  const auto *diag = level.diag.data();
+
+  auto rr = 0.0;
+  for (auto y = 1u; y < dim_y - 1; ++y) {
+    for (auto x = 1u; x < dim_x - 1; ++x) {
+      auto idx = y * dim_x + x;
+      r[idx] = -level.h2 * f[idx] - (diag[idx] * u[idx] - (u[idx - 1] + u[idx + 1] + u[idx - dim_x] + u[idx + dim_x]));
+      p[idx] = r[idx];
+      rr += (double) r[idx] * (double) r[idx];
+    }
+  }
+  auto stop_rr = rr * COARSE_TOLERANCE * COARSE_TOLERANCE;
+  auto max_iterations = (dim_x - 2) * (dim_y - 2);
+  for (auto iter = 0u; iter < max_iterations && rr > stop_rr; ++iter) {
+    auto pq = 0.0;
+    for (auto y = 1u; y < dim_y - 1; ++y) {
+      for (auto x = 1u; x < dim_x - 1; ++x) {
+        auto idx = y * dim_x + x;
+        q[idx] = diag[idx] * p[idx] - (p[idx - 1] + p[idx + 1] + p[idx - dim_x] + p[idx + dim_x]);
+        pq += (double) p[idx] * (double) q[idx];
+      }
+    }
+    auto alpha = (float) (rr / pq);
+    auto rr_next = 0.0;
+    for (auto y = 1u; y < dim_y - 1; ++y) {
+      for (auto x = 1u; x < dim_x - 1; ++x) {
+        auto idx = y * dim_x + x;
+        u[idx] += alpha * p[idx];
+        r[idx] -= alpha * q[idx];
+        rr_next += (double) r[idx] * (double) r[idx];
+      }
+    }
+    auto beta = (float) (rr_next / rr);
+    rr = rr_next;
+    for (auto y = 1u; y < dim_y - 1; ++y) {
+      for (auto x = 1u; x < dim_x - 1; ++x) {
+        auto idx = y * dim_x + x;
+        p[idx] = r[idx] + beta * p[idx];
+      }
+    }
+  }
+}
+
+void MultigridPoissonSolver::VCycle(uint32_t level_idx) {
+  auto &level = levels_[level_idx];
+  if (level_idx == levels_.size() - 1) {
+    SolveCoarsest(level);
+    return;
+  }
+
+  auto &coarse = levels_[level_idx + 1];
+  Smooth(level, NUM_PRE_SMOOTH_SWEEPS);
+  ComputeResidual(level);
+  Restrict(level.r, level, coarse.f, coarse);
+  std::fill(coarse.u.begin(), coarse.u.end(), 0.0f);
+  VCycle(level_idx + 1);
+  Prolong(coarse, level, true);
+  Smooth(level, NUM_POST_SMOOTH_SWEEPS);
+}
+
+void MultigridPoissonSolver::LoadRightHandSide(const Field2D &divergence) {
+  auto &finest = levels_.front();
+  for (auto y = 1; y < (int32_t) finest.dim_y - 1; ++y) {
+    const auto *div = divergence.Row(y - 1) - 1;
+    for (auto x = 1; x < (int32_t) finest.dim_x - 1; ++x) {
+      finest.f[y * finest.dim_x + x] = div[x];
+    }
+  }
+}
+
+void MultigridPoissonSolver::StoreSolution(Field2D &pressure) const {
+  const auto &finest = levels_.front();
+  for (auto y = 1; y < (int32_t) finest.dim_y - 1; ++y) {
+    auto *p = pressure.Row(y - 1) - 1;
+    for (auto x = 1; x < (int32_t) finest.dim_x - 1; ++x) {
+      p[x] = finest.u[y * finest.dim_x + x];
+    }
+  }
+}
+
+double MultigridPoissonSolver::RelativeResidual(double rhs_norm) {
+  auto &finest = levels_.front();
+  ComputeResidual(finest);
+  auto last_row = (int32_t) finest.dim_y - 1;
+  auto residual_sq = ParallelSum(thread_pool_, 1, last_row, finest.dim_x, [&](int32_t y_begin, int32_t y_end) {
+    auto sum = 0.0;
+    for (auto y = y_begin; y < y_end; ++y) {
+      for (auto x = 1; x < (int32_t) finest.dim_x - 1; ++x) {
+        auto r = (double) finest.r[y * finest.dim_x + x];
+        sum += r * r;
+      }
+    }
+    return sum;
+  });
+  return std::sqrt(residual_sq) / rhs_norm;
+}
+
+void MultigridPoissonSolver::FullMultigrid(const Field2D &divergence, Field2D &pressure) {
+  LoadRightHandSide(divergence);
+
+  // Restrict the right hand side all the way down, solve there and work back up using the
+  // interpolated coarse solution as the initial guess for a V-cycle on each level.
+  for (size_t l = 0; l < levels_.size() - 1; ++l) {
+    Restrict(levels_[l].f, levels_[l], levels_[l + 1].f, levels_[l + 1]);
+  }
+  std::fill(levels_.back().u.begin(), levels_.back().u.end(), 0.0f);
+  VCycle((uint32_t) levels_.size() - 1);
+  for (auto l = (int32_t) levels_.size() - 2; l >= 0; --l) {
+    Prolong(levels_[l + 1], levels_[l], false);
+    VCycle(l);
+  }
+  StoreSolution(pressure);
+}
+
+PoissonSolverStats MultigridPoissonSolver::Solve(const Field2D &divergence,
+                                                 Field2D &pressure,
+                                                 float tolerance,
+                                                 uint32_t max_v_cycles) {
+  LoadRightHandSide(divergence);
+  auto &finest = levels_.front();
+  auto last_row = (int32_t) finest.dim_y - 1;
+  auto rhs_norm = std::sqrt(ParallelSum(thread_pool_, 1, last_row, finest.dim_x, [&](int32_t y_begin, int32_t y_end) {
+    auto sum = 0.0;
+    for (auto y = y_begin; y < y_end; ++y) {
+      const auto *p = pressure.Row(y - 1) - 1;
+      for (auto x = 1; x < (int32_t) finest.dim_x - 1; ++x) {
+        auto idx = y * finest.dim_x + x;
+        sum += (double) finest.f[idx] * (double) finest.f[idx];
+        finest.u[idx] = p[x];
+      }
+    }
+    return sum;
+  }));
+  if (rhs_norm == 0.0) {
+    pressure.Fill(0.0f);
+    return {0, 0.0f};
+  }
+
+  auto relative_residual = RelativeResidual(rhs_norm);
+  auto cycle = 0u;
+  while (relative_residual > tolerance && cycle < max_v_cycles) {
+    VCycle(0);
+    relative_residual = RelativeResidual(rhs_norm);
+    ++cycle;
+  }
+  StoreSolution(pressure);
+  return {cycle, (float) relative_residual};
+}
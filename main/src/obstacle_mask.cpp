@@ -0,0 +1,250 @@
+#include "obstacle_mask.h"
+#include "red_black_sor.h"
+
+#include <algorithm>
+#include <cmath>
+
+const uint32_t FLUID_LEFT = 1u;
+const uint32_t FLUID_RIGHT = 2u;
+const uint32_t FLUID_BELOW = 4u;
+const uint32_t FLUID_ABOVE = 8u;
+
+ObstacleMask::ObstacleMask() //
+        : ObstacleMask(0, 0) //
+{}
+
+ObstacleMask::ObstacleMask(uint32_t width, uint32_t height) //
+        : width_{width}                                     //
+        , height_{height}                                   //
+        , words_per_row_{(width + 63) / 64}                 //
+        , num_solid_{0}                                     //
+        , version_{0}                                       //
+        , bits_((size_t) words_per_row_ * height, 0)        //
+{}
+
+void ObstacleMask::Set(int32_t x, int32_t y, bool solid) {
+  assert(x >= 0 && x < (int32_t) width_ && y >= 0 && y < (int32_t) height_);
+  if (IsSolid(x, y) == solid) {
+    return;
+  }
+  bits_[(size_t) y * words_per_row_ + (uint32_t) x / 64] ^= uint64_t(1) << ((uint32_t) x % 64);
+  num_solid_ = solid ? num_solid_ + 1 : num_solid_ - 1;
+  ++version_;
+}
+
+void ObstacleMask::Clear() {
+  if (num_solid_ == 0) {
+    return;
+  }
+  std::fill(bits_.begin(), bits_.end(), 0);
+  num_solid_ = 0;
+  ++version_;
+}
+
+FluidRegion::FluidRegion() //
+        : width_{0}        //
+        , height_{0}       //
+        , row_runs_(1, 0)  //
+        , row_solid_runs_(1, 0) //
+{}
+
+/*
+ * Whole words of fluid or of solid are stepped over 64 cells at a time, so an open row costs a
+ * pass over its words.
+ */
+FluidRegion::FluidRegion(const ObstacleMask &mask) //
+        : width_{mask.Width()}                     //
+        , height_{mask.Height()}                   //
+{
+  auto w = (int32_t) width_;
+  auto h = (int32_t) height_;
+  row_runs_.reserve(height_ + 1);
+  row_solid_runs_.reserve(height_ + 1);
+  for (auto y = 0; y < h; ++y) {
+    row_runs_.push_back((uint32_t) runs_.size());
+    row_solid_runs_.push_back((uint32_t) solid_runs_.size());
+    const auto *words = mask.Row(y);
+    auto x = 0;
+    while (x < w) {
+      auto solid = mask.IsSolid(x, y);
+      auto run_begin = x;
+      while (x < w) {
+        // Bits that differ from the run's first cell, from x to the end of the word
+        auto word = words[x / 64] >> (x % 64);
+        auto same = (solid ? ~word : word) & (~uint64_t(0) >> (x % 64));
+        auto length = same ? __builtin_ctzll(same) : 64 - x % 64;
+        x = std::min(w, x + length);
+        if (same) {
+          break;
+        }
+      }
+      (solid ? solid_runs_ : runs_).push_back({run_begin, x});
+    }
+  }
+  row_runs_.push_back((uint32_t) runs_.size());
+  row_solid_runs_.push_back((uint32_t) solid_runs_.size());
+
+  auto is_fluid = [&](int32_t x, int32_t y) {
+    return x >= 0 && x < w && y >= 0 && y < h && !mask.IsSolid(x, y);
+  };
+  for (auto y = 0; y < h; ++y) {
+    for (auto run = SolidRunsBegin(y); run != SolidRunsEnd(y); ++run) {
+      for (auto x = run->x_begin; x < run->x_end; ++x) {
+        auto fluid_neighbours = (is_fluid(x - 1, y) ? FLUID_LEFT : 0u) | (is_fluid(x + 1, y) ? FLUID_RIGHT : 0u)
+                                | (is_fluid(x, y - 1) ? FLUID_BELOW : 0u) | (is_fluid(x, y + 1) ? FLUID_ABOVE : 0u);
+        if (fluid_neighbours) {
+          auto mean_neighbours = fluid_neighbours;
+          for (auto pair : {FLUID_LEFT | FLUID_RIGHT, FLUID_BELOW | FLUID_ABOVE}) {
+            if ((fluid_neighbours & pair) == pair) {
+              mean_neighbours &= ~pair;
+            }
+          }
+          auto num_mean = __builtin_popcount(mean_neighbours);
+          auto inv_mean = num_mean ? 1.0f / (float) num_mean : 0.0f;
+          boundary_cells_.push_back({x, y, fluid_neighbours, mean_neighbours, inv_mean});
+        }
+      }
+    }
+  }
+}
+
+void FluidRegion::ClearSolid(Field2D &field) const {
+  for (auto y = 0; y < (int32_t) height_; ++y) {
+    auto *row = field.Row(y);
+    for (auto run = SolidRunsBegin(y); run != SolidRunsEnd(y); ++run) {
+      std::fill(row + run->x_begin, row + run->x_end, 0.0f);
+    }
+  }
+}
+
+void FluidRegion::ApplyScalarBoundary(Field2D &field) const {
+  for (const auto &cell : boundary_cells_) {
+    const auto *row = field.Row(cell.y);
+    auto sum = 0.0f;
+    sum += (cell.mean_neighbours & FLUID_LEFT) ? row[cell.x - 1] : 0.0f;
+    sum += (cell.mean_neighbours & FLUID_RIGHT) ? row[cell.x + 1] : 0.0f;
+    sum += (cell.mean_neighbours & FLUID_BELOW) ? field.Row(cell.y - 1)[cell.x] : 0.0f;
+    sum += (cell.mean_neighbours & FLUID_ABOVE) ? field.Row(cell.y + 1)[cell.x] : 0.0f;
+    field(cell.x, cell.y) = sum * cell.inv_mean;
+  }
+}
+
+/*
+ * A cell with no fluid neighbour along x has all of its mean_neighbours along y, so inv_mean is
+ * also the weight for the mean of the tangential component, and likewise the other way round.
+ */
+void FluidRegion::ApplyVelocityBoundary(Field2D &velocity_x, Field2D &velocity_y) const {
+  for (const auto &cell : boundary_cells_) {
+    if (cell.fluid_neighbours & (FLUID_LEFT | FLUID_RIGHT)) {
+      velocity_x(cell.x, cell.y) = 0.0f;
+    } else {
+      auto below = (cell.mean_neighbours & FLUID_BELOW) ? velocity_x(cell.x, cell.y - 1) : 0.0f;
+      auto above = (cell.mean_neighbours & FLUID_ABOVE) ? velocity_x(cell.x, cell.y + 1) : 0.0f;
+      velocity_x(cell.x, cell.y) = (below + above) * cell.inv_mean;
+    }
+    if (cell.fluid_neighbours & (FLUID_BELOW | FLUID_ABOVE)) {
+      velocity_y(cell.x, cell.y) = 0.0f;
+    } else {
+      auto left = (cell.mean_neighbours & FLUID_LEFT) ? velocity_y(cell.x - 1, cell.y) : 0.0f;
+      auto right = (cell.mean_neighbours & FLUID_RIGHT) ? velocity_y(cell.x + 1, cell.y) : 0.0f;
+      velocity_y(cell.x, cell.y) = (left + right) * cell.inv_mean;
+    }
+  }
+}
+
+/*
+ * A run starting at x_begin is a row of its own to RedBlackSorRow, whose parity counts from the
+ * run's first cell.
+ */
+double RedBlackSorRuns(const FluidRegion &region,
+                       const Field2D &rhs,
+                       float rhs_weight,
+                       float neighbour_weight,
+                       float omega,
+                       uint32_t colour,
+                       int32_t y_begin,
+                       int32_t y_end,
+                       Field2D &u) {
+  auto sum = 0.0;
+  for (auto y = y_begin; y < y_end; ++y) {
+    auto *row = u.Row(y);
+    const auto *below = u.Row(y - 1);
+    const auto *above = u.Row(y + 1);
+    const auto *rhs_row = rhs.Row(y);
+    for (auto run = region.RunsBegin(y); run != region.RunsEnd(y); ++run) {
+      auto x = run->x_begin;
+      auto parity = (int32_t) ((colour + y + x) & 1);
+      sum += RedBlackSorRow(below + x, row + x, above + x, rhs_row + x, run->x_end - x, parity, rhs_weight,
+                            neighbour_weight, omega);
+    }
+  }
+  return sum;
+}
+
+double JacobiRuns(const FluidRegion &region,
+                  const Field2D &divergence,
+                  const Field2D &pressure,
+                  int32_t y_begin,
+                  int32_t y_end,
+                  Field2D &next) {
+  auto sum = 0.0;
+  for (auto y = y_begin; y < y_end; ++y) {
+    const auto *p = pressure.Row(y);
+    const auto *p_below = pressure.Row(y - 1);
+    const auto *p_above = pressure.Row(y + 1);
+    const auto *div = divergence.Row(y);
+    auto *p_next = next.Row(y);
+    for (auto run = region.RunsBegin(y); run != region.RunsEnd(y); ++run) {
+      for (auto x = run->x_begin; x < run->x_end; ++x) {
+        auto p_new = (p[x - 1] + p[x + 1] + p_below[x] + p_above[x] - div[x]) * 0.25f;
+        auto change = (double) (p_new - p[x]);
+        sum += change * change;
+        p_next[x] = p_new;
+      }
+    }
+  }
+  return sum;
+}
+
+void DivergenceRuns(const FluidRegion &region,
+                    const Field2D &velocity_x,
+                    const Field2D &velocity_y,
+                    int32_t y_begin,
+                    int32_t y_end,
+                    Field2D &divergence) {
+  for (auto y = y_begin; y < y_end; ++y) {
+    const auto *vx = velocity_x.Row(y);
+    const auto *vy_below = velocity_y.Row(y - 1);
+    const auto *vy_above = velocity_y.Row(y + 1);
+    auto *div = divergence.Row(y);
+    for (auto run = region.RunsBegin(y); run != region.RunsEnd(y); ++run) {
+      for (auto x = run->x_begin; x < run->x_end; ++x) {
+        div[x] = (vx[x + 1] - vx[x - 1] + vy_above[x] - vy_below[x]) * 0.5f;
+      }
+    }
+  }
+}
+
+double ProjectRuns(const FluidRegion &region,
+                   const Field2D &pressure,
+                   int32_t y_begin,
+                   int32_t y_end,
+                   Field2D &velocity_x,
+                   Field2D &velocity_y) {
+  auto max_speed = 0.0f;
+  for (auto y = y_begin; y < y_end; ++y) {
+    const auto *p = pressure.Row(y);
+    const auto *p_below = pressure.Row(y - 1);
+    const auto *p_above = pressure.Row(y + 1);
+    auto *vx = velocity_x.Row(y);
+    auto *vy = velocity_y.Row(y);
+    for (auto run = region.RunsBegin(y); run != region.RunsEnd(y); ++run) {
+      for (auto x = run->x_begin; x < run->x_end; ++x) {
+        vx[x] -= (p[x + 1] - p[x - 1]) * 0.5f;
+        vy[x] -= (p_above[x] - p_below[x]) * 0.5f;
+        max_speed = std::max(max_speed, std::max(std::abs(vx[x]), std::abs(vy[x])));
+      }
+    }
+  }
+  return (double) max_speed;
+}
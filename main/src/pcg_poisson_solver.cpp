@@ -0,0 +1,234 @@
+#include "pcg_poisson_solver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+// Modified incomplete Cholesky blend and safety factor (Bridson, Fluid Simulation for Computer Graphics)
+const float MIC_TAU = 0.97f;
+const float MIC_SIGMA = 0.25f;
+
+PcgPoissonSolver::PcgPoissonSolver(uint32_t dim_x, uint32_t dim_y) //
+        : dim_x_{dim_x}                                             //
+        , dim_y_{dim_y}                                             //
+        , thread_pool_{nullptr}                                     //
+{
+  if (dim_x < 3 || dim_y < 3) {
+    throw std::runtime_error("PCG needs at least one interior cell");
+  }
+  precon_ = Field2D(dim_x_ - 2, dim_y_ - 2, 1);
+  residual_ = Field2D(dim_x_ - 2, dim_y_ - 2, 1);
+  aux_ = Field2D(dim_x_ - 2, dim_y_ - 2, 1);
+  search_ = Field2D(dim_x_ - 2, dim_y_ - 2, 1);
+  temp_ = Field2D(dim_x_ - 2, dim_y_ - 2, 1);
+  ComputePreconditioner();
+}
+
+/*
+ * The preconditioner depends on how rows are banded across threads, so it is rebuilt here.
+ */
+void PcgPoissonSolver::SetThreadPool(ThreadPool *thread_pool) {
+  thread_pool_ = thread_pool;
+  ComputePreconditioner();
+}
+
+/*
+ * A has 4 on the diagonal and -1 for each neighbour that is also an interior cell. Neighbours in
+ * the halo are known (zero) pressures so they drop out of the matrix. Every halo stays zero, which
+ * lets the loops below treat every neighbour coefficient as -1.
+ *
+ * MIC(0) is a sequential sweep, so when rows are split into bands each band gets its own
+ * factorisation of its diagonal block of A, ignoring the couplings to neighbouring bands
+ * (block Jacobi over bands). The first row of a band reads the all-zero halo row in place of the
+ * row below, and its last row is treated as having no neighbour above. With a single band this is
+ * plain MIC(0).
+ */
+void PcgPoissonSolver::ComputePreconditioner() {
+  auto w = (int32_t) precon_.Width();
+  auto h = (int32_t) precon_.Height();
+  ParallelFor(thread_pool_, 0, h, w, [&](int32_t y_begin, int32_t y_end) {
+    for (auto y = y_begin; y < y_end; ++y) {
+      auto has_up = (y + 1 < y_end) ? 1.0f : 0.0f;
+      auto *precon = precon_.Row(y);
+      const auto *precon_below = precon_.Row(y > y_begin ? y - 1 : -1);
+      for (auto x = 0; x < w; ++x) {
+        auto has_right = (x + 1 < w) ? 1.0f : 0.0f;
+        auto p_left = precon[x - 1];
+        auto p_down = precon_below[x];
+        auto e = 4.0f
+                 - p_left * p_left
+                 - p_down * p_down
+                 - MIC_TAU * (has_up * p_left * p_left + has_right * p_down * p_down);
+        if (e < MIC_SIGMA * 4.0f) {
+          e = 4.0f;
+        }
+        precon[x] = 1.0f / std::sqrt(e);
+      }
+    }
+  });
+}
+
+/*
+ * z = (LL^T)^-1 r by forward then backward substitution within each band. The bands must match
+ * those used by ComputePreconditioner().
+ */
+void PcgPoissonSolver::ApplyPreconditioner(const Field2D &r, Field2D &z) {
+  auto w = (int32_t) precon_.Width();
+  auto h = (int32_t) precon_.Height();
+  auto &q = temp_;
+  ParallelFor(thread_pool_, 0, h, w, [&](int32_t y_begin, int32_t y_end) {
+    for (auto y = y_begin; y < y_end; ++y) {
+      const auto *precon = precon_.Row(y);
+      const auto *precon_below = precon_.Row(y > y_begin ? y - 1 : -1);
+      const auto *r_row = r.Row(y);
+      auto *q_row = q.Row(y);
+      const auto *q_below = q.Row(y > y_begin ? y - 1 : -1);
+      for (auto x = 0; x < w; ++x) {
+        auto t = r_row[x]
+                 + precon[x - 1] * q_row[x - 1]
+                 + precon_below[x] * q_below[x];
+        q_row[x] = t * precon[x];
+      }
+    }
+    for (auto y = y_end - 1; y >= y_begin; --y) {
+      const auto *precon = precon_.Row(y);
+      const auto *q_row = q.Row(y);
+      auto *z_row = z.Row(y);
+      const auto *z_above = z.Row(y + 1 < y_end ? y + 1 : h);
+      for (auto x = w - 1; x >= 0; --x) {
+        auto t = q_row[x]
+                 + precon[x] * z_row[x + 1]
+                 + precon[x] * z_above[x];
+        z_row[x] = t * precon[x];
+      }
+    }
+  });
+}
+
+/*
+ * z = As
+ */
+void PcgPoissonSolver::ApplyMatrix(const Field2D &s, Field2D &z) const {
+  auto w = (int32_t) s.Width();
+  ParallelFor(thread_pool_, 0, (int32_t) s.Height(), w, [&](int32_t y_begin, int32_t y_end) {
+    for (auto y = y_begin; y < y_end; ++y) {
+      const auto *s_row = s.Row(y);
+      const auto *s_below = s.Row(y - 1);
+      const auto *s_above = s.Row(y + 1);
+      auto *z_row = z.Row(y);
+      for (auto x = 0; x < w; ++x) {
+        z_row[x] = 4.0f * s_row[x] - s_row[x - 1] - s_row[x + 1] - s_below[x] - s_above[x];
+      }
+    }
+  });
+}
+
+double PcgPoissonSolver::Dot(const Field2D &a, const Field2D &b) const {
+  auto w = (int32_t) a.Width();
+  return ParallelSum(thread_pool_, 0, (int32_t) a.Height(), w, [&](int32_t y_begin, int32_t y_end) {
+    auto sum = 0.0;
+    for (auto y = y_begin; y < y_end; ++y) {
+      const auto *a_row = a.Row(y);
+      const auto *b_row = b.Row(y);
+      for (auto x = 0; x < w; ++x) {
+        sum += (double) a_row[x] * (double) b_row[x];
+      }
+    }
+    return sum;
+  });
+}
+
+PoissonSolverStats PcgPoissonSolver::Solve(const Field2D &divergence,
+                                           Field2D &pressure,
+                                           float tolerance,
+                                           uint32_t max_iterations) {
+  auto w = (int32_t) precon_.Width();
+  auto h = (int32_t) precon_.Height();
+
+  // Ap = -divergence, starting from the guess already in pressure
+  ApplyMatrix(pressure, aux_);
+  auto rhs_norm = std::sqrt(ParallelSum(thread_pool_, 0, h, w, [&](int32_t y_begin, int32_t y_end) {
+    auto sum = 0.0;
+    for (auto y = y_begin; y < y_end; ++y) {
+      const auto *div = divergence.Row(y);
+      const auto *ap = aux_.Row(y);
+      auto *r = residual_.Row(y);
+      for (auto x = 0; x < w; ++x) {
+        sum += (double) div[x] * (double) div[x];
+        r[x] = -div[x] - ap[x];
+      }
+    }
+    return sum;
+  }));
+  if (rhs_norm == 0.0) {
+    pressure.Fill(0.0f);
+    return {0, 0.0f};
+  }
+  if (std::sqrt(Dot(residual_, residual_)) / rhs_norm <= tolerance) {
+    return {0, TrueResidual(divergence, pressure, rhs_norm)};
+  }
+
+  ApplyPreconditioner(residual_, aux_);
+  search_.CopyFrom(aux_);
+  auto sigma = Dot(residual_, aux_);
+
+  for (auto iter = 0u; iter < max_iterations; ++iter) {
+    ApplyMatrix(search_, aux_);
+    auto alpha = (float) (sigma / Dot(search_, aux_));
+    auto residual_sq = ParallelSum(thread_pool_, 0, h, w, [&](int32_t y_begin, int32_t y_end) {
+      auto sum = 0.0;
+      for (auto y = y_begin; y < y_end; ++y) {
+        auto *p = pressure.Row(y);
+        auto *r = residual_.Row(y);
+        const auto *s = search_.Row(y);
+        const auto *as = aux_.Row(y);
+        for (auto x = 0; x < w; ++x) {
+          p[x] += alpha * s[x];
+          r[x] -= alpha * as[x];
+          sum += (double) r[x] * (double) r[x];
+        }
+      }
+      return sum;
+    });
+    auto relative_residual = std::sqrt(residual_sq) / rhs_norm;
+    if (relative_residual <= tolerance) {
+      return {(uint32_t) iter + 1, TrueResidual(divergence, pressure, rhs_norm)};
+    }
+
+    ApplyPreconditioner(residual_, aux_);
+    auto sigma_new = Dot(residual_, aux_);
+    auto beta = (float) (sigma_new / sigma);
+    ParallelFor(thread_pool_, 0, h, w, [&](int32_t y_begin, int32_t y_end) {
+      for (auto y = y_begin; y < y_end; ++y) {
+        auto *s = search_.Row(y);
+        const auto *z = aux_.Row(y);
+        for (auto x = 0; x < w; ++x) {
+          s[x] = z[x] + beta * s[x];
+        }
+      }
+    });
+    sigma = sigma_new;
+  }
+  return {max_iterations, TrueResidual(divergence, pressure, rhs_norm)};
+}
+
+/*
+ * The recurrence residual drifts from b - Ap in single precision so report the real one.
+ */
+float PcgPoissonSolver::TrueResidual(const Field2D &divergence, const Field2D &pressure, double rhs_norm) {
+  ApplyMatrix(pressure, aux_);
+  auto w = (int32_t) divergence.Width();
+  auto residual_sq = ParallelSum(thread_pool_, 0, (int32_t) divergence.Height(), w, [&](int32_t y_begin, int32_t y_end) {
+    auto sum = 0.0;
+    for (auto y = y_begin; y < y_end; ++y) {
+      const auto *div = divergence.Row(y);
+      const auto *ap = aux_.Row(y);
+      for (auto x = 0; x < w; ++x) {
+        auto r = (double) -div[x] - (double) ap[x];
+        sum += r * r;
+      }
+    }
+    return sum;
+  });
+  return (float) (std::sqrt(residual_sq) / rhs_norm);
+}
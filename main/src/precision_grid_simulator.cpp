@@ -0,0 +1,421 @@
+#include "precision_grid_simulator.h"
+#include "red_black_sor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+const uint32_t NUM_GS_ITERS = 10;
+const float DEFAULT_PRESSURE_TOLERANCE = 1e-4f;
+const uint32_t DEFAULT_MAX_PRESSURE_ITERATIONS = 200;
+
+namespace {
+/*
+ * How the kernels get at the rows of a field in the compute type. In general a chunk of up to
+ * CHUNK_CELLS cells, plus the cell either side for the stencils, is converted into a buffer and
+ * results are converted back from one. When storage is already the compute type the row itself
+ * is used and a chunk is the whole row.
+ */
+template<typename Storage, typename Compute>
+struct RowAccess {
+  // Even, so that every chunk starts on the row's red-black parity
+  static const int32_t CHUNK_CELLS = 512;
+  static const int32_t BUFFER_CELLS = CHUNK_CELLS + 2;
+
+  // Cells x - 1 to x + n of a row, returned as a pointer to cell x
+  static const Compute *Load(const Storage *row, int32_t x, int32_t n, Compute *buffer) {
+    ConvertRow(row + x - 1, buffer, (size_t) n + 2);
+    return buffer + 1;
+  }
+
+  static Compute *LoadForUpdate(Storage *row, int32_t x, int32_t n, Compute *buffer) {
+    ConvertRow(row + x - 1, buffer, (size_t) n + 2);
+    return buffer + 1;
+  }
+
+  // Where to put cells x to x + n - 1 of a row before storing them
+  static Compute *Output(Storage *, int32_t, Compute *buffer) { return buffer + 1; }
+
+  static void Store(const Compute *cells, Storage *row, int32_t x, int32_t n) {
+    ConvertRow(cells, row + x, (size_t) n);
+  }
+
+  // Store only the cells of one red-black colour. The others may be read by another thread.
+  static void StoreColour(const Compute *cells, Storage *row, int32_t x, int32_t n, int32_t parity) {
+    Storage converted[CHUNK_CELLS];
+    ConvertRow(cells, converted, (size_t) n);
+    for (auto i = parity; i < n; i += 2) {
+      row[x + i] = converted[i];
+    }
+  }
+};
+
+template<typename T>
+struct RowAccess<T, T> {
+  static const int32_t CHUNK_CELLS = std::numeric_limits<int32_t>::max();
+  static const int32_t BUFFER_CELLS = 1;
+
+  static const T *Load(const T *row, int32_t x, int32_t, T *) { return row + x; }
+
+  static T *LoadForUpdate(T *row, int32_t x, int32_t, T *) { return row + x; }
+
+  static T *Output(T *row, int32_t x, T *) { return row + x; }
+
+  static void Store(const T *, T *, int32_t, int32_t) {}
+
+  static void StoreColour(const T *, T *, int32_t, int32_t, int32_t) {}
+};
+
+// Run body(x, n) over consecutive chunks of at most chunk cells covering [0, width)
+template<typename Body>
+inline void ForEachChunk(int32_t width, int32_t chunk, const Body &body) {
+  for (auto x = 0; x < width; x += std::min(chunk, width - x)) {
+    body(x, std::min(chunk, width - x));
+  }
+}
+
+template<typename T>
+inline T Lerp(T from, T to, T pct) { return from + pct * (to - from); }
+}
+
+template<typename Policy>
+PrecisionGridSimulator<Policy>::PrecisionGridSimulator(uint32_t width,      //
+                                                       uint32_t height,     //
+                                                       float delta_t,       //
+                                                       float diffusion_rate //
+)                                                                           //
+        : FluidSimulator2D{width, height, false}                    //
+        , delta_t_{delta_t}                                         //
+        , diffusion_rate_{diffusion_rate}                           //
+        , pressure_tolerance_{std::max(DEFAULT_PRESSURE_TOLERANCE, Policy::MinTolerance())} //
+        , max_pressure_iterations_{DEFAULT_MAX_PRESSURE_ITERATIONS} //
+        , pressure_omega_{OptimalSorOmega(width - 2, height - 2)}   //
+        , last_pressure_solve_{0, 0.0f}                             //
+        , thread_pool_{std::make_unique<ThreadPool>(0)}             //
+        , stored_density_{width - 2, height - 2, 1}                 //
+        , stored_velocity_x_{width - 2, height - 2, 1}              //
+        , stored_velocity_y_{width - 2, height - 2, 1}              //
+        , pressure_{width - 2, height - 2, 1}                       //
+        , divergence_{width - 2, height - 2, 1}                     //
+        , temp_density_{width - 2, height - 2, 1}                   //
+        , temp_velocity_x_{width - 2, height - 2, 1}                //
+        , temp_velocity_y_{width - 2, height - 2, 1}                //
+{}
+
+template<typename Policy>
+void PrecisionGridSimulator<Policy>::SetPressureTolerance(float tolerance) {
+  pressure_tolerance_ = tolerance;
+}
+
+template<typename Policy>
+void PrecisionGridSimulator<Policy>::SetMaxPressureIterations(uint32_t max_iterations) {
+  max_pressure_iterations_ = max_iterations;
+}
+
+template<typename Policy>
+void PrecisionGridSimulator<Policy>::SetNumThreads(uint32_t num_threads) {
+  thread_pool_ = std::make_unique<ThreadPool>(num_threads);
+}
+
+template<typename Policy>
+const std::vector<float> &PrecisionGridSimulator<Policy>::Density() const {
+  stored_density_.CopyTo(density_view_);
+  return density_view_;
+}
+
+template<typename Policy>
+const std::vector<float> &PrecisionGridSimulator<Policy>::VelocityX() const {
+  stored_velocity_x_.CopyTo(velocity_x_view_);
+  return velocity_x_view_;
+}
+
+template<typename Policy>
+const std::vector<float> &PrecisionGridSimulator<Policy>::VelocityY() const {
+  stored_velocity_y_.CopyTo(velocity_y_view_);
+  return velocity_y_view_;
+}
+
+template<typename Policy>
+void PrecisionGridSimulator<Policy>::AddDensity(uint32_t x, uint32_t y, float amount) {
+  if (x >= dim_x_ || y >= dim_y_) {
+    throw std::out_of_range("Cell is outside the grid");
+  }
+  auto &cell = stored_density_((int32_t) x - 1, (int32_t) y - 1);
+  cell = Storage(cell + amount);
+}
+
+template<typename Policy>
+void PrecisionGridSimulator<Policy>::ProcessStoredSources() {
+  for (const auto &source : Sources()) {
+    auto x = (int32_t) (source.first % dim_x_) - 1;
+    auto y = (int32_t) (source.first / dim_x_) - 1;
+    stored_density_(x, y) = Storage(std::get<0>(source.second));
+    stored_velocity_x_(x, y) = Storage(std::get<1>(source.second));
+    stored_velocity_y_(x, y) = Storage(std::get<2>(source.second));
+  }
+}
+
+/*
+ * Red-black Gauss-Seidel as in GridFluidSimulator
+ */
+template<typename Policy>
+void PrecisionGridSimulator<Policy>::Diffuse(const Field &current, Field &next) {
+  next.CopyFrom(current);
+  auto k = (Compute) delta_t_ * (Compute) diffusion_rate_;
+  auto inv_k1 = Compute(1) / (k + Compute(1));
+  for (auto iter = 0u; iter < NUM_GS_ITERS; ++iter) {
+    for (auto colour = 0u; colour < 2; ++colour) {
+      RedBlackSorSweep(current, inv_k1, Compute(0.25) * k * inv_k1, Compute(1), colour, next);
+    }
+    CorrectBoundaryDensities(next);
+  }
+}
+
+/*
+ * The scalar SemiLagrangianAdvector kernel in the compute type. The velocity for the backtrace
+ * is loaded a chunk at a time; the stencil corners are gathered and converted one by one.
+ */
+template<typename Policy>
+void PrecisionGridSimulator<Policy>::AdvectFields() {
+  using Access = RowAccess<Storage, Compute>;
+  const Field *sources[] = {&stored_density_, &stored_velocity_x_, &stored_velocity_y_};
+  Field *destinations[] = {&temp_density_, &temp_velocity_x_, &temp_velocity_y_};
+  auto w = (int32_t) stored_density_.Width();
+  auto h = (int32_t) stored_density_.Height();
+  auto stride = (int32_t) stored_density_.Stride();
+  auto dt = (Compute) delta_t_;
+  auto half = Compute(0.5);
+  thread_pool_->ParallelFor(0, h, (uint32_t) w, [&](int32_t y_begin, int32_t y_end) {
+    alignas(64) Compute vx_buffer[Access::BUFFER_CELLS];
+    alignas(64) Compute vy_buffer[Access::BUFFER_CELLS];
+    alignas(64) Compute out_buffer[3][Access::BUFFER_CELLS];
+    for (auto y = y_begin; y < y_end; ++y) {
+      ForEachChunk(w, Access::CHUNK_CELLS, [&](int32_t x_begin, int32_t n) {
+        const auto *vx = Access::Load(stored_velocity_x_.Row(y), x_begin, n, vx_buffer);
+        const auto *vy = Access::Load(stored_velocity_y_.Row(y), x_begin, n, vy_buffer);
+        Compute *out[3];
+        for (auto t = 0; t < 3; ++t) {
+          out[t] = Access::Output(destinations[t]->Row(y), x_begin, out_buffer[t]);
+        }
+        for (auto i = 0; i < n; ++i) {
+          auto source_x = ((Compute) (x_begin + i) + half) - vx[i] * dt;
+          auto source_y = ((Compute) y + half) - vy[i] * dt;
+          source_x = std::max(-half, std::min((Compute) w + half, source_x));
+          source_y = std::max(-half, std::min((Compute) h + half, source_y));
+          auto base_x = std::min(std::floor(source_x - half), (Compute) (w - 1));
+          auto base_y = std::min(std::floor(source_y - half), (Compute) (h - 1));
+          auto frac_x = source_x - base_x - half;
+          auto frac_y = source_y - base_y - half;
+          auto offset = (int32_t) base_y * stride + (int32_t) base_x;
+          for (auto t = 0; t < 3; ++t) {
+            const auto *btm = sources[t]->Row(0) + offset;
+            const auto *top = btm + stride;
+            auto btm_lerp = Lerp((Compute) btm[0], (Compute) btm[1], frac_x);
+            auto top_lerp = Lerp((Compute) top[0], (Compute) top[1], frac_x);
+            out[t][i] = Lerp(btm_lerp, top_lerp, frac_y);
+          }
+        }
+        for (auto t = 0; t < 3; ++t) {
+          Access::Store(out[t], destinations[t]->Row(y), x_begin, n);
+        }
+      });
+    }
+  });
+  CorrectBoundaryDensities(temp_density_);
+  CorrectBoundaryVelocities(temp_velocity_x_, temp_velocity_y_);
+  stored_density_.Swap(temp_density_);
+  stored_velocity_x_.Swap(temp_velocity_x_);
+  stored_velocity_y_.Swap(temp_velocity_y_);
+}
+
+/*
+ * d(x,y) = [ vx(x+1,y) - vx(x-1,y) + vy(x,y+1) - vy(x,y-1) ] * 0.5f
+ */
+template<typename Policy>
+void PrecisionGridSimulator<Policy>::ComputeDivergence(Field &divergence) {
+  using Access = RowAccess<Storage, Compute>;
+  auto w = (int32_t) divergence.Width();
+  thread_pool_->ParallelFor(0, (int32_t) divergence.Height(), (uint32_t) w, [&](int32_t y_begin, int32_t y_end) {
+    alignas(64) Compute vx_buffer[Access::BUFFER_CELLS];
+    alignas(64) Compute window[3][Access::BUFFER_CELLS];
+    alignas(64) Compute div_buffer[Access::BUFFER_CELLS];
+    ForEachChunk(w, Access::CHUNK_CELLS, [&](int32_t x_begin, int32_t n) {
+      // vy rows pass through a window of three, so each is converted once
+      const auto *vy_below = Access::Load(stored_velocity_y_.Row(y_begin - 1), x_begin, n, window[0]);
+      const auto *vy = Access::Load(stored_velocity_y_.Row(y_begin), x_begin, n, window[1]);
+      for (auto y = y_begin; y < y_end; ++y) {
+        const auto *vx = Access::Load(stored_velocity_x_.Row(y), x_begin, n, vx_buffer);
+        auto *above_buffer = window[(y - y_begin + 2) % 3];
+        const auto *vy_above = Access::Load(stored_velocity_y_.Row(y + 1), x_begin, n, above_buffer);
+        auto *div = Access::Output(divergence.Row(y), x_begin, div_buffer);
+        for (auto x = 0; x < n; ++x) {
+          div[x] = (vx[x + 1] - vx[x - 1] + vy_above[x] - vy_below[x]) * Compute(0.5);
+        }
+        Access::Store(div, divergence.Row(y), x_begin, n);
+        vy_below = vy;
+        vy = vy_above;
+      }
+    });
+  });
+}
+
+/*
+ * Red-black SOR with the residual estimate GridFluidSimulator uses. The pressure halo stays zero.
+ */
+template<typename Policy>
+PoissonSolverStats PrecisionGridSimulator<Policy>::ComputePressure(const Field &divergence, Field &pressure) {
+  auto rhs_norm = Norm(divergence);
+  if (rhs_norm == 0.0) {
+    pressure.Fill(0.0f);
+    return {0, 0.0f};
+  }
+
+  auto relative_residual = 1.0;
+  auto iter = 0u;
+  while (iter < max_pressure_iterations_) {
+    auto change_sq = 0.0;
+    for (auto colour = 0u; colour < 2; ++colour) {
+      change_sq += RedBlackSorSweep(divergence, Compute(-0.25), Compute(0.25), (Compute) pressure_omega_, colour,
+                                    pressure);
+    }
+    ++iter;
+    relative_residual = 4.0 * std::sqrt(change_sq) / rhs_norm;
+    if (relative_residual <= pressure_tolerance_) {
+      break;
+    }
+  }
+  return {iter, (float) relative_residual};
+}
+
+/*
+ * As RedBlackSorSweep, but a column of chunks at a time so that each row is converted once as it
+ * moves through a window of three. The row just updated can serve as the row below the next one
+ * straight from its buffer, since the next row only reads the cells of the other colour. Only the
+ * updated colour is stored back.
+ */
+template<typename Policy>
+double PrecisionGridSimulator<Policy>::RedBlackSorSweep(const Field &rhs,
+                                                        Compute rhs_weight,
+                                                        Compute neighbour_weight,
+                                                        Compute omega,
+                                                        uint32_t colour,
+                                                        Field &u) {
+  using Access = RowAccess<Storage, Compute>;
+  auto w = (int32_t) u.Width();
+  return thread_pool_->ParallelSum(0, (int32_t) u.Height(), (uint32_t) w, [&](int32_t y_begin, int32_t y_end) {
+    alignas(64) Compute window[3][Access::BUFFER_CELLS];
+    alignas(64) Compute rhs_buffer[Access::BUFFER_CELLS];
+    auto sum = 0.0;
+    ForEachChunk(w, Access::CHUNK_CELLS, [&](int32_t x_begin, int32_t n) {
+      const Compute *below = Access::Load(u.Row(y_begin - 1), x_begin, n, window[0]);
+      auto *cells = Access::LoadForUpdate(u.Row(y_begin), x_begin, n, window[1]);
+      for (auto y = y_begin; y < y_end; ++y) {
+        auto parity = (int32_t) ((colour + y) & 1);
+        auto *above = Access::LoadForUpdate(u.Row(y + 1), x_begin, n, window[(y - y_begin + 2) % 3]);
+        const auto *cells_rhs = Access::Load(rhs.Row(y), x_begin, n, rhs_buffer);
+        sum += RedBlackSorRow(below, cells, above, cells_rhs, n, parity, rhs_weight, neighbour_weight, omega);
+        Access::StoreColour(cells, u.Row(y), x_begin, n, parity);
+        below = cells;
+        cells = above;
+      }
+    });
+    return sum;
+  });
+}
+
+template<typename Policy>
+double PrecisionGridSimulator<Policy>::Norm(const Field &field) const {
+  using Access = RowAccess<Storage, Compute>;
+  auto w = (int32_t) field.Width();
+  return std::sqrt(thread_pool_->ParallelSum(0, (int32_t) field.Height(), (uint32_t) w,
+                                             [&](int32_t y_begin, int32_t y_end) {
+    alignas(64) Compute buffer[Access::BUFFER_CELLS];
+    auto sum = 0.0;
+    for (auto y = y_begin; y < y_end; ++y) {
+      ForEachChunk(w, Access::CHUNK_CELLS, [&](int32_t x_begin, int32_t n) {
+        const auto *cells = Access::Load(field.Row(y), x_begin, n, buffer);
+        for (auto x = 0; x < n; ++x) {
+          sum += (double) cells[x] * (double) cells[x];
+        }
+      });
+    }
+    return sum;
+  }));
+}
+
+/*
+ * Subtract the central difference pressure gradient from the velocity
+ */
+template<typename Policy>
+void PrecisionGridSimulator<Policy>::SuppressDivergence() {
+  using Access = RowAccess<Storage, Compute>;
+  ComputeDivergence(divergence_);
+  last_pressure_solve_ = ComputePressure(divergence_, pressure_);
+
+  auto w = (int32_t) pressure_.Width();
+  thread_pool_->ParallelFor(0, (int32_t) pressure_.Height(), (uint32_t) w, [&](int32_t y_begin, int32_t y_end) {
+    alignas(64) Compute window[3][Access::BUFFER_CELLS];
+    alignas(64) Compute vx_buffer[Access::BUFFER_CELLS];
+    alignas(64) Compute vy_buffer[Access::BUFFER_CELLS];
+    ForEachChunk(w, Access::CHUNK_CELLS, [&](int32_t x_begin, int32_t n) {
+      const auto *p_below = Access::Load(pressure_.Row(y_begin - 1), x_begin, n, window[0]);
+      const auto *p = Access::Load(pressure_.Row(y_begin), x_begin, n, window[1]);
+      for (auto y = y_begin; y < y_end; ++y) {
+        const auto *p_above = Access::Load(pressure_.Row(y + 1), x_begin, n, window[(y - y_begin + 2) % 3]);
+        auto *vx = Access::LoadForUpdate(stored_velocity_x_.Row(y), x_begin, n, vx_buffer);
+        auto *vy = Access::LoadForUpdate(stored_velocity_y_.Row(y), x_begin, n, vy_buffer);
+        for (auto x = 0; x < n; ++x) {
+          vx[x] -= (p[x + 1] - p[x - 1]) * Compute(0.5);
+          vy[x] -= (p_above[x] - p_below[x]) * Compute(0.5);
+        }
+        Access::Store(vx, stored_velocity_x_.Row(y), x_begin, n);
+        Access::Store(vy, stored_velocity_y_.Row(y), x_begin, n);
+        p_below = p;
+        p = p_above;
+      }
+    });
+  });
+  CorrectBoundaryVelocities(stored_velocity_x_, stored_velocity_y_);
+}
+
+/*
+ * Zero gradient at the walls
+ */
+template<typename Policy>
+void PrecisionGridSimulator<Policy>::CorrectBoundaryDensities(Field &densities) const {
+  densities.FillHalo(1.0f, 1.0f);
+}
+
+/*
+ * No flow through the walls; tangential velocity is copied
+ */
+template<typename Policy>
+void PrecisionGridSimulator<Policy>::CorrectBoundaryVelocities(Field &velocity_x, Field &velocity_y) const {
+  velocity_x.FillHalo(0.0f, 1.0f);
+  velocity_y.FillHalo(1.0f, 0.0f);
+}
+
+template<typename Policy>
+void PrecisionGridSimulator<Policy>::Simulate() {
+  ProcessStoredSources();
+  CorrectBoundaryDensities(stored_density_);
+  CorrectBoundaryVelocities(stored_velocity_x_, stored_velocity_y_);
+
+  Diffuse(stored_density_, temp_density_);
+  stored_density_.Swap(temp_density_);
+
+  Diffuse(stored_velocity_x_, temp_velocity_x_);
+  Diffuse(stored_velocity_y_, temp_velocity_y_);
+  CorrectBoundaryVelocities(temp_velocity_x_, temp_velocity_y_);
+  stored_velocity_x_.Swap(temp_velocity_x_);
+  stored_velocity_y_.Swap(temp_velocity_y_);
+
+  AdvectFields();
+
+  SuppressDivergence();
+}
+
+template class PrecisionGridSimulator<DoublePrecision>;
+template class PrecisionGridSimulator<SinglePrecision>;
+template class PrecisionGridSimulator<HalfStorage>;
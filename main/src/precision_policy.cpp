@@ -0,0 +1,65 @@
+#include "precision_policy.h"
+
+// As for the advection kernels, the F16C paths are compiled with per-function target attributes
+// and only taken when the CPU reports the extension.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define PRECISION_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace {
+#ifdef PRECISION_X86_KERNELS
+bool HasF16c() {
+  static const bool has_f16c = __builtin_cpu_supports("f16c") && __builtin_cpu_supports("avx");
+  return has_f16c;
+}
+
+__attribute__((target("avx,f16c")))
+size_t HalfToFloatF16c(const Half *src, float *dst, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    auto halves = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(halves));
+  }
+  return i;
+}
+
+__attribute__((target("avx,f16c")))
+size_t FloatToHalfF16c(const float *src, Half *dst, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    auto halves = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), halves);
+  }
+  return i;
+}
+#endif
+}
+
+/*
+ * The vector loop handles whole groups of 8 and the scalar conversion, which rounds the same
+ * way, the rest.
+ */
+void ConvertRow(const Half *src, float *dst, size_t n) {
+  size_t i = 0;
+#ifdef PRECISION_X86_KERNELS
+  if (HasF16c()) {
+    i = HalfToFloatF16c(src, dst, n);
+  }
+#endif
+  for (; i < n; ++i) {
+    dst[i] = HalfBitsToFloat(src[i].bits);
+  }
+}
+
+void ConvertRow(const float *src, Half *dst, size_t n) {
+  size_t i = 0;
+#ifdef PRECISION_X86_KERNELS
+  if (HasF16c()) {
+    i = FloatToHalfF16c(src, dst, n);
+  }
+#endif
+  for (; i < n; ++i) {
+    dst[i].bits = FloatToHalfBits(src[i]);
+  }
+}
@@ -0,0 +1,170 @@
+#include "red_black_sor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <initializer_list>
+
+// Cache budget for the u and rhs rows of one temporally blocked tile
+const uint32_t TILE_CACHE_BYTES = 512 * 1024;
+
+namespace {
+/*
+ * Row y's share of Field2D::FillHalo for a one cell halo. The side cells of a row are only read
+ * by that row and the halo rows below and above only by the first and last rows, so each row can
+ * refresh its part as soon as it finishes an iteration.
+ */
+void FillRowHalo(Field2D &u, int32_t y, float x_edge_factor, float y_edge_factor) {
+  auto w = (int32_t) u.Width();
+  auto h = (int32_t) u.Height();
+  auto *row = u.Row(y);
+  row[-1] = x_edge_factor * row[0];
+  row[w] = x_edge_factor * row[w - 1];
+  for (auto outside_y : {-1, h}) {
+    if (outside_y != y - 1 && outside_y != y + 1) {
+      continue;
+    }
+    auto *outside = u.Row(outside_y);
+    for (auto x = 0; x < w; ++x) {
+      outside[x] = y_edge_factor * row[x];
+    }
+    outside[-1] = 0.5f * (outside[0] + row[-1]);
+    outside[w] = 0.5f * (outside[w - 1] + row[w]);
+  }
+}
+
+/*
+ * Half sweep number half_sweep of an iteration-aligned run over rows [y_begin, y_end). Odd half
+ * sweeps finish an iteration, so the rows refresh their halo.
+ */
+void SweepRows(const Field2D &rhs,
+               float rhs_weight,
+               float neighbour_weight,
+               float omega,
+               float x_edge_factor,
+               float y_edge_factor,
+               int32_t half_sweep,
+               int32_t y_begin,
+               int32_t y_end,
+               Field2D &u) {
+  auto w = (int32_t) u.Width();
+  auto colour = half_sweep & 1;
+  for (auto y = y_begin; y < y_end; ++y) {
+    auto parity = (colour + y) & 1;
+    RedBlackSorRow(u.Row(y - 1), u.Row(y), u.Row(y + 1), rhs.Row(y), w, parity, rhs_weight, neighbour_weight, omega);
+    if (colour == 1) {
+      FillRowHalo(u, y, x_edge_factor, y_edge_factor);
+    }
+  }
+}
+}
+
+float OptimalSorOmega(uint32_t width, uint32_t height) {
+  auto n = (double) std::max(width, height) + 1.0;
+  return (float) (2.0 / (1.0 + std::sin(M_PI / n)));
+}
+
+double RedBlackSorSweep(ThreadPool *thread_pool,
+                        const Field2D &rhs,
+                        float rhs_weight,
+                        float neighbour_weight,
+                        float omega,
+                        uint32_t colour,
+                        Field2D &u) {
+  auto w = (int32_t) u.Width();
+  return ParallelSum(thread_pool, 0, (int32_t) u.Height(), w, [&](int32_t y_begin, int32_t y_end) {
+    auto sum = 0.0;
+    for (auto y = y_begin; y < y_end; ++y) {
+      auto parity = (int32_t) ((colour + y) & 1);
+      sum += RedBlackSorRow(u.Row(y - 1), u.Row(y), u.Row(y + 1), rhs.Row(y), w, parity, rhs_weight, neighbour_weight, omega);
+    }
+    return sum;
+  });
+}
+
+double RedBlackSorSweep(ThreadPool *thread_pool,
+                        const TileMap &tile_map,
+                        const TiledField2D &rhs,
+                        float rhs_weight,
+                        float neighbour_weight,
+                        float omega,
+                        uint32_t colour,
+                        TiledField2D &u) {
+  const auto &active = tile_map.ActiveTiles();
+  return ParallelSum(thread_pool, 0, (int32_t) active.size(), TILE_SIZE * TILE_SIZE, [&](int32_t begin, int32_t end) {
+    auto sum = 0.0;
+    for (auto i = begin; i < end; ++i) {
+      auto tile = active[i];
+      auto slot = tile_map.Slot(tile);
+      auto *cells = u.Tile(slot);
+      const auto *cells_rhs = rhs.Tile(slot);
+      auto extent_x = tile_map.ExtentX(tile);
+      // Tile origins are even, so the colour of a local cell is that of its interior cell
+      for (auto y = 0; y < tile_map.ExtentY(tile); ++y) {
+        auto parity = (int32_t) ((colour + y) & 1);
+        auto *row = cells + y * TILE_STRIDE;
+        sum += RedBlackSorRow(row - TILE_STRIDE, row, row + TILE_STRIDE, cells_rhs + y * TILE_STRIDE, extent_x, parity,
+                      rhs_weight, neighbour_weight, omega);
+      }
+    }
+    return sum;
+  });
+}
+
+void RedBlackSorTiled(ThreadPool *thread_pool,
+                      const Field2D &rhs,
+                      float rhs_weight,
+                      float neighbour_weight,
+                      float omega,
+                      uint32_t num_iterations,
+                      float x_edge_factor,
+                      float y_edge_factor,
+                      Field2D &u) {
+  auto w = (int32_t) u.Width();
+  auto h = (int32_t) u.Height();
+  if (u.Halo() != 1) {
+    for (auto iter = 0u; iter < num_iterations; ++iter) {
+      RedBlackSorSweep(thread_pool, rhs, rhs_weight, neighbour_weight, omega, 0, u);
+      RedBlackSorSweep(thread_pool, rhs, rhs_weight, neighbour_weight, omega, 1, u);
+      u.FillHalo(x_edge_factor, y_edge_factor);
+    }
+    return;
+  }
+
+  // A tile advanced by d half sweeps needs at least 2d + 2 rows so that the triangles over
+  // neighbouring tile edges neither overlap nor read each other's rows
+  auto row_bytes = (uint32_t) (2 * u.Stride() * sizeof(float));
+  auto tile_rows = std::max((int32_t) (TILE_CACHE_BYTES / row_bytes), 6);
+  auto iterations_per_pass = (uint32_t) std::max(1, (tile_rows - 2) / 4);
+  auto num_tiles = std::max(1, h / tile_rows);
+  auto tile_begin = [&](int32_t tile) { return (int32_t) ((int64_t) h * tile / num_tiles); };
+
+  for (auto done = 0u; done < num_iterations; done += iterations_per_pass) {
+    auto depth = 2 * (int32_t) std::min(iterations_per_pass, num_iterations - done);
+
+    // Trapezoids: each tile runs every half sweep, giving up a row per half sweep at each edge it
+    // shares with another tile, as those rows would need the neighbour's values
+    ParallelFor(thread_pool, 0, num_tiles, (uint32_t) (tile_rows * w), [&](int32_t first, int32_t last) {
+      for (auto tile = first; tile < last; ++tile) {
+        auto y_begin = tile_begin(tile);
+        auto y_end = tile_begin(tile + 1);
+        for (auto s = 0; s < depth; ++s) {
+          SweepRows(rhs, rhs_weight, neighbour_weight, omega, x_edge_factor, y_edge_factor, s,
+                    (tile > 0) ? y_begin + s : y_begin,
+                    (tile < num_tiles - 1) ? y_end - s : y_end,
+                    u);
+        }
+      }
+    });
+
+    // Inverted triangles over each shared edge fill in the rows the trapezoids left behind
+    ParallelFor(thread_pool, 1, num_tiles, (uint32_t) (depth * w), [&](int32_t first, int32_t last) {
+      for (auto edge = first; edge < last; ++edge) {
+        auto y_edge = tile_begin(edge);
+        for (auto s = 1; s < depth; ++s) {
+          SweepRows(rhs, rhs_weight, neighbour_weight, omega, x_edge_factor, y_edge_factor, s,
+                    y_edge - s, y_edge + s, u);
+        }
+      }
+    });
+  }
+}
@@ -0,0 +1,539 @@
+#include "semi_lagrangian_advector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+// The vector kernels are compiled with per-function target attributes, so the rest of the build
+// keeps its baseline flags and the CPU is only asked for the ISA when the kernel is chosen.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ADVECTION_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace {
+using Target = SemiLagrangianAdvector::Target;
+using Periodicity = SemiLagrangianAdvector::Periodicity;
+
+inline float Lerp(float from, float to, float pct) { return from + pct * (to - from); }
+
+// Bottom left corner of a 2x2 interpolation stencil, as an offset from cell (0, 0), and the weights
+struct Stencil {
+  int32_t offset;
+  float frac_x;
+  float frac_y;
+};
+
+// The same stencil as interior coordinates of its bottom left corner
+struct Departure {
+  int32_t base_x;
+  int32_t base_y;
+  float frac_x;
+  float frac_y;
+};
+
+/*
+ * Reference version of every kernel. The SSE4.2 and AVX2 kernels follow it operation for
+ * operation and match it exactly. AVX-512 always has fused multiply-add, which that kernel uses,
+ * so it agrees to within rounding.
+ */
+inline Departure Trace(const float *velocity_x,
+                       const float *velocity_y,
+                       int32_t x, int32_t y,
+                       int32_t w, int32_t h,
+                       float delta_t,
+                       Periodicity periodic) {
+  // Get the source point for that flow, staying within the centres of the halo cells
+  auto source_x = ((float) x + 0.5f) - velocity_x[x] * delta_t;
+  auto source_y = ((float) y + 0.5f) - velocity_y[x] * delta_t;
+  // Wrap into [0, w) or [0, h); the halo then holds the far side for the stencil
+  if (periodic.x) {
+    source_x -= (float) w * std::floor(source_x * (1.0f / (float) w));
+  }
+  if (periodic.y) {
+    source_y -= (float) h * std::floor(source_y * (1.0f / (float) h));
+  }
+  source_x = std::max(-0.5f, std::min((float) w + 0.5f, source_x));
+  source_y = std::max(-0.5f, std::min((float) h + 0.5f, source_y));
+
+  // Base coord of the 2x2 stencil, clamped so that base + 1 is still in the halo
+  auto base_x = std::min(std::floor(source_x - 0.5f), (float) (w - 1));
+  auto base_y = std::min(std::floor(source_y - 0.5f), (float) (h - 1));
+  return {(int32_t) base_x, (int32_t) base_y, source_x - base_x - 0.5f, source_y - base_y - 0.5f};
+}
+
+inline Stencil Backtrace(const float *velocity_x,
+                         const float *velocity_y,
+                         int32_t x, int32_t y,
+                         int32_t w, int32_t h, int32_t stride,
+                         float delta_t,
+                         Periodicity periodic) {
+  auto departure = Trace(velocity_x, velocity_y, x, y, w, h, delta_t, periodic);
+  return {departure.base_y * stride + departure.base_x, departure.frac_x, departure.frac_y};
+}
+
+inline float Interpolate(const float *origin, int32_t stride, const Stencil &stencil) {
+  const auto *btm = origin + stencil.offset;
+  const auto *top = btm + stride;
+  auto btm_lerp = Lerp(btm[0], btm[1], stencil.frac_x);
+  auto top_lerp = Lerp(top[0], top[1], stencil.frac_x);
+  return Lerp(btm_lerp, top_lerp, stencil.frac_y);
+}
+
+// Advect cells [x_begin, x_end) of row y one at a time
+void AdvectCellsScalar(const float *velocity_x,
+                       const float *velocity_y,
+                       int32_t y,
+                       float delta_t,
+                       const Target *targets,
+                       size_t num_targets,
+                       Periodicity periodic,
+                       int32_t x_begin,
+                       int32_t x_end) {
+  const auto &shape = *targets[0].source;
+  auto w = (int32_t) shape.Width();
+  auto h = (int32_t) shape.Height();
+  auto stride = (int32_t) shape.Stride();
+  for (auto x = x_begin; x < x_end; ++x) {
+    auto stencil = Backtrace(velocity_x, velocity_y, x, y, w, h, stride, delta_t, periodic);
+    for (size_t t = 0; t < num_targets; ++t) {
+      targets[t].destination->Row(y)[x] = Interpolate(targets[t].source->Row(0), stride, stencil);
+    }
+  }
+}
+
+/*
+ * Cells of row y from the tiled copies of the sources. A 2x2 stencil always lies within the tile
+ * holding its bottom left corner and that tile's ring, so its cells are as close together in
+ * memory as the tile is wide, whichever way the departure point lies.
+ */
+void AdvectRowTiled(const float *velocity_x,
+                    const float *velocity_y,
+                    int32_t y,
+                    float delta_t,
+                    const TileMap &tile_map,
+                    const SemiLagrangianAdvector::TiledTarget *targets,
+                    size_t num_targets,
+                    Periodicity periodic) {
+  auto w = (int32_t) tile_map.Width();
+  auto h = (int32_t) tile_map.Height();
+  auto tiles_x = tile_map.TilesX();
+  for (auto x = 0; x < w; ++x) {
+    auto departure = Trace(velocity_x, velocity_y, x, y, w, h, delta_t, periodic);
+    // As TileMap::TileAt() and OriginX/Y(), without dividing by the number of tiles per row
+    auto tile_x = (int32_t) ((uint32_t) std::max(0, departure.base_x) / TILE_SIZE);
+    auto tile_y = (int32_t) ((uint32_t) std::max(0, departure.base_y) / TILE_SIZE);
+    auto slot = tile_map.Slot(tile_y * tiles_x + tile_x);
+    auto offset = (departure.base_y - tile_y * TILE_SIZE) * TILE_STRIDE + (departure.base_x - tile_x * TILE_SIZE);
+    for (size_t t = 0; t < num_targets; ++t) {
+      targets[t].destination->Row(y)[x] =
+              Interpolate(targets[t].source->Tile(slot), TILE_STRIDE, {offset, departure.frac_x, departure.frac_y});
+    }
+  }
+}
+
+void AdvectRowScalar(const float *velocity_x,
+                     const float *velocity_y,
+                     int32_t y,
+                     float delta_t,
+                     const Target *targets,
+                     size_t num_targets,
+                     Periodicity periodic,
+                     int32_t x_begin,
+                     int32_t x_end) {
+  AdvectCellsScalar(velocity_x, velocity_y, y, delta_t, targets, num_targets, periodic, x_begin, x_end);
+}
+
+#ifdef ADVECTION_X86_KERNELS
+/*
+ * The vector kernels below work on 4, 8 or 16 consecutive cells of a row. Each vector of cells
+ * is backtraced once and the stencil is then applied to every target. Rows are aligned to a
+ * whole AVX-512 vector so the velocity loads and destination stores are aligned. Stencil corners
+ * are addressed as offsets from cell (0, 0) of each source, which may be negative in the halo.
+ * Cells past the last whole vector go through the scalar path.
+ */
+__attribute__((target("sse4.2")))
+void AdvectRowSse42(const float *velocity_x,
+                    const float *velocity_y,
+                    int32_t y,
+                    float delta_t,
+                    const Target *targets,
+                    size_t num_targets,
+                    Periodicity periodic,
+                    int32_t x_begin,
+                    int32_t x_end) {
+  const auto &shape = *targets[0].source;
+  auto w = (int32_t) shape.Width();
+  auto h = (int32_t) shape.Height();
+  auto s = (intptr_t) shape.Stride();
+
+  const auto dt = _mm_set1_ps(delta_t);
+  const auto half = _mm_set1_ps(0.5f);
+  const auto low = _mm_set1_ps(-0.5f);
+  const auto high_x = _mm_set1_ps((float) w + 0.5f);
+  const auto high_y = _mm_set1_ps((float) h + 0.5f);
+  const auto period_x = _mm_set1_ps((float) w);
+  const auto period_y = _mm_set1_ps((float) h);
+  const auto inv_period_x = _mm_set1_ps(1.0f / (float) w);
+  const auto inv_period_y = _mm_set1_ps(1.0f / (float) h);
+  const auto max_base_x = _mm_set1_ps((float) (w - 1));
+  const auto max_base_y = _mm_set1_ps((float) (h - 1));
+  const auto stride = _mm_set1_epi32((int32_t) s);
+  const auto centre_y = _mm_set1_ps((float) y + 0.5f);
+  const auto lane_centres = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+  alignas(16) int32_t corner[4];
+
+  // Cells before the first aligned vector go through the scalar path too
+  auto x = std::min(x_end, (x_begin + 3) / 4 * 4);
+  AdvectCellsScalar(velocity_x, velocity_y, y, delta_t, targets, num_targets, periodic, x_begin, x);
+  for (; x + 4 <= x_end; x += 4) {
+    auto centre_x = _mm_add_ps(_mm_set1_ps((float) x), lane_centres);
+    auto source_x = _mm_sub_ps(centre_x, _mm_mul_ps(_mm_load_ps(velocity_x + x), dt));
+    auto source_y = _mm_sub_ps(centre_y, _mm_mul_ps(_mm_load_ps(velocity_y + x), dt));
+    if (periodic.x) {
+      source_x = _mm_sub_ps(source_x, _mm_mul_ps(period_x, _mm_floor_ps(_mm_mul_ps(source_x, inv_period_x))));
+    }
+    if (periodic.y) {
+      source_y = _mm_sub_ps(source_y, _mm_mul_ps(period_y, _mm_floor_ps(_mm_mul_ps(source_y, inv_period_y))));
+    }
+    source_x = _mm_max_ps(low, _mm_min_ps(high_x, source_x));
+    source_y = _mm_max_ps(low, _mm_min_ps(high_y, source_y));
+
+    auto base_x = _mm_min_ps(_mm_floor_ps(_mm_sub_ps(source_x, half)), max_base_x);
+    auto base_y = _mm_min_ps(_mm_floor_ps(_mm_sub_ps(source_y, half)), max_base_y);
+    auto frac_x = _mm_sub_ps(_mm_sub_ps(source_x, base_x), half);
+    auto frac_y = _mm_sub_ps(_mm_sub_ps(source_y, base_y), half);
+
+    // No gather before AVX2, so fetch the corners lane by lane
+    auto index = _mm_add_epi32(_mm_mullo_epi32(_mm_cvtps_epi32(base_y), stride), _mm_cvtps_epi32(base_x));
+    _mm_store_si128((__m128i *) corner, index);
+
+    for (size_t t = 0; t < num_targets; ++t) {
+      const auto *o = targets[t].source->Row(0);
+      auto bl = _mm_setr_ps(o[corner[0]], o[corner[1]], o[corner[2]], o[corner[3]]);
+      auto br = _mm_setr_ps(o[corner[0] + 1], o[corner[1] + 1], o[corner[2] + 1], o[corner[3] + 1]);
+      auto tl = _mm_setr_ps(o[corner[0] + s], o[corner[1] + s], o[corner[2] + s], o[corner[3] + s]);
+      auto tr = _mm_setr_ps(o[corner[0] + s + 1], o[corner[1] + s + 1], o[corner[2] + s + 1], o[corner[3] + s + 1]);
+
+      auto btm_lerp = _mm_add_ps(bl, _mm_mul_ps(frac_x, _mm_sub_ps(br, bl)));
+      auto top_lerp = _mm_add_ps(tl, _mm_mul_ps(frac_x, _mm_sub_ps(tr, tl)));
+      _mm_store_ps(targets[t].destination->Row(y) + x,
+                   _mm_add_ps(btm_lerp, _mm_mul_ps(frac_y, _mm_sub_ps(top_lerp, btm_lerp))));
+    }
+  }
+  AdvectCellsScalar(velocity_x, velocity_y, y, delta_t, targets, num_targets, periodic, x, x_end);
+}
+
+__attribute__((target("avx2")))
+void AdvectRowAvx2(const float *velocity_x,
+                   const float *velocity_y,
+                   int32_t y,
+                   float delta_t,
+                   const Target *targets,
+                   size_t num_targets,
+                   Periodicity periodic,
+                   int32_t x_begin,
+                   int32_t x_end) {
+  const auto &shape = *targets[0].source;
+  auto w = (int32_t) shape.Width();
+  auto h = (int32_t) shape.Height();
+
+  const auto dt = _mm256_set1_ps(delta_t);
+  const auto half = _mm256_set1_ps(0.5f);
+  const auto low = _mm256_set1_ps(-0.5f);
+  const auto high_x = _mm256_set1_ps((float) w + 0.5f);
+  const auto high_y = _mm256_set1_ps((float) h + 0.5f);
+  const auto period_x = _mm256_set1_ps((float) w);
+  const auto period_y = _mm256_set1_ps((float) h);
+  const auto inv_period_x = _mm256_set1_ps(1.0f / (float) w);
+  const auto inv_period_y = _mm256_set1_ps(1.0f / (float) h);
+  const auto max_base_x = _mm256_set1_ps((float) (w - 1));
+  const auto max_base_y = _mm256_set1_ps((float) (h - 1));
+  const auto stride = _mm256_set1_epi32((int32_t) shape.Stride());
+  const auto one = _mm256_set1_epi32(1);
+  const auto centre_y = _mm256_set1_ps((float) y + 0.5f);
+  const auto lane_centres = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+
+  // Cells before the first aligned vector go through the scalar path too
+  auto x = std::min(x_end, (x_begin + 7) / 8 * 8);
+  AdvectCellsScalar(velocity_x, velocity_y, y, delta_t, targets, num_targets, periodic, x_begin, x);
+  for (; x + 8 <= x_end; x += 8) {
+    auto centre_x = _mm256_add_ps(_mm256_set1_ps((float) x), lane_centres);
+    auto source_x = _mm256_sub_ps(centre_x, _mm256_mul_ps(_mm256_load_ps(velocity_x + x), dt));
+    auto source_y = _mm256_sub_ps(centre_y, _mm256_mul_ps(_mm256_load_ps(velocity_y + x), dt));
+    if (periodic.x) {
+      source_x = _mm256_sub_ps(source_x,
+                               _mm256_mul_ps(period_x, _mm256_floor_ps(_mm256_mul_ps(source_x, inv_period_x))));
+    }
+    if (periodic.y) {
+      source_y = _mm256_sub_ps(source_y,
+                               _mm256_mul_ps(period_y, _mm256_floor_ps(_mm256_mul_ps(source_y, inv_period_y))));
+    }
+    source_x = _mm256_max_ps(low, _mm256_min_ps(high_x, source_x));
+    source_y = _mm256_max_ps(low, _mm256_min_ps(high_y, source_y));
+
+    auto base_x = _mm256_min_ps(_mm256_floor_ps(_mm256_sub_ps(source_x, half)), max_base_x);
+    auto base_y = _mm256_min_ps(_mm256_floor_ps(_mm256_sub_ps(source_y, half)), max_base_y);
+    auto frac_x = _mm256_sub_ps(_mm256_sub_ps(source_x, base_x), half);
+    auto frac_y = _mm256_sub_ps(_mm256_sub_ps(source_y, base_y), half);
+
+    auto btm_left = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvtps_epi32(base_y), stride),
+                                     _mm256_cvtps_epi32(base_x));
+    auto btm_right = _mm256_add_epi32(btm_left, one);
+    auto top_left = _mm256_add_epi32(btm_left, stride);
+    auto top_right = _mm256_add_epi32(top_left, one);
+
+    for (size_t t = 0; t < num_targets; ++t) {
+      const auto *origin = targets[t].source->Row(0);
+      auto bl = _mm256_i32gather_ps(origin, btm_left, 4);
+      auto br = _mm256_i32gather_ps(origin, btm_right, 4);
+      auto tl = _mm256_i32gather_ps(origin, top_left, 4);
+      auto tr = _mm256_i32gather_ps(origin, top_right, 4);
+
+      auto btm_lerp = _mm256_add_ps(bl, _mm256_mul_ps(frac_x, _mm256_sub_ps(br, bl)));
+      auto top_lerp = _mm256_add_ps(tl, _mm256_mul_ps(frac_x, _mm256_sub_ps(tr, tl)));
+      _mm256_store_ps(targets[t].destination->Row(y) + x,
+                      _mm256_add_ps(btm_lerp, _mm256_mul_ps(frac_y, _mm256_sub_ps(top_lerp, btm_lerp))));
+    }
+  }
+  AdvectCellsScalar(velocity_x, velocity_y, y, delta_t, targets, num_targets, periodic, x, x_end);
+}
+
+__attribute__((target("avx512f")))
+void AdvectRowAvx512(const float *velocity_x,
+                     const float *velocity_y,
+                     int32_t y,
+                     float delta_t,
+                     const Target *targets,
+                     size_t num_targets,
+                     Periodicity periodic,
+                     int32_t x_begin,
+                     int32_t x_end) {
+  const auto &shape = *targets[0].source;
+  auto w = (int32_t) shape.Width();
+  auto h = (int32_t) shape.Height();
+
+  const auto dt = _mm512_set1_ps(delta_t);
+  const auto half = _mm512_set1_ps(0.5f);
+  const auto low = _mm512_set1_ps(-0.5f);
+  const auto high_x = _mm512_set1_ps((float) w + 0.5f);
+  const auto high_y = _mm512_set1_ps((float) h + 0.5f);
+  const auto period_x = _mm512_set1_ps((float) w);
+  const auto period_y = _mm512_set1_ps((float) h);
+  const auto inv_period_x = _mm512_set1_ps(1.0f / (float) w);
+  const auto inv_period_y = _mm512_set1_ps(1.0f / (float) h);
+  const auto max_base_x = _mm512_set1_ps((float) (w - 1));
+  const auto max_base_y = _mm512_set1_ps((float) (h - 1));
+  const auto stride = _mm512_set1_epi32((int32_t) shape.Stride());
+  const auto one = _mm512_set1_epi32(1);
+  const auto centre_y = _mm512_set1_ps((float) y + 0.5f);
+  const auto lane_centres = _mm512_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f,
+                                           8.5f, 9.5f, 10.5f, 11.5f, 12.5f, 13.5f, 14.5f, 15.5f);
+
+  // Cells before the first aligned vector go through the scalar path too
+  auto x = std::min(x_end, (x_begin + 15) / 16 * 16);
+  AdvectCellsScalar(velocity_x, velocity_y, y, delta_t, targets, num_targets, periodic, x_begin, x);
+  for (; x + 16 <= x_end; x += 16) {
+    auto centre_x = _mm512_add_ps(_mm512_set1_ps((float) x), lane_centres);
+    auto source_x = _mm512_fnmadd_ps(_mm512_load_ps(velocity_x + x), dt, centre_x);
+    auto source_y = _mm512_fnmadd_ps(_mm512_load_ps(velocity_y + x), dt, centre_y);
+    if (periodic.x) {
+      auto turns_x = _mm512_roundscale_ps(_mm512_mul_ps(source_x, inv_period_x), _MM_FROUND_TO_NEG_INF);
+      source_x = _mm512_fnmadd_ps(period_x, turns_x, source_x);
+    }
+    if (periodic.y) {
+      auto turns_y = _mm512_roundscale_ps(_mm512_mul_ps(source_y, inv_period_y), _MM_FROUND_TO_NEG_INF);
+      source_y = _mm512_fnmadd_ps(period_y, turns_y, source_y);
+    }
+    source_x = _mm512_max_ps(low, _mm512_min_ps(high_x, source_x));
+    source_y = _mm512_max_ps(low, _mm512_min_ps(high_y, source_y));
+
+    auto base_x = _mm512_min_ps(_mm512_roundscale_ps(_mm512_sub_ps(source_x, half), _MM_FROUND_TO_NEG_INF),
+                                max_base_x);
+    auto base_y = _mm512_min_ps(_mm512_roundscale_ps(_mm512_sub_ps(source_y, half), _MM_FROUND_TO_NEG_INF),
+                                max_base_y);
+    auto frac_x = _mm512_sub_ps(_mm512_sub_ps(source_x, base_x), half);
+    auto frac_y = _mm512_sub_ps(_mm512_sub_ps(source_y, base_y), half);
+
+    auto btm_left = _mm512_add_epi32(_mm512_mullo_epi32(_mm512_cvtps_epi32(base_y), stride),
+                                     _mm512_cvtps_epi32(base_x));
+    auto btm_right = _mm512_add_epi32(btm_left, one);
+    auto top_left = _mm512_add_epi32(btm_left, stride);
+    auto top_right = _mm512_add_epi32(top_left, one);
+
+    for (size_t t = 0; t < num_targets; ++t) {
+      const auto *origin = targets[t].source->Row(0);
+      auto bl = _mm512_i32gather_ps(btm_left, origin, 4);
+      auto br = _mm512_i32gather_ps(btm_right, origin, 4);
+      auto tl = _mm512_i32gather_ps(top_left, origin, 4);
+      auto tr = _mm512_i32gather_ps(top_right, origin, 4);
+
+      auto btm_lerp = _mm512_fmadd_ps(frac_x, _mm512_sub_ps(br, bl), bl);
+      auto top_lerp = _mm512_fmadd_ps(frac_x, _mm512_sub_ps(tr, tl), tl);
+      _mm512_store_ps(targets[t].destination->Row(y) + x,
+                      _mm512_fmadd_ps(frac_y, _mm512_sub_ps(top_lerp, btm_lerp), btm_lerp));
+    }
+  }
+  AdvectCellsScalar(velocity_x, velocity_y, y, delta_t, targets, num_targets, periodic, x, x_end);
+}
+#endif
+
+bool IsaSupported(SemiLagrangianAdvector::Isa isa) {
+#ifdef ADVECTION_X86_KERNELS
+  switch (isa) {
+    case SemiLagrangianAdvector::AVX512:
+      return __builtin_cpu_supports("avx512f");
+    case SemiLagrangianAdvector::AVX2:
+      return __builtin_cpu_supports("avx2");
+    case SemiLagrangianAdvector::SSE42:
+      return __builtin_cpu_supports("sse4.2");
+    case SemiLagrangianAdvector::SCALAR:
+      return true;
+  }
+  return false;
+#else
+  return isa == SemiLagrangianAdvector::SCALAR;
+#endif
+}
+}
+
+SemiLagrangianAdvector::SemiLagrangianAdvector() //
+        : SemiLagrangianAdvector(DetectIsa())    //
+{}
+
+SemiLagrangianAdvector::SemiLagrangianAdvector(Isa isa) //
+        : isa_{isa}                                     //
+        , periodic_{false, false}                       //
+        , kernel_{AdvectRowScalar}                      //
+{
+  if (!IsaSupported(isa)) {
+    throw std::runtime_error(std::string("CPU does not support the ") + IsaName(isa) + " advection kernel");
+  }
+#ifdef ADVECTION_X86_KERNELS
+  if (isa == AVX512) {
+    kernel_ = AdvectRowAvx512;
+  } else if (isa == AVX2) {
+    kernel_ = AdvectRowAvx2;
+  } else if (isa == SSE42) {
+    kernel_ = AdvectRowSse42;
+  }
+#endif
+}
+
+SemiLagrangianAdvector::Isa SemiLagrangianAdvector::DetectIsa() {
+  for (auto isa : {AVX512, AVX2, SSE42}) {
+    if (IsaSupported(isa)) {
+      return isa;
+    }
+  }
+  return SCALAR;
+}
+
+void SemiLagrangianAdvector::SetPeriodic(bool periodic) {
+  SetPeriodic(periodic, periodic);
+}
+
+void SemiLagrangianAdvector::SetPeriodic(bool periodic_x, bool periodic_y) {
+  periodic_ = {periodic_x, periodic_y};
+}
+
+const char *SemiLagrangianAdvector::IsaName(Isa isa) {
+  switch (isa) {
+    case AVX512:
+      return "AVX-512";
+    case AVX2:
+      return "AVX2";
+    case SSE42:
+      return "SSE4.2";
+    case SCALAR:
+      return "scalar";
+  }
+  return "unknown";
+}
+
+void SemiLagrangianAdvector::Advect(const Field2D &velocity_x,
+                                    const Field2D &velocity_y,
+                                    float delta_t,
+                                    const Field2D &source,
+                                    Field2D &destination) const {
+  Target target{&source, &destination};
+  Advect(velocity_x, velocity_y, delta_t, &target, 1);
+}
+
+void SemiLagrangianAdvector::Advect(const Field2D &velocity_x,
+                                    const Field2D &velocity_y,
+                                    float delta_t,
+                                    const Target *targets,
+                                    size_t num_targets) const {
+  if (num_targets > 0) {
+    AdvectRows(velocity_x, velocity_y, delta_t, targets, num_targets, 0, (int32_t) targets[0].source->Height());
+  }
+}
+
+void SemiLagrangianAdvector::AdvectRows(const Field2D &velocity_x,
+                                        const Field2D &velocity_y,
+                                        float delta_t,
+                                        const Target *targets,
+                                        size_t num_targets,
+                                        int32_t y_begin,
+                                        int32_t y_end) const {
+  if (num_targets == 0) {
+    return;
+  }
+  const auto &shape = *targets[0].source;
+  assert(shape.Halo() >= 1);
+  assert(velocity_x.Width() == shape.Width() && velocity_x.Height() == shape.Height());
+  assert(velocity_y.Width() == shape.Width() && velocity_y.Height() == shape.Height());
+  for (size_t t = 0; t < num_targets; ++t) {
+    assert(targets[t].source->Width() == shape.Width() && targets[t].source->Height() == shape.Height());
+    assert(targets[t].source->Halo() == shape.Halo());
+    assert(targets[t].destination->Width() == shape.Width() && targets[t].destination->Height() == shape.Height());
+  }
+  assert(y_begin >= 0 && y_end <= (int32_t) shape.Height());
+  for (auto y = y_begin; y < y_end; ++y) {
+    kernel_(velocity_x.Row(y), velocity_y.Row(y), y, delta_t, targets, num_targets, periodic_, 0,
+            (int32_t) shape.Width());
+  }
+}
+
+/*
+ * Per row the tiled kernel costs the same arithmetic as the scalar one; what changes is where the
+ * stencils are read from.
+ */
+void SemiLagrangianAdvector::AdvectRowsTiled(const Field2D &velocity_x,
+                                             const Field2D &velocity_y,
+                                             float delta_t,
+                                             const TileMap &tile_map,
+                                             const TiledTarget *targets,
+                                             size_t num_targets,
+                                             int32_t y_begin,
+                                             int32_t y_end) const {
+  assert(velocity_x.Width() == tile_map.Width() && velocity_x.Height() == tile_map.Height());
+  assert(velocity_y.Width() == tile_map.Width() && velocity_y.Height() == tile_map.Height());
+  assert((int32_t) tile_map.ActiveTiles().size() == tile_map.NumTiles());
+  assert(y_begin >= 0 && y_end <= (int32_t) tile_map.Height());
+  for (auto y = y_begin; y < y_end; ++y) {
+    AdvectRowTiled(velocity_x.Row(y), velocity_y.Row(y), y, delta_t, tile_map, targets, num_targets, periodic_);
+  }
+}
+
+void SemiLagrangianAdvector::AdvectRuns(const Field2D &velocity_x,
+                                        const Field2D &velocity_y,
+                                        float delta_t,
+                                        const FluidRegion &region,
+                                        const Target *targets,
+                                        size_t num_targets,
+                                        int32_t y_begin,
+                                        int32_t y_end) const {
+  if (num_targets == 0) {
+    return;
+  }
+  assert(region.Width() == targets[0].source->Width() && region.Height() == targets[0].source->Height());
+  for (auto y = y_begin; y < y_end; ++y) {
+    for (auto run = region.RunsBegin(y); run != region.RunsEnd(y); ++run) {
+      kernel_(velocity_x.Row(y), velocity_y.Row(y), y, delta_t, targets, num_targets, periodic_, run->x_begin,
+              run->x_end);
+    }
+  }
+}
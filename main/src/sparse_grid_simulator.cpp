@@ -0,0 +1,447 @@
+#include "sparse_grid_simulator.h"
+#include "red_black_sor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <initializer_list>
+#include <stdexcept>
+
+const uint32_t NUM_GS_ITERS = 10;
+const float DEFAULT_DENSITY_THRESHOLD = 1e-4f;
+const float DEFAULT_VELOCITY_THRESHOLD = 1e-2f;
+const float DEFAULT_PRESSURE_TOLERANCE = 1e-4f;
+const uint32_t DEFAULT_MAX_PRESSURE_ITERATIONS = 200;
+
+namespace {
+inline float Lerp(float from, float to, float pct) { return from + pct * (to - from); }
+
+// A field to advect and the field that receives the result
+struct Target {
+  const TiledField2D *source;
+  TiledField2D *destination;
+};
+}
+
+SparseGridSimulator::SparseGridSimulator(uint32_t width,      //
+                                         uint32_t height,     //
+                                         float delta_t,       //
+                                         float diffusion_rate //
+)                    //
+        : FluidSimulator2D{width, height, false}                    //
+        , delta_t_{delta_t}                                         //
+        , diffusion_rate_{diffusion_rate}                           //
+        , density_threshold_{DEFAULT_DENSITY_THRESHOLD}             //
+        , velocity_threshold_{DEFAULT_VELOCITY_THRESHOLD}           //
+        , pressure_tolerance_{DEFAULT_PRESSURE_TOLERANCE}           //
+        , max_pressure_iterations_{DEFAULT_MAX_PRESSURE_ITERATIONS} //
+        , pressure_omega_{OptimalSorOmega(width - 2, height - 2)}   //
+        , last_pressure_solve_{0, 0.0f}                             //
+        , thread_pool_{std::make_unique<ThreadPool>(0)}             //
+        , tile_map_{width - 2, height - 2}                          //
+        , tiled_density_{tile_map_}                                 //
+        , tiled_velocity_x_{tile_map_}                              //
+        , tiled_velocity_y_{tile_map_}                              //
+        , pressure_{tile_map_}                                      //
+        , divergence_{tile_map_}                                    //
+        , temp_density_{tile_map_}                                  //
+        , temp_velocity_x_{tile_map_}                               //
+        , temp_velocity_y_{tile_map_}                               //
+{
+  tile_is_wanted_.assign(tile_map_.NumTiles(), 0);
+}
+
+void SparseGridSimulator::SetActivityThresholds(float density_threshold, float velocity_threshold) {
+  density_threshold_ = density_threshold;
+  velocity_threshold_ = velocity_threshold;
+}
+
+void SparseGridSimulator::SetPressureTolerance(float tolerance) {
+  pressure_tolerance_ = tolerance;
+}
+
+void SparseGridSimulator::SetMaxPressureIterations(uint32_t max_iterations) {
+  max_pressure_iterations_ = max_iterations;
+}
+
+void SparseGridSimulator::SetNumThreads(uint32_t num_threads) {
+  thread_pool_ = std::make_unique<ThreadPool>(num_threads);
+}
+
+const std::vector<float> &SparseGridSimulator::Density() const {
+  tiled_density_.CopyTo(density_view_);
+  return density_view_;
+}
+
+const std::vector<float> &SparseGridSimulator::VelocityX() const {
+  tiled_velocity_x_.CopyTo(velocity_x_view_);
+  return velocity_x_view_;
+}
+
+const std::vector<float> &SparseGridSimulator::VelocityY() const {
+  tiled_velocity_y_.CopyTo(velocity_y_view_);
+  return velocity_y_view_;
+}
+
+/*
+ * Grid cells on the boundary ring go to the ring of the nearest tile, where the next boundary
+ * update overwrites them, as in FluidSimulator2D.
+ */
+void SparseGridSimulator::AddDensity(uint32_t x, uint32_t y, float amount) {
+  if (x >= dim_x_ || y >= dim_y_) {
+    throw std::out_of_range("Cell is outside the grid");
+  }
+  auto cell_x = (int32_t) x - 1;
+  auto cell_y = (int32_t) y - 1;
+  auto tile = tile_map_.TileAt(std::max(0, std::min((int32_t) dim_x_ - 3, cell_x)),
+                               std::max(0, std::min((int32_t) dim_y_ - 3, cell_y)));
+  auto slot = ActivateTile(tile);
+  auto offset = (cell_y - tile_map_.OriginY(tile)) * TILE_STRIDE + (cell_x - tile_map_.OriginX(tile));
+  tiled_density_.Tile(slot)[offset] += amount;
+  tile_map_.Compact();
+}
+
+/*
+ * Give a tile storage in every field, zeroed, unless it already has it. Returns its slot.
+ */
+int32_t SparseGridSimulator::ActivateTile(int32_t tile) {
+  auto slot = tile_map_.Slot(tile);
+  if (slot >= 0) {
+    return slot;
+  }
+  slot = tile_map_.Activate(tile);
+  for (auto *field : {&tiled_density_, &tiled_velocity_x_, &tiled_velocity_y_, &pressure_, &divergence_,
+                      &temp_density_, &temp_velocity_x_, &temp_velocity_y_}) {
+    field->Reserve();
+    field->ClearTile(slot);
+  }
+  return slot;
+}
+
+/*
+ * A tile is busy if any of its cells has a density, or moves along either axis in a step, above
+ * the thresholds. Busy tiles and source tiles keep the tiles within reach of them active: one
+ * tile, plus however many tiles the fastest velocity crosses in a step, so that nothing is
+ * advected out of the active region. Everything else is retired and its contents, all below the
+ * thresholds, dropped.
+ */
+void SparseGridSimulator::UpdateActiveTiles() {
+  const auto &active = tile_map_.ActiveTiles();
+  auto num_active = (int32_t) active.size();
+  tile_is_busy_.resize(num_active);
+  tile_max_speed_.resize(num_active);
+  ParallelFor(thread_pool_.get(), 0, num_active, TILE_SIZE * TILE_SIZE, [&](int32_t begin, int32_t end) {
+    for (auto i = begin; i < end; ++i) {
+      auto tile = active[i];
+      auto slot = tile_map_.Slot(tile);
+      const auto *density = tiled_density_.Tile(slot);
+      const auto *vx = tiled_velocity_x_.Tile(slot);
+      const auto *vy = tiled_velocity_y_.Tile(slot);
+      auto extent_x = tile_map_.ExtentX(tile);
+      auto max_density = 0.0f;
+      auto max_speed = 0.0f;
+      for (auto y = 0; y < tile_map_.ExtentY(tile); ++y) {
+        for (auto x = 0; x < extent_x; ++x) {
+          auto idx = y * TILE_STRIDE + x;
+          max_density = std::max(max_density, std::abs(density[idx]));
+          max_speed = std::max(max_speed, std::max(std::abs(vx[idx]), std::abs(vy[idx])));
+        }
+      }
+      tile_is_busy_[i] = max_density > density_threshold_ || max_speed * delta_t_ > velocity_threshold_;
+      tile_max_speed_[i] = max_speed;
+    }
+  });
+
+  auto max_speed = 0.0f;
+  for (auto i = 0; i < num_active; ++i) {
+    max_speed = std::max(max_speed, tile_max_speed_[i]);
+  }
+  auto reach = 1 + (int32_t) std::min((float) tile_map_.NumTiles(), max_speed * delta_t_ / (float) TILE_SIZE);
+
+  auto tiles_x = tile_map_.TilesX();
+  auto tiles_y = tile_map_.TilesY();
+  auto want_around = [&](int32_t tile) {
+    auto tile_x = tile % tiles_x;
+    auto tile_y = tile / tiles_x;
+    for (auto y = std::max(0, tile_y - reach); y <= std::min(tiles_y - 1, tile_y + reach); ++y) {
+      for (auto x = std::max(0, tile_x - reach); x <= std::min(tiles_x - 1, tile_x + reach); ++x) {
+        auto wanted = y * tiles_x + x;
+        if (!tile_is_wanted_[wanted]) {
+          tile_is_wanted_[wanted] = 1;
+          wanted_tiles_.push_back(wanted);
+        }
+      }
+    }
+  };
+  for (auto i = 0; i < num_active; ++i) {
+    if (tile_is_busy_[i]) {
+      want_around(active[i]);
+    }
+  }
+  // Under a negative threshold every tile would be busy, so the whole interior is wanted at once
+  // rather than growing out from the sources a ring of tiles per step
+  if (density_threshold_ < 0.0f || velocity_threshold_ < 0.0f) {
+    for (auto tile = 0; tile < tile_map_.NumTiles(); ++tile) {
+      if (!tile_is_wanted_[tile]) {
+        tile_is_wanted_[tile] = 1;
+        wanted_tiles_.push_back(tile);
+      }
+    }
+  }
+  for (const auto &source : Sources()) {
+    auto x = std::max(0, std::min((int32_t) dim_x_ - 3, (int32_t) (source.first % dim_x_) - 1));
+    auto y = std::max(0, std::min((int32_t) dim_y_ - 3, (int32_t) (source.first / dim_x_) - 1));
+    want_around(tile_map_.TileAt(x, y));
+  }
+
+  for (auto i = 0; i < num_active; ++i) {
+    if (!tile_is_wanted_[active[i]]) {
+      tile_map_.Retire(active[i]);
+    }
+  }
+  for (auto tile : wanted_tiles_) {
+    ActivateTile(tile);
+    tile_is_wanted_[tile] = 0;
+  }
+  wanted_tiles_.clear();
+  tile_map_.Compact();
+}
+
+void SparseGridSimulator::ProcessTiledSources() {
+  for (const auto &source : Sources()) {
+    auto cell_x = (int32_t) (source.first % dim_x_) - 1;
+    auto cell_y = (int32_t) (source.first / dim_x_) - 1;
+    auto tile = tile_map_.TileAt(std::max(0, std::min((int32_t) dim_x_ - 3, cell_x)),
+                                 std::max(0, std::min((int32_t) dim_y_ - 3, cell_y)));
+    auto slot = tile_map_.Slot(tile);
+    auto offset = (cell_y - tile_map_.OriginY(tile)) * TILE_STRIDE + (cell_x - tile_map_.OriginX(tile));
+    tiled_density_.Tile(slot)[offset] = std::get<0>(source.second);
+    tiled_velocity_x_.Tile(slot)[offset] = std::get<1>(source.second);
+    tiled_velocity_y_.Tile(slot)[offset] = std::get<2>(source.second);
+  }
+}
+
+/*
+ * Red-black Gauss-Seidel as in GridFluidSimulator. The tile rings are refreshed after each half
+ * sweep so the next colour sees its neighbours, and the boundary after each iteration.
+ */
+void SparseGridSimulator::Diffuse(const TiledField2D &current, TiledField2D &next) {
+  next.CopyFrom(thread_pool_.get(), current);
+  auto k = delta_t_ * diffusion_rate_;
+  auto inv_k1 = 1.0f / (k + 1.0f);
+  for (auto iter = 0u; iter < NUM_GS_ITERS; ++iter) {
+    for (auto colour = 0u; colour < 2; ++colour) {
+      RedBlackSorSweep(thread_pool_.get(), tile_map_, current, inv_k1, 0.25f * k * inv_k1, 1.0f, colour, next);
+      next.ExchangeHalo(thread_pool_.get());
+    }
+    next.FillBoundary(1.0f, 1.0f);
+  }
+}
+
+/*
+ * Semi-Lagrangian advection with the same backtrace and bilinear interpolation as the scalar
+ * SemiLagrangianAdvector kernel. The 2x2 stencil always lies within one tile and its ring; when
+ * that tile is inactive the cells are looked up one by one, which mostly gives zero.
+ */
+void SparseGridSimulator::AdvectFields() {
+  const Target targets[] = {
+          {&tiled_density_, &temp_density_},
+          {&tiled_velocity_x_, &temp_velocity_x_},
+          {&tiled_velocity_y_, &temp_velocity_y_},
+  };
+  auto w = (int32_t) tile_map_.Width();
+  auto h = (int32_t) tile_map_.Height();
+  const auto &active = tile_map_.ActiveTiles();
+  ParallelFor(thread_pool_.get(), 0, (int32_t) active.size(), TILE_SIZE * TILE_SIZE, [&](int32_t begin, int32_t end) {
+    for (auto i = begin; i < end; ++i) {
+      auto tile = active[i];
+      auto slot = tile_map_.Slot(tile);
+      auto origin_x = tile_map_.OriginX(tile);
+      auto origin_y = tile_map_.OriginY(tile);
+      auto extent_x = tile_map_.ExtentX(tile);
+      const auto *velocity_x = tiled_velocity_x_.Tile(slot);
+      const auto *velocity_y = tiled_velocity_y_.Tile(slot);
+      for (auto y = 0; y < tile_map_.ExtentY(tile); ++y) {
+        for (auto x = 0; x < extent_x; ++x) {
+          auto idx = y * TILE_STRIDE + x;
+          auto source_x = ((float) (origin_x + x) + 0.5f) - velocity_x[idx] * delta_t_;
+          auto source_y = ((float) (origin_y + y) + 0.5f) - velocity_y[idx] * delta_t_;
+          source_x = std::max(-0.5f, std::min((float) w + 0.5f, source_x));
+          source_y = std::max(-0.5f, std::min((float) h + 0.5f, source_y));
+          auto base_x = std::min(std::floor(source_x - 0.5f), (float) (w - 1));
+          auto base_y = std::min(std::floor(source_y - 0.5f), (float) (h - 1));
+          auto frac_x = source_x - base_x - 0.5f;
+          auto frac_y = source_y - base_y - 0.5f;
+          auto cell_x = (int32_t) base_x;
+          auto cell_y = (int32_t) base_y;
+
+          auto source_tile = tile_map_.TileAt(std::max(0, cell_x), std::max(0, cell_y));
+          auto source_slot = tile_map_.Slot(source_tile);
+          auto offset = (cell_y - tile_map_.OriginY(source_tile)) * TILE_STRIDE
+                        + (cell_x - tile_map_.OriginX(source_tile));
+          for (const auto &target : targets) {
+            float btm[2];
+            float top[2];
+            if (source_slot >= 0) {
+              const auto *cells = target.source->Tile(source_slot) + offset;
+              btm[0] = cells[0];
+              btm[1] = cells[1];
+              top[0] = cells[TILE_STRIDE];
+              top[1] = cells[TILE_STRIDE + 1];
+            } else {
+              btm[0] = target.source->Value(cell_x, cell_y);
+              btm[1] = target.source->Value(cell_x + 1, cell_y);
+              top[0] = target.source->Value(cell_x, cell_y + 1);
+              top[1] = target.source->Value(cell_x + 1, cell_y + 1);
+            }
+            auto btm_lerp = Lerp(btm[0], btm[1], frac_x);
+            auto top_lerp = Lerp(top[0], top[1], frac_x);
+            target.destination->Tile(slot)[idx] = Lerp(btm_lerp, top_lerp, frac_y);
+          }
+        }
+      }
+    }
+  });
+  CorrectBoundaryDensities(temp_density_);
+  CorrectBoundaryVelocities(temp_velocity_x_, temp_velocity_y_);
+  tiled_density_.Swap(temp_density_);
+  tiled_velocity_x_.Swap(temp_velocity_x_);
+  tiled_velocity_y_.Swap(temp_velocity_y_);
+}
+
+/*
+ * d(x,y) = [ vx(x+1,y) - vx(x-1,y) + vy(x,y+1) - vy(x,y-1) ] * 0.5f
+ */
+void SparseGridSimulator::ComputeDivergence(TiledField2D &divergence) {
+  const auto &active = tile_map_.ActiveTiles();
+  ParallelFor(thread_pool_.get(), 0, (int32_t) active.size(), TILE_SIZE * TILE_SIZE, [&](int32_t begin, int32_t end) {
+    for (auto i = begin; i < end; ++i) {
+      auto tile = active[i];
+      auto slot = tile_map_.Slot(tile);
+      const auto *vx = tiled_velocity_x_.Tile(slot);
+      const auto *vy = tiled_velocity_y_.Tile(slot);
+      auto *div = divergence.Tile(slot);
+      auto extent_x = tile_map_.ExtentX(tile);
+      for (auto y = 0; y < tile_map_.ExtentY(tile); ++y) {
+        for (auto x = y * TILE_STRIDE; x < y * TILE_STRIDE + extent_x; ++x) {
+          div[x] = (vx[x + 1] - vx[x - 1] + vy[x + TILE_STRIDE] - vy[x - TILE_STRIDE]) * 0.5f;
+        }
+      }
+    }
+  });
+}
+
+/*
+ * Red-black SOR with the residual estimate GridFluidSimulator uses. Pressure is zero in the ring
+ * outside the interior and in inactive tiles.
+ */
+PoissonSolverStats SparseGridSimulator::ComputePressure(const TiledField2D &divergence, TiledField2D &pressure) {
+  auto rhs_norm = Norm(divergence);
+  if (rhs_norm == 0.0) {
+    for (auto tile : tile_map_.ActiveTiles()) {
+      pressure.ClearTile(tile_map_.Slot(tile));
+    }
+    return {0, 0.0f};
+  }
+
+  auto relative_residual = 1.0;
+  auto iter = 0u;
+  while (iter < max_pressure_iterations_) {
+    auto change_sq = 0.0;
+    for (auto colour = 0u; colour < 2; ++colour) {
+      change_sq += RedBlackSorSweep(thread_pool_.get(), tile_map_, divergence, -0.25f, 0.25f, pressure_omega_,
+                                    colour, pressure);
+      pressure.ExchangeHalo(thread_pool_.get());
+    }
+    ++iter;
+    relative_residual = 4.0 * std::sqrt(change_sq) / rhs_norm;
+    if (relative_residual <= pressure_tolerance_) {
+      break;
+    }
+  }
+  return {iter, (float) relative_residual};
+}
+
+double SparseGridSimulator::Norm(const TiledField2D &field) const {
+  const auto &active = tile_map_.ActiveTiles();
+  auto sum_sq = ParallelSum(thread_pool_.get(), 0, (int32_t) active.size(), TILE_SIZE * TILE_SIZE,
+                            [&](int32_t begin, int32_t end) {
+    auto sum = 0.0;
+    for (auto i = begin; i < end; ++i) {
+      auto tile = active[i];
+      const auto *cells = field.Tile(tile_map_.Slot(tile));
+      auto extent_x = tile_map_.ExtentX(tile);
+      for (auto y = 0; y < tile_map_.ExtentY(tile); ++y) {
+        for (auto x = y * TILE_STRIDE; x < y * TILE_STRIDE + extent_x; ++x) {
+          sum += (double) cells[x] * (double) cells[x];
+        }
+      }
+    }
+    return sum;
+  });
+  return std::sqrt(sum_sq);
+}
+
+/*
+ * Subtract the central difference pressure gradient from the velocity
+ */
+void SparseGridSimulator::SuppressDivergence() {
+  ComputeDivergence(divergence_);
+  last_pressure_solve_ = ComputePressure(divergence_, pressure_);
+
+  const auto &active = tile_map_.ActiveTiles();
+  ParallelFor(thread_pool_.get(), 0, (int32_t) active.size(), TILE_SIZE * TILE_SIZE, [&](int32_t begin, int32_t end) {
+    for (auto i = begin; i < end; ++i) {
+      auto tile = active[i];
+      auto slot = tile_map_.Slot(tile);
+      const auto *p = pressure_.Tile(slot);
+      auto *vx = tiled_velocity_x_.Tile(slot);
+      auto *vy = tiled_velocity_y_.Tile(slot);
+      auto extent_x = tile_map_.ExtentX(tile);
+      for (auto y = 0; y < tile_map_.ExtentY(tile); ++y) {
+        for (auto x = y * TILE_STRIDE; x < y * TILE_STRIDE + extent_x; ++x) {
+          vx[x] -= (p[x + 1] - p[x - 1]) * 0.5f;
+          vy[x] -= (p[x + TILE_STRIDE] - p[x - TILE_STRIDE]) * 0.5f;
+        }
+      }
+    }
+  });
+  CorrectBoundaryVelocities(tiled_velocity_x_, tiled_velocity_y_);
+}
+
+/*
+ * Zero gradient at the walls
+ */
+void SparseGridSimulator::CorrectBoundaryDensities(TiledField2D &densities) const {
+  densities.ExchangeHalo(thread_pool_.get());
+  densities.FillBoundary(1.0f, 1.0f);
+}
+
+/*
+ * No flow through the walls; tangential velocity is copied
+ */
+void SparseGridSimulator::CorrectBoundaryVelocities(TiledField2D &velocity_x, TiledField2D &velocity_y) const {
+  velocity_x.ExchangeHalo(thread_pool_.get());
+  velocity_x.FillBoundary(0.0f, 1.0f);
+  velocity_y.ExchangeHalo(thread_pool_.get());
+  velocity_y.FillBoundary(1.0f, 0.0f);
+}
+
+void SparseGridSimulator::Simulate() {
+  UpdateActiveTiles();
+  ProcessTiledSources();
+  CorrectBoundaryDensities(tiled_density_);
+  CorrectBoundaryVelocities(tiled_velocity_x_, tiled_velocity_y_);
+
+  Diffuse(tiled_density_, temp_density_);
+  tiled_density_.Swap(temp_density_);
+
+  Diffuse(tiled_velocity_x_, temp_velocity_x_);
+  Diffuse(tiled_velocity_y_, temp_velocity_y_);
+  CorrectBoundaryVelocities(temp_velocity_x_, temp_velocity_y_);
+  tiled_velocity_x_.Swap(temp_velocity_x_);
+  tiled_velocity_y_.Swap(temp_velocity_y_);
+
+  AdvectFields();
+
+  SuppressDivergence();
+}
@@ -0,0 +1,107 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+// A band should be worth at least this many cell updates before another thread is woken for it
+const uint32_t MIN_BAND_CELLS = 16384;
+
+ThreadPool::ThreadPool(uint32_t num_threads) //
+        : generation_{0}                     //
+        , bands_pending_{0}                  //
+        , stopping_{false}                   //
+        , function_{nullptr}                 //
+        , body_{nullptr}                     //
+        , begin_{0}                          //
+        , end_{0}                            //
+        , num_bands_{0}                      //
+{
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  band_results_.resize(num_threads, 0.0);
+  for (auto band = 1u; band < num_threads; ++band) {
+    workers_.emplace_back(&ThreadPool::WorkerLoop, this, band);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_ready_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+uint32_t ThreadPool::NumBands(int32_t num_rows, uint32_t row_cells) const {
+  if (num_rows <= 0) {
+    return 0;
+  }
+  auto cells = (uint64_t) num_rows * std::max(1u, row_cells);
+  auto worthwhile = std::max<uint64_t>(1, cells / MIN_BAND_CELLS);
+  return (uint32_t) std::min<uint64_t>({worthwhile, (uint64_t) num_rows, NumThreads()});
+}
+
+void ThreadPool::Run(int32_t begin, int32_t end, uint32_t num_bands, BandFunction function, const void *body) {
+  if (num_bands == 0) {
+    return;
+  }
+  if (num_bands == 1) {
+    function(*this, body, 0, begin, end);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    function_ = function;
+    body_ = body;
+    begin_ = begin;
+    end_ = end;
+    num_bands_ = num_bands;
+    bands_pending_ = num_bands - 1;
+    ++generation_;
+  }
+  work_ready_.notify_all();
+
+  RunBand(0);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  work_done_.wait(lock, [this] { return bands_pending_ == 0; });
+}
+
+void ThreadPool::RunBand(uint32_t band) {
+  auto num_rows = (int64_t) (end_ - begin_);
+  auto band_begin = begin_ + (int32_t) (num_rows * band / num_bands_);
+  auto band_end = begin_ + (int32_t) (num_rows * (band + 1) / num_bands_);
+  function_(*this, body_, band, band_begin, band_end);
+}
+
+/*
+ * Worker n always runs band n, so a loop with fewer bands than threads leaves the highest
+ * numbered workers idle.
+ */
+void ThreadPool::WorkerLoop(uint32_t band) {
+  uint64_t seen_generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_ready_.wait(lock, [&] { return stopping_ || generation_ != seen_generation; });
+      if (stopping_) {
+        return;
+      }
+      seen_generation = generation_;
+      if (band >= num_bands_) {
+        continue;
+      }
+    }
+
+    RunBand(band);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--bands_pending_ == 0) {
+      work_done_.notify_one();
+    }
+  }
+}
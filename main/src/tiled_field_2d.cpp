@@ -0,0 +1,278 @@
+#include "tiled_field_2d.h"
+
+#include <cstring>
+#include <stdexcept>
+
+// Tiles added to a pool at a time
+const uint32_t TILES_PER_CHUNK = 64;
+
+TileMap::TileMap(uint32_t width, uint32_t height) //
+        : width_{width}                            //
+        , height_{height}                          //
+        , tiles_x_{((int32_t) width + TILE_SIZE - 1) / TILE_SIZE}  //
+        , tiles_y_{((int32_t) height + TILE_SIZE - 1) / TILE_SIZE} //
+        , num_slots_{0}                                            //
+{
+  if (width == 0 || height == 0) {
+    throw std::runtime_error("Tile map width and height must be non-zero");
+  }
+  slot_of_tile_.assign((size_t) tiles_x_ * tiles_y_, -1);
+}
+
+int32_t TileMap::Activate(int32_t tile) {
+  assert(slot_of_tile_[tile] < 0);
+  int32_t slot;
+  if (free_slots_.empty()) {
+    slot = num_slots_++;
+  } else {
+    slot = free_slots_.back();
+    free_slots_.pop_back();
+  }
+  slot_of_tile_[tile] = slot;
+  active_tiles_.push_back(tile);
+  return slot;
+}
+
+void TileMap::Retire(int32_t tile) {
+  assert(slot_of_tile_[tile] >= 0);
+  free_slots_.push_back(slot_of_tile_[tile]);
+  slot_of_tile_[tile] = -1;
+}
+
+void TileMap::Compact() {
+  active_tiles_.erase(std::remove_if(active_tiles_.begin(), active_tiles_.end(),
+                                     [&](int32_t tile) { return slot_of_tile_[tile] < 0; }),
+                      active_tiles_.end());
+  std::sort(active_tiles_.begin(), active_tiles_.end());
+  active_tiles_.erase(std::unique(active_tiles_.begin(), active_tiles_.end()), active_tiles_.end());
+}
+
+TiledField2D::TiledField2D(const TileMap &tile_map) //
+        : tile_map_{tile_map}                        //
+{}
+
+TiledField2D::~TiledField2D() {
+  for (auto *chunk : chunks_) {
+    FreeAligned(chunk);
+  }
+}
+
+void TiledField2D::Reserve() {
+  while ((int32_t) tiles_.size() < tile_map_.NumSlots()) {
+    auto *chunk = AllocateAligned((size_t) TILES_PER_CHUNK * TILE_FLOATS);
+    chunks_.push_back(chunk);
+    for (auto i = 0u; i < TILES_PER_CHUNK; ++i) {
+      tiles_.push_back(chunk + (size_t) i * TILE_FLOATS + TILE_STRIDE + 1);
+    }
+  }
+}
+
+void TiledField2D::ClearTile(int32_t slot) {
+  std::fill(Tile(slot) - TILE_STRIDE - 1, Tile(slot) - TILE_STRIDE - 1 + TILE_FLOATS, 0.0f);
+}
+
+void TiledField2D::CopyFrom(ThreadPool *thread_pool, const TiledField2D &other) {
+  const auto &active = tile_map_.ActiveTiles();
+  ParallelFor(thread_pool, 0, (int32_t) active.size(), TILE_FLOATS, [&](int32_t begin, int32_t end) {
+    for (auto i = begin; i < end; ++i) {
+      auto slot = tile_map_.Slot(active[i]);
+      std::memcpy(Tile(slot) - TILE_STRIDE - 1, other.Tile(slot) - TILE_STRIDE - 1, TILE_FLOATS * sizeof(float));
+    }
+  });
+}
+
+void TiledField2D::CopyFrom(ThreadPool *thread_pool, const Field2D &dense) {
+  assert(dense.Width() == tile_map_.Width() && dense.Height() == tile_map_.Height() && dense.Halo() >= 1);
+  const auto &active = tile_map_.ActiveTiles();
+  ParallelFor(thread_pool, 0, (int32_t) active.size(), TILE_FLOATS, [&](int32_t begin, int32_t end) {
+    for (auto i = begin; i < end; ++i) {
+      auto tile = active[i];
+      auto *cells = Tile(tile_map_.Slot(tile));
+      auto origin_x = tile_map_.OriginX(tile);
+      auto origin_y = tile_map_.OriginY(tile);
+      auto extent_x = tile_map_.ExtentX(tile);
+      for (auto y = -1; y <= tile_map_.ExtentY(tile); ++y) {
+        std::memcpy(cells + y * TILE_STRIDE - 1, dense.Row(origin_y + y) + origin_x - 1,
+                    (extent_x + 2) * sizeof(float));
+      }
+    }
+  });
+}
+
+/*
+ * Only ring cells inside the interior are written; those outside belong to FillBoundary(). A tile
+ * clipped by the right or top of the interior has the boundary there, so it has no neighbour on
+ * that side.
+ */
+void TiledField2D::ExchangeHalo(ThreadPool *thread_pool) {
+  const auto &active = tile_map_.ActiveTiles();
+  auto tiles_x = tile_map_.TilesX();
+  auto tiles_y = tile_map_.TilesY();
+  const auto stride = TILE_STRIDE;
+  const auto size = TILE_SIZE;
+  ParallelFor(thread_pool, 0, (int32_t) active.size(), TILE_FLOATS, [&](int32_t begin, int32_t end) {
+    for (auto i = begin; i < end; ++i) {
+      auto tile = active[i];
+      auto tile_x = tile % tiles_x;
+      auto tile_y = tile / tiles_x;
+      auto extent_x = tile_map_.ExtentX(tile);
+      auto extent_y = tile_map_.ExtentY(tile);
+      auto *cells = Tile(tile_map_.Slot(tile));
+      auto has_left = tile_x > 0;
+      auto has_right = tile_x < tiles_x - 1;
+      auto has_below = tile_y > 0;
+      auto has_above = tile_y < tiles_y - 1;
+      // Cell (0, 0) of the neighbouring tile, or nullptr if it is inactive
+      auto neighbour = [&](int32_t dx, int32_t dy) -> const float * {
+        auto slot = tile_map_.Slot(tile + dy * tiles_x + dx);
+        return slot < 0 ? nullptr : Tile(slot);
+      };
+
+      if (has_left) {
+        const auto *left = neighbour(-1, 0);
+        for (auto y = 0; y < extent_y; ++y) {
+          cells[y * stride - 1] = left ? left[y * stride + size - 1] : 0.0f;
+        }
+      }
+      if (has_right) {
+        const auto *right = neighbour(1, 0);
+        for (auto y = 0; y < extent_y; ++y) {
+          cells[y * stride + size] = right ? right[y * stride] : 0.0f;
+        }
+      }
+      if (has_below) {
+        const auto *below = neighbour(0, -1);
+        for (auto x = 0; x < extent_x; ++x) {
+          cells[x - stride] = below ? below[(size - 1) * stride + x] : 0.0f;
+        }
+      }
+      if (has_above) {
+        const auto *above = neighbour(0, 1);
+        for (auto x = 0; x < extent_x; ++x) {
+          cells[size * stride + x] = above ? above[x] : 0.0f;
+        }
+      }
+      if (has_left && has_below) {
+        const auto *corner = neighbour(-1, -1);
+        cells[-stride - 1] = corner ? corner[(size - 1) * stride + size - 1] : 0.0f;
+      }
+      if (has_right && has_below) {
+        const auto *corner = neighbour(1, -1);
+        cells[-stride + size] = corner ? corner[(size - 1) * stride] : 0.0f;
+      }
+      if (has_left && has_above) {
+        const auto *corner = neighbour(-1, 1);
+        cells[size * stride - 1] = corner ? corner[size - 1] : 0.0f;
+      }
+      if (has_right && has_above) {
+        const auto *corner = neighbour(1, 1);
+        cells[size * stride + size] = corner ? corner[0] : 0.0f;
+      }
+    }
+  });
+}
+
+/*
+ * Edges first, then the four corners of the boundary ring, in the order Field2D::FillHalo uses.
+ * Along each wall the ring cells either side of a tile are included unless they are a corner.
+ */
+void TiledField2D::FillBoundary(float x_edge_factor, float y_edge_factor) {
+  auto tiles_x = tile_map_.TilesX();
+  auto tiles_y = tile_map_.TilesY();
+  const auto stride = TILE_STRIDE;
+  for (auto tile : tile_map_.ActiveTiles()) {
+    auto tile_x = tile % tiles_x;
+    auto tile_y = tile / tiles_x;
+    auto is_left = tile_x == 0;
+    auto is_right = tile_x == tiles_x - 1;
+    auto is_bottom = tile_y == 0;
+    auto is_top = tile_y == tiles_y - 1;
+    if (!is_left && !is_right && !is_bottom && !is_top) {
+      continue;
+    }
+    auto extent_x = tile_map_.ExtentX(tile);
+    auto extent_y = tile_map_.ExtentY(tile);
+    auto *cells = Tile(tile_map_.Slot(tile));
+    auto x_begin = is_left ? 0 : -1;
+    auto x_end = is_right ? extent_x : extent_x + 1;
+    auto y_begin = is_bottom ? 0 : -1;
+    auto y_end = is_top ? extent_y : extent_y + 1;
+
+    if (is_bottom) {
+      for (auto x = x_begin; x < x_end; ++x) {
+        cells[x - stride] = y_edge_factor * cells[x];
+      }
+    }
+    if (is_top) {
+      for (auto x = x_begin; x < x_end; ++x) {
+        cells[extent_y * stride + x] = y_edge_factor * cells[(extent_y - 1) * stride + x];
+      }
+    }
+    if (is_left) {
+      for (auto y = y_begin; y < y_end; ++y) {
+        cells[y * stride - 1] = x_edge_factor * cells[y * stride];
+      }
+    }
+    if (is_right) {
+      for (auto y = y_begin; y < y_end; ++y) {
+        cells[y * stride + extent_x] = x_edge_factor * cells[y * stride + extent_x - 1];
+      }
+    }
+    if (is_bottom && is_left) {
+      cells[-stride - 1] = 0.5f * (cells[-stride] + cells[-1]);
+    }
+    if (is_bottom && is_right) {
+      cells[-stride + extent_x] = 0.5f * (cells[-stride + extent_x - 1] + cells[extent_x]);
+    }
+    if (is_top && is_left) {
+      cells[extent_y * stride - 1] = 0.5f * (cells[extent_y * stride] + cells[(extent_y - 1) * stride - 1]);
+    }
+    if (is_top && is_right) {
+      cells[extent_y * stride + extent_x] =
+              0.5f * (cells[extent_y * stride + extent_x - 1] + cells[(extent_y - 1) * stride + extent_x]);
+    }
+  }
+}
+
+float TiledField2D::Value(int32_t x, int32_t y) const {
+  auto w = (int32_t) tile_map_.Width();
+  auto h = (int32_t) tile_map_.Height();
+  assert(x >= -1 && x <= w && y >= -1 && y <= h);
+  auto tile = tile_map_.TileAt(std::max(0, std::min(w - 1, x)), std::max(0, std::min(h - 1, y)));
+  auto slot = tile_map_.Slot(tile);
+  if (slot < 0) {
+    return 0.0f;
+  }
+  return Tile(slot)[(y - tile_map_.OriginY(tile)) * TILE_STRIDE + (x - tile_map_.OriginX(tile))];
+}
+
+void TiledField2D::CopyTo(std::vector<float> &dense) const {
+  auto w = (int32_t) tile_map_.Width();
+  auto h = (int32_t) tile_map_.Height();
+  auto dense_width = w + 2;
+  dense.assign((size_t) dense_width * (h + 2), 0.0f);
+  for (auto tile : tile_map_.ActiveTiles()) {
+    const auto *cells = Tile(tile_map_.Slot(tile));
+    auto origin_x = tile_map_.OriginX(tile);
+    auto origin_y = tile_map_.OriginY(tile);
+    auto extent_x = tile_map_.ExtentX(tile);
+    for (auto y = 0; y < tile_map_.ExtentY(tile); ++y) {
+      auto dense_row = (size_t) (origin_y + y + 1) * dense_width + origin_x + 1;
+      std::memcpy(dense.data() + dense_row, cells + y * TILE_STRIDE, extent_x * sizeof(float));
+    }
+  }
+  for (auto x = -1; x <= w; ++x) {
+    dense[x + 1] = Value(x, -1);
+    dense[(size_t) (h + 1) * dense_width + x + 1] = Value(x, h);
+  }
+  for (auto y = 0; y < h; ++y) {
+    dense[(size_t) (y + 1) * dense_width] = Value(-1, y);
+    dense[(size_t) (y + 1) * dense_width + w + 1] = Value(w, y);
+  }
+}
+
+void TiledField2D::Swap(TiledField2D &other) noexcept {
+  assert(&tile_map_ == &other.tile_map_);
+  chunks_.swap(other.chunks_);
+  tiles_.swap(other.tiles_);
+}
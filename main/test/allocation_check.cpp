@@ -0,0 +1,130 @@
+/*
+ * Checks that GridFluidSimulator::Simulate() allocates nothing once warmed up, for each pressure
+ * solver and with obstacles.
+ *
+ *   AllocationCheck [grid size]
+ *
+ * Every operator new in the process is counted, and the field storage, which does not come from
+ * operator new, is checked through the live bytes of GetFieldMemoryStats(). The first steps may
+ * allocate, as solvers and fluid regions are built on first use. Returns non-zero if any later
+ * step allocates.
+ */
+#include "grid_fluid_simulator.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+
+const uint32_t DEFAULT_GRID_SIZE = 130;
+const uint32_t NUM_WARMUP_STEPS = 3;
+const uint32_t NUM_CHECKED_STEPS = 10;
+const float DELTA_T = 1.0f / 15.0f;
+const float DIFFUSION_RATE = 0.2f;
+
+namespace {
+std::atomic<uint64_t> num_allocations{0};
+
+void *CountedAllocate(std::size_t size) {
+  ++num_allocations;
+  if (auto *ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+struct Configuration {
+  const char *name;
+  std::function<void(GridFluidSimulator &)> setup;
+};
+
+uint64_t LiveFieldBytes() {
+  auto stats = GetFieldMemoryStats();
+  return stats.heap_bytes + stats.transparent_huge_page_bytes + stats.hugetlbfs_bytes;
+}
+}
+
+void *operator new(std::size_t size) {
+  return CountedAllocate(size);
+}
+
+void *operator new[](std::size_t size) {
+  return CountedAllocate(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  ++num_allocations;
+  return std::malloc(size ? size : 1);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  ++num_allocations;
+  return std::malloc(size ? size : 1);
+}
+
+void operator delete(void *ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+int main(int argc, char *argv[]) {
+  auto size = (argc > 1) ? (uint32_t) std::atoi(argv[1]) : DEFAULT_GRID_SIZE;
+
+  const Configuration configurations[] = {
+      {"jacobi", [](GridFluidSimulator &) {}},
+      {"red-black sor",
+       [](GridFluidSimulator &sim) { sim.SetPressureSolver(GridFluidSimulator::RED_BLACK_SOR); }},
+      {"fused sor",
+       [](GridFluidSimulator &sim) {
+         sim.SetPressureSolver(GridFluidSimulator::RED_BLACK_SOR);
+         sim.SetFusedProjection(true);
+       }},
+      {"multigrid", [](GridFluidSimulator &sim) { sim.SetPressureSolver(GridFluidSimulator::MULTIGRID); }},
+      {"pcg", [](GridFluidSimulator &sim) { sim.SetPressureSolver(GridFluidSimulator::PCG); }},
+      {"fft", [](GridFluidSimulator &sim) { sim.SetPeriodicBoundaries(true); }},
+      {"obstacles",
+       [size](GridFluidSimulator &sim) {
+         for (auto y = size / 4; y < 3 * size / 4; ++y) {
+           sim.SetSolid(size / 2, y, true);
+         }
+       }},
+  };
+
+  auto failures = 0;
+  for (const auto &configuration : configurations) {
+    GridFluidSimulator sim{size, size, DELTA_T, DIFFUSION_RATE};
+    configuration.setup(sim);
+    sim.AddSource(size / 4, size / 2, 1.0f, 2.0f, 0.5f);
+    for (auto step = 0u; step < NUM_WARMUP_STEPS; ++step) {
+      sim.Simulate();
+    }
+
+    // GetFieldMemoryStats() allocates itself, so it is read outside the counted steps
+    auto field_bytes_before = LiveFieldBytes();
+    auto allocations_before = num_allocations.load();
+    for (auto step = 0u; step < NUM_CHECKED_STEPS; ++step) {
+      sim.Simulate();
+    }
+    auto allocations = num_allocations.load() - allocations_before;
+    auto field_bytes_changed = LiveFieldBytes() != field_bytes_before;
+
+    auto passed = allocations == 0 && !field_bytes_changed;
+    std::printf("%-14s %-4s %llu allocations in %u steps%s\n", configuration.name, passed ? "ok" : "FAIL",
+                (unsigned long long) allocations, NUM_CHECKED_STEPS,
+                field_bytes_changed ? ", field storage changed" : "");
+    failures += passed ? 0 : 1;
+  }
+  return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}